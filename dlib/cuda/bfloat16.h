@@ -0,0 +1,140 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#ifndef DLIB_DNN_BFLOAT16_H_
+#define DLIB_DNN_BFLOAT16_H_
+
+#include "bfloat16_abstract.h"
+#include "../serialize.h"
+#include "../assert.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    struct bfloat16
+    {
+        uint16_t bits;
+
+        bfloat16() = default;
+
+        explicit bfloat16(
+            float value
+        )
+        {
+            uint32_t u;
+            std::memcpy(&u, &value, sizeof(u));
+            if ((u & 0x7FFFFFFF) > 0x7F800000)
+            {
+                // Keep NaNs quiet, rounding could turn them into infinities
+                bits = static_cast<uint16_t>((u >> 16) | 0x40);
+            }
+            else
+            {
+                // Round to nearest, ties to even
+                u += 0x7FFF + ((u >> 16) & 1);
+                bits = static_cast<uint16_t>(u >> 16);
+            }
+        }
+
+        explicit operator float(
+        ) const
+        {
+            const uint32_t u = static_cast<uint32_t>(bits) << 16;
+            float value;
+            std::memcpy(&value, &u, sizeof(value));
+            return value;
+        }
+    };
+
+    inline void serialize(const bfloat16& item, std::ostream& out)
+    {
+        serialize(item.bits, out);
+    }
+
+    inline void deserialize(bfloat16& item, std::istream& in)
+    {
+        deserialize(item.bits, in);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    class bfloat16_tensor
+    {
+    public:
+
+        bfloat16_tensor(
+        ) : m_n(0), m_k(0), m_nr(0), m_nc(0) {}
+
+        void set_size(
+            long long n, long long k = 1, long long nr = 1, long long nc = 1
+        )
+        {
+            DLIB_CASSERT( n >= 0 && k >= 0 && nr >= 0 && nc >= 0);
+            m_n = n;
+            m_k = k;
+            m_nr = nr;
+            m_nc = nc;
+            values.resize(n*k*nr*nc);
+        }
+
+        long long num_samples() const { return m_n; }
+        long long k() const { return m_k; }
+        long long nr() const { return m_nr; }
+        long long nc() const { return m_nc; }
+        size_t size() const { return values.size(); }
+        bool empty() const { return values.empty(); }
+        size_t size_in_bytes() const { return values.size()*sizeof(bfloat16); }
+
+        bfloat16* data() { return values.data(); }
+        const bfloat16* data() const { return values.data(); }
+
+        void clear()
+        {
+            set_size(0,0,0,0);
+            // Give the memory back, this is the whole point of storing tensors this way
+            std::vector<bfloat16>().swap(values);
+        }
+
+        friend void serialize(const bfloat16_tensor& item, std::ostream& out)
+        {
+            serialize("bfloat16_tensor", out);
+            serialize(item.m_n, out);
+            serialize(item.m_k, out);
+            serialize(item.m_nr, out);
+            serialize(item.m_nc, out);
+            serialize(item.values, out);
+        }
+
+        friend void deserialize(bfloat16_tensor& item, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "bfloat16_tensor")
+                throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::bfloat16_tensor.");
+            deserialize(item.m_n, in);
+            deserialize(item.m_k, in);
+            deserialize(item.m_nr, in);
+            deserialize(item.m_nc, in);
+            deserialize(item.values, in);
+            if (item.values.size() != static_cast<size_t>(item.m_n*item.m_k*item.m_nr*item.m_nc))
+                throw serialization_error("Corrupt data found while deserializing dlib::bfloat16_tensor.");
+        }
+
+    private:
+        long long m_n;
+        long long m_k;
+        long long m_nr;
+        long long m_nc;
+        std::vector<bfloat16> values;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_BFLOAT16_H_
+
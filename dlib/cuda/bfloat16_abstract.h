@@ -0,0 +1,163 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#undef DLIB_DNN_BFLOAT16_ABSTRACT_H_
+#ifdef DLIB_DNN_BFLOAT16_ABSTRACT_H_
+
+#include "../serialize.h"
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    struct bfloat16
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object is a 16 bit "brain floating point" number.  It has the sign
+                bit and the 8 exponent bits of a float but only 7 bits of mantissa, so it
+                covers the same range as a float with about 3 significant decimal digits.
+                It is used to store tensors in half the memory of floats, all the
+                arithmetic being done in float.
+
+                bits holds the 16 most significant bits of the float representation.
+        !*/
+
+        uint16_t bits;
+
+        bfloat16(
+        ) = default;
+        /*!
+            ensures
+                - #bits is left uninitialized, like the value of a default initialized
+                  float.
+        !*/
+
+        explicit bfloat16(
+            float value
+        );
+        /*!
+            ensures
+                - #*this is the bfloat16 closest to value, ties being rounded to the
+                  value with an even mantissa.  Infinities are kept, NaNs remain NaNs.
+                - if value is a normal float then |float(#*this) - value| <= |value|/256
+        !*/
+
+        explicit operator float(
+        ) const;
+        /*!
+            ensures
+                - returns the value of this number.  The conversion is exact.
+        !*/
+    };
+
+    void serialize(const bfloat16& item, std::ostream& out);
+    void deserialize(bfloat16& item, std::istream& in);
+    /*!
+        provides serialization support
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    class bfloat16_tensor
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object is a 4D array of bfloat16 values with the same layout as a
+                tensor.  It is a storage type only: tensors are converted to and from it
+                with tt::float_to_bfloat16() and tt::bfloat16_to_float(), and all the
+                computations are done on float tensors.  It is useful to keep tensors
+                that are not needed right away, like the activations saved for the
+                backward pass, in half the memory.
+
+                The values always live in host memory.
+        !*/
+
+    public:
+
+        bfloat16_tensor(
+        );
+        /*!
+            ensures
+                - #size() == 0
+                - #num_samples() == 0
+                - #k() == 0
+                - #nr() == 0
+                - #nc() == 0
+        !*/
+
+        void set_size(
+            long long n, long long k = 1, long long nr = 1, long long nc = 1
+        );
+        /*!
+            requires
+                - n >= 0 && k >= 0 && nr >= 0 && nc >= 0
+            ensures
+                - #num_samples() == n
+                - #k() == k
+                - #nr() == nr
+                - #nc() == nc
+                - #size() == n*k*nr*nc
+        !*/
+
+        long long num_samples() const;
+        long long k() const;
+        long long nr() const;
+        long long nc() const;
+        /*!
+            ensures
+                - return the dimensions of this tensor, as for dlib::tensor.
+        !*/
+
+        size_t size(
+        ) const;
+        /*!
+            ensures
+                - returns num_samples()*k()*nr()*nc()
+        !*/
+
+        bool empty(
+        ) const;
+        /*!
+            ensures
+                - returns size() == 0
+        !*/
+
+        size_t size_in_bytes(
+        ) const;
+        /*!
+            ensures
+                - returns size()*sizeof(bfloat16), i.e. half the size of a float tensor
+                  of the same dimensions.
+        !*/
+
+        bfloat16* data(
+        );
+        const bfloat16* data(
+        ) const;
+        /*!
+            ensures
+                - returns a pointer to the size() values of this tensor, stored in the
+                  same order as the values of a dlib::tensor.
+        !*/
+
+        void clear(
+        );
+        /*!
+            ensures
+                - #size() == 0 and the memory used by the values is released.
+        !*/
+    };
+
+    void serialize(const bfloat16_tensor& item, std::ostream& out);
+    void deserialize(bfloat16_tensor& item, std::istream& in);
+    /*!
+        provides serialization support
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_BFLOAT16_ABSTRACT_H_
+
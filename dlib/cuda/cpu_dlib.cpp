@@ -9,6 +9,7 @@
 #include "tensor_tools.h"
 #include "../image_transforms/interpolation.h"
 #include "../threads.h"
+#include "../simd/simd_check.h"
 
 namespace dlib
 {
@@ -2598,6 +2599,419 @@ namespace dlib
                 });
         }
 
+    // ------------------------------------------------------------------------------------
+
+        namespace
+        {
+            // Multiply-adds per call below which quantized_gemm() runs on a single thread
+            const long quantized_min_parallel_work = 64*1024;
+
+            // Rows of W computed by one task of quantized_gemm()
+            const long quantized_row_block = 16;
+
+            // Beyond this many lhs rows the product is compute bound: the weights are
+            // expanded to floats once and multiplied with BLAS instead.
+            const long quantized_max_direct_rows = 16;
+
+#if defined(DLIB_HAVE_AVX2)
+            inline float horizontal_sum(__m256 v)
+            {
+                __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+                s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+                s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+                return _mm_cvtss_f32(s);
+            }
+
+            inline __m256 multiply_add(__m256 a, __m256 b, __m256 c)
+            {
+#ifdef __FMA__
+                return _mm256_fmadd_ps(a, b, c);
+#else
+                return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+            }
+#endif
+
+            // sum_i x[i]*q[i] for n signed 8 bit values q
+            float quantized_dot8(const float* x, const int8_t* q, long n)
+            {
+                long i = 0;
+                float sum = 0;
+#if defined(DLIB_HAVE_AVX512F)
+                __m512 acc16 = _mm512_setzero_ps();
+                for (; i + 16 <= n; i += 16)
+                {
+                    const __m512 w = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(q + i))));
+                    acc16 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), w, acc16);
+                }
+                sum += _mm512_reduce_add_ps(acc16);
+#endif
+#if defined(DLIB_HAVE_AVX2)
+                __m256 acc8 = _mm256_setzero_ps();
+                for (; i + 8 <= n; i += 8)
+                {
+                    const __m256 w = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(q + i))));
+                    acc8 = multiply_add(_mm256_loadu_ps(x + i), w, acc8);
+                }
+                sum += horizontal_sum(acc8);
+#endif
+                for (; i < n; ++i)
+                    sum += x[i]*q[i];
+                return sum;
+            }
+
+            // sum_i x[i]*q[i] for n 4 bit values q, stored as described in
+            // quantized_matrix_abstract.h
+            float quantized_dot4(const float* x, const unsigned char* q, long n)
+            {
+                const long block = quantized_matrix::int4_block_size, half = block/2;
+                long i = 0;
+                float sum = 0;
+#if defined(DLIB_HAVE_AVX512F)
+                const __m512i mask16 = _mm512_set1_epi32(0x0F), offset16 = _mm512_set1_epi32(8);
+                __m512 acc16 = _mm512_setzero_ps();
+                for (; i + block <= n; i += block, q += half)
+                {
+                    const __m512i b = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)q));
+                    const __m512 lo = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_and_si512(b, mask16), offset16));
+                    const __m512 hi = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(b, 4), offset16));
+                    acc16 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), lo, acc16);
+                    acc16 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + half), hi, acc16);
+                }
+                sum += _mm512_reduce_add_ps(acc16);
+#elif defined(DLIB_HAVE_AVX2)
+                const __m256i mask8 = _mm256_set1_epi32(0x0F), offset8 = _mm256_set1_epi32(8);
+                __m256 acc8 = _mm256_setzero_ps();
+                for (; i + block <= n; i += block, q += half)
+                {
+                    for (long j = 0; j < half; j += 8)
+                    {
+                        const __m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(q + j)));
+                        const __m256 lo = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(b, mask8), offset8));
+                        const __m256 hi = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(b, 4), offset8));
+                        acc8 = multiply_add(_mm256_loadu_ps(x + i + j), lo, acc8);
+                        acc8 = multiply_add(_mm256_loadu_ps(x + i + half + j), hi, acc8);
+                    }
+                }
+                sum += horizontal_sum(acc8);
+#endif
+                for (; i < n; i += block, q += half)
+                {
+                    for (long j = 0; j < half; ++j)
+                    {
+                        if (i + j < n)
+                            sum += x[i + j]*(static_cast<int>(q[j] & 0x0F) - 8);
+                        if (i + half + j < n)
+                            sum += x[i + half + j]*(static_cast<int>(q[j] >> 4) - 8);
+                    }
+                }
+                return sum;
+            }
+
+            // sum_i x[i]*q[i] for n bfloat16 values q, accumulated in float
+            float bfloat16_dot(const float* x, const bfloat16* q, long n)
+            {
+                long i = 0;
+                float sum = 0;
+#if defined(DLIB_HAVE_AVX512F)
+                __m512 acc16 = _mm512_setzero_ps();
+                for (; i + 16 <= n; i += 16)
+                {
+                    const __m512i b = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(q + i)));
+                    acc16 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_castsi512_ps(_mm512_slli_epi32(b, 16)), acc16);
+                }
+                sum += _mm512_reduce_add_ps(acc16);
+#endif
+#if defined(DLIB_HAVE_AVX2)
+                __m256 acc8 = _mm256_setzero_ps();
+                for (; i + 8 <= n; i += 8)
+                {
+                    const __m256i b = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(q + i)));
+                    acc8 = multiply_add(_mm256_loadu_ps(x + i), _mm256_castsi256_ps(_mm256_slli_epi32(b, 16)), acc8);
+                }
+                sum += horizontal_sum(acc8);
+#endif
+                for (; i < n; ++i)
+                    sum += x[i]*static_cast<float>(q[i]);
+                return sum;
+            }
+        }
+
+        void quantized_gemm (
+            tensor& dest,
+            const tensor& lhs,
+            const quantized_matrix& rhs
+        )
+        {
+            const long M = lhs.num_samples();
+            const long K = rhs.nc();
+            const long N = rhs.nr();
+            DLIB_CASSERT(!rhs.empty() && M > 0 &&
+                (long)lhs.size() == M*K &&
+                dest.num_samples() == M &&
+                (long)dest.size() == M*N,
+                "\nlhs: " << lhs.num_samples() << "x" << lhs.k() << "x" << lhs.nr() << "x" << lhs.nc() <<
+                "\ndest: " << dest.num_samples() << "x" << dest.k() << "x" << dest.nr() << "x" << dest.nc() <<
+                "\nrhs: " << rhs.nr() << "x" << rhs.nc());
+
+            if (M > quantized_max_direct_rows)
+            {
+                resizable_tensor w;
+                rhs.dequantize(w);
+                auto d = alias_tensor(M, N)(dest, 0);
+                d = mat(alias_tensor(M, K)(lhs, 0).get())*trans(mat(w));
+                return;
+            }
+
+            // Decoding a token multiplies a few rows by the whole weight matrix, so each row
+            // of W is read once and expanded on the fly for all the rows of lhs.
+            const float* x = lhs.host();
+            float* d = dest.host_write_only();
+            auto compute = [&](long n0, long n1)
+            {
+                for (long n = n0; n < n1; ++n)
+                {
+                    const unsigned char* q = rhs.row(n);
+                    const float s = rhs.scale(n);
+                    for (long m = 0; m < M; ++m)
+                    {
+                        const float dot = rhs.bits() == 8 ?
+                            quantized_dot8(x + m*K, reinterpret_cast<const int8_t*>(q), K) :
+                            rhs.bits() == 4 ?
+                            quantized_dot4(x + m*K, q, K) :
+                            bfloat16_dot(x + m*K, reinterpret_cast<const bfloat16*>(q), K);
+                        d[m*N + n] = s*dot;
+                    }
+                }
+            };
+
+            if (M*N*K < quantized_min_parallel_work)
+            {
+                compute(0, N);
+                return;
+            }
+            const long num_blocks = (N + quantized_row_block - 1)/quantized_row_block;
+            parallel_for(0, num_blocks, [&](long b)
+            {
+                compute(b*quantized_row_block, std::min(N, (b + 1)*quantized_row_block));
+            });
+        }
+
+        void quantized_embeddings (
+            resizable_tensor& dest,
+            const tensor& src,
+            const quantized_matrix& embs,
+            float scale
+        )
+        {
+            DLIB_CASSERT(
+                src.nr() > 0 &&
+                !embs.empty() &&
+                dest.num_samples() == src.num_samples() &&
+                dest.k() == src.k() &&
+                dest.nr() == src.nr() &&
+                dest.nc() == embs.nc(),
+                "\nsrc: " << src.num_samples() << "x" << src.k() << "x" << src.nr() << "x" << src.nc() <<
+                "\ndest: " << dest.num_samples() << "x" << dest.k() << "x" << dest.nr() << "x" << dest.nc() <<
+                "\nembs: " << embs.nr() << "x" << embs.nc()
+            );
+
+            const long nc = dest.nc();
+            const float* src_data = src.host();
+            float* dest_data = dest.host_write_only();
+            for (long s = 0; s < dest.num_samples(); ++s)
+            {
+                for (long k = 0; k < dest.k(); ++k)
+                {
+                    for (long r = 0; r < dest.nr(); ++r)
+                    {
+                        const unsigned long token_idx = static_cast<unsigned long>(src_data[tensor_index(src, s, k, r, 0)]);
+                        float* d = dest_data + tensor_index(dest, s, k, r, 0);
+                        if (token_idx < static_cast<unsigned long>(embs.nr()))
+                            embs.dequantize_row(token_idx, d, scale);
+                        else
+                            std::fill(d, d + nc, 0.0f);
+                    }
+                }
+            }
+        }
+    // ------------------------------------------------------------------------------------
+
+        namespace
+        {
+            // Values converted by one task of float_to_bfloat16() and bfloat16_to_float()
+            const size_t bfloat16_block_size = 256*1024;
+
+            void to_bfloat16(bfloat16* dest, const float* src, size_t n)
+            {
+                size_t i = 0;
+#if defined(DLIB_HAVE_AVX512BF16)
+                for (; i + 16 <= n; i += 16)
+                {
+                    const __m256bh b = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+                    std::memcpy(dest + i, &b, sizeof(b));
+                }
+#elif defined(DLIB_HAVE_AVX2)
+                // Same rounding as the bfloat16 constructor, 8 values at a time
+                const __m256i one = _mm256_set1_epi32(1), bias = _mm256_set1_epi32(0x7FFF);
+                const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF), inf = _mm256_set1_epi32(0x7F800000);
+                const __m256i quiet = _mm256_set1_epi32(0x40);
+                for (; i + 8 <= n; i += 8)
+                {
+                    const __m256i u = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+                    const __m256i hi = _mm256_srli_epi32(u, 16);
+                    const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(bias, _mm256_and_si256(hi, one))), 16);
+                    const __m256i is_nan = _mm256_cmpgt_epi32(_mm256_and_si256(u, abs_mask), inf);
+                    const __m256i r = _mm256_blendv_epi8(rounded, _mm256_or_si256(hi, quiet), is_nan);
+                    const __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+                    _mm_storeu_si128((__m128i*)(dest + i), packed);
+                }
+#endif
+                for (; i < n; ++i)
+                    dest[i] = bfloat16(src[i]);
+            }
+
+            void from_bfloat16(float* dest, const bfloat16* src, size_t n)
+            {
+                size_t i = 0;
+#if defined(DLIB_HAVE_AVX512F)
+                for (; i + 16 <= n; i += 16)
+                {
+                    const __m512i b = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + i)));
+                    _mm512_storeu_si512(dest + i, _mm512_slli_epi32(b, 16));
+                }
+#elif defined(DLIB_HAVE_AVX2)
+                for (; i + 8 <= n; i += 8)
+                {
+                    const __m256i b = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+                    _mm256_storeu_si256((__m256i*)(dest + i), _mm256_slli_epi32(b, 16));
+                }
+#endif
+                for (; i < n; ++i)
+                    dest[i] = static_cast<float>(src[i]);
+            }
+
+            template <typename T, typename U, typename F>
+            void convert_in_blocks(T* dest, const U* src, size_t n, F convert)
+            {
+                if (n <= bfloat16_block_size)
+                {
+                    convert(dest, src, n);
+                    return;
+                }
+                const size_t num_blocks = (n + bfloat16_block_size - 1)/bfloat16_block_size;
+                parallel_for(0, num_blocks, [&](size_t b)
+                {
+                    const size_t begin = b*bfloat16_block_size;
+                    convert(dest + begin, src + begin, std::min(n - begin, bfloat16_block_size));
+                });
+            }
+        }
+
+        void float_to_bfloat16 (
+            bfloat16_tensor& dest,
+            const tensor& src
+        )
+        {
+            dest.set_size(src.num_samples(), src.k(), src.nr(), src.nc());
+            convert_in_blocks(dest.data(), src.host(), src.size(), to_bfloat16);
+        }
+
+        void bfloat16_to_float (
+            resizable_tensor& dest,
+            const bfloat16_tensor& src
+        )
+        {
+            dest.set_size(src.num_samples(), src.k(), src.nr(), src.nc());
+            convert_in_blocks(dest.host_write_only(), src.data(), src.size(), from_bfloat16);
+        }
+
+    // ------------------------------------------------------------------------------------
+
+        void normalize_linear_output (
+            tensor& dest,
+            bool add_to,
+            const tensor& xw,
+            const tensor& src,
+            double eps,
+            bool subtract_mean,
+            const tensor& gamma,
+            const tensor& beta,
+            const tensor& weight_sums,
+            const tensor& biases
+        )
+        {
+            const long num_groups = src.num_samples();
+            const long rows = num_groups*src.k()*src.nr();
+            const long N = weight_sums.size();
+            DLIB_CASSERT(rows > 0 && eps > 0 &&
+                (long)xw.size() == rows*N &&
+                have_same_dimensions(dest, xw) &&
+                (long)gamma.size() == src.k() &&
+                (beta.size() == 0 || beta.size() == gamma.size()) &&
+                (biases.size() == 0 || (long)biases.size() == N),
+                "\nsrc: " << src.num_samples() << "x" << src.k() << "x" << src.nr() << "x" << src.nc() <<
+                "\nxw: " << xw.num_samples() << "x" << xw.k() << "x" << xw.nr() << "x" << xw.nc() <<
+                "\ngamma.size(): " << gamma.size() <<
+                "\nbeta.size(): " << beta.size() <<
+                "\nweight_sums.size(): " << weight_sums.size() <<
+                "\nbiases.size(): " << biases.size() <<
+                "\neps: " << eps);
+
+            const long group_size = src.size()/num_groups;
+            const float* s = src.host();
+            const float* p_xw = xw.host();
+            const float* g = gamma.host();
+            const float* b = beta.size() != 0 ? beta.host() : nullptr;
+            const float* ws = weight_sums.host();
+            const float* bias = biases.size() != 0 ? biases.host() : nullptr;
+            float* d = dest.host();
+
+            // Each group is normalized with its own statistics.  Since xw already holds the
+            // product of the raw rows with W, normalizing row r is an affine transform of
+            // its product: a*xw(r) + c*weight_sums, with a and c given by the statistics of
+            // the group and the gamma and beta of the channel.
+            auto process = [&](long i)
+            {
+                const float* x = s + i*group_size;
+                double sum = 0, sum_sq = 0;
+                for (long j = 0; j < group_size; ++j)
+                {
+                    sum += x[j];
+                    sum_sq += x[j]*x[j];
+                }
+                const double mean = subtract_mean ? sum/group_size : 0;
+                const double invstd = 1/std::sqrt(sum_sq/group_size - mean*mean + eps);
+
+                for (long k = 0; k < src.k(); ++k)
+                {
+                    const float a = static_cast<float>(invstd*g[k]);
+                    const float c = static_cast<float>((b ? b[k] : 0) - mean*invstd*g[k]);
+                    for (long r = 0; r < src.nr(); ++r)
+                    {
+                        const long row = (i*src.k() + k)*src.nr() + r;
+                        const float* in = p_xw + row*N;
+                        float* out = d + row*N;
+                        for (long j = 0; j < N; ++j)
+                        {
+                            const float v = a*in[j] + c*ws[j] + (bias ? bias[j] : 0);
+                            out[j] = add_to ? out[j] + v : v;
+                        }
+                    }
+                }
+            };
+
+            if (rows*(N + src.nc()) < quantized_min_parallel_work)
+            {
+                for (long i = 0; i < num_groups; ++i)
+                    process(i);
+            }
+            else
+            {
+                parallel_for(0, num_groups, process);
+            }
+        }
+
     // ------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------
 
@@ -2839,100 +3253,203 @@ namespace dlib
     // ------------------------------------------------------------------------------------
     // ------------------------------------------------------------------------------------
 
-        void img2col(
-            matrix<float>& output,
-            const tensor& data,
-            long n,
-            long filter_nr,
-            long filter_nc,
-            long stride_y,
-            long stride_x,
-            long padding_y,
-            long padding_x
-        )
+        namespace
         {
-            const auto d = data.host() + data.k()*data.nr()*data.nc()*n;
-            const rectangle boundary = get_rect(data);
+            // Number of floats in the im2col block handled by one task of the
+            // convolution, so the block stays in cache while it is multiplied.
+            const long conv_block_floats = 64*1024;
 
-            const long out_nr = 1+(data.nr()+2*padding_y-filter_nr)/stride_y;
-            const long out_nc = 1+(data.nc()+2*padding_x-filter_nc)/stride_x;
+            // Multiply-adds per sample above which a whole im2col matrix is given to
+            // BLAS, which uses several threads by itself.
+            const long conv_min_blas_work = 256*256*64;
 
-            output.set_size(out_nr*out_nc, 
-                            data.k()*filter_nr*filter_nc);
-            DLIB_CASSERT(output.size() != 0);
-            float* t = &output(0,0);
+            struct conv_geometry
+            {
+                conv_geometry(
+                    const tensor& data,
+                    long filter_nr_,
+                    long filter_nc_,
+                    long stride_y_,
+                    long stride_x_,
+                    long padding_y_,
+                    long padding_x_
+                ) : k(data.k()), nr(data.nr()), nc(data.nc()),
+                    filter_nr(filter_nr_), filter_nc(filter_nc_),
+                    stride_y(stride_y_), stride_x(stride_x_),
+                    padding_y(padding_y_), padding_x(padding_x_),
+                    out_nr(1+(data.nr()+2*padding_y_-filter_nr_)/stride_y_),
+                    out_nc(1+(data.nc()+2*padding_x_-filter_nc_)/stride_x_)
+                {}
+
+                long sample_size() const { return k*nr*nc; }
+                long window_size() const { return filter_nr*filter_nc; }
+                long patch_size() const { return k*filter_nr*filter_nc; }
+                long num_positions() const { return out_nr*out_nc; }
+
+                long k, nr, nc;
+                long filter_nr, filter_nc;
+                long stride_y, stride_x;
+                long padding_y, padding_x;
+                long out_nr, out_nc;
+            };
 
-            // now fill in the Toeplitz output matrix for the n-th sample in data.  
-            long cnt = 0;
-            const long max_r = data.nr() + padding_y-(filter_nr-1);
-            const long max_c = data.nc() + padding_x-(filter_nc-1);
-            for (long r = -padding_y; r < max_r; r+=stride_y)
+            // Calls f(p, src) for the output positions p in [p0,p1) whose window has its
+            // element (y,x) inside the image, src being the offset of that element in
+            // the input plane.  Consecutive calls of a row have consecutive p.
+            template <typename F>
+            void for_each_tap_position(
+                const conv_geometry& g,
+                long y,
+                long x,
+                long p0,
+                long p1,
+                F&& f
+            )
             {
-                for (long c = -padding_x; c < max_c; c+=stride_x)
+                // Range of output columns reading inside the image
+                const long c0 = std::max<long>(0, (g.padding_x - x + g.stride_x - 1)/g.stride_x);
+                const long c1 = std::min(g.out_nc, (g.nc + g.padding_x - x + g.stride_x - 1)/g.stride_x);
+                for (long r = p0/g.out_nc; r*g.out_nc < p1; ++r)
                 {
-                    for (long k = 0; k < data.k(); ++k)
+                    const long yy = r*g.stride_y - g.padding_y + y;
+                    if (yy < 0 || yy >= g.nr)
+                        continue;
+                    const long first = std::max(c0, p0 - r*g.out_nc);
+                    const long last = std::min(c1, p1 - r*g.out_nc);
+                    for (long c = first; c < last; ++c)
+                        f(r*g.out_nc + c, yy*g.nc + c*g.stride_x - g.padding_x + x);
+                }
+            }
+
+            // Columns [p0,p1) of the im2col matrix of one sample, restricted to the input
+            // planes [k0,k1).  Row (k-k0)*window_size() + y*filter_nc + x holds the input
+            // value under tap (y,x) of plane k for each output position, zero in the
+            // padding.  Rows are ld floats apart.
+            void img2col(
+                float* t,
+                long ld,
+                const float* d,
+                const conv_geometry& g,
+                long p0,
+                long p1,
+                long k0,
+                long k1
+            )
+            {
+                for (long k = k0; k < k1; ++k)
+                {
+                    const float* plane = d + k*g.nr*g.nc;
+                    for (long y = 0; y < g.filter_nr; ++y)
                     {
-                        for (long y = 0; y < filter_nr; ++y)
+                        for (long x = 0; x < g.filter_nc; ++x, t += ld)
                         {
-                            for (long x = 0; x < filter_nc; ++x)
-                            {
-                                DLIB_ASSERT(cnt < output.size());
-                                long xx = c+x;
-                                long yy = r+y;
-                                if (boundary.contains(xx,yy))
-                                    *t = d[(k*data.nr() + yy)*data.nc() + xx];
-                                else
-                                    *t = 0;
-                                ++t;
-                                ++cnt;
-                            }
+                            std::fill(t, t + (p1 - p0), 0.0f);
+                            for_each_tap_position(g, y, x, p0, p1, [&](long p, long src) { t[p - p0] = plane[src]; });
                         }
                     }
                 }
             }
-        }
-
-        void col2img(
-            const matrix<float>& output,
-            tensor& data,
-            long n,
-            long filter_nr,
-            long filter_nc,
-            long stride_y,
-            long stride_x,
-            long padding_y,
-            long padding_x
-        )
-        {
-            const auto d = data.host() + data.k()*data.nr()*data.nc()*n;
-            const rectangle boundary = get_rect(data);
 
-            DLIB_CASSERT(output.size() != 0);
-            const float* t = &output(0,0);
+            // The transpose of img2col(): adds columns [p0,p1) of an im2col shaped matrix
+            // back into the input planes [k0,k1) of one sample.
+            void col2img(
+                const float* t,
+                long ld,
+                float* d,
+                const conv_geometry& g,
+                long p0,
+                long p1,
+                long k0,
+                long k1
+            )
+            {
+                for (long k = k0; k < k1; ++k)
+                {
+                    float* plane = d + k*g.nr*g.nc;
+                    for (long y = 0; y < g.filter_nr; ++y)
+                    {
+                        for (long x = 0; x < g.filter_nc; ++x, t += ld)
+                            for_each_tap_position(g, y, x, p0, p1, [&](long p, long dst) { plane[dst] += t[p - p0]; });
+                    }
+                }
+            }
 
-            // now fill in the Toeplitz output matrix for the n-th sample in data.  
-            const long max_r = data.nr() + padding_y-(filter_nr-1);
-            const long max_c = data.nc() + padding_x-(filter_nc-1);
-            for (long r = -padding_y; r < max_r; r+=stride_y)
+            // dest = A*B, or dest += A*B if add_to_dest, where A is M x K, B is K x N and
+            // all three are row major with the given row strides.  Blocks of 4 rows by 16
+            // columns of dest are accumulated in registers, so each value of B loaded is
+            // used 4 times and each value of A 16 times.
+            void conv_gemm(
+                bool add_to_dest,
+                float* dest,
+                long ldd,
+                const float* A,
+                long lda,
+                const float* B,
+                long ldb,
+                long M,
+                long N,
+                long K
+            )
             {
-                for (long c = -padding_x; c < max_c; c+=stride_x)
+                const long MR = 4, NR = 16;
+                for (long j0 = 0; j0 < N; j0 += NR)
                 {
-                    for (long k = 0; k < data.k(); ++k)
+                    const long nr = std::min(NR, N - j0);
+                    for (long i0 = 0; i0 < M; i0 += MR)
                     {
-                        for (long y = 0; y < filter_nr; ++y)
+                        const long mr = std::min(MR, M - i0);
+                        float acc[MR][NR] = {};
+                        if (mr == MR && nr == NR)
                         {
-                            for (long x = 0; x < filter_nc; ++x)
+                            const float* a0 = A + i0*lda;
+                            const float* a1 = a0 + lda;
+                            const float* a2 = a1 + lda;
+                            const float* a3 = a2 + lda;
+                            for (long k = 0; k < K; ++k)
                             {
-                                long xx = c+x;
-                                long yy = r+y;
-                                if (boundary.contains(xx,yy))
-                                    d[(k*data.nr() + yy)*data.nc() + xx] += *t;
-                                ++t;
+                                const float* b = B + k*ldb + j0;
+                                for (long j = 0; j < NR; ++j)
+                                {
+                                    acc[0][j] += a0[k]*b[j];
+                                    acc[1][j] += a1[k]*b[j];
+                                    acc[2][j] += a2[k]*b[j];
+                                    acc[3][j] += a3[k]*b[j];
+                                }
+                            }
+                        }
+                        else
+                        {
+                            for (long k = 0; k < K; ++k)
+                            {
+                                const float* b = B + k*ldb + j0;
+                                for (long i = 0; i < mr; ++i)
+                                {
+                                    const float a = A[(i0 + i)*lda + k];
+                                    for (long j = 0; j < nr; ++j)
+                                        acc[i][j] += a*b[j];
+                                }
                             }
                         }
+
+                        for (long i = 0; i < mr; ++i)
+                        {
+                            float* d = dest + (i0 + i)*ldd + j0;
+                            if (add_to_dest)
+                                for (long j = 0; j < nr; ++j) d[j] += acc[i][j];
+                            else
+                                for (long j = 0; j < nr; ++j) d[j] = acc[i][j];
+                        }
                     }
                 }
             }
+
+            // Number of columns of an im2col block of rows floats per column that fits in
+            // conv_block_floats, rounded to a multiple of the 16 columns of conv_gemm().
+            long conv_block_columns(long rows, long num_positions)
+            {
+                const long cols = std::max<long>(16, conv_block_floats/rows/16*16);
+                return std::min(cols, num_positions);
+            }
         }
 
         void tensor_conv::operator() (
@@ -2971,17 +3488,51 @@ namespace dlib
             DLIB_CASSERT(output.nr() == 1+(data.nr()+2*last_padding_y-filters.nr())/last_stride_y);
             DLIB_CASSERT(output.nc() == 1+(data.nc()+2*last_padding_x-filters.nc())/last_stride_x);
 
-
-            matrix<float> temp;
-            for (long n = 0; n < data.num_samples(); ++n)
+            const conv_geometry g(data, filters.nr(), filters.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
+            const long num_samples = data.num_samples();
+            const long num_filters = filters.num_samples();
+            const long num_positions = g.num_positions();
+            const long patch_size = g.patch_size();
+            const float* d = data.host();
+            const float* f = filters.host();
+            float* out = add_to_output ? output.host() : output.host_write_only();
+
+#ifdef DLIB_USE_BLAS
+            // Large samples: all the threads build the im2col matrix of a sample and
+            // BLAS multiplies it straight into the output.
+            if (num_filters*num_positions*patch_size >= conv_min_blas_work)
             {
-                img2col(temp, data, n, filters.nr(), filters.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
-
-                if (add_to_output)
-                    output.add_to_sample(n, mat(filters)*trans(temp));
-                else 
-                    output.set_sample(n, mat(filters)*trans(temp));
+                using namespace blas_bindings;
+                std::vector<float> col(patch_size*num_positions);
+                for (long n = 0; n < num_samples; ++n)
+                {
+                    const float* dn = d + n*g.sample_size();
+                    parallel_for(0, g.k, [&](long k)
+                    {
+                        img2col(col.data() + k*g.window_size()*num_positions, num_positions, dn, g, 0, num_positions, k, k + 1);
+                    });
+                    cblas_gemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, num_filters, num_positions, patch_size,
+                        1, f, patch_size, col.data(), num_positions,
+                        add_to_output ? 1 : 0, out + n*num_filters*num_positions, num_positions);
+                }
+                return;
             }
+#endif
+
+            // Every task multiplies the filters with a cache sized block of columns of the
+            // im2col matrix of one sample and owns the matching output columns.
+            const long block = conv_block_columns(patch_size, num_positions);
+            const long num_blocks = (num_positions + block - 1)/block;
+            parallel_for(0, num_samples*num_blocks, [&](long i)
+            {
+                const long n = i/num_blocks;
+                const long p0 = (i%num_blocks)*block;
+                const long p1 = std::min(num_positions, p0 + block);
+                std::vector<float> col(patch_size*(p1 - p0));
+                img2col(col.data(), p1 - p0, d + n*g.sample_size(), g, p0, p1, 0, g.k);
+                conv_gemm(add_to_output, out + n*num_filters*num_positions + p0, num_positions,
+                    f, patch_size, col.data(), p1 - p0, num_filters, p1 - p0, patch_size);
+            });
         }
 
         void tensor_conv::operator() (
@@ -3025,19 +3576,67 @@ namespace dlib
             tensor& data_gradient
         )
         {
-            matrix<float> temp;
+            const conv_geometry g(data_gradient, filters.nr(), filters.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
+            const long num_samples = gradient_input.num_samples();
+            const long num_filters = filters.num_samples();
+            const long num_positions = g.num_positions();
+            const long patch_size = g.patch_size();
+            const long window = g.window_size();
+            DLIB_CASSERT(gradient_input.k() == num_filters);
+            DLIB_CASSERT(gradient_input.nr()*gradient_input.nc() == num_positions);
+
             if (!add_to_output)
                 data_gradient = 0;
-            for (long n = 0; n < gradient_input.num_samples(); ++n)
-            {
-                auto gi = mat(gradient_input.host()+gradient_input.k()*gradient_input.nr()*gradient_input.nc()*n,
-                              gradient_input.k(),
-                              gradient_input.nr()*gradient_input.nc());
-                                    
+            const float* gi = gradient_input.host();
+            const float* f = filters.host();
+            float* dg = data_gradient.host();
 
-                temp = trans(gi)*mat(filters);
-                col2img(temp, data_gradient, n, filters.nr(), filters.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
+#ifdef DLIB_USE_BLAS
+            // Large samples: BLAS computes the im2col shaped gradient of a sample, then
+            // every thread adds back its own input planes.
+            if (num_filters*num_positions*patch_size >= conv_min_blas_work)
+            {
+                using namespace blas_bindings;
+                std::vector<float> col(patch_size*num_positions);
+                for (long n = 0; n < num_samples; ++n)
+                {
+                    cblas_gemm(CblasRowMajor, CblasTrans, CblasNoTrans, patch_size, num_positions, num_filters,
+                        1, f, patch_size, gi + n*num_filters*num_positions, num_positions,
+                        0, col.data(), num_positions);
+                    float* dgn = dg + n*g.sample_size();
+                    parallel_for(0, g.k, [&](long k)
+                    {
+                        col2img(col.data() + k*window*num_positions, num_positions, dgn, g, 0, num_positions, k, k + 1);
+                    });
+                }
+                return;
             }
+#endif
+
+            // The rows of the im2col shaped gradient that belong to an input plane only
+            // depend on the matching columns of the filters, so every task owns a plane
+            // of one sample and a block of columns, and adds it back on its own.  The
+            // planes are split in column blocks one after the other since their
+            // contributions overlap.
+            std::vector<float> filters_t(patch_size*num_filters);
+            for (long r = 0; r < num_filters; ++r)
+                for (long c = 0; c < patch_size; ++c)
+                    filters_t[c*num_filters + r] = f[r*patch_size + c];
+            const long block = conv_block_columns(window, num_positions);
+            parallel_for(0, num_samples*g.k, [&](long i)
+            {
+                const long n = i/g.k;
+                const long k = i%g.k;
+                const float* gin = gi + n*num_filters*num_positions;
+                std::vector<float> col(window*block);
+                for (long p0 = 0; p0 < num_positions; p0 += block)
+                {
+                    const long p1 = std::min(num_positions, p0 + block);
+                    conv_gemm(false, col.data(), p1 - p0, filters_t.data() + k*window*num_filters, num_filters,
+                        gin + p0, num_positions, window, p1 - p0, num_filters);
+                    col2img(col.data(), p1 - p0, dg + n*g.sample_size(), g, p0, p1, k, k + 1);
+                }
+            });
         }
 
     // ------------------------------------------------------------------------------------
@@ -3050,27 +3649,75 @@ namespace dlib
             tensor& filters_gradient
         )
         {
-            matrix<float> temp;
-            for (long n = 0; n < gradient_input.num_samples(); ++n)
-            {
-                auto gi = mat(gradient_input.host()+gradient_input.k()*gradient_input.nr()*gradient_input.nc()*n,
-                              gradient_input.k(),
-                              gradient_input.nr()*gradient_input.nc());
+            const conv_geometry g(data, filters_gradient.nr(), filters_gradient.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
+            const long num_samples = gradient_input.num_samples();
+            const long num_filters = filters_gradient.num_samples();
+            const long num_positions = g.num_positions();
+            const long patch_size = g.patch_size();
+            const long window = g.window_size();
+            DLIB_CASSERT(gradient_input.k() == num_filters);
+            DLIB_CASSERT(gradient_input.nr()*gradient_input.nc() == num_positions);
 
+            const float* gi = gradient_input.host();
+            const float* d = data.host();
+            float* fg = add_to_output ? filters_gradient.host() : filters_gradient.host_write_only();
 
-                img2col(temp, data, n, filters_gradient.nr(), filters_gradient.nc(), last_stride_y, last_stride_x, last_padding_y, last_padding_x);
-                if (n == 0)
+#ifdef DLIB_USE_BLAS
+            // Large samples: all the threads build the im2col matrix of a sample and
+            // BLAS accumulates its product with the gradient.
+            if (num_filters*num_positions*patch_size >= conv_min_blas_work)
+            {
+                using namespace blas_bindings;
+                std::vector<float> col(patch_size*num_positions);
+                for (long n = 0; n < num_samples; ++n)
                 {
-                    if (add_to_output)
-                        filters_gradient += gi*temp;
-                    else
-                        filters_gradient = gi*temp;
+                    const float* dn = d + n*g.sample_size();
+                    parallel_for(0, g.k, [&](long k)
+                    {
+                        img2col(col.data() + k*window*num_positions, num_positions, dn, g, 0, num_positions, k, k + 1);
+                    });
+                    cblas_gemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_filters, patch_size, num_positions,
+                        1, gi + n*num_filters*num_positions, num_positions, col.data(), num_positions,
+                        (n > 0 || add_to_output) ? 1 : 0, fg, patch_size);
                 }
-                else
+                return;
+            }
+#endif
+
+            // Every task owns the gradient of the filters over one input plane and sums
+            // it over all the samples, in the same order whatever the number of threads.
+            // It is computed transposed, as im2col rows times the transposed gradient.
+            std::vector<float> gi_t(num_samples*num_positions*num_filters);
+            parallel_for(0, num_samples, [&](long n)
+            {
+                const float* src = gi + n*num_filters*num_positions;
+                float* dst = gi_t.data() + n*num_positions*num_filters;
+                for (long r = 0; r < num_filters; ++r)
+                    for (long c = 0; c < num_positions; ++c)
+                        dst[c*num_filters + r] = src[r*num_positions + c];
+            });
+            const long block = conv_block_columns(window, num_positions);
+            parallel_for(0, g.k, [&](long k)
+            {
+                std::vector<float> acc(window*num_filters, 0.0f);
+                std::vector<float> col(window*block);
+                for (long n = 0; n < num_samples; ++n)
                 {
-                    filters_gradient += gi*temp;
+                    for (long p0 = 0; p0 < num_positions; p0 += block)
+                    {
+                        const long p1 = std::min(num_positions, p0 + block);
+                        img2col(col.data(), p1 - p0, d + n*g.sample_size(), g, p0, p1, k, k + 1);
+                        conv_gemm(true, acc.data(), num_filters, col.data(), p1 - p0,
+                            gi_t.data() + (n*num_positions + p0)*num_filters, num_filters, window, num_filters, p1 - p0);
+                    }
                 }
-            }
+                for (long f = 0; f < num_filters; ++f)
+                {
+                    float* dst = fg + f*patch_size + k*window;
+                    for (long w = 0; w < window; ++w)
+                        dst[w] = add_to_output ? dst[w] + acc[w*num_filters + f] : acc[w*num_filters + f];
+                }
+            });
         }
 
      // ------------------------------------------------------------------------------------
@@ -3436,6 +4083,502 @@ namespace dlib
             });
         }
 
+    // ------------------------------------------------------------------------------------
+
+        namespace
+        {
+            // A plane of a PLANE_WISE gemm() operand: a rows x cols row major matrix
+            struct gemm_plane_operand
+            {
+                gemm_plane_operand(const tensor& t) : heads(t.k()), group(1)
+                {
+                    // A 2D matrix operand is shared by all the planes of the other operands
+                    is_matrix = is_2d_matrix(t);
+                    rows = t.nr();
+                    cols = t.nc();
+                    if (is_matrix && (t.num_samples() > 1 || t.k() > 1))
+                    {
+                        rows = t.num_samples();
+                        cols = t.k();
+                    }
+                }
+
+                // Index of the plane of this operand used by plane p of the gemm(), where
+                // each of the operand's channels is shared by group consecutive channels.
+                long index(long p, long num_heads) const
+                {
+                    return is_matrix ? 0 : (p/num_heads)*heads + (p%num_heads)/group;
+                }
+
+                size_t offset(long p, long num_heads) const { return index(p, num_heads)*rows*cols; }
+
+                bool is_matrix;
+                long rows, cols;
+                long heads, group;
+            };
+
+            // Number of rows of dest computed by one task of the plane wise gemm()
+            const long gemm_row_block = 32;
+
+            // Below this many multiply-adds per plane, running all the planes concurrently
+            // with the simple kernel below beats calling BLAS plane after plane.
+            const long gemm_min_blas_work = 256*256*64;
+
+            // dest rows [r0,r1) = alpha*L*R + beta*dest, where L is the (possibly
+            // transposed) lhs plane and R is a row major K x N matrix.
+            void gemm_plane_rows(
+                float beta,
+                float* dest,
+                float alpha,
+                const float* lhs,
+                long lhs_cols,
+                bool trans_lhs,
+                const float* r,
+                long K,
+                long N,
+                long r0,
+                long r1
+            )
+            {
+                for (long i = r0; i < r1; ++i)
+                {
+                    float* d = dest + i*N;
+                    if (beta == 0)
+                        std::fill(d, d + N, 0.0f);
+                    else if (beta != 1)
+                        for (long j = 0; j < N; ++j)
+                            d[j] *= beta;
+
+                    for (long k = 0; k < K; ++k)
+                    {
+                        const float a = alpha*(trans_lhs ? lhs[k*lhs_cols + i] : lhs[i*lhs_cols + k]);
+                        const float* rk = r + k*N;
+                        for (long j = 0; j < N; ++j)
+                            d[j] += a*rk[j];
+                    }
+                }
+            }
+        }
+
+        void gemm_plane_wise (
+            float beta,
+            tensor& dest,
+            float alpha,
+            const tensor& lhs,
+            bool trans_lhs,
+            const tensor& rhs,
+            bool trans_rhs
+        )
+        {
+            gemm_plane_operand l(lhs), r(rhs), d(dest);
+
+            // The planes are counted on the operands that aren't shared 2D matrices.  An
+            // operand with fewer channels than the others has each of its channels shared
+            // by a group of consecutive channels (e.g. grouped-query attention).
+            long num_samples = std::numeric_limits<long>::max();
+            long num_heads = 1;
+            const tensor* operands[] = { &lhs, &rhs, &dest };
+            for (const tensor* t : operands)
+            {
+                if (!is_2d_matrix(*t))
+                {
+                    num_samples = std::min<long>(num_samples, t->num_samples());
+                    num_heads = std::max<long>(num_heads, t->k());
+                }
+            }
+            if (num_samples == std::numeric_limits<long>::max())
+                num_samples = 1;
+            for (gemm_plane_operand* op : { &l, &r, &d })
+            {
+                if (op->is_matrix)
+                    continue;
+                DLIB_CASSERT(num_heads%op->heads == 0,
+                    "\nThe channels of a PLANE_WISE gemm() operand must evenly divide those of the others."
+                    << "\nchannels: " << op->heads << ", largest number of channels: " << num_heads);
+                op->group = num_heads/op->heads;
+            }
+            const long num_planes = num_samples*num_heads;
+
+            const long M = trans_lhs ? l.cols : l.rows;
+            const long K = trans_lhs ? l.rows : l.cols;
+            const long N = trans_rhs ? r.rows : r.cols;
+            DLIB_CASSERT((trans_rhs ? r.cols : r.rows) == K && d.rows == M && d.cols == N,
+                "\nIncompatible plane dimensions in PLANE_WISE gemm()."
+                << "\nlhs plane: " << l.rows << "x" << l.cols << (trans_lhs ? " (transposed)" : "")
+                << "\nrhs plane: " << r.rows << "x" << r.cols << (trans_rhs ? " (transposed)" : "")
+                << "\ndest plane: " << d.rows << "x" << d.cols);
+            if (num_planes == 0 || M == 0 || N == 0)
+                return;
+
+            // Planes writing to the same dest plane are summed into it one after the other,
+            // only the first one scaling the previous content by beta.
+            const long num_dest_planes = d.is_matrix ? 1 : num_samples*d.heads;
+            const long planes_per_dest = num_planes/num_dest_planes;
+            const auto plane_of = [&](long dp, long g)
+            {
+                return d.is_matrix ? g : (dp/d.heads)*num_heads + (dp%d.heads)*d.group + g;
+            };
+
+            const float* lhs_ptr = lhs.host();
+            const float* rhs_ptr = rhs.host();
+            float* dest_ptr = (beta == 0) ? dest.host_write_only() : dest.host();
+
+#ifdef DLIB_USE_BLAS
+            // Large planes: BLAS is much faster than the kernel below and uses several
+            // threads by itself, so the planes are given to it one after the other,
+            // straight from the tensor memory.
+            if (num_planes == 1 || M*N*K >= gemm_min_blas_work)
+            {
+                using namespace blas_bindings;
+                for (long dp = 0; dp < num_dest_planes; ++dp)
+                {
+                    for (long g = 0; g < planes_per_dest; ++g)
+                    {
+                        const long p = plane_of(dp, g);
+                        cblas_gemm(CblasRowMajor, trans_lhs ? CblasTrans : CblasNoTrans,
+                            trans_rhs ? CblasTrans : CblasNoTrans, M, N, K,
+                            alpha, lhs_ptr + l.offset(p, num_heads), l.cols,
+                            rhs_ptr + r.offset(p, num_heads), r.cols,
+                            g == 0 ? beta : 1, dest_ptr + d.offset(p, num_heads), d.cols);
+                    }
+                }
+                return;
+            }
+#endif
+
+            // The kernel wants each rhs plane as a row major K x N matrix.  A transposed
+            // rhs is packed once per plane it holds, however many planes share it.
+            std::vector<float> packed;
+            const float* rhs_rows = rhs_ptr;
+            if (trans_rhs)
+            {
+                const long num_rhs_planes = r.is_matrix ? 1 : num_samples*r.heads;
+                packed.resize(num_rhs_planes*K*N);
+                parallel_for(0, num_rhs_planes, [&](long p)
+                {
+                    const float* src = rhs_ptr + p*K*N;
+                    float* dst = packed.data() + p*K*N;
+                    for (long n = 0; n < N; ++n)
+                        for (long k = 0; k < K; ++k)
+                            dst[k*N + n] = src[n*K + k];
+                });
+                rhs_rows = packed.data();
+            }
+
+            // Every task owns a block of rows of one dest plane, so the planes sharing a
+            // dest plane never write to it concurrently.
+            const long num_row_blocks = (M + gemm_row_block - 1)/gemm_row_block;
+            parallel_for(0, num_dest_planes*num_row_blocks, [&](long idx)
+            {
+                const long dp = idx/num_row_blocks;
+                const long r0 = (idx%num_row_blocks)*gemm_row_block;
+                for (long g = 0; g < planes_per_dest; ++g)
+                {
+                    const long p = plane_of(dp, g);
+                    gemm_plane_rows(g == 0 ? beta : 1, dest_ptr + d.offset(p, num_heads), alpha,
+                        lhs_ptr + l.offset(p, num_heads), l.cols, trans_lhs,
+                        rhs_rows + r.offset(p, num_heads), K, N, r0, std::min(M, r0 + gemm_row_block));
+                }
+            });
+        }
+
+    // ------------------------------------------------------------------------------------
+
+        namespace
+        {
+            // Number of query rows and key rows processed together by the attention kernels.
+            // A block of keys (and values) is reused by all the rows of a query block while
+            // it is still in cache.
+            const long sdpa_block_q = 32;
+            const long sdpa_block_k = 64;
+
+            struct sdpa_geometry
+            {
+                sdpa_geometry(
+                    const tensor& q,
+                    const tensor& k,
+                    const tensor& v,
+                    bool causal
+                ) : num_planes(q.num_samples()*q.k()), num_heads(q.k()), num_kv_heads(k.k()),
+                    group(k.k() > 0 ? q.k()/k.k() : 1), lq(q.nr()), lk(k.nr()), d(q.nc()), dv(v.nc()),
+                    // When there are more keys than queries the queries are the last rows
+                    // of the sequence, e.g. when the keys come from a KV cache.
+                    offset(k.nr() - q.nr()), causal(causal)
+                {
+                    DLIB_CASSERT(q.num_samples() == k.num_samples() && k.num_samples() == v.num_samples());
+                    DLIB_CASSERT(k.k() == v.k() && k.k() > 0 && q.k()%k.k() == 0,
+                        "The number of query heads must be a multiple of the number of key/value heads.");
+                    DLIB_CASSERT(q.nc() == k.nc());
+                    DLIB_CASSERT(k.nr() == v.nr());
+                    DLIB_CASSERT(!causal || k.nr() >= q.nr(),
+                        "A causal attention needs at least as many keys as queries.");
+                }
+
+                long padding(const std::vector<long>& padding_lengths, long plane) const
+                {
+                    const size_t sample = plane/num_heads;
+                    return sample < padding_lengths.size() ? padding_lengths[sample] : 0;
+                }
+
+                // Key/value plane shared by the group of query heads containing this plane
+                long kv_plane(long plane) const { return (plane/num_heads)*num_kv_heads + (plane%num_heads)/group; }
+
+                // Keys [begin, end) visible from query row r
+                long key_end(long r) const { return causal ? std::min(lk, r + offset + 1) : lk; }
+
+                const long num_planes, num_heads, num_kv_heads, group, lq, lk, d, dv, offset;
+                const bool causal;
+            };
+
+            // Copies rows [c0, c1) of the (rows x cols) matrix m into t as a cols x (c1-c0)
+            // matrix so that dot products against a block of rows become axpy operations.
+            inline void sdpa_transpose_block(
+                const float* m,
+                long cols,
+                long c0,
+                long c1,
+                float* t
+            )
+            {
+                const long n = c1 - c0;
+                for (long j = 0; j < n; ++j)
+                {
+                    const float* row = m + (c0 + j)*cols;
+                    for (long i = 0; i < cols; ++i)
+                        t[i*n + j] = row[i];
+                }
+            }
+
+            // s[j] = scale*dot(x, rows j of the transposed block t), for j in [0, n)
+            inline void sdpa_row_times_block(
+                const float* x,
+                const float* t,
+                long cols,
+                long n,
+                float scale,
+                float* s
+            )
+            {
+                std::fill(s, s + n, 0.0f);
+                for (long i = 0; i < cols; ++i)
+                {
+                    const float xi = x[i]*scale;
+                    const float* ti = t + i*n;
+                    for (long j = 0; j < n; ++j)
+                        s[j] += xi*ti[j];
+                }
+            }
+        }
+
+        void scaled_dot_product_attention(
+            resizable_tensor& dest,
+            resizable_tensor& lse,
+            const tensor& q,
+            const tensor& k,
+            const tensor& v,
+            float scale,
+            bool causal,
+            const std::vector<long>& padding_lengths
+        )
+        {
+            const sdpa_geometry g(q, k, v, causal);
+            dest.set_size(q.num_samples(), q.k(), g.lq, g.dv);
+            lse.set_size(q.num_samples(), q.k(), g.lq, 1);
+
+            const float* qp = q.host();
+            const float* kp = k.host();
+            const float* vp = v.host();
+            float* out = dest.host_write_only();
+            float* lsep = lse.host_write_only();
+
+            const long num_q_blocks = (g.lq + sdpa_block_q - 1)/sdpa_block_q;
+            parallel_for(0, g.num_planes*num_q_blocks, [&](long idx)
+            {
+                const long plane = idx/num_q_blocks;
+                const long r0 = (idx%num_q_blocks)*sdpa_block_q;
+                const long r1 = std::min(g.lq, r0 + sdpa_block_q);
+                const long pad = g.padding(padding_lengths, plane);
+
+                const float* qplane = qp + plane*g.lq*g.d;
+                const float* kplane = kp + g.kv_plane(plane)*g.lk*g.d;
+                const float* vplane = vp + g.kv_plane(plane)*g.lk*g.dv;
+
+                std::vector<float> kt(g.d*sdpa_block_k), s(sdpa_block_k);
+                std::vector<float> acc((r1 - r0)*g.dv, 0.0f), row_max(r1 - r0, -std::numeric_limits<float>::infinity()), row_sum(r1 - r0, 0.0f);
+
+                // Key blocks entirely above the causal diagonal of this query block are never visited.
+                const long c_end = g.key_end(r1 - 1);
+                for (long c0 = pad; c0 < c_end; c0 += sdpa_block_k)
+                {
+                    const long c1 = std::min(c_end, c0 + sdpa_block_k);
+                    const long n = c1 - c0;
+                    sdpa_transpose_block(kplane, g.d, c0, c1, kt.data());
+                    for (long r = r0; r < r1; ++r)
+                    {
+                        // Padding rows and columns are masked.  So are keys after the query.
+                        if (r + g.offset < pad)
+                            continue;
+                        const long m = std::min(c1, g.key_end(r)) - c0;
+                        if (m <= 0)
+                            continue;
+
+                        sdpa_row_times_block(qplane + r*g.d, kt.data(), g.d, n, scale, s.data());
+                        const long i = r - r0;
+                        const float block_max = *std::max_element(s.begin(), s.begin() + m);
+                        const float new_max = std::max(row_max[i], block_max);
+                        const float correction = std::exp(row_max[i] - new_max);
+                        float* a = &acc[i*g.dv];
+                        if (correction != 1)
+                        {
+                            row_sum[i] *= correction;
+                            for (long c = 0; c < g.dv; ++c)
+                                a[c] *= correction;
+                        }
+                        for (long j = 0; j < m; ++j)
+                        {
+                            const float p = std::exp(s[j] - new_max);
+                            row_sum[i] += p;
+                            const float* vrow = vplane + (c0 + j)*g.dv;
+                            for (long c = 0; c < g.dv; ++c)
+                                a[c] += p*vrow[c];
+                        }
+                        row_max[i] = new_max;
+                    }
+                }
+
+                for (long r = r0; r < r1; ++r)
+                {
+                    const long i = r - r0;
+                    float* o = out + (plane*g.lq + r)*g.dv;
+                    if (row_sum[i] > 0)
+                    {
+                        const float inv = 1.0f/row_sum[i];
+                        for (long c = 0; c < g.dv; ++c)
+                            o[c] = acc[i*g.dv + c]*inv;
+                        lsep[plane*g.lq + r] = row_max[i] + std::log(row_sum[i]);
+                    }
+                    else
+                    {
+                        // Same convention as softmax(): a fully masked row outputs zeros
+                        std::fill(o, o + g.dv, 0.0f);
+                        lsep[plane*g.lq + r] = -std::numeric_limits<float>::infinity();
+                    }
+                }
+            });
+        }
+
+        void scaled_dot_product_attention_gradient(
+            const tensor& gradient_input,
+            const tensor& dest,
+            const tensor& lse,
+            const tensor& q,
+            const tensor& k,
+            const tensor& v,
+            float scale,
+            bool causal,
+            const std::vector<long>& padding_lengths,
+            tensor& q_grad,
+            tensor& k_grad,
+            tensor& v_grad
+        )
+        {
+            const sdpa_geometry g(q, k, v, causal);
+            DLIB_CASSERT(have_same_dimensions(gradient_input, dest));
+            DLIB_CASSERT(dest.nr() == g.lq && dest.nc() == g.dv);
+            DLIB_CASSERT(lse.size() == static_cast<size_t>(g.num_planes*g.lq));
+            DLIB_CASSERT(have_same_dimensions(q, q_grad));
+            DLIB_CASSERT(have_same_dimensions(k, k_grad));
+            DLIB_CASSERT(have_same_dimensions(v, v_grad));
+
+            const float* gi = gradient_input.host();
+            const float* op = dest.host();
+            const float* lsep = lse.host();
+            const float* qp = q.host();
+            const float* kp = k.host();
+            const float* vp = v.host();
+            float* dq = q_grad.host();
+            float* dk = k_grad.host();
+            float* dv = v_grad.host();
+
+            // The key and value gradients of a plane receive contributions from every query
+            // row of every query head sharing it, so the key/value planes are the unit of work.
+            const long num_kv_planes = g.num_planes/g.group;
+            parallel_for(0, num_kv_planes, [&](long kv)
+            {
+                const float* kplane = kp + kv*g.lk*g.d;
+                const float* vplane = vp + kv*g.lk*g.dv;
+                float* dkplane = dk + kv*g.lk*g.d;
+                float* dvplane = dv + kv*g.lk*g.dv;
+                std::vector<float> delta(g.lq);
+                std::vector<float> kt(g.d*sdpa_block_k), vt(g.dv*sdpa_block_k);
+                std::vector<float> s(sdpa_block_k), dp(sdpa_block_k);
+
+                // The query heads sharing this key/value plane
+                const long first_plane = (kv/g.num_kv_heads)*g.num_heads + (kv%g.num_kv_heads)*g.group;
+                for (long plane = first_plane; plane < first_plane + g.group; ++plane)
+                {
+                    const long pad = g.padding(padding_lengths, plane);
+                    const float* qplane = qp + plane*g.lq*g.d;
+                    const float* giplane = gi + plane*g.lq*g.dv;
+                    const float* oplane = op + plane*g.lq*g.dv;
+                    const float* lseplane = lsep + plane*g.lq;
+                    float* dqplane = dq + plane*g.lq*g.d;
+
+                    // delta[r] = dot(gradient_input[r], dest[r]), the softmax gradient correction
+                    for (long r = 0; r < g.lq; ++r)
+                    {
+                        float sum = 0;
+                        for (long c = 0; c < g.dv; ++c)
+                            sum += giplane[r*g.dv + c]*oplane[r*g.dv + c];
+                        delta[r] = sum;
+                    }
+
+                    for (long r0 = 0; r0 < g.lq; r0 += sdpa_block_q)
+                    {
+                        const long r1 = std::min(g.lq, r0 + sdpa_block_q);
+                        const long c_end = g.key_end(r1 - 1);
+                        for (long c0 = pad; c0 < c_end; c0 += sdpa_block_k)
+                        {
+                            const long c1 = std::min(c_end, c0 + sdpa_block_k);
+                            const long n = c1 - c0;
+                            sdpa_transpose_block(kplane, g.d, c0, c1, kt.data());
+                            sdpa_transpose_block(vplane, g.dv, c0, c1, vt.data());
+                            for (long r = r0; r < r1; ++r)
+                            {
+                                if (r + g.offset < pad)
+                                    continue;
+                                const long m = std::min(c1, g.key_end(r)) - c0;
+                                if (m <= 0)
+                                    continue;
+
+                                // Recompute the probabilities from the saved log-sum-exp
+                                sdpa_row_times_block(qplane + r*g.d, kt.data(), g.d, n, scale, s.data());
+                                sdpa_row_times_block(giplane + r*g.dv, vt.data(), g.dv, n, 1, dp.data());
+                                const float* gir = giplane + r*g.dv;
+                                const float* qr = qplane + r*g.d;
+                                float* dqr = dqplane + r*g.d;
+                                for (long j = 0; j < m; ++j)
+                                {
+                                    const float p = std::exp(s[j] - lseplane[r]);
+                                    const float ds = p*(dp[j] - delta[r])*scale;
+                                    float* dvj = dvplane + (c0 + j)*g.dv;
+                                    for (long c = 0; c < g.dv; ++c)
+                                        dvj[c] += p*gir[c];
+                                    const float* kj = kplane + (c0 + j)*g.d;
+                                    float* dkj = dkplane + (c0 + j)*g.d;
+                                    for (long c = 0; c < g.d; ++c)
+                                    {
+                                        dqr[c] += ds*kj[c];
+                                        dkj[c] += ds*qr[c];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
     // ------------------------------------------------------------------------------------
     
     } 
@@ -7,6 +7,8 @@
 // and cudnn_dlibapi.h
 
 #include "tensor.h"
+#include "quantized_matrix.h"
+#include "bfloat16.h"
 #include "../geometry/rectangle.h"
 #include "../dnn/utilities.h"
 
@@ -536,6 +538,44 @@ namespace dlib
             bool scale
         );
 
+    // -----------------------------------------------------------------------------------
+
+        void quantized_gemm (
+            tensor& dest,
+            const tensor& lhs,
+            const quantized_matrix& rhs
+        );
+
+        void quantized_embeddings (
+            resizable_tensor& dest,
+            const tensor& src,
+            const quantized_matrix& embs,
+            float scale
+        );
+
+        void float_to_bfloat16 (
+            bfloat16_tensor& dest,
+            const tensor& src
+        );
+
+        void bfloat16_to_float (
+            resizable_tensor& dest,
+            const bfloat16_tensor& src
+        );
+
+        void normalize_linear_output (
+            tensor& dest,
+            bool add_to,
+            const tensor& xw,
+            const tensor& src,
+            double eps,
+            bool subtract_mean,
+            const tensor& gamma,
+            const tensor& beta,
+            const tensor& weight_sums,
+            const tensor& biases
+        );
+
     // -----------------------------------------------------------------------------------
 
         void compute_act_halt_probabilities(
@@ -593,6 +633,46 @@ namespace dlib
             const resizable_tensor& sin_cache
         );
 
+    // -----------------------------------------------------------------------------------
+
+        void gemm_plane_wise (
+            float beta,
+            tensor& dest,
+            float alpha,
+            const tensor& lhs,
+            bool trans_lhs,
+            const tensor& rhs,
+            bool trans_rhs
+        );
+
+    // -----------------------------------------------------------------------------------
+
+        void scaled_dot_product_attention(
+            resizable_tensor& dest,
+            resizable_tensor& lse,
+            const tensor& q,
+            const tensor& k,
+            const tensor& v,
+            float scale,
+            bool causal,
+            const std::vector<long>& padding_lengths
+        );
+
+        void scaled_dot_product_attention_gradient(
+            const tensor& gradient_input,
+            const tensor& dest,
+            const tensor& lse,
+            const tensor& q,
+            const tensor& k,
+            const tensor& v,
+            float scale,
+            bool causal,
+            const std::vector<long>& padding_lengths,
+            tensor& q_grad,
+            tensor& k_grad,
+            tensor& v_grad
+        );
+
     // -----------------------------------------------------------------------------------
 
         class pooling
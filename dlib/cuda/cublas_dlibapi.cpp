@@ -10,6 +10,7 @@
 
 #include <cublas_v2.h>
 #include <vector>
+#include <limits>
 
 static const char* cublas_get_error_string(cublasStatus_t s)
 {
@@ -167,13 +168,33 @@ namespace dlib
                 const size_t rhs_plane_size = rhs.nr() * rhs.nc();
                 const size_t dest_plane_size = dest.nr() * dest.nc();
 
-                long num_samples, num_channels = std::min({ lhs.k(), rhs.k(), dest.k() });
-                if (lhs_is_matrix && rhs_is_matrix && dest_is_matrix)
+                // The planes are counted on the operands that aren't shared 2D matrices.  An
+                // operand with fewer channels than the others has each of its channels shared
+                // by a group of consecutive channels (e.g. grouped-query attention).
+                long num_samples = std::numeric_limits<long>::max();
+                long num_heads = 1;
+                const tensor* operands[] = { &lhs, &rhs, &dest };
+                for (const tensor* t : operands)
+                {
+                    if (!is_2d_matrix(*t))
+                    {
+                        num_samples = std::min<long>(num_samples, t->num_samples());
+                        num_heads = std::max<long>(num_heads, t->k());
+                    }
+                }
+                if (num_samples == std::numeric_limits<long>::max())
                     num_samples = 1;
-                else if (!lhs_is_matrix && rhs_is_matrix)
-                    num_samples = lhs.num_samples();
-                else
-                    num_samples = std::min({ lhs.num_samples(), rhs.num_samples(), dest.num_samples() });
+                for (const tensor* t : operands)
+                {
+                    DLIB_CASSERT(is_2d_matrix(*t) || num_heads % t->k() == 0,
+                        "The channels of a PLANE_WISE gemm() operand must evenly divide those of the others.");
+                }
+                const long num_planes = num_samples * num_heads;
+                const auto plane_offset = [&](const tensor& t, bool is_matrix, size_t plane_size, long p) -> size_t
+                {
+                    return is_matrix ? 0 :
+                        ((p / num_heads) * t.k() + (p % num_heads) / (num_heads / t.k())) * plane_size;
+                };
 
                 size_t lhs_rows = lhs.nr();
                 size_t lhs_cols = lhs.nc();
@@ -196,18 +217,22 @@ namespace dlib
                     dest_cols = dest.k();
                 }
 
-                for (long b = 0; b < num_samples; ++b)
+                // Planes writing to the same dest plane are summed into it one after the
+                // other, only the first one scaling the previous content by beta.
+                const long num_dest_planes = dest_is_matrix ? 1 : num_samples * dest.k();
+                const long planes_per_dest = num_planes / num_dest_planes;
+                const int k = trans_rhs ? rhs_cols : rhs_rows;
+                const float one = 1;
+
+                for (long dp = 0; dp < num_dest_planes; ++dp)
                 {
-                    for (long c = 0; c < num_channels; ++c)
+                    for (long g = 0; g < planes_per_dest; ++g)
                     {
-                        auto lhs_slice = lhs_is_matrix ? lhs.device() :
-                            lhs.device() + (b * num_channels + c) * lhs_plane_size;
-                        auto rhs_slice = rhs_is_matrix ? rhs.device() :
-                            rhs.device() + (b * num_channels + c) * rhs_plane_size;
-                        auto dest_slice = dest_is_matrix ? dest.device() :
-                            dest.device() + (b * num_channels + c) * dest_plane_size;
-
-                        const int k = trans_rhs ? rhs_cols : rhs_rows;
+                        const long p = dest_is_matrix ? g :
+                            (dp / dest.k()) * num_heads + (dp % dest.k()) * planes_per_dest + g;
+                        auto lhs_slice = lhs.device() + plane_offset(lhs, lhs_is_matrix, lhs_plane_size, p);
+                        auto rhs_slice = rhs.device() + plane_offset(rhs, rhs_is_matrix, rhs_plane_size, p);
+                        auto dest_slice = dest.device() + plane_offset(dest, dest_is_matrix, dest_plane_size, p);
 
                         CHECK_CUBLAS(cublasSgemm(
                             context(),
@@ -216,7 +241,7 @@ namespace dlib
                             &alpha,
                             rhs_slice, rhs_cols,
                             lhs_slice, lhs_cols,
-                            &beta,
+                            g == 0 ? &beta : &one,
                             dest_slice, dest_cols
                         ));
                     }
@@ -0,0 +1,206 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#ifndef DLIB_DNN_QUANTIZED_MATRIX_H_
+#define DLIB_DNN_QUANTIZED_MATRIX_H_
+
+#include "quantized_matrix_abstract.h"
+#include "tensor.h"
+#include "bfloat16.h"
+#include "../serialize.h"
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    class quantized_matrix
+    {
+    public:
+
+        // Number of values sharing a 16 byte group in the 4 bit layout
+        static constexpr long int4_block_size = 32;
+
+        quantized_matrix(
+        ) : rows(0), cols(0), nbits(0), stride(0) {}
+
+        long nr() const { return rows; }
+        long nc() const { return cols; }
+        int bits() const { return nbits; }
+        bool empty() const { return rows == 0; }
+        size_t row_stride() const { return stride; }
+        size_t size_in_bytes() const { return data.size() + scales.size()*sizeof(float); }
+
+        const unsigned char* row(long r) const { return data.data() + r*stride; }
+        float scale(long r) const { return scales[r]; }
+
+        void clear()
+        {
+            rows = 0;
+            cols = 0;
+            nbits = 0;
+            stride = 0;
+            data.clear();
+            scales.clear();
+        }
+
+        void quantize(
+            const tensor& m,
+            bool trans,
+            int bits
+        )
+        {
+            DLIB_CASSERT(bits == 8 || bits == 4 || bits == 16, "bits: " << bits);
+            DLIB_CASSERT(m.size() != 0);
+
+            const long mr = m.num_samples();
+            const long mc = m.size()/m.num_samples();
+            rows = trans ? mc : mr;
+            cols = trans ? mr : mc;
+            nbits = bits;
+            stride = row_bytes(nbits, cols);
+            data.assign(rows*stride, nbits == 4 ? 0x88 : 0);
+            scales.assign(rows, 0);
+
+            const float* src = m.host();
+            if (nbits == 16)
+            {
+                // bfloat16 values have their own exponent and need no scale
+                for (long r = 0; r < rows; ++r)
+                {
+                    scales[r] = 1;
+                    bfloat16* dest = reinterpret_cast<bfloat16*>(data.data() + r*stride);
+                    for (long c = 0; c < cols; ++c)
+                        dest[c] = bfloat16(trans ? src[c*mc + r] : src[r*mc + c]);
+                }
+                return;
+            }
+
+            const float qmax = nbits == 8 ? 127 : 7;
+            std::vector<float> values(cols);
+            for (long r = 0; r < rows; ++r)
+            {
+                float amax = 0;
+                for (long c = 0; c < cols; ++c)
+                {
+                    values[c] = trans ? src[c*mc + r] : src[r*mc + c];
+                    amax = std::max(amax, std::abs(values[c]));
+                }
+                if (amax == 0)
+                    continue;
+
+                scales[r] = amax/qmax;
+                unsigned char* dest = data.data() + r*stride;
+                for (long c = 0; c < cols; ++c)
+                {
+                    const int q = static_cast<int>(std::max(-qmax, std::min(qmax, std::round(values[c]/scales[r]))));
+                    if (nbits == 8)
+                    {
+                        dest[c] = static_cast<unsigned char>(static_cast<int8_t>(q));
+                    }
+                    else
+                    {
+                        // Inside a block, byte j holds value j in its low nibble and value
+                        // j+16 in its high nibble, both offset by 8.
+                        const long block = c/int4_block_size, j = c%int4_block_size;
+                        unsigned char& b = dest[block*(int4_block_size/2) + j%(int4_block_size/2)];
+                        if (j < int4_block_size/2)
+                            b = (b & 0xF0) | static_cast<unsigned char>(q + 8);
+                        else
+                            b = (b & 0x0F) | static_cast<unsigned char>((q + 8) << 4);
+                    }
+                }
+            }
+        }
+
+        float value(long r, long c) const
+        {
+            const unsigned char* q = row(r);
+            if (nbits == 16)
+                return static_cast<float>(reinterpret_cast<const bfloat16*>(q)[c]);
+            if (nbits == 8)
+                return scales[r]*static_cast<int8_t>(q[c]);
+
+            const long j = c%int4_block_size;
+            const unsigned char b = q[c/int4_block_size*(int4_block_size/2) + j%(int4_block_size/2)];
+            return scales[r]*(static_cast<int>(j < int4_block_size/2 ? b & 0x0F : b >> 4) - 8);
+        }
+
+        void dequantize_row(
+            long r,
+            float* dest,
+            float scale = 1
+        ) const
+        {
+            for (long c = 0; c < cols; ++c)
+                dest[c] = scale*value(r, c);
+        }
+
+        void dequantize(
+            resizable_tensor& dest
+        ) const
+        {
+            dest.set_size(rows, cols);
+            float* d = dest.host_write_only();
+            for (long r = 0; r < rows; ++r)
+                dequantize_row(r, d + r*cols);
+        }
+
+        friend void serialize(const quantized_matrix& item, std::ostream& out)
+        {
+            serialize("quantized_matrix", out);
+            serialize(item.rows, out);
+            serialize(item.cols, out);
+            serialize(item.nbits, out);
+            serialize(item.data, out);
+            serialize(item.scales, out);
+        }
+
+        friend void deserialize(quantized_matrix& item, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "quantized_matrix")
+                throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::quantized_matrix.");
+            deserialize(item.rows, in);
+            deserialize(item.cols, in);
+            deserialize(item.nbits, in);
+            deserialize(item.data, in);
+            deserialize(item.scales, in);
+            if (item.rows == 0)
+            {
+                item.stride = 0;
+                return;
+            }
+            if (item.nbits != 8 && item.nbits != 4 && item.nbits != 16)
+                throw serialization_error("Invalid number of bits found while deserializing dlib::quantized_matrix.");
+            item.stride = row_bytes(item.nbits, item.cols);
+            if (item.data.size() != item.rows*item.stride || item.scales.size() != (size_t)item.rows)
+                throw serialization_error("Corrupt data found while deserializing dlib::quantized_matrix.");
+        }
+
+    private:
+
+        static size_t row_bytes(int nbits, long cols)
+        {
+            if (nbits == 4)
+                return (cols + int4_block_size - 1)/int4_block_size*(int4_block_size/2);
+            return cols*(nbits/8);
+        }
+
+        long rows;
+        long cols;
+        int nbits;
+        size_t stride;
+        std::vector<unsigned char> data;
+        std::vector<float> scales;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_QUANTIZED_MATRIX_H_
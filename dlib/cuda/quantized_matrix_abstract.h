@@ -0,0 +1,199 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#undef DLIB_DNN_QUANTIZED_MATRIX_ABSTRACT_H_
+#ifdef DLIB_DNN_QUANTIZED_MATRIX_ABSTRACT_H_
+
+#include "tensor_abstract.h"
+#include "bfloat16_abstract.h"
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    class quantized_matrix
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object is a read-only nr() x nc() matrix of floats stored with 8 or 4
+                bits per value.  Each row r has its own scale and value(r,c) is the signed
+                integer stored for element (r,c) times scale(r).  The scale of a row is
+                chosen so that its largest magnitude maps to 127 (8 bits) or 7 (4 bits).
+                With 16 bits the values are stored as bfloat16 and every scale is 1.
+
+                It is the weight storage used by the quantized inference path of the fc_,
+                linear_ and embeddings_ layers.  The rows are the output channels of fc_
+                and linear_ and the embedding vectors of embeddings_, so every output
+                channel gets its own scale.
+
+            STORAGE LAYOUT
+                Row r occupies row_stride() bytes starting at row(r).
+                - 16 bits: bytes 2c and 2c+1 are the bfloat16 of element c, in the
+                  byte order of the machine.
+                - 8 bits: byte c is the two's complement value of element c.
+                - 4 bits: the row is split in blocks of int4_block_size == 32 values
+                  stored in 16 bytes.  Byte j of a block holds value j of the block in its
+                  low nibble and value j+16 in its high nibble, both offset by 8.  The last
+                  block is padded with zeros.
+                This layout lets SIMD kernels expand a whole block with a few shifts and
+                masks, and it does not depend on the instruction set used to read it.
+
+            THREAD SAFETY
+                The const member functions may be called concurrently.
+        !*/
+
+    public:
+
+        static constexpr long int4_block_size = 32;
+
+        quantized_matrix(
+        );
+        /*!
+            ensures
+                - #empty() == true
+                - #nr() == 0
+                - #nc() == 0
+                - #bits() == 0
+        !*/
+
+        void quantize(
+            const tensor& m,
+            bool trans,
+            int bits
+        );
+        /*!
+            requires
+                - bits == 8 || bits == 4 || bits == 16
+                - m.size() != 0
+            ensures
+                - Let M be mat(m) if trans == false, trans(mat(m)) otherwise, where m is
+                  viewed as a m.num_samples() x m.size()/m.num_samples() matrix.
+                - #nr() == M.nr()
+                - #nc() == M.nc()
+                - #bits() == bits
+                - for all valid r and c: #value(r,c) is the closest representable value
+                  to M(r,c).  In particular, |#value(r,c) - M(r,c)| <= #scale(r)/2 when
+                  bits is 8 or 4, and #value(r,c) == float(bfloat16(M(r,c))) when bits
+                  is 16.
+                - Rows of zeros are stored exactly, with a zero scale (8 and 4 bits).
+        !*/
+
+        long nr(
+        ) const;
+        /*!
+            ensures
+                - returns the number of rows of this matrix.
+        !*/
+
+        long nc(
+        ) const;
+        /*!
+            ensures
+                - returns the number of columns of this matrix.
+        !*/
+
+        int bits(
+        ) const;
+        /*!
+            ensures
+                - returns the number of bits used by each value (8, 4 or 16), or 0 if
+                  empty().
+        !*/
+
+        bool empty(
+        ) const;
+        /*!
+            ensures
+                - returns nr() == 0
+        !*/
+
+        void clear(
+        );
+        /*!
+            ensures
+                - #empty() == true
+        !*/
+
+        size_t row_stride(
+        ) const;
+        /*!
+            ensures
+                - returns the number of bytes used by each row (see STORAGE LAYOUT).
+        !*/
+
+        size_t size_in_bytes(
+        ) const;
+        /*!
+            ensures
+                - returns the number of bytes used by the quantized values and the scales.
+                  This is about 1/4 (8 bits), 1/8 (4 bits) or 1/2 (16 bits) of the size of
+                  the float matrix.
+        !*/
+
+        const unsigned char* row(
+            long r
+        ) const;
+        /*!
+            requires
+                - 0 <= r < nr()
+            ensures
+                - returns a pointer to the row_stride() bytes of row r.
+        !*/
+
+        float scale(
+            long r
+        ) const;
+        /*!
+            requires
+                - 0 <= r < nr()
+            ensures
+                - returns the scale of row r.
+        !*/
+
+        float value(
+            long r,
+            long c
+        ) const;
+        /*!
+            requires
+                - 0 <= r < nr()
+                - 0 <= c < nc()
+            ensures
+                - returns the dequantized value of element (r,c).
+        !*/
+
+        void dequantize_row(
+            long r,
+            float* dest,
+            float scale = 1
+        ) const;
+        /*!
+            requires
+                - 0 <= r < nr()
+                - dest points to nc() floats
+            ensures
+                - for all valid c: #dest[c] == scale*value(r,c)
+        !*/
+
+        void dequantize(
+            resizable_tensor& dest
+        ) const;
+        /*!
+            ensures
+                - #dest.num_samples() == nr()
+                - #dest.k() == nc()
+                - for all valid r and c: #dest.host()[r*nc()+c] == value(r,c)
+        !*/
+    };
+
+    void serialize(const quantized_matrix& item, std::ostream& out);
+    void deserialize(quantized_matrix& item, std::istream& in);
+    /*!
+        provides serialization support
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_QUANTIZED_MATRIX_ABSTRACT_H_
@@ -242,80 +242,7 @@ namespace dlib { namespace tt
         }
         else if (mode == operation_mode::PLANE_WISE)
         {
-            const bool lhs_is_matrix = is_2d_matrix(lhs);
-            const bool rhs_is_matrix = is_2d_matrix(rhs);
-            const bool dest_is_matrix = is_2d_matrix(dest);
-
-            const size_t lhs_plane_size = lhs.nr() * lhs.nc();
-            const size_t rhs_plane_size = rhs.nr() * rhs.nc();
-            const size_t dest_plane_size = dest.nr() * dest.nc();
-
-            long num_samples, num_channels = std::min({ lhs.k(), rhs.k(), dest.k() });
-            if (lhs_is_matrix && rhs_is_matrix && dest_is_matrix)
-                num_samples = 1;
-            else if (!lhs_is_matrix && rhs_is_matrix)
-                num_samples = lhs.num_samples();
-            else
-                num_samples = std::min({ lhs.num_samples(), rhs.num_samples(), dest.num_samples() });
-
-            size_t lhs_rows = lhs.nr();
-            size_t lhs_cols = lhs.nc();
-            if (lhs_is_matrix && (lhs.num_samples() > 1 || lhs.k() > 1)) {
-                lhs_rows = lhs.num_samples();
-                lhs_cols = lhs.k();
-            }
-            size_t rhs_rows = rhs.nr();
-            size_t rhs_cols = rhs.nc();
-            if (rhs_is_matrix && (rhs.num_samples() > 1 || rhs.k() > 1)) {
-                rhs_rows = rhs.num_samples();
-                rhs_cols = rhs.k();
-            }
-            size_t dest_rows = dest.nr();
-            size_t dest_cols = dest.nc();
-            if (dest_is_matrix && (dest.num_samples() > 1 || dest.k() > 1)) {
-                dest_rows = dest.num_samples();
-                dest_cols = dest.k();
-            }
-
-            // Process each plane
-            for (long b = 0; b < num_samples; ++b)
-            {
-                for (long c = 0; c < num_channels; ++c)
-                {
-                    auto lhs_slice = lhs_is_matrix ?
-                        alias_tensor(lhs_rows, lhs_cols)(lhs, 0) :
-                        alias_tensor(lhs_rows, lhs_cols)(lhs, (b * num_channels + c) * lhs_plane_size);
-                    auto rhs_slice = rhs_is_matrix ?
-                        alias_tensor(rhs_rows, rhs_cols)(rhs, 0) :
-                        alias_tensor(rhs_rows, rhs_cols)(rhs, (b * num_channels + c) * rhs_plane_size);
-                    auto dest_slice = dest_is_matrix ?
-                        alias_tensor(dest_rows, dest_cols)(dest, 0) :
-                        alias_tensor(dest_rows, dest_cols)(dest, (b * num_channels + c) * dest_plane_size);
-
-                    if (beta != 0)
-                    {
-                        if (trans_lhs && trans_rhs)
-                            dest_slice = alpha * trans(mat(lhs_slice)) * trans(mat(rhs_slice)) + beta * mat(dest_slice);
-                        else if (!trans_lhs && trans_rhs)
-                            dest_slice = alpha * mat(lhs_slice) * trans(mat(rhs_slice)) + beta * mat(dest_slice);
-                        else if (trans_lhs && !trans_rhs)
-                            dest_slice = alpha * trans(mat(lhs_slice)) * mat(rhs_slice) + beta * mat(dest_slice);
-                        else
-                            dest_slice = alpha * mat(lhs_slice) * mat(rhs_slice) + beta * mat(dest_slice);
-                    }
-                    else
-                    {
-                        if (trans_lhs && trans_rhs)
-                            dest_slice = alpha * trans(mat(lhs_slice)) * trans(mat(rhs_slice));
-                        else if (!trans_lhs && trans_rhs)
-                            dest_slice = alpha * mat(lhs_slice) * trans(mat(rhs_slice));
-                        else if (trans_lhs && !trans_rhs)
-                            dest_slice = alpha * trans(mat(lhs_slice)) * mat(rhs_slice);
-                        else
-                            dest_slice = alpha * mat(lhs_slice) * mat(rhs_slice);
-                    }
-                }
-            }
+            cpu::gemm_plane_wise(beta, dest, alpha, lhs, trans_lhs, rhs, trans_rhs);
         }
 #endif
     }
@@ -1427,6 +1354,59 @@ namespace dlib { namespace tt
 #endif
     }
 
+// ----------------------------------------------------------------------------------------
+
+    void quantized_gemm (
+        tensor& dest,
+        const tensor& lhs,
+        const quantized_matrix& rhs
+    )
+    {
+        cpu::quantized_gemm(dest, lhs, rhs);
+    }
+
+    void quantized_embeddings (
+        resizable_tensor& dest,
+        const tensor& src,
+        const quantized_matrix& embs,
+        float scale
+    )
+    {
+        cpu::quantized_embeddings(dest, src, embs, scale);
+    }
+
+    void float_to_bfloat16 (
+        bfloat16_tensor& dest,
+        const tensor& src
+    )
+    {
+        cpu::float_to_bfloat16(dest, src);
+    }
+
+    void bfloat16_to_float (
+        resizable_tensor& dest,
+        const bfloat16_tensor& src
+    )
+    {
+        cpu::bfloat16_to_float(dest, src);
+    }
+
+    void normalize_linear_output (
+        tensor& dest,
+        bool add_to,
+        const tensor& xw,
+        const tensor& src,
+        double eps,
+        bool subtract_mean,
+        const tensor& gamma,
+        const tensor& beta,
+        const tensor& weight_sums,
+        const tensor& biases
+    )
+    {
+        cpu::normalize_linear_output(dest, add_to, xw, src, eps, subtract_mean, gamma, beta, weight_sums, biases);
+    }
+
 // ----------------------------------------------------------------------------------------
 
     void compute_act_halt_probabilities(
@@ -1527,6 +1507,44 @@ namespace dlib { namespace tt
 #endif
     }
 
+// ----------------------------------------------------------------------------------------
+
+    // There is no CUDA version of these kernels yet, so the CPU version is used in both
+    // builds.
+
+    void scaled_dot_product_attention(
+        resizable_tensor& dest,
+        resizable_tensor& lse,
+        const tensor& q,
+        const tensor& k,
+        const tensor& v,
+        float scale,
+        bool causal,
+        const std::vector<long>& padding_lengths
+    )
+    {
+        cpu::scaled_dot_product_attention(dest, lse, q, k, v, scale, causal, padding_lengths);
+    }
+
+    void scaled_dot_product_attention_gradient(
+        const tensor& gradient_input,
+        const tensor& dest,
+        const tensor& lse,
+        const tensor& q,
+        const tensor& k,
+        const tensor& v,
+        float scale,
+        bool causal,
+        const std::vector<long>& padding_lengths,
+        tensor& q_grad,
+        tensor& k_grad,
+        tensor& v_grad
+    )
+    {
+        cpu::scaled_dot_product_attention_gradient(gradient_input, dest, lse, q, k, v, scale,
+            causal, padding_lengths, q_grad, k_grad, v_grad);
+    }
+
 // ----------------------------------------------------------------------------------------
 
 }}
@@ -183,7 +183,9 @@ namespace dlib { namespace tt
                     - L.nc() == R.nr()
 
                 For PLANE_WISE mode:
-                    - lhs.num_samples() == rhs.num_samples() && lhs.k() == rhs.k()
+                    - lhs.num_samples() == rhs.num_samples()
+                    - Let C be the largest k() of the operands that aren't 2D matrices.  Then
+                      the k() of each of these operands evenly divides C.
                     - If !trans_lhs && !trans_rhs:
                         lhs.nc() == rhs.nr()
                         dest.nr() == lhs.nr() && dest.nc() == rhs.nc()
@@ -211,6 +213,19 @@ namespace dlib { namespace tt
                         and channel:
                             dest[s][k] = alpha * (lhs[s][k] * rhs[s][k]) + beta * dest[s][k]
                             where [s][k] represents the 2D plane for sample s and channel k.
+                    - An operand for which is_2d_matrix() is true is used as is for every
+                      plane.  The number of planes is given by the other operands.
+                    - The channels of an operand may be fewer than those of the others as long
+                      as they evenly divide them.  Each channel of such an operand is then
+                      shared by a group of consecutive channels, without being copied, which is
+                      how grouped-query attention shares one key/value head between several
+                      query heads.  When dest is shared, by being a 2D matrix or by having
+                      fewer channels, the products of all the planes sharing a dest plane are
+                      added together:
+                        dest[s][k] = alpha * sum of (lhs * rhs) over these planes + beta * dest[s][k]
+                    - On the CPU, the planes are spread over the threads of the default thread
+                      pool.  When dlib is linked with BLAS, planes big enough to benefit from
+                      it are instead handed to BLAS one at a time.
             
                 Note that the PLANE_WISE mode is particularly useful for operations like attention
                 mechanisms in neural networks, where you want to perform matrix multiplications
@@ -2167,6 +2182,128 @@ namespace dlib { namespace tt
             - The function is thread-safe and processes samples in parallel.
     */
 
+// ----------------------------------------------------------------------------------------
+
+    void quantized_gemm (
+        tensor& dest,
+        const tensor& lhs,
+        const quantized_matrix& rhs
+    );
+    /*!
+        requires
+            - !rhs.empty()
+            - lhs.num_samples() > 0
+            - lhs.size() == lhs.num_samples()*rhs.nc()
+            - dest.num_samples() == lhs.num_samples()
+            - dest.size() == dest.num_samples()*rhs.nr()
+        ensures
+            - Let L be lhs viewed as a lhs.num_samples() x rhs.nc() matrix and W the
+              dequantized rhs.  This function performs:
+                - #dest = L*trans(W)
+              with dest viewed as a dest.num_samples() x rhs.nr() matrix.
+            - The weights are expanded on the fly inside the dot products (using AVX2 or
+              AVX-512 when dlib is compiled for them), so a product with few rows, like
+              the one computed for each generated token, reads 2 (16 bits), 4 (8 bits)
+              or 8 (4 bits) times less memory than the float gemm().  The products are
+              accumulated in float.  Larger products are computed with gemm() on a float
+              copy of the weights.
+            - This function always runs on the CPU, even when DLIB_USE_CUDA is defined.
+    !*/
+
+    void quantized_embeddings (
+        resizable_tensor& dest,
+        const tensor& src,
+        const quantized_matrix& embs,
+        float scale
+    );
+    /*!
+        requires
+            - src.nr() > 0
+            - !embs.empty()
+            - dest.num_samples() == src.num_samples()
+            - dest.k() == src.k()
+            - dest.nr() == src.nr()
+            - dest.nc() == embs.nc()
+        ensures
+            - Performs the same projection as embeddings() with the embedding vectors
+              being the rows of embs, multiplied by scale:
+                - Let token_idx = static_cast<unsigned long>(src(s,k,r,0))
+                - If token_idx < embs.nr():
+                    - #dest(s,k,r,c) = scale*embs.value(token_idx, c)
+                - Else:
+                    - #dest(s,k,r,c) = 0
+            - This function always runs on the CPU, even when DLIB_USE_CUDA is defined.
+    !*/
+
+    void float_to_bfloat16 (
+        bfloat16_tensor& dest,
+        const tensor& src
+    );
+    /*!
+        ensures
+            - #dest has the dimensions of src.
+            - for all valid i: #dest.data()[i] == bfloat16(src.host()[i]), except that
+              denormal values may be flushed to zero.
+            - Uses the AVX-512 BF16 conversion instruction, or AVX2, when dlib is compiled
+              for them.  Large tensors are converted by several threads.
+            - This function always runs on the CPU, even when DLIB_USE_CUDA is defined.
+    !*/
+
+    void bfloat16_to_float (
+        resizable_tensor& dest,
+        const bfloat16_tensor& src
+    );
+    /*!
+        ensures
+            - #dest has the dimensions of src.
+            - for all valid i: #dest.host()[i] == float(src.data()[i])
+            - This function always runs on the CPU, even when DLIB_USE_CUDA is defined.
+    !*/
+
+    void normalize_linear_output (
+        tensor& dest,
+        bool add_to,
+        const tensor& xw,
+        const tensor& src,
+        double eps,
+        bool subtract_mean,
+        const tensor& gamma,
+        const tensor& beta,
+        const tensor& weight_sums,
+        const tensor& biases
+    );
+    /*!
+        requires
+            - Let R == src.num_samples()*src.k()*src.nr() and N == weight_sums.size()
+            - R > 0
+            - eps > 0
+            - xw.size() == R*N
+            - have_same_dimensions(dest, xw)
+            - gamma.size() == src.k()
+            - beta.size() == gamma.size() || beta.size() == 0
+            - biases.size() == N || biases.size() == 0
+            - dest and xw may be the same tensor when add_to == false.
+        ensures
+            - This function is the second half of a linear transform applied to the output
+              of layer_normalize() or rms_normalize(), without ever computing that output.
+              Let X be src viewed as a R x src.nc() matrix and W a src.nc() x N matrix
+              whose column sums are weight_sums.  xw must hold X*W (viewed as a R x N
+              matrix), and then:
+                - Each sample of src is normalized with its own statistics, computed over
+                  all its values: m is their mean if subtract_mean == true and 0 otherwise,
+                  and s == 1/sqrt(mean((x-m)^2) + eps).
+                - Let Y be the normalized src, i.e. Y(r,c) == (X(r,c)-m)*s*gamma[k] + beta[k]
+                  where k is the channel of row r, and beta is taken as 0 if empty.
+                - Let V == Y*W + B, with B the biases (0 if empty) added to every row.
+                - if (add_to) then
+                    - #dest == dest + V
+                - else
+                    - #dest == V
+            - With subtract_mean == true this is the normalization of layer_normalize(),
+              and with subtract_mean == false the one of rms_normalize().
+            - This function always runs on the CPU, even when DLIB_USE_CUDA is defined.
+    !*/
+
 // ----------------------------------------------------------------------------------------
 
     class multi_device_tensor_averager
@@ -2549,6 +2686,84 @@ namespace dlib { namespace tt
                     data[pos,i+1] = -data[pos,i] * sin_cache[pos,i/2] + data[pos,i+1] * cos_cache[pos,i/2]
         !*/
 
+// ----------------------------------------------------------------------------------------
+
+    void scaled_dot_product_attention(
+        resizable_tensor& dest,
+        resizable_tensor& lse,
+        const tensor& q,
+        const tensor& k,
+        const tensor& v,
+        float scale,
+        bool causal,
+        const std::vector<long>& padding_lengths = std::vector<long>()
+    );
+    /*!
+        requires
+            - q.num_samples() == k.num_samples() == v.num_samples()
+            - k.k() == v.k()
+            - q.k() is a multiple of k.k()
+            - q.nc() == k.nc()
+            - k.nr() == v.nr()
+            - if (causal) then k.nr() >= q.nr()
+        ensures
+            - Computes attention for every (sample, head) plane of q, k and v, i.e. for
+              each plane:
+                #dest = softmax(scale*q*trans(k) + mask)*v
+              where the softmax is taken over each row and mask is 0 for visible keys and
+              -infinity for masked ones.  Query row r is at position r + k.nr() - q.nr() of
+              the key sequence (the queries are the last rows of the sequence), and key c
+              is masked if:
+                - causal == true and c is after the position of row r, or
+                - c < padding_lengths[n], where n is the sample index.
+              Query rows positioned inside the padding see no keys.  As with softmax(),
+              the output for a row without any visible key is 0.
+            - When k has fewer heads than q (grouped-query or multi-query attention), key
+              and value head h is used by the q.k()/k.k() consecutive query heads starting
+              at h*q.k()/k.k().  The shared heads are read in place, never copied.
+            - have_same_dimensions(#dest, q) except #dest.nc() == v.nc()
+            - #lse.size() == q.num_samples()*q.k()*q.nr() and contains, for each query row,
+              the log of the sum of the exponentiated scores (-infinity for rows without a
+              visible key).  It is needed by scaled_dot_product_attention_gradient().
+            - The keys are processed in blocks with an online softmax so that the full
+              q.nr() x k.nr() score matrix is never stored, and key blocks that are
+              entirely masked by the causal mask are skipped.
+            - padding_lengths is typically tril_padding_context::get_all_lengths().
+              Samples without an entry have no padding.
+    !*/
+
+    void scaled_dot_product_attention_gradient(
+        const tensor& gradient_input,
+        const tensor& dest,
+        const tensor& lse,
+        const tensor& q,
+        const tensor& k,
+        const tensor& v,
+        float scale,
+        bool causal,
+        const std::vector<long>& padding_lengths,
+        tensor& q_grad,
+        tensor& k_grad,
+        tensor& v_grad
+    );
+    /*!
+        requires
+            - dest and lse are the outputs of scaled_dot_product_attention(dest, lse, q,
+              k, v, scale, causal, padding_lengths)
+            - have_same_dimensions(gradient_input, dest)
+            - have_same_dimensions(q, q_grad)
+            - have_same_dimensions(k, k_grad)
+            - have_same_dimensions(v, v_grad)
+        ensures
+            - Let f(q,k,v) == dot(gradient_input, dest output of
+              scaled_dot_product_attention(dest, lse, q, k, v, scale, causal, padding_lengths))
+            - Adds the gradient of f() with respect to q to #q_grad.
+            - Adds the gradient of f() with respect to k to #k_grad.
+            - Adds the gradient of f() with respect to v to #v_grad.
+            - The attention probabilities are recomputed block by block from lse, so the
+              memory used does not grow with the square of the sequence length.
+    !*/
+
 // ----------------------------------------------------------------------------------------
 
 }}
@@ -12,6 +12,7 @@
 
 #ifndef DLIB_ISO_CPP_ONLY
 #include "data_io/load_image_dataset.h"
+#include "data_io/token_corpus.h"
 #endif
 
 #endif // DLIB_DATA_Io_HEADER
@@ -6,8 +6,12 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <functional>
 #include "../matrix.h"
 #include "../serialize.h"
+#include "../rand.h"
+#include "../dnn/layers.h"
+#include "../dnn/input.h"
 
 namespace dlib
 {
@@ -709,26 +713,615 @@ namespace dlib
         long current_size_;              // Current number of tokens
     };
 
-    inline void build_single_token_prediction_dataset(
-        const std::vector<std::vector<int>>& token_sequences,
-        long window_len,
-        long padding_token,
-        bool use_left_padding,
-        std::vector<matrix<int, 0, 1>>& X,
-        std::vector<unsigned long>& Y)
+    // ---------------------------------------------------------------------------------
+
+    class token_sampler
     {
-        X.clear();
-        Y.clear();
+    public:
+        token_sampler(
+            unsigned long seed = 0
+        ) : temperature_(1.0f),
+            top_k_(0),
+            top_p_(1.0f),
+            min_p_(0.0f),
+            repetition_penalty_(1.0f),
+            repetition_window_(64),
+            rnd_(seed)
+        {
+        }
 
-        for (const auto& seq : token_sequences)
+        void set_temperature(float temperature)
+        {
+            DLIB_CASSERT(temperature >= 0, "Temperature must be non-negative");
+            temperature_ = temperature;
+        }
+
+        void set_top_k(long k)
+        {
+            DLIB_CASSERT(k >= 0, "top_k must be non-negative");
+            top_k_ = k;
+        }
+
+        void set_top_p(float p)
+        {
+            DLIB_CASSERT(0 < p && p <= 1, "top_p must be in (0, 1]");
+            top_p_ = p;
+        }
+
+        void set_min_p(float p)
+        {
+            DLIB_CASSERT(0 <= p && p <= 1, "min_p must be in [0, 1]");
+            min_p_ = p;
+        }
+
+        void set_repetition_penalty(float penalty, long window = 64)
+        {
+            DLIB_CASSERT(penalty >= 1, "Repetition penalty must be >= 1");
+            DLIB_CASSERT(window >= 0, "Repetition window must be non-negative");
+            repetition_penalty_ = penalty;
+            repetition_window_ = window;
+        }
+
+        void set_seed(unsigned long seed) { rnd_.set_seed(cast_to_string(seed)); }
+
+        float get_temperature() const { return temperature_; }
+        long get_top_k() const { return top_k_; }
+        float get_top_p() const { return top_p_; }
+        float get_min_p() const { return min_p_; }
+        float get_repetition_penalty() const { return repetition_penalty_; }
+        long get_repetition_window() const { return repetition_window_; }
+        bool is_greedy() const { return temperature_ == 0; }
+
+        long operator()(
+            const float* logits,
+            long vocab_size,
+            const std::vector<int>& history = std::vector<int>()
+        )
+        {
+            DLIB_CASSERT(vocab_size > 0, "Vocabulary size must be positive");
+
+            // Greedy decoding ignores every other setting
+            if (temperature_ == 0)
+                return static_cast<long>(std::max_element(logits, logits + vocab_size) - logits);
+
+            const double total = filter_candidates(logits, vocab_size, history);
+            const double r = rnd_.get_random_double() * total;
+            double cumsum = 0;
+            for (const auto& c : candidates_)
+            {
+                cumsum += c.first;
+                if (r < cumsum)
+                    return c.second;
+            }
+            return candidates_.back().second;
+        }
+
+        void get_distribution(
+            const float* logits,
+            long vocab_size,
+            const std::vector<int>& history,
+            std::vector<float>& probs
+        )
+        {
+            DLIB_CASSERT(vocab_size > 0, "Vocabulary size must be positive");
+
+            probs.assign(vocab_size, 0.0f);
+            if (temperature_ == 0)
+            {
+                probs[std::max_element(logits, logits + vocab_size) - logits] = 1;
+                return;
+            }
+
+            const double total = filter_candidates(logits, vocab_size, history);
+            for (const auto& c : candidates_)
+                probs[c.second] = static_cast<float>(c.first / total);
+        }
+
+        friend void serialize(const token_sampler& item, std::ostream& out)
+        {
+            serialize("token_sampler", out);
+            serialize(item.temperature_, out);
+            serialize(item.top_k_, out);
+            serialize(item.top_p_, out);
+            serialize(item.min_p_, out);
+            serialize(item.repetition_penalty_, out);
+            serialize(item.repetition_window_, out);
+            serialize(item.rnd_, out);
+        }
+
+        friend void deserialize(token_sampler& item, std::istream& in)
+        {
+            std::string name;
+            deserialize(name, in);
+            if (name != "token_sampler")
+            {
+                throw serialization_error("Error deserializing object of type 'token_sampler': "
+                    "expected 'token_sampler' but got '" + name + "'");
+            }
+
+            deserialize(item.temperature_, in);
+            deserialize(item.top_k_, in);
+            deserialize(item.top_p_, in);
+            deserialize(item.min_p_, in);
+            deserialize(item.repetition_penalty_, in);
+            deserialize(item.repetition_window_, in);
+            deserialize(item.rnd_, in);
+        }
+
+    private:
+        // Leaves in candidates_ the tokens that pass the filters, most probable first,
+        // with their unnormalized probabilities and returns the sum of these.
+        double filter_candidates(
+            const float* logits,
+            long vocab_size,
+            const std::vector<int>& history
+        )
+        {
+            // Softmax with temperature, shifted by the max logit for stability
+            probs_.resize(vocab_size);
+            const float max_logit = *std::max_element(logits, logits + vocab_size);
+            for (long i = 0; i < vocab_size; ++i)
+                probs_[i] = std::exp((logits[i] - max_logit) / temperature_);
+
+            // Penalize the tokens seen in the most recent part of the history.  Each
+            // token is penalized once, however many times it occurs.
+            if (repetition_penalty_ > 1 && !history.empty())
+            {
+                const size_t window = repetition_window_ == 0 ? history.size() :
+                    std::min(history.size(), static_cast<size_t>(repetition_window_));
+                seen_.assign(vocab_size, 0);
+                for (size_t i = history.size() - window; i < history.size(); ++i)
+                {
+                    const int token = history[i];
+                    if (token >= 0 && token < vocab_size && !seen_[token])
+                    {
+                        seen_[token] = 1;
+                        probs_[token] /= repetition_penalty_;
+                    }
+                }
+            }
+
+            // Candidates above the min-p threshold
+            const float max_prob = *std::max_element(probs_.begin(), probs_.end());
+            const float threshold = max_prob * min_p_;
+            candidates_.clear();
+            for (long i = 0; i < vocab_size; ++i)
+            {
+                if (probs_[i] >= threshold && probs_[i] > 0)
+                    candidates_.push_back(std::make_pair(probs_[i], i));
+            }
+            if (candidates_.empty())
+            {
+                const long best = static_cast<long>(std::max_element(logits, logits + vocab_size) - logits);
+                candidates_.push_back(std::make_pair(1.0f, best));
+                return 1;
+            }
+
+            const size_t k = top_k_ > 0 ? std::min(candidates_.size(), static_cast<size_t>(top_k_)) : candidates_.size();
+            auto by_prob = [](const std::pair<float,long>& a, const std::pair<float,long>& b)
+                { return a.first > b.first || (a.first == b.first && a.second < b.second); };
+            if (k < candidates_.size())
+                std::partial_sort(candidates_.begin(), candidates_.begin() + k, candidates_.end(), by_prob);
+            else
+                std::sort(candidates_.begin(), candidates_.end(), by_prob);
+            candidates_.resize(k);
+
+            // Nucleus: keep the smallest prefix holding top_p of the remaining mass
+            double total = 0;
+            for (const auto& c : candidates_)
+                total += c.first;
+            if (top_p_ < 1)
+            {
+                double cumsum = 0;
+                for (size_t i = 0; i < candidates_.size(); ++i)
+                {
+                    cumsum += candidates_[i].first;
+                    if (cumsum >= top_p_ * total)
+                    {
+                        candidates_.resize(i + 1);
+                        return cumsum;
+                    }
+                }
+            }
+            return total;
+        }
+
+        float temperature_;              // 0 selects greedy decoding
+        long top_k_;                     // 0 disables top-k filtering
+        float top_p_;                    // 1 disables nucleus filtering
+        float min_p_;                    // 0 disables min-p filtering
+        float repetition_penalty_;       // 1 disables the penalty
+        long repetition_window_;         // Recent tokens penalized, 0 for all
+        dlib::rand rnd_;
+
+        // Scratch buffers reused between calls
+        std::vector<float> probs_;
+        std::vector<char> seen_;
+        std::vector<std::pair<float, long>> candidates_;
+    };
+
+    // ---------------------------------------------------------------------------------
+
+    namespace impl
+    {
+        template <typename net_type>
+        const tensor& forward_token_windows(
+            net_type& net,
+            const std::vector<const std::vector<int>*>& sequences,
+            long window_size,
+            long padding_token,
+            resizable_tensor& x
+        )
+        {
+            // Left-padded window of the last window_size tokens of each sequence, the
+            // padding length of each sample goes to the causal masks.
+            typedef typename net_type::input_type input_type;
+            typedef typename input_type::type token_type;
+            std::vector<input_type> windows(sequences.size());
+            std::vector<long> padding(sequences.size());
+            for (size_t s = 0; s < sequences.size(); ++s)
+            {
+                const std::vector<int>& h = *sequences[s];
+                const long len = std::min(window_size, static_cast<long>(h.size()));
+                padding[s] = window_size - len;
+                windows[s].set_size(window_size);
+                for (long i = 0; i < padding[s]; ++i)
+                    windows[s](i) = static_cast<token_type>(padding_token);
+                for (long i = 0; i < len; ++i)
+                    windows[s](padding[s] + i) = static_cast<token_type>(h[h.size() - len + i]);
+            }
+
+            tril_padding_context::set_from_lengths(padding);
+            net.to_tensor(windows.begin(), windows.end(), x);
+            const tensor& out = net.forward(x);
+            DLIB_CASSERT(out.num_samples() == static_cast<long>(sequences.size()),
+                "The network must output one sample per input window");
+            return out;
+        }
+    }
+
+    template <typename net_type>
+    class text_generator
+    {
+    public:
+        typedef typename net_type::input_type input_type;
+        typedef typename input_type::type token_type;
+
+        text_generator(
+            net_type& net,
+            long window_size,
+            long padding_token,
+            unsigned long seed = 0
+        ) : net_(net),
+            window_size_(window_size),
+            padding_token_(padding_token),
+            max_new_tokens_(256),
+            max_batch_size_(0),
+            sampler_(seed)
+        {
+            DLIB_CASSERT(window_size > 0, "Window size must be positive");
+        }
+
+        token_sampler& sampler() { return sampler_; }
+        const token_sampler& sampler() const { return sampler_; }
+
+        void set_max_new_tokens(long n)
+        {
+            DLIB_CASSERT(n > 0, "The number of generated tokens must be positive");
+            max_new_tokens_ = n;
+        }
+
+        void set_max_batch_size(long n)
+        {
+            DLIB_CASSERT(n >= 0, "Batch size must be non-negative");
+            max_batch_size_ = n;
+        }
+
+        void set_stop_tokens(const std::vector<int>& tokens) { stop_tokens_ = tokens; }
+        void add_stop_token(int token) { stop_tokens_.push_back(token); }
+
+        long get_window_size() const { return window_size_; }
+        long get_padding_token() const { return padding_token_; }
+        long get_max_new_tokens() const { return max_new_tokens_; }
+        long get_max_batch_size() const { return max_batch_size_; }
+        const std::vector<int>& get_stop_tokens() const { return stop_tokens_; }
+
+        std::vector<std::vector<int>> generate(
+            const std::vector<std::vector<int>>& prompts,
+            const std::function<bool(size_t, int)>& on_token = nullptr
+        )
         {
-            const long len = static_cast<long>(seq.size());
-            if (len <= 1) continue;
+            std::vector<std::vector<int>> outputs(prompts.size());
+            if (prompts.empty())
+                return outputs;
+            for (const auto& p : prompts)
+                DLIB_CASSERT(!p.empty(), "Prompts must contain at least one token");
+
+            // Full token history of each sequence, used for the windows and the
+            // repetition penalty
+            std::vector<std::vector<int>> histories(prompts);
+            std::vector<size_t> active;
+            size_t next_prompt = 0;
+            const size_t batch_limit = max_batch_size_ > 0 ? static_cast<size_t>(max_batch_size_) : prompts.size();
+
+            std::vector<const std::vector<int>*> sequences;
+            resizable_tensor x;
+            while (true)
+            {
+                // Finished sequences leave room for waiting prompts
+                while (active.size() < batch_limit && next_prompt < prompts.size())
+                    active.push_back(next_prompt++);
+                if (active.empty())
+                    break;
+
+                sequences.clear();
+                for (size_t idx : active)
+                    sequences.push_back(&histories[idx]);
+                const tensor& out = impl::forward_token_windows(net_, sequences, window_size_, padding_token_, x);
+
+                // The logits of the next token are the last row of each sample when the
+                // network outputs one row per position, the whole sample otherwise.
+                const long sample_size = out.size() / out.num_samples();
+                const long vocab_size = out.nc() > 1 ? out.nc() : sample_size;
+                const float* logits = out.host();
+
+                std::vector<size_t> still_active;
+                still_active.reserve(active.size());
+                for (size_t s = 0; s < active.size(); ++s)
+                {
+                    const size_t idx = active[s];
+                    const int token = static_cast<int>(sampler_(
+                        logits + (s + 1) * sample_size - vocab_size, vocab_size, histories[idx]));
+                    histories[idx].push_back(token);
+                    outputs[idx].push_back(token);
+
+                    bool done = std::find(stop_tokens_.begin(), stop_tokens_.end(), token) != stop_tokens_.end()
+                        || static_cast<long>(outputs[idx].size()) >= max_new_tokens_;
+                    if (on_token && !on_token(idx, token))
+                        done = true;
+                    if (!done)
+                        still_active.push_back(idx);
+                }
+                active.swap(still_active);
+            }
+
+            tril_padding_context::clear();
+            return outputs;
+        }
+
+        std::vector<int> generate(
+            const std::vector<int>& prompt,
+            const std::function<bool(int)>& on_token = nullptr
+        )
+        {
+            std::function<bool(size_t, int)> callback;
+            if (on_token)
+                callback = [&on_token](size_t, int token) { return on_token(token); };
+            return generate(std::vector<std::vector<int>>(1, prompt), callback)[0];
+        }
+
+    private:
+        net_type& net_;
+        long window_size_;               // Number of tokens fed to the network
+        long padding_token_;             // Token used for left padding
+        long max_new_tokens_;            // Generation limit per sequence
+        long max_batch_size_;            // Concurrent sequences, 0 for all
+        std::vector<int> stop_tokens_;   // Tokens ending a sequence
+        token_sampler sampler_;
+    };
+
+    // ---------------------------------------------------------------------------------
+
+    template <typename target_net_type, typename draft_net_type>
+    class speculative_generator
+    {
+    public:
+        speculative_generator(
+            target_net_type& target,
+            draft_net_type& draft,
+            long window_size,
+            long padding_token,
+            unsigned long seed = 0
+        ) : target_(target),
+            draft_(draft),
+            window_size_(window_size),
+            padding_token_(padding_token),
+            num_draft_tokens_(4),
+            max_new_tokens_(256),
+            sampler_(seed),
+            rnd_(seed),
+            num_drafted_(0),
+            num_accepted_(0)
+        {
+            DLIB_CASSERT(window_size > 0, "Window size must be positive");
+        }
+
+        token_sampler& sampler() { return sampler_; }
+        const token_sampler& sampler() const { return sampler_; }
+
+        void set_num_draft_tokens(long n)
+        {
+            DLIB_CASSERT(n > 0, "The number of draft tokens must be positive");
+            num_draft_tokens_ = n;
+        }
+
+        void set_max_new_tokens(long n)
+        {
+            DLIB_CASSERT(n > 0, "The number of generated tokens must be positive");
+            max_new_tokens_ = n;
+        }
+
+        void set_stop_tokens(const std::vector<int>& tokens) { stop_tokens_ = tokens; }
+        void add_stop_token(int token) { stop_tokens_.push_back(token); }
+
+        long get_window_size() const { return window_size_; }
+        long get_padding_token() const { return padding_token_; }
+        long get_num_draft_tokens() const { return num_draft_tokens_; }
+        long get_max_new_tokens() const { return max_new_tokens_; }
+        const std::vector<int>& get_stop_tokens() const { return stop_tokens_; }
+
+        unsigned long get_num_drafted() const { return num_drafted_; }
+        unsigned long get_num_accepted() const { return num_accepted_; }
+        double get_acceptance_rate() const
+        {
+            return num_drafted_ == 0 ? 0.0 : static_cast<double>(num_accepted_) / num_drafted_;
+        }
+
+        std::vector<int> generate(
+            const std::vector<int>& prompt,
+            const std::function<bool(int)>& on_token = nullptr
+        )
+        {
+            DLIB_CASSERT(!prompt.empty(), "The prompt must contain at least one token");
+            num_drafted_ = 0;
+            num_accepted_ = 0;
+
+            std::vector<int> history(prompt), output, drafted;
+            const std::vector<const std::vector<int>*> sequence(1, &history);
+            std::vector<std::vector<float>> draft_probs(num_draft_tokens_);
+            std::vector<float> target_probs;
+            std::vector<std::vector<int>> prefixes;
+            std::vector<const std::vector<int>*> prefix_ptrs;
+            resizable_tensor x;
+
+            bool done = false;
+            while (!done)
+            {
+                // A round emits at most n+1 tokens, so never draft past the token limit
+                const long n = std::min(num_draft_tokens_, max_new_tokens_ - static_cast<long>(output.size()) - 1);
+                const size_t context_size = history.size();
+
+                // The draft network proposes n tokens, one forward pass each
+                drafted.clear();
+                long vocab_size = 0;
+                for (long i = 0; i < n; ++i)
+                {
+                    const tensor& out = impl::forward_token_windows(draft_, sequence, window_size_, padding_token_, x);
+                    const long sample_size = out.size() / out.num_samples();
+                    vocab_size = out.nc() > 1 ? out.nc() : sample_size;
+                    sampler_.get_distribution(out.host() + sample_size - vocab_size, vocab_size, history, draft_probs[i]);
+                    drafted.push_back(static_cast<int>(draw(draft_probs[i])));
+                    history.push_back(drafted.back());
+                }
+
+                // The target network scores the n proposals and the token following
+                // them in a single batched forward pass.  Sample i is the window ending
+                // right before drafted token i, exactly the input plain decoding would
+                // give the target at that point.
+                history.resize(context_size);
+                prefixes.resize(n + 1);
+                prefix_ptrs.resize(n + 1);
+                for (long i = 0; i <= n; ++i)
+                {
+                    prefixes[i].assign(history.begin(), history.end());
+                    prefixes[i].insert(prefixes[i].end(), drafted.begin(), drafted.begin() + i);
+                    prefix_ptrs[i] = &prefixes[i];
+                }
+                const tensor& out = impl::forward_token_windows(target_, prefix_ptrs, window_size_, padding_token_, x);
+                const long sample_size = out.size() / out.num_samples();
+                const long target_vocab_size = out.nc() > 1 ? out.nc() : sample_size;
+                DLIB_CASSERT(n == 0 || vocab_size == target_vocab_size,
+                    "The draft and target networks must share the same vocabulary");
+
+                for (long i = 0; i <= n && !done; ++i)
+                {
+                    const float* logits = out.host() + (i + 1) * sample_size - target_vocab_size;
+                    sampler_.get_distribution(logits, target_vocab_size, history, target_probs);
+
+                    int token;
+                    bool rejected = false;
+                    if (i < n)
+                    {
+                        // Accept the draft token with probability min(1, p/q), otherwise
+                        // resample from the normalized residual max(0, p-q).  The emitted
+                        // tokens then follow the target distribution exactly.
+                        const std::vector<float>& q = draft_probs[i];
+                        token = drafted[i];
+                        ++num_drafted_;
+                        if (rnd_.get_random_double() * q[token] < target_probs[token])
+                        {
+                            ++num_accepted_;
+                        }
+                        else
+                        {
+                            for (size_t v = 0; v < target_probs.size(); ++v)
+                                target_probs[v] = std::max(0.0f, target_probs[v] - q[v]);
+                            token = static_cast<int>(draw(target_probs));
+                            rejected = true;
+                        }
+                    }
+                    else
+                    {
+                        // Every proposal was accepted, the target adds one more token
+                        token = static_cast<int>(draw(target_probs));
+                    }
+
+                    history.push_back(token);
+                    output.push_back(token);
+                    done = std::find(stop_tokens_.begin(), stop_tokens_.end(), token) != stop_tokens_.end()
+                        || static_cast<long>(output.size()) >= max_new_tokens_;
+                    if (on_token && !on_token(token))
+                        done = true;
+                    if (rejected)
+                        break;
+                }
+            }
+
+            tril_padding_context::clear();
+            return output;
+        }
+
+    private:
+        long draw(const std::vector<float>& probs)
+        {
+            double total = 0;
+            for (float p : probs)
+                total += p;
+            const double r = rnd_.get_random_double() * total;
+            double cumsum = 0;
+            long last = 0;
+            for (size_t i = 0; i < probs.size(); ++i)
+            {
+                if (probs[i] <= 0)
+                    continue;
+                cumsum += probs[i];
+                last = static_cast<long>(i);
+                if (r < cumsum)
+                    return last;
+            }
+            return last;
+        }
+
+        target_net_type& target_;
+        draft_net_type& draft_;
+        long window_size_;               // Number of tokens fed to both networks
+        long padding_token_;             // Token used for left padding
+        long num_draft_tokens_;          // Proposals verified per target pass
+        long max_new_tokens_;            // Generation limit
+        std::vector<int> stop_tokens_;   // Tokens ending the sequence
+        token_sampler sampler_;          // Shapes both distributions
+        dlib::rand rnd_;                 // Draws the tokens and the acceptance tests
+        unsigned long num_drafted_;      // Statistics of the last generate() call
+        unsigned long num_accepted_;
+    };
+
+    namespace impl
+    {
+        inline void append_single_token_windows(
+            const int* seq,
+            long len,
+            long window_len,
+            long padding_token,
+            bool use_left_padding,
+            std::vector<token_window>& X,
+            std::vector<unsigned long>& Y)
+        {
+            if (len <= 1) return;
 
             long start = 0;
             if (len < window_len)
             {
-                if (!use_left_padding) continue;
+                if (!use_left_padding) return;
                 start = (len - window_len);
             }
 
@@ -737,13 +1330,7 @@ namespace dlib
             {
                 for (long pos = 1; pos < window_len; ++pos)
                 {
-                    matrix<int, 0, 1> window(window_len, 1);
-                    long pad = window_len - pos;
-
-                    for (long i = 0; i < pad; ++i) window(i) = padding_token;
-                    for (long i = 0; i < pos; ++i) window(pad + i) = seq[i];
-
-                    X.push_back(window);
+                    X.emplace_back(seq, len, pos - window_len, window_len, padding_token);
                     Y.push_back(seq[pos]);
                 }
             }
@@ -751,31 +1338,73 @@ namespace dlib
             // Slide window through sequence
             for (long pos = start; pos < len - 1; ++pos)
             {
-                matrix<int, 0, 1> window(window_len, 1);
-
-                for (long i = 0; i < window_len; ++i)
-                {
-                    long idx = pos + i;
-                    window(i) = (idx >= 0 && idx < len) ? seq[idx] : padding_token;
-                }
-
                 long target_idx = pos + window_len;
                 if (target_idx >= 0 && target_idx < len)
                 {
-                    X.push_back(window);
+                    X.emplace_back(seq, len, pos, window_len, padding_token);
                     Y.push_back(seq[target_idx]);
                 }
             }
         }
     }
 
+    inline void build_single_token_prediction_dataset(
+        const int* tokens,
+        size_t num_tokens,
+        long window_len,
+        long padding_token,
+        bool use_left_padding,
+        std::vector<token_window>& X,
+        std::vector<unsigned long>& Y)
+    {
+        X.clear();
+        Y.clear();
+        impl::append_single_token_windows(tokens, static_cast<long>(num_tokens), window_len,
+            padding_token, use_left_padding, X, Y);
+    }
+
+    inline void build_single_token_prediction_dataset(
+        const std::vector<std::vector<int>>& token_sequences,
+        long window_len,
+        long padding_token,
+        bool use_left_padding,
+        std::vector<token_window>& X,
+        std::vector<unsigned long>& Y)
+    {
+        X.clear();
+        Y.clear();
+
+        for (const auto& seq : token_sequences)
+        {
+            impl::append_single_token_windows(seq.data(), static_cast<long>(seq.size()), window_len,
+                padding_token, use_left_padding, X, Y);
+        }
+    }
+
+    inline void build_single_token_prediction_dataset(
+        const std::vector<std::vector<int>>& token_sequences,
+        long window_len,
+        long padding_token,
+        bool use_left_padding,
+        std::vector<matrix<int, 0, 1>>& X,
+        std::vector<unsigned long>& Y)
+    {
+        std::vector<token_window> windows;
+        build_single_token_prediction_dataset(token_sequences, window_len, padding_token,
+            use_left_padding, windows, Y);
+
+        X.resize(windows.size());
+        for (size_t i = 0; i < windows.size(); ++i)
+            X[i] = windows[i].to_matrix();
+    }
+
     inline void build_multi_token_prediction_dataset(
         const std::vector<std::vector<int>>& source_sequences,
         const std::vector<std::vector<int>>& target_sequences,
         long src_window_len,
         long tgt_window_len,
         long padding_token,
-        std::vector<matrix<int, 0, 1>>& X,
+        std::vector<token_window>& X,
         std::vector<matrix<unsigned long, 0, 1>>& Y)
     {
         DLIB_CASSERT(source_sequences.size() == target_sequences.size(),
@@ -799,23 +1428,9 @@ namespace dlib
 
             while (true)
             {
-                // Build source window
-                matrix<int, 0, 1> src_window(src_window_len, 1);
-                long src_real = 0;
-
-                for (long j = 0; j < src_window_len; ++j)
-                {
-                    long idx = src_pos + j;
-                    if (idx >= 0 && idx < src_len)
-                    {
-                        src_window(j) = src[idx];
-                        src_real++;
-                    }
-                    else
-                    {
-                        src_window(j) = padding_token;
-                    }
-                }
+                // Count the real tokens of the source window
+                const long src_real = std::max(0L,
+                    std::min(src_pos + src_window_len, src_len) - std::max(src_pos, 0L));
 
                 // Build target window
                 matrix<unsigned long, 0, 1> tgt_window(tgt_window_len, 1);
@@ -838,7 +1453,7 @@ namespace dlib
                 // Stop if no real tokens in either window
                 if (src_real == 0 || tgt_real == 0) break;
 
-                X.push_back(src_window);
+                X.emplace_back(src.data(), src_len, src_pos, src_window_len, padding_token);
                 Y.push_back(tgt_window);
 
                 // Stop if both sequences fully consumed
@@ -851,6 +1466,24 @@ namespace dlib
         }
     }
 
+    inline void build_multi_token_prediction_dataset(
+        const std::vector<std::vector<int>>& source_sequences,
+        const std::vector<std::vector<int>>& target_sequences,
+        long src_window_len,
+        long tgt_window_len,
+        long padding_token,
+        std::vector<matrix<int, 0, 1>>& X,
+        std::vector<matrix<unsigned long, 0, 1>>& Y)
+    {
+        std::vector<token_window> windows;
+        build_multi_token_prediction_dataset(source_sequences, target_sequences, src_window_len,
+            tgt_window_len, padding_token, windows, Y);
+
+        X.resize(windows.size());
+        for (size_t i = 0; i < windows.size(); ++i)
+            X[i] = windows[i].to_matrix();
+    }
+
     template <typename sample_type, typename label_type>
     void shuffle_training_dataset(
         std::vector<sample_type>& samples,
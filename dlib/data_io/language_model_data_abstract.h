@@ -6,8 +6,12 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <functional>
 #include "../matrix.h"
 #include "../serialize.h"
+#include "../rand.h"
+#include "../dnn/layers_abstract.h"
+#include "../dnn/input_abstract.h"
 
 namespace dlib
 {
@@ -451,6 +455,430 @@ namespace dlib
         long current_size_;              // Current number of tokens
     };
 
+    // ---------------------------------------------------------------------------------
+
+    class token_sampler
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object picks the next token of a sequence from the logits a language
+                model outputs for it.  It implements the usual decoding strategies:
+                - greedy (argmax) decoding when the temperature is 0
+                - temperature scaling of the softmax
+                - repetition penalty on the tokens seen recently
+                - min-p filtering: tokens less likely than min_p times the most likely
+                  token are discarded
+                - top-k filtering: only the k most likely tokens are kept
+                - top-p (nucleus) filtering: only the most likely tokens holding a
+                  fraction top_p of the remaining probability mass are kept
+                The filters are applied in that order and the token is then drawn from
+                the renormalized distribution of the remaining candidates.
+
+                By default, tokens are drawn from the plain softmax of the logits: the
+                temperature is 1 and every filter is disabled.
+
+            THREAD SAFETY
+                Sampling changes the state of the internal random number generator, so an
+                instance must not be used by several threads at once.
+        !*/
+    public:
+
+        token_sampler(
+            unsigned long seed = 0
+        );
+        /*!
+            ensures
+                - #get_temperature() == 1
+                - #get_top_k() == 0
+                - #get_top_p() == 1
+                - #get_min_p() == 0
+                - #get_repetition_penalty() == 1
+                - #get_repetition_window() == 64
+                - The random number generator is seeded with seed.
+        !*/
+
+        void set_temperature(float temperature);
+        /*!
+            requires
+                - temperature >= 0
+            ensures
+                - #get_temperature() == temperature
+                - A temperature of 0 selects greedy decoding.  Values below 1 sharpen the
+                  distribution and values above 1 flatten it.
+        !*/
+
+        void set_top_k(long k);
+        /*!
+            requires
+                - k >= 0
+            ensures
+                - #get_top_k() == k
+                - 0 disables top-k filtering.
+        !*/
+
+        void set_top_p(float p);
+        /*!
+            requires
+                - 0 < p <= 1
+            ensures
+                - #get_top_p() == p
+                - 1 disables nucleus filtering.
+        !*/
+
+        void set_min_p(float p);
+        /*!
+            requires
+                - 0 <= p <= 1
+            ensures
+                - #get_min_p() == p
+                - 0 disables min-p filtering.
+        !*/
+
+        void set_repetition_penalty(float penalty, long window = 64);
+        /*!
+            requires
+                - penalty >= 1
+                - window >= 0
+            ensures
+                - #get_repetition_penalty() == penalty
+                - #get_repetition_window() == window
+                - The probability of every token found in the last window tokens of the
+                  history is divided by penalty (once per token).  A window of 0 covers
+                  the whole history and a penalty of 1 disables the penalty.
+        !*/
+
+        void set_seed(unsigned long seed);
+        /*!
+            ensures
+                - Reseeds the random number generator.  Two samplers with the same
+                  settings and seed draw the same tokens from the same logits.
+        !*/
+
+        float get_temperature() const;
+        long get_top_k() const;
+        float get_top_p() const;
+        float get_min_p() const;
+        float get_repetition_penalty() const;
+        long get_repetition_window() const;
+        /*!
+            ensures
+                - Return the current sampling settings
+        !*/
+
+        bool is_greedy() const;
+        /*!
+            ensures
+                - returns get_temperature() == 0
+        !*/
+
+        long operator()(
+            const float* logits,
+            long vocab_size,
+            const std::vector<int>& history = std::vector<int>()
+        );
+        /*!
+            requires
+                - vocab_size > 0
+                - logits points to vocab_size unnormalized scores, one per token
+            ensures
+                - Returns the next token, a value in [0, vocab_size).
+                - If is_greedy() then returns the index of the largest logit and every
+                  other setting is ignored.
+                - Otherwise draws a token as described at the top of this class.  history
+                  holds the tokens of the sequence so far and is only used by the
+                  repetition penalty.
+        !*/
+
+        void get_distribution(
+            const float* logits,
+            long vocab_size,
+            const std::vector<int>& history,
+            std::vector<float>& probs
+        );
+        /*!
+            requires
+                - vocab_size > 0
+                - logits points to vocab_size unnormalized scores, one per token
+            ensures
+                - #probs.size() == vocab_size
+                - #probs is the distribution operator() draws from: the filtered tokens
+                  have a probability of 0 and the others sum to 1.  If is_greedy() then
+                  #probs is 1 for the token with the largest logit and 0 elsewhere.
+                - Does not change the state of the random number generator.
+        !*/
+
+        friend void serialize(const token_sampler& item, std::ostream& out);
+        friend void deserialize(token_sampler& item, std::istream& in);
+        /*!
+            provides serialization support, including the random generator state
+        !*/
+    };
+
+    // ---------------------------------------------------------------------------------
+
+    template <typename net_type>
+    class text_generator
+    {
+        /*!
+            REQUIREMENTS ON net_type
+                - net_type is an add_layer or add_loss_layer object whose input_type is
+                  matrix<T,0,1> for some integral type T (e.g. the subnet() of a language
+                  model ending in loss_cross_entropy_per_logit).
+                - net.forward() outputs the logits of the next token of each sample,
+                  either one row per position (the shape of a linear_ head, where the
+                  last row of each sample is used) or one value per token in each sample
+                  (the shape of an fc_ head).
+
+            WHAT THIS OBJECT REPRESENTS
+                This object runs autoregressive generation for a language model.  It
+                feeds the last window_size tokens of each sequence to the network, draws
+                the next token with a token_sampler, appends it and repeats until a stop
+                condition is reached.
+
+                Many prompts are decoded together: every step runs a single forward pass
+                over the batch of active sequences.  Windows of sequences shorter than
+                window_size are left-padded and the padding length of each sample is
+                published through tril_padding_context, so the causal attention masks
+                ignore the padding of each sample independently.  Sequences that stop
+                leave the batch and, when get_max_batch_size() limits the batch, waiting
+                prompts take their place.
+
+            THREAD SAFETY
+                tril_padding_context is global, so only one text_generator (or any other
+                code setting tril_padding_context) may run at a time.
+        !*/
+    public:
+
+        typedef typename net_type::input_type input_type;
+        typedef typename input_type::type token_type;
+
+        text_generator(
+            net_type& net,
+            long window_size,
+            long padding_token,
+            unsigned long seed = 0
+        );
+        /*!
+            requires
+                - window_size > 0
+                - net outlives this object
+            ensures
+                - #get_window_size() == window_size
+                - #get_padding_token() == padding_token
+                - #get_max_new_tokens() == 256
+                - #get_max_batch_size() == 0
+                - #get_stop_tokens().size() == 0
+                - #sampler() is a default token_sampler seeded with seed.
+        !*/
+
+        token_sampler& sampler();
+        const token_sampler& sampler() const;
+        /*!
+            ensures
+                - Returns the sampler used to pick each token.
+        !*/
+
+        void set_max_new_tokens(long n);
+        /*!
+            requires
+                - n > 0
+            ensures
+                - #get_max_new_tokens() == n
+        !*/
+
+        void set_max_batch_size(long n);
+        /*!
+            requires
+                - n >= 0
+            ensures
+                - #get_max_batch_size() == n
+                - At most n sequences are decoded together (0 means all the prompts).
+        !*/
+
+        void set_stop_tokens(const std::vector<int>& tokens);
+        void add_stop_token(int token);
+        /*!
+            ensures
+                - Replaces, or appends to, the tokens that end a sequence.
+        !*/
+
+        long get_window_size() const;
+        long get_padding_token() const;
+        long get_max_new_tokens() const;
+        long get_max_batch_size() const;
+        const std::vector<int>& get_stop_tokens() const;
+        /*!
+            ensures
+                - Return the current generation settings
+        !*/
+
+        std::vector<std::vector<int>> generate(
+            const std::vector<std::vector<int>>& prompts,
+            const std::function<bool(size_t, int)>& on_token = nullptr
+        );
+        /*!
+            requires
+                - for all valid i: prompts[i].size() > 0
+            ensures
+                - Generates a continuation of each prompt and returns them: the returned
+                  vector R has prompts.size() elements and R[i] holds the tokens
+                  generated after prompts[i] (the prompt itself is not included).
+                - A sequence stops after generating one of get_stop_tokens() (which is
+                  kept as the last element of R[i]), after get_max_new_tokens() tokens,
+                  or when on_token returns false.
+                - If on_token is set, on_token(i, token) is called for every generated
+                  token as soon as it is sampled, which allows streaming the output.
+                  Tokens of different prompts are interleaved.
+                - Prompts longer than get_window_size() are conditioned on their last
+                  get_window_size() tokens.
+                - #tril_padding_context::is_set() == false
+        !*/
+
+        std::vector<int> generate(
+            const std::vector<int>& prompt,
+            const std::function<bool(int)>& on_token = nullptr
+        );
+        /*!
+            requires
+                - prompt.size() > 0
+            ensures
+                - Same as generate() above for a single prompt, returns its continuation.
+        !*/
+    };
+
+    // ---------------------------------------------------------------------------------
+
+    template <typename target_net_type, typename draft_net_type>
+    class speculative_generator
+    {
+        /*!
+            REQUIREMENTS ON target_net_type AND draft_net_type
+                - Same as the net_type of text_generator.  Both networks use the same
+                  tokenizer, and so the same vocabulary.
+
+            WHAT THIS OBJECT REPRESENTS
+                This object generates text with the target network using speculative
+                decoding.  Each round, the small draft network proposes
+                get_num_draft_tokens() tokens, one cheap forward pass each, and the
+                target network scores all of them in a single forward pass.  Proposals
+                are accepted from left to right with probability min(1, p/q), where p
+                and q are the target and draft distributions given by
+                sampler().get_distribution().  The first rejected proposal is replaced
+                by a token drawn from the normalized max(0, p-q) and ends the round; if
+                all are accepted the target adds one more token.
+
+                The target pass is a batch of n+1 windows, the window preceding each
+                proposal and the one following the last.  This costs more arithmetic
+                than scoring all the positions of a single window, but each sample is
+                exactly the input plain decoding would give the target, whatever the
+                length of the sequence.  (A single window would not do: the
+                normalization layers of the transformers in this library work over
+                whole samples, so the logits of a position depend on the positions
+                after it.)
+
+                As a result, the tokens follow the distribution the target network
+                samples from on its own, and with greedy decoding they are identical to
+                the tokens of a text_generator over the target network, while the target
+                runs once per round instead of once per token.  The speedup depends on
+                get_acceptance_rate(), i.e. how well the draft network imitates the
+                target.
+
+            THREAD SAFETY
+                Like text_generator, only one generator may run at a time.
+        !*/
+    public:
+
+        speculative_generator(
+            target_net_type& target,
+            draft_net_type& draft,
+            long window_size,
+            long padding_token,
+            unsigned long seed = 0
+        );
+        /*!
+            requires
+                - window_size > 0
+                - target and draft outlive this object
+            ensures
+                - #get_window_size() == window_size
+                - #get_padding_token() == padding_token
+                - #get_num_draft_tokens() == 4
+                - #get_max_new_tokens() == 256
+                - #get_stop_tokens().size() == 0
+                - #sampler() is a default token_sampler.
+                - The random number generator is seeded with seed.
+        !*/
+
+        token_sampler& sampler();
+        const token_sampler& sampler() const;
+        /*!
+            ensures
+                - Returns the sampler shaping the target and draft distributions.  Only
+                  its settings are used, the tokens are drawn by this object.
+        !*/
+
+        void set_num_draft_tokens(long n);
+        /*!
+            requires
+                - n > 0
+            ensures
+                - #get_num_draft_tokens() == n
+        !*/
+
+        void set_max_new_tokens(long n);
+        /*!
+            requires
+                - n > 0
+            ensures
+                - #get_max_new_tokens() == n
+        !*/
+
+        void set_stop_tokens(const std::vector<int>& tokens);
+        void add_stop_token(int token);
+        /*!
+            ensures
+                - Replaces, or appends to, the tokens that end the sequence.
+        !*/
+
+        long get_window_size() const;
+        long get_padding_token() const;
+        long get_num_draft_tokens() const;
+        long get_max_new_tokens() const;
+        const std::vector<int>& get_stop_tokens() const;
+        /*!
+            ensures
+                - Return the current generation settings
+        !*/
+
+        unsigned long get_num_drafted() const;
+        unsigned long get_num_accepted() const;
+        double get_acceptance_rate() const;
+        /*!
+            ensures
+                - Return the number of proposals verified by the target network during
+                  the last call to generate(), the number of them that were accepted and
+                  their ratio (0 if nothing was verified).
+        !*/
+
+        std::vector<int> generate(
+            const std::vector<int>& prompt,
+            const std::function<bool(int)>& on_token = nullptr
+        );
+        /*!
+            requires
+                - prompt.size() > 0
+            ensures
+                - Generates a continuation of prompt and returns it (the prompt itself is
+                  not included).
+                - Generation stops after one of get_stop_tokens() (which is kept as the
+                  last returned token), after get_max_new_tokens() tokens, or when
+                  on_token returns false.
+                - If on_token is set, on_token(token) is called for every token as soon
+                  as it is accepted.
+                - #tril_padding_context::is_set() == false
+        !*/
+    };
+
     inline void build_single_token_prediction_dataset(
         const std::vector<std::vector<int>>& token_sequences,
         long window_len,
@@ -470,6 +898,46 @@ namespace dlib
             - Returns samples in X (input windows) and Y (target tokens)
             - X contains matrix<int,0,1> of shape (window_len, 1)
             - Y contains unsigned long values representing the next token
+            - Every window is a copy of its tokens, so X takes O(N*window_len) memory for
+              N tokens.  The overloads taking std::vector<token_window> build the same
+              dataset without copying the tokens.
+    !*/
+
+    inline void build_single_token_prediction_dataset(
+        const std::vector<std::vector<int>>& token_sequences,
+        long window_len,
+        long padding_token,
+        bool use_left_padding,
+        std::vector<token_window>& X,
+        std::vector<unsigned long>& Y);
+    /*!
+        ensures
+            - Builds the same dataset as the version of this function taking
+              std::vector<matrix<int,0,1>>, except that each sample is a token_window
+              referring to the tokens of token_sequences.  That is, for all valid i,
+              X[i].to_matrix() is the i-th window built by that function.
+            - Only the windows are stored, so the memory used is O(N) for N tokens
+              instead of O(N*window_len).  The windows are written into the input tensor
+              by input<token_window> when the network needs them, and they can be
+              shuffled with shuffle_training_dataset() and given to dnn_trainer like
+              matrices.
+            - token_sequences must outlive X, and must not be modified while X is in use.
+    !*/
+
+    inline void build_single_token_prediction_dataset(
+        const int* tokens,
+        size_t num_tokens,
+        long window_len,
+        long padding_token,
+        bool use_left_padding,
+        std::vector<token_window>& X,
+        std::vector<unsigned long>& Y);
+    /*!
+        requires
+            - tokens points to num_tokens ints
+        ensures
+            - Same as above for a single sequence of tokens stored in one contiguous
+              array, which may be memory mapped.  The array must outlive X.
     !*/
 
     inline void build_multi_token_prediction_dataset(
@@ -497,6 +965,29 @@ namespace dlib
             - Y contains matrix<unsigned long,0,1> of shape (tgt_window_len, 1)
     !*/
 
+    inline void build_multi_token_prediction_dataset(
+        const std::vector<std::vector<int>>& source_sequences,
+        const std::vector<std::vector<int>>& target_sequences,
+        long src_window_len,
+        long tgt_window_len,
+        long padding_token,
+        std::vector<token_window>& X,
+        std::vector<matrix<unsigned long, 0, 1>>& Y);
+    /*!
+        requires
+            - source_sequences.size() == target_sequences.size()
+            - src_window_len > 0
+            - tgt_window_len > 0
+        ensures
+            - Builds the same dataset as the version of this function taking
+              std::vector<matrix<int,0,1>>, except that the source windows are
+              token_window objects referring to the tokens of source_sequences.  That
+              is, for all valid i, X[i].to_matrix() is the i-th source window built by
+              that function.
+            - The target windows are still copied, since they are the labels of the loss.
+            - source_sequences must outlive X, and must not be modified while X is in use.
+    !*/
+
     template <typename sample_type, typename label_type>
     void shuffle_training_dataset(
         std::vector<sample_type>& samples,
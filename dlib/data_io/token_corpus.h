@@ -0,0 +1,437 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#ifndef DLIB_TOKEN_CORPUS_H_
+#define DLIB_TOKEN_CORPUS_H_
+
+#ifdef DLIB_ISO_CPP_ONLY
+#error "DLIB_ISO_CPP_ONLY is defined so you can't use this OS dependent code.  Turn DLIB_ISO_CPP_ONLY off if you want to use it."
+#endif
+
+#include "token_corpus_abstract.h"
+#include "language_model_data.h"
+#include "../platform.h"
+#include "../error.h"
+#include "../dir_nav.h"
+#include "../threads/parallel_for_extension.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef WIN32
+#include "../windows_magic.h"
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    namespace impl
+    {
+        // Layout of the header of a token corpus file.  The tokens follow the header and
+        // the document offsets follow the tokens, padded to a multiple of 8 bytes.
+        struct token_corpus_header
+        {
+            char magic[8];
+            uint32_t byte_order;
+            uint32_t token_bytes;
+            uint64_t vocab_size;
+            uint64_t num_tokens;
+            uint64_t num_documents;
+        };
+
+        const char token_corpus_magic[8] = { 'd', 'l', 'i', 'b', 't', 'o', 'k', '1' };
+        const uint32_t token_corpus_byte_order = 0x01020304;
+
+        inline uint64_t token_corpus_offsets_position(const token_corpus_header& h)
+        {
+            const uint64_t end = sizeof(token_corpus_header) + h.num_tokens*h.token_bytes;
+            return (end + 7)/8*8;
+        }
+
+        // Read-only mapping of a whole file in memory
+        class mapped_file
+        {
+        public:
+            explicit mapped_file(const std::string& filename)
+            {
+#ifdef WIN32
+                file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file == INVALID_HANDLE_VALUE)
+                    throw error("Unable to open " + filename);
+                LARGE_INTEGER file_size;
+                if (!GetFileSizeEx(file, &file_size))
+                {
+                    CloseHandle(file);
+                    throw error("Unable to get the size of " + filename);
+                }
+                bytes = static_cast<size_t>(file_size.QuadPart);
+                if (bytes == 0)
+                    return;
+                mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (mapping != NULL)
+                    ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (ptr == nullptr)
+                {
+                    if (mapping != NULL) CloseHandle(mapping);
+                    CloseHandle(file);
+                    throw error("Unable to map " + filename + " in memory");
+                }
+#else
+                const int fd = ::open(filename.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw error("Unable to open " + filename);
+                struct stat st;
+                if (::fstat(fd, &st) != 0)
+                {
+                    ::close(fd);
+                    throw error("Unable to get the size of " + filename);
+                }
+                bytes = static_cast<size_t>(st.st_size);
+                if (bytes != 0)
+                {
+                    void* p = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+                    if (p == MAP_FAILED)
+                    {
+                        ::close(fd);
+                        throw error("Unable to map " + filename + " in memory");
+                    }
+                    ptr = p;
+                }
+                // The mapping stays valid once the file is closed
+                ::close(fd);
+#endif
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            ~mapped_file()
+            {
+#ifdef WIN32
+                if (ptr) UnmapViewOfFile(ptr);
+                if (mapping != NULL) CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+                if (ptr) ::munmap(ptr, bytes);
+#endif
+            }
+
+            const unsigned char* data() const { return static_cast<const unsigned char*>(ptr); }
+            size_t size() const { return bytes; }
+
+        private:
+            void* ptr = nullptr;
+            size_t bytes = 0;
+#ifdef WIN32
+            HANDLE file = INVALID_HANDLE_VALUE;
+            HANDLE mapping = NULL;
+#endif
+        };
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    class token_corpus_writer
+    {
+    public:
+        token_corpus_writer(
+            const std::string& filename,
+            size_t vocab_size,
+            int token_bytes = 0
+        )
+        {
+            DLIB_CASSERT(vocab_size > 0);
+            DLIB_CASSERT(token_bytes == 0 || token_bytes == 2 || token_bytes == 4);
+            DLIB_CASSERT(token_bytes != 2 || vocab_size <= 65536);
+            DLIB_CASSERT(vocab_size <= 0x80000000ull);
+
+            std::memcpy(header.magic, impl::token_corpus_magic, sizeof(header.magic));
+            header.byte_order = impl::token_corpus_byte_order;
+            header.token_bytes = token_bytes != 0 ? token_bytes : (vocab_size <= 65536 ? 2 : 4);
+            header.vocab_size = vocab_size;
+            header.num_tokens = 0;
+            header.num_documents = 0;
+            offsets.push_back(0);
+
+            fout.open(filename, std::ios::binary);
+            if (!fout)
+                throw error("Unable to create " + filename);
+            // The header is written again with the final counts by close()
+            fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+
+        token_corpus_writer(const token_corpus_writer&) = delete;
+        token_corpus_writer& operator=(const token_corpus_writer&) = delete;
+
+        ~token_corpus_writer()
+        {
+            try { close(); } catch (...) {}
+        }
+
+        void add_document(
+            const std::vector<int>& tokens
+        )
+        {
+            DLIB_CASSERT(fout.is_open(), "add_document() called after close()");
+            if (header.token_bytes == 2)
+                write_tokens<uint16_t>(tokens);
+            else
+                write_tokens<uint32_t>(tokens);
+            header.num_tokens += tokens.size();
+            header.num_documents += 1;
+            offsets.push_back(header.num_tokens);
+            if (!fout)
+                throw error("Error while writing a token corpus");
+        }
+
+        size_t num_documents() const { return header.num_documents; }
+        uint64_t num_tokens() const { return header.num_tokens; }
+        int token_bytes() const { return header.token_bytes; }
+
+        void close()
+        {
+            if (!fout.is_open())
+                return;
+
+            const uint64_t end = sizeof(header) + header.num_tokens*header.token_bytes;
+            const char zeros[8] = {};
+            fout.write(zeros, impl::token_corpus_offsets_position(header) - end);
+            fout.write(reinterpret_cast<const char*>(offsets.data()), offsets.size()*sizeof(uint64_t));
+            fout.seekp(0);
+            fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            const bool ok = static_cast<bool>(fout);
+            fout.close();
+            if (!ok || !fout)
+                throw error("Error while writing a token corpus");
+        }
+
+    private:
+
+        template <typename T>
+        void write_tokens(const std::vector<int>& tokens)
+        {
+            buffer.resize(tokens.size()*sizeof(T));
+            T* dest = reinterpret_cast<T*>(buffer.data());
+            for (size_t i = 0; i < tokens.size(); ++i)
+            {
+                if (tokens[i] < 0 || static_cast<uint64_t>(tokens[i]) >= header.vocab_size)
+                {
+                    std::ostringstream sout;
+                    sout << "Token " << tokens[i] << " is outside of the vocabulary of size " << header.vocab_size;
+                    throw error(sout.str());
+                }
+                dest[i] = static_cast<T>(tokens[i]);
+            }
+            fout.write(buffer.data(), buffer.size());
+        }
+
+        std::ofstream fout;
+        impl::token_corpus_header header;
+        std::vector<uint64_t> offsets;
+        std::vector<char> buffer;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    class token_corpus
+    {
+    public:
+        token_corpus() = default;
+
+        explicit token_corpus(
+            const std::string& filename
+        )
+        {
+            open(filename);
+        }
+
+        void open(
+            const std::string& filename
+        )
+        {
+            auto file = std::make_shared<impl::mapped_file>(filename);
+            impl::token_corpus_header h;
+            if (file->size() < sizeof(h))
+                throw error(filename + " is not a token corpus file");
+            std::memcpy(&h, file->data(), sizeof(h));
+            if (std::memcmp(h.magic, impl::token_corpus_magic, sizeof(h.magic)) != 0)
+                throw error(filename + " is not a token corpus file");
+            if (h.byte_order != impl::token_corpus_byte_order)
+                throw error(filename + " was written on a machine with a different byte order");
+            if ((h.token_bytes != 2 && h.token_bytes != 4) ||
+                impl::token_corpus_offsets_position(h) + (h.num_documents + 1)*sizeof(uint64_t) != file->size())
+                throw error("Corrupt token corpus file " + filename);
+
+            const uint64_t* offs = reinterpret_cast<const uint64_t*>(file->data() + impl::token_corpus_offsets_position(h));
+            if (offs[0] != 0 || offs[h.num_documents] != h.num_tokens)
+                throw error("Corrupt token corpus file " + filename);
+
+            mapping = file;
+            header = h;
+            offsets = offs;
+        }
+
+        bool is_open() const { return mapping != nullptr; }
+        size_t num_documents() const { return is_open() ? header.num_documents : 0; }
+        uint64_t num_tokens() const { return is_open() ? header.num_tokens : 0; }
+        size_t vocab_size() const { return is_open() ? header.vocab_size : 0; }
+        int token_bytes() const { return is_open() ? header.token_bytes : 0; }
+
+        int operator[](
+            uint64_t i
+        ) const
+        {
+            DLIB_ASSERT(i < num_tokens());
+            if (header.token_bytes == 2)
+                return reinterpret_cast<const uint16_t*>(tokens())[i];
+            return static_cast<int>(reinterpret_cast<const uint32_t*>(tokens())[i]);
+        }
+
+        uint64_t document_begin(
+            size_t d
+        ) const
+        {
+            DLIB_ASSERT(d <= num_documents());
+            return offsets[d];
+        }
+
+        size_t document_size(
+            size_t d
+        ) const
+        {
+            DLIB_ASSERT(d < num_documents());
+            return offsets[d+1] - offsets[d];
+        }
+
+        void get_document(
+            size_t d,
+            std::vector<int>& tokens_out
+        ) const
+        {
+            DLIB_CASSERT(d < num_documents());
+            get_tokens(offsets[d], offsets[d+1], tokens_out);
+        }
+
+        void get_tokens(
+            uint64_t begin,
+            uint64_t end,
+            std::vector<int>& tokens_out
+        ) const
+        {
+            DLIB_CASSERT(begin <= end && end <= num_tokens());
+            tokens_out.resize(end - begin);
+            if (header.token_bytes == 2)
+                std::copy(reinterpret_cast<const uint16_t*>(tokens()) + begin, reinterpret_cast<const uint16_t*>(tokens()) + end, tokens_out.begin());
+            else
+                std::copy(reinterpret_cast<const uint32_t*>(tokens()) + begin, reinterpret_cast<const uint32_t*>(tokens()) + end, tokens_out.begin());
+        }
+
+        const int* int_tokens(
+        ) const
+        {
+            DLIB_CASSERT(token_bytes() == 4, "The tokens are only stored as ints in corpora with 4 byte tokens");
+            return reinterpret_cast<const int*>(tokens());
+        }
+
+        std::pair<size_t, size_t> shard(
+            size_t shard_index,
+            size_t num_shards
+        ) const
+        {
+            DLIB_CASSERT(num_shards > 0 && shard_index < num_shards);
+            // Cut at the documents closest to equal numbers of tokens
+            auto cut = [&](size_t s) -> size_t {
+                if (s == 0) return 0;
+                if (s == num_shards) return num_documents();
+                const uint64_t target = num_tokens()*s/num_shards;
+                return std::lower_bound(offsets, offsets + num_documents(), target) - offsets;
+            };
+            return std::make_pair(cut(shard_index), cut(shard_index + 1));
+        }
+
+    private:
+
+        const unsigned char* tokens() const { return mapping->data() + sizeof(impl::token_corpus_header); }
+
+        std::shared_ptr<impl::mapped_file> mapping;
+        impl::token_corpus_header header = {};
+        const uint64_t* offsets = nullptr;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename tokenizer_type>
+    size_t build_token_corpus(
+        const tokenizer_type& tokenizer,
+        const std::string& directory,
+        const std::string& filename,
+        bool verbose = false
+    )
+    {
+        std::vector<file> files = get_files_in_directory_tree(dlib::directory(directory), match_all());
+        std::sort(files.begin(), files.end(),
+            [](const file& a, const file& b) { return a.full_name() < b.full_name(); });
+
+        token_corpus_writer writer(filename, tokenizer.get_vocab_size());
+
+        // The files are read and encoded in parallel, batch by batch, and written in the
+        // order of their names so the corpus doesn't depend on the number of threads
+        const size_t batch_size = 64;
+        std::vector<std::vector<int>> encoded;
+        std::vector<char> is_text;
+        size_t num_skipped = 0;
+        for (size_t batch = 0; batch < files.size(); batch += batch_size)
+        {
+            const size_t n = std::min(batch_size, files.size() - batch);
+            encoded.assign(n, std::vector<int>());
+            is_text.assign(n, 0);
+            parallel_for(0, static_cast<long>(n), [&](long i) {
+                const std::string& name = files[batch + i].full_name();
+                file_content_type type;
+                if (!detect_file_type(name, type))
+                    return;
+                std::ifstream fin(name, std::ios::binary);
+                std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+                encoded[i] = tokenizer.encode(text);
+                is_text[i] = 1;
+            }, 1);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (is_text[i])
+                    writer.add_document(encoded[i]);
+                else
+                    ++num_skipped;
+            }
+
+            if (verbose)
+            {
+                std::cout << "Encoded " << batch + n << "/" << files.size() << " files, "
+                    << writer.num_tokens() << " tokens, " << num_skipped << " binary files skipped" << std::endl;
+            }
+        }
+
+        writer.close();
+        return writer.num_documents();
+    }
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_TOKEN_CORPUS_H_
+
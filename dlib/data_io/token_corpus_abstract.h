@@ -0,0 +1,302 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#undef DLIB_TOKEN_CORPUS_ABSTRACT_H_
+#ifdef DLIB_TOKEN_CORPUS_ABSTRACT_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "language_model_data_abstract.h"
+
+namespace dlib
+{
+
+    /*!
+        TOKEN CORPUS FILE FORMAT
+            A token corpus file stores the tokens of a set of documents so that they can
+            be used for training without encoding the text again.  It holds, in order:
+                - A 40 byte header: the magic string "dlibtok1", a byte order marker,
+                  the number of bytes per token (2 or 4), the vocabulary size, the number
+                  of tokens and the number of documents.
+                - The tokens of all the documents one after the other, as uint16_t when
+                  the vocabulary has at most 65536 tokens and as uint32_t otherwise.
+                - Zero padding up to a multiple of 8 bytes.
+                - num_documents+1 uint64_t offsets, document d holding the tokens in
+                  [offset[d], offset[d+1]).
+            The values are stored in the byte order of the machine that wrote the file.
+            The file is memory mapped for reading, so opening it takes constant time and
+            the pages are loaded by the OS as they are used and shared between processes.
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    class token_corpus_writer
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object writes a token corpus file, one document at a time.
+        !*/
+
+    public:
+
+        token_corpus_writer(
+            const std::string& filename,
+            size_t vocab_size,
+            int token_bytes = 0
+        );
+        /*!
+            requires
+                - 0 < vocab_size <= 2^31
+                - token_bytes == 0, 2 or 4
+                - if (token_bytes == 2) then vocab_size <= 65536
+            ensures
+                - Creates the file filename, which will hold tokens in [0, vocab_size).
+                - #token_bytes() == token_bytes if it isn't 0, otherwise 2 if vocab_size
+                  <= 65536 and 4 otherwise.
+                - #num_documents() == 0
+            throws
+                - dlib::error if the file can't be created.
+        !*/
+
+        ~token_corpus_writer(
+        );
+        /*!
+            ensures
+                - calls close(), ignoring any error.
+        !*/
+
+        void add_document(
+            const std::vector<int>& tokens
+        );
+        /*!
+            requires
+                - close() has not been called.
+            ensures
+                - Appends a document holding tokens to the file.
+                - #num_documents() == num_documents() + 1
+                - #num_tokens() == num_tokens() + tokens.size()
+            throws
+                - dlib::error if a token is not in [0, vocab_size) or if the file can't be
+                  written.
+        !*/
+
+        size_t num_documents(
+        ) const;
+        /*!
+            ensures
+                - returns the number of documents added so far.
+        !*/
+
+        uint64_t num_tokens(
+        ) const;
+        /*!
+            ensures
+                - returns the number of tokens added so far.
+        !*/
+
+        int token_bytes(
+        ) const;
+        /*!
+            ensures
+                - returns the number of bytes used to store each token.
+        !*/
+
+        void close(
+        );
+        /*!
+            ensures
+                - Writes the document index and the header and closes the file, which can
+                  then be opened by token_corpus.  Does nothing if the file is already
+                  closed.
+            throws
+                - dlib::error if the file can't be written.
+        !*/
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    class token_corpus
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object gives random access to the tokens and documents of a token
+                corpus file, which it maps in memory.
+
+                Copies of a token_corpus share the same mapping, which is released when
+                the last of them is destroyed.  The pointer returned by int_tokens() is
+                valid as long as one of them exists.
+
+            THREAD SAFETY
+                The const member functions may be called concurrently.
+        !*/
+
+    public:
+
+        token_corpus(
+        );
+        /*!
+            ensures
+                - #is_open() == false
+        !*/
+
+        explicit token_corpus(
+            const std::string& filename
+        );
+        /*!
+            ensures
+                - calls open(filename)
+        !*/
+
+        void open(
+            const std::string& filename
+        );
+        /*!
+            ensures
+                - Maps the token corpus file filename in memory.
+                - #is_open() == true
+            throws
+                - dlib::error if the file can't be mapped, is not a token corpus, is
+                  corrupt or was written on a machine with a different byte order.  In
+                  this case *this is unchanged.
+        !*/
+
+        bool is_open(
+        ) const;
+        /*!
+            ensures
+                - returns true if a corpus has been opened.
+        !*/
+
+        size_t num_documents(
+        ) const;
+        uint64_t num_tokens(
+        ) const;
+        size_t vocab_size(
+        ) const;
+        int token_bytes(
+        ) const;
+        /*!
+            ensures
+                - return the values given to the token_corpus_writer that wrote the file,
+                  or 0 if !is_open().
+        !*/
+
+        int operator[](
+            uint64_t i
+        ) const;
+        /*!
+            requires
+                - i < num_tokens()
+            ensures
+                - returns the i-th token of the corpus.
+        !*/
+
+        uint64_t document_begin(
+            size_t d
+        ) const;
+        /*!
+            requires
+                - d <= num_documents()
+            ensures
+                - returns the index of the first token of document d, or num_tokens() if
+                  d == num_documents().
+        !*/
+
+        size_t document_size(
+            size_t d
+        ) const;
+        /*!
+            requires
+                - d < num_documents()
+            ensures
+                - returns the number of tokens of document d.
+        !*/
+
+        void get_document(
+            size_t d,
+            std::vector<int>& tokens
+        ) const;
+        /*!
+            requires
+                - d < num_documents()
+            ensures
+                - #tokens == the tokens of document d.
+        !*/
+
+        void get_tokens(
+            uint64_t begin,
+            uint64_t end,
+            std::vector<int>& tokens
+        ) const;
+        /*!
+            requires
+                - begin <= end <= num_tokens()
+            ensures
+                - #tokens.size() == end-begin
+                - for all valid i: #tokens[i] == (*this)[begin+i]
+        !*/
+
+        const int* int_tokens(
+        ) const;
+        /*!
+            requires
+                - token_bytes() == 4
+            ensures
+                - returns a pointer to the num_tokens() tokens of the corpus, read
+                  directly from the mapped file.  It can be given to
+                  build_single_token_prediction_dataset() to build token_window samples
+                  without copying the corpus.  A corpus can be written with 4 byte tokens
+                  by giving token_bytes == 4 to the token_corpus_writer.
+        !*/
+
+        std::pair<size_t, size_t> shard(
+            size_t shard_index,
+            size_t num_shards
+        ) const;
+        /*!
+            requires
+                - 0 <= shard_index < num_shards
+            ensures
+                - Splits the documents in num_shards contiguous ranges holding about the
+                  same number of tokens and returns the range [first, second) of
+                  shard_index.  This lets each process of a distributed training read
+                  its own part of the corpus.
+                - The shards cover all the documents and don't overlap.  That is,
+                  shard(0,n).first == 0, shard(n-1,n).second == num_documents() and
+                  shard(i,n).second == shard(i+1,n).first.
+        !*/
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename tokenizer_type>
+    size_t build_token_corpus(
+        const tokenizer_type& tokenizer,
+        const std::string& directory,
+        const std::string& filename,
+        bool verbose = false
+    );
+    /*!
+        requires
+            - tokenizer_type has the interface of bpe_tokenizer, i.e. encode() and
+              get_vocab_size().
+        ensures
+            - Encodes every file of the directory tree rooted at directory with
+              tokenizer and writes them in the token corpus file filename, one document
+              per file, in the order of their full names.
+            - Files that detect_file_type() doesn't find to be text are skipped, as well
+              as empty files.
+            - The files are read and encoded in parallel.
+            - If verbose is true, progress information is printed to the standard output.
+            - returns the number of documents written.
+        throws
+            - dlib::error if the corpus file can't be written.
+            - dlib::directory::dir_not_found if directory doesn't exist.
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_TOKEN_CORPUS_ABSTRACT_H_
+
@@ -66,6 +66,9 @@ namespace dlib
 
         template<typename T>
         using has_clean = decltype(std::declval<T>().clean());
+
+        template<typename T>
+        using has_set_replay_mode = decltype(std::declval<T>().set_replay_mode(bool{}));
     }
 
 // ----------------------------------------------------------------------------------------
@@ -192,6 +195,19 @@ namespace dlib
         );
     }
 
+    template <typename T>
+    void call_set_replay_mode_if_exists(T& obj, bool replay)
+    /*!
+        ensures
+            - calls obj.set_replay_mode(replay) if obj has a .set_replay_mode() method.
+    !*/
+    {
+        switch_(bools(is_detected<impl::has_set_replay_mode, T>{}),
+            [&](true_t, auto _) { _(obj).set_replay_mode(replay); },
+            [](auto...)         { /*no-op*/ }
+        );
+    }
+
 // ----------------------------------------------------------------------------------------
 
     namespace impl
@@ -1113,6 +1129,17 @@ namespace dlib
             return impl::backward_requires_forward_output(details, *subnetwork);
         }
 
+        void release_activations(
+        )
+        {
+            // Frees what forward() and back_propagate_error() recompute, but not the
+            // parameter gradients which are still needed by update_parameters().
+            x_grad.clear();
+            cached_output.clear();
+            gradient_input_is_stale = true;
+            subnetwork->release_activations();
+        }
+
         void swap(add_layer& item)
         {
             std::swap(subnetwork,item.subnetwork);
@@ -1499,6 +1526,15 @@ namespace dlib
             return impl::backward_requires_forward_output(details, wsub);
         }
 
+        void release_activations(
+        )
+        {
+            x_grad.clear();
+            cached_output.clear();
+            grad_final.clear();
+            gradient_input_is_stale = true;
+        }
+
         class subnet_wrapper
         {
         public:
@@ -1754,6 +1790,9 @@ namespace dlib
         tensor& private_get_gradient_input() 
         { return subnetwork.private_get_gradient_input(); }
 
+        void release_activations(
+        ) { subnetwork.release_activations(); }
+
         subnet_type subnetwork;
 
         // This member doesn't logically contribute to the state of the object since it is
@@ -1807,13 +1846,30 @@ namespace dlib
 
         repeat(
         ) : 
-            details(num)
+            details(num),
+            checkpointing(false),
+            bfloat16_checkpoints(false)
         {
         }
 
         size_t num_repetitions (
         ) const { return num; }
 
+        void set_checkpointing (
+            bool enabled,
+            bool bfloat16_storage = false
+        ) 
+        { 
+            checkpointing = enabled; 
+            bfloat16_checkpoints = enabled && bfloat16_storage;
+        }
+
+        bool is_checkpointing (
+        ) const { return checkpointing; }
+
+        bool uses_bfloat16_checkpoints (
+        ) const { return bfloat16_checkpoints; }
+
         const repeated_layer_type& get_repeated_layer (
             size_t i 
         ) const
@@ -1839,7 +1895,9 @@ namespace dlib
         repeat(
             const repeat<num,T,U>& item
         ) : 
-            subnetwork(item.subnetwork)
+            subnetwork(item.subnetwork),
+            checkpointing(item.checkpointing),
+            bfloat16_checkpoints(item.bfloat16_checkpoints)
         {
             for (auto&& d : item.details)
                 details.emplace_back(d);
@@ -1851,7 +1909,9 @@ namespace dlib
             U ...args2
         ): 
             details(num, std::move(arg1)),
-            subnetwork(std::move(args2)...)
+            subnetwork(std::move(args2)...),
+            checkpointing(false),
+            bfloat16_checkpoints(false)
         {
         }
 
@@ -1861,7 +1921,9 @@ namespace dlib
             U ...args2
         ): 
             details(num, arg1.data),
-            subnetwork(std::move(args2)...)
+            subnetwork(std::move(args2)...),
+            checkpointing(false),
+            bfloat16_checkpoints(false)
         {
         }
 
@@ -1872,7 +1934,9 @@ namespace dlib
             U ...args2
         ): 
             details(num, std::move(arg1)),
-            subnetwork(std::move(args2)...)
+            subnetwork(std::move(args2)...),
+            checkpointing(false),
+            bfloat16_checkpoints(false)
         {
         }
 
@@ -1909,9 +1973,38 @@ namespace dlib
         const tensor& forward(const tensor& x)
         {
             subnetwork.forward(x);
-            details[details.size()-1].forward(subnetwork.get_output());
-            for (long i = details.size()-2; i >= 0; --i)
-                details[i].forward(details[i+1].get_output());
+            if (checkpointing)
+            {
+                // Keep only the output of each repetition and let back_propagate_error()
+                // recompute the rest.  The top one is kept whole since it is the first one
+                // needed by back_propagate_error() and its output is our output.
+                checkpoints.resize(details.size());
+                compact_checkpoints.clear();
+                compact_checkpoints.resize(bfloat16_checkpoints ? details.size() : 0);
+                for (long i = details.size()-1; i > 0; --i)
+                {
+                    details[i].forward(repetition_input(i));
+                    checkpoints[i] = details[i].private_get_output();
+                    details[i].release_activations();
+                    // Once consumed, the input of this repetition can be stored in
+                    // bfloat16.  The input of the top one stays in float since it is
+                    // needed first.
+                    if (bfloat16_checkpoints && i+1 < (long)details.size())
+                    {
+                        tt::float_to_bfloat16(compact_checkpoints[i+1], checkpoints[i+1]);
+                        checkpoints[i+1].clear();
+                    }
+                }
+                details[0].forward(repetition_input(0));
+            }
+            else
+            {
+                checkpoints.clear();
+                compact_checkpoints.clear();
+                details[details.size()-1].forward(subnetwork.get_output());
+                for (long i = details.size()-2; i >= 0; --i)
+                    details[i].forward(details[i+1].get_output());
+            }
             return private_get_output();
         }
 
@@ -1956,6 +2049,30 @@ namespace dlib
             zero_gradients zero_grads = zero_gradients::yes
         )
         {
+            if (!checkpoints.empty())
+            {
+                // Run each repetition again, from its saved input, right before its own
+                // backward pass and free it as soon as the one below it is done with its
+                // gradient.  Layers drawing random numbers are told to replay the draws
+                // of the first forward() so the gradients are the same as without
+                // checkpointing.
+                details[0].back_propagate_error(repetition_input(0), gradient_input, zero_grads);
+                for (size_t i = 1; i < details.size(); ++i)
+                {
+                    const tensor& input = repetition_input(i);
+                    visit_computational_layers(details[i], [](auto& l) { call_set_replay_mode_if_exists(l, true); });
+                    details[i].forward(input);
+                    visit_computational_layers(details[i], [](auto& l) { call_set_replay_mode_if_exists(l, false); });
+                    details[i].back_propagate_error(input, details[i-1].get_final_data_gradient(), zero_grads);
+                    if (i > 1)
+                        details[i-1].release_activations();
+                }
+                subnetwork.back_propagate_error(x, details.back().get_final_data_gradient(), zero_grads);
+                if (details.size() > 1)
+                    details.back().release_activations();
+                return;
+            }
+
             if (details.size() > 1)
             {
                 details[0].back_propagate_error(details[1].get_output(), gradient_input, zero_grads);
@@ -2004,6 +2121,9 @@ namespace dlib
         void clean()
         {
             temp_tensor.clear();
+            checkpoints.clear();
+            compact_checkpoints.clear();
+            checkpoint_input.clear();
             subnetwork.clean();
             for (auto&& d : details)
                 d.clean();
@@ -2011,20 +2131,30 @@ namespace dlib
 
         friend void serialize(const repeat& item, std::ostream& out)
         {
-            int version = 1;
+            int version = 3;
             serialize(version, out);
             serialize(item.details, out);
             serialize(item.subnetwork, out);
+            serialize(item.checkpointing, out);
+            serialize(item.bfloat16_checkpoints, out);
         }
 
         friend void deserialize(repeat& item, std::istream& in)
         {
             int version = 0;
             deserialize(version, in);
-            if (version != 1)
+            if (!(1 <= version && version <= 3))
                 throw serialization_error("Unexpected version found while deserializing dlib::repeat.");
             deserialize(item.details, in);
             deserialize(item.subnetwork, in);
+            item.checkpointing = false;
+            item.bfloat16_checkpoints = false;
+            if (version >= 2)
+                deserialize(item.checkpointing, in);
+            if (version >= 3)
+                deserialize(item.bfloat16_checkpoints, in);
+            item.checkpoints.clear();
+            item.compact_checkpoints.clear();
         }
 
         friend std::ostream& operator<< (std::ostream& out, const repeat& item)
@@ -2069,9 +2199,47 @@ namespace dlib
             details[0].disable_output_and_gradient_getters();
         }
 
+        void release_activations(
+        )
+        {
+            checkpoints.clear();
+            compact_checkpoints.clear();
+            checkpoint_input.clear();
+            for (auto&& d : details)
+                d.release_activations();
+            subnetwork.release_activations();
+        }
+
+        const tensor& repetition_input(
+            size_t i
+        )
+        {
+            if (i+1 == details.size())
+                return subnetwork.get_output();
+            else if (!compact_checkpoints.empty() && !compact_checkpoints[i+1].empty())
+            {
+                tt::bfloat16_to_float(checkpoint_input, compact_checkpoints[i+1]);
+                return checkpoint_input;
+            }
+            else if (!checkpoints.empty())
+                return checkpoints[i+1];
+            else
+                return details[i+1].get_output();
+        }
+
 
         std::vector<repeated_layer_type> details; 
         subnet_type subnetwork;
+        bool checkpointing;
+
+        bool bfloat16_checkpoints;
+
+        // The outputs of the repetitions saved by forward() when checkpointing.  Empty
+        // otherwise.  With bfloat16_checkpoints all but the input of the top repetition
+        // are in compact_checkpoints, and checkpoint_input holds the one being replayed.
+        std::vector<resizable_tensor> checkpoints;
+        std::vector<bfloat16_tensor> compact_checkpoints;
+        resizable_tensor checkpoint_input;
 
         // temp_tensor doesn't logically contribute to the state of this class.
         // It is here only to void needing to reallocate it over and over.
@@ -2338,6 +2506,15 @@ namespace dlib
         tensor& private_get_gradient_input() 
         { return get_gradient_input(); }
 
+        void release_activations(
+        )
+        {
+            cached_output.clear();
+            cached_output_ptr = nullptr;
+            grad_final.clear();
+            gradient_input_is_stale = true;
+        }
+
         void swap(add_tag_layer& item)
         {
             std::swap(input_layer_, item.input_layer_);
@@ -3179,6 +3356,9 @@ namespace dlib
         tensor& private_get_gradient_input() 
         { return layer<TAG_TYPE>(subnetwork).private_get_gradient_input(); }
 
+        void release_activations(
+        ) { subnetwork.release_activations(); }
+
         subnet_type subnetwork;
 
         // This member doesn't logically contribute to the state of the object since it is
@@ -1430,9 +1430,9 @@ namespace dlib
                 repeat<2,REPEATED_LAYER,SUBNET> would create a network equivalent to REPEATED_LAYER<REPEATED_LAYER<SUBNET>>.
 
                 Also, this object provides an interface identical to the one defined by the
-                add_layer object except that we add the num_repetitions() and
-                get_repeated_layer() methods.  These additions are shown below along with
-                some additional explanatory comments.
+                add_layer object except that we add the num_repetitions(),
+                get_repeated_layer() and checkpointing methods.  These additions are shown
+                below along with some additional explanatory comments.
         !*/
 
     public:
@@ -1505,6 +1505,60 @@ namespace dlib
                   instance of REPEATED_LAYER that is stacked immediately on top of SUBNET.
         !*/
 
+        void set_checkpointing (
+            bool enabled,
+            bool bfloat16_storage = false
+        );
+        /*!
+            ensures
+                - #is_checkpointing() == enabled
+                - #uses_bfloat16_checkpoints() == (enabled && bfloat16_storage)
+        !*/
+
+        bool is_checkpointing (
+        ) const;
+        /*!
+            ensures
+                - returns true if this object trades compute for memory by recomputing the
+                  activations of its repetitions during back_propagate_error().  It is
+                  false by default.
+
+                  When true, forward() keeps only the output of each REPEATED_LAYER
+                  instance and frees the outputs and gradients of the layers inside all of
+                  them but the top one.  back_propagate_error() then runs each instance
+                  forward again, from its saved input, right before propagating through it,
+                  and frees it once the gradient has been passed below.  So only one
+                  instance holds its activations at a time instead of all num of them, for
+                  the price of one extra forward pass through every instance but the top
+                  one.  The outputs, parameter gradients and data gradients are the same as
+                  with checkpointing disabled, provided the layers of REPEATED_LAYER
+                  compute their outputs deterministically.  Layers drawing random numbers
+                  in forward, like dropout_, are put in replay mode by calling
+                  set_replay_mode() on them during the recomputation.  Note that layers
+                  updating some state in forward, like bn_ running statistics, update it
+                  twice.
+                - Within the repetitions other than the top one, the gradients are always
+                  zeroed between calls to back_propagate_error(), whatever its zero_grads
+                  argument.
+                - This setting is serialized.  See also set_all_checkpointing() in
+                  visitors_abstract.h.
+        !*/
+
+        bool uses_bfloat16_checkpoints (
+        ) const;
+        /*!
+            ensures
+                - returns true if, when checkpointing, the saved outputs of the
+                  repetitions are stored as bfloat16 (see bfloat16_tensor), halving the
+                  memory they use.  The input of the top repetition is kept in float.
+                  The other repetitions are recomputed from their rounded inputs, so the
+                  gradients are no longer exactly the ones computed without
+                  checkpointing, but only differ by the bfloat16 rounding of these inputs
+                  (a relative error of at most 2^-8 per value).  The outputs of forward()
+                  are unaffected.
+                - This setting is serialized.
+        !*/
+
         const subnet_type& subnet(
         ) const; 
         /*!
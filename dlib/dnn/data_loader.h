@@ -0,0 +1,200 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#ifndef DLIB_DNN_DATA_LOADER_H_
+#define DLIB_DNN_DATA_LOADER_H_
+
+#include "data_loader_abstract.h"
+#include "../cuda/tensor.h"
+#include "core.h"
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    template <
+        typename input_type,
+        typename label_type
+        >
+    struct prefetched_batch
+    {
+        unsigned long long index = 0;
+        std::vector<input_type> samples;
+        std::vector<label_type> labels;
+        resizable_tensor data;
+    };
+
+    template <typename input_type, typename label_type>
+    void swap(prefetched_batch<input_type,label_type>& a, prefetched_batch<input_type,label_type>& b)
+    {
+        std::swap(a.index, b.index);
+        a.samples.swap(b.samples);
+        a.labels.swap(b.labels);
+        a.data.swap(b.data);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    template <
+        typename net_type
+        >
+    class data_loader
+    {
+    public:
+        typedef typename net_type::input_type input_type;
+        typedef typename net_type::training_label_type label_type;
+        typedef prefetched_batch<input_type,label_type> batch_type;
+        typedef std::function<void(unsigned long long, std::vector<input_type>&, std::vector<label_type>&)> batch_maker_type;
+
+        data_loader(
+            const net_type& net,
+            batch_maker_type make_batch_,
+            size_t num_workers = std::thread::hardware_concurrency(),
+            size_t max_prefetched_batches = 0,
+            bool deterministic_ = true
+        ) :
+            input_layer(net.input_layer()),
+            make_batch(std::move(make_batch_)),
+            deterministic(deterministic_)
+        {
+            DLIB_CASSERT(make_batch != nullptr);
+            num_workers = std::max<size_t>(num_workers, 1);
+            max_batches = max_prefetched_batches != 0 ? max_prefetched_batches : 2*num_workers;
+            DLIB_CASSERT(max_batches >= num_workers,
+                "Each worker needs room for the batch it is making."
+                << "\n\t num_workers: " << num_workers
+                << "\n\t max_prefetched_batches: " << max_prefetched_batches);
+
+            for (size_t i = 0; i < num_workers; ++i)
+                workers.emplace_back([this]() { worker_loop(); });
+        }
+
+        data_loader(const data_loader&) = delete;
+        data_loader& operator=(const data_loader&) = delete;
+
+        ~data_loader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m);
+                stopped = true;
+            }
+            worker_cv.notify_all();
+            for (auto& w : workers)
+                w.join();
+        }
+
+        size_t get_num_workers() const { return workers.size(); }
+        size_t get_max_prefetched_batches() const { return max_batches; }
+        bool is_deterministic() const { return deterministic; }
+
+        void get_next_batch(
+            batch_type& batch
+        )
+        {
+            std::unique_lock<std::mutex> lock(m);
+            consumer_cv.wait(lock, [&]() {
+                return error != nullptr ||
+                    (deterministic ? ready.count(next_to_deliver) != 0 : !ready.empty());
+            });
+            if (error != nullptr)
+                std::rethrow_exception(error);
+
+            auto it = deterministic ? ready.find(next_to_deliver) : ready.begin();
+            swap(batch, it->second);
+            // The buffers of the batch given back are used again by the workers
+            free_batches.push_back(std::move(it->second));
+            ready.erase(it);
+            ++next_to_deliver;
+            lock.unlock();
+            worker_cv.notify_one();
+        }
+
+    private:
+
+        void worker_loop()
+        {
+            batch_type batch;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    // The batches being made and the ones waiting to be taken are bounded
+                    // by max_batches, counted from the next batch to deliver.
+                    worker_cv.wait(lock, [&]() {
+                        return stopped || next_index < next_to_deliver + max_batches;
+                    });
+                    if (stopped)
+                        return;
+                    if (!free_batches.empty())
+                    {
+                        swap(batch, free_batches.back());
+                        free_batches.pop_back();
+                    }
+                    batch.index = next_index++;
+                }
+
+                try
+                {
+                    batch.samples.clear();
+                    batch.labels.clear();
+                    make_batch(batch.index, batch.samples, batch.labels);
+                    DLIB_CASSERT(batch.samples.size() > 0, "The batch maker made an empty batch.");
+                    DLIB_CASSERT(batch.labels.size() == batch.samples.size() ||
+                        (std::is_same<label_type, no_label_type>::value && batch.labels.size() == 0),
+                        "The batch maker must give one label per sample."
+                        << "\n\t batch.samples.size(): " << batch.samples.size()
+                        << "\n\t batch.labels.size(): " << batch.labels.size());
+                    input_layer.to_tensor(batch.samples.begin(), batch.samples.end(), batch.data);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    if (error == nullptr)
+                        error = std::current_exception();
+                    stopped = true;
+                    consumer_cv.notify_all();
+                    worker_cv.notify_all();
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m);
+                    const unsigned long long index = batch.index;
+                    swap(ready[index], batch);
+                }
+                consumer_cv.notify_one();
+            }
+        }
+
+        const typename net_type::input_layer_type input_layer;
+        const batch_maker_type make_batch;
+        const bool deterministic;
+        size_t max_batches;
+
+        std::mutex m;
+        std::condition_variable worker_cv;
+        std::condition_variable consumer_cv;
+        bool stopped = false;
+        std::exception_ptr error;
+        unsigned long long next_index = 0;
+        unsigned long long next_to_deliver = 0;
+        std::map<unsigned long long, batch_type> ready;
+        std::vector<batch_type> free_batches;
+        std::vector<std::thread> workers;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_DATA_LOADER_H_
+
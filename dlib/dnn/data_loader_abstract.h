@@ -0,0 +1,178 @@
+// Copyright (C) 2026  Cydral Technology (cydraltechnology@gmail.com)
+// License: Boost Software License   See LICENSE.txt for the full license.
+#undef DLIB_DNN_DATA_LOADER_ABSTRACT_H_
+#ifdef DLIB_DNN_DATA_LOADER_ABSTRACT_H_
+
+#include "../cuda/tensor_abstract.h"
+#include <vector>
+#include <functional>
+
+namespace dlib
+{
+
+// ----------------------------------------------------------------------------------------
+
+    template <
+        typename input_type,
+        typename label_type
+        >
+    struct prefetched_batch
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object is a mini-batch made by a data_loader: its samples, their
+                labels and the tensor made from the samples by the input layer of the
+                network.  It can be given directly to dnn_trainer::train_one_step().
+
+                Its buffers are reused: when a batch is given to
+                data_loader::get_next_batch() or dnn_trainer::train_one_step(), its
+                memory is exchanged with the memory of other batches instead of being
+                allocated again.  When dlib uses CUDA the memory of a resizable_tensor is
+                pinned, so data is copied to the GPU asynchronously.
+        !*/
+
+        unsigned long long index = 0;
+        std::vector<input_type> samples;
+        std::vector<label_type> labels;
+        resizable_tensor data;
+    };
+
+    template <typename input_type, typename label_type>
+    void swap(
+        prefetched_batch<input_type,label_type>& a,
+        prefetched_batch<input_type,label_type>& b
+    );
+    /*!
+        provides a global swap function
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    template <
+        typename net_type
+        >
+    class data_loader
+    {
+        /*!
+            REQUIREMENTS ON net_type
+                net_type is an add_loss_layer object.
+
+            WHAT THIS OBJECT REPRESENTS
+                This object makes the mini-batches of a training in background threads,
+                so that loading, decoding and augmenting the data doesn't stall the
+                training steps.  Each of its worker threads repeatedly:
+                    - takes the index of the next batch to make,
+                    - calls the user supplied batch maker to fill the samples and labels
+                      of the batch,
+                    - converts the samples to a tensor with a copy of the input layer of
+                      the network.
+                At most get_max_prefetched_batches() batches are made ahead of the
+                training, which bounds the memory used.
+
+                The batches are numbered 0, 1, 2, ... and the stream never ends: the
+                batch maker decides what batch i holds, for instance the i-th mini-batch
+                of a shuffled epoch.  Seeding the random number generators of the batch
+                maker with the batch index makes the content of each batch independent of
+                the number of threads.
+
+                A typical training loop is:
+                    data_loader<net_type> loader(net, make_batch);
+                    dnn_trainer<net_type> trainer(net);
+                    prefetched_batch<...> batch;  // or data_loader<net_type>::batch_type
+                    while (trainer.get_learning_rate() >= 1e-5)
+                    {
+                        loader.get_next_batch(batch);
+                        trainer.train_one_step(batch);
+                    }
+
+            THREAD SAFETY
+                get_next_batch() must be called from one thread at a time.  The batch
+                maker is called concurrently from the worker threads.
+        !*/
+
+    public:
+        typedef typename net_type::input_type input_type;
+        typedef typename net_type::training_label_type label_type;
+        typedef prefetched_batch<input_type,label_type> batch_type;
+        typedef std::function<void(unsigned long long, std::vector<input_type>&, std::vector<label_type>&)> batch_maker_type;
+
+        data_loader(
+            const net_type& net,
+            batch_maker_type make_batch,
+            size_t num_workers = std::thread::hardware_concurrency(),
+            size_t max_prefetched_batches = 0,
+            bool deterministic = true
+        );
+        /*!
+            requires
+                - make_batch != nullptr
+                - make_batch(index, samples, labels) must be callable concurrently.  It is
+                  given empty samples and labels vectors and must push the samples of
+                  batch number index into samples and their labels into labels.  It must
+                  make at least one sample.  If net_type has an unsupervised loss then
+                  labels may be left empty.
+                - max_prefetched_batches == 0 or max_prefetched_batches >= num_workers
+            ensures
+                - Starts max(num_workers,1) threads making batches with make_batch.  The
+                  input layer of net is copied, net itself is not used by the workers.
+                - #get_num_workers() == max(num_workers,1)
+                - #get_max_prefetched_batches() == max_prefetched_batches, or
+                  2*get_num_workers() if max_prefetched_batches == 0.
+                - #is_deterministic() == deterministic
+        !*/
+
+        ~data_loader(
+        );
+        /*!
+            ensures
+                - Stops the worker threads, waiting for the batches being made.
+        !*/
+
+        size_t get_num_workers(
+        ) const;
+        /*!
+            ensures
+                - returns the number of threads making batches.
+        !*/
+
+        size_t get_max_prefetched_batches(
+        ) const;
+        /*!
+            ensures
+                - returns the maximum number of batches made or being made ahead of the
+                  ones taken by get_next_batch().
+        !*/
+
+        bool is_deterministic(
+        ) const;
+        /*!
+            ensures
+                - returns true if get_next_batch() returns the batches in the order of
+                  their indices.  Otherwise they are returned as soon as they are ready,
+                  which avoids waiting for a slow batch when the order doesn't matter.
+        !*/
+
+        void get_next_batch(
+            batch_type& batch
+        );
+        /*!
+            ensures
+                - Waits for a batch to be ready and swaps it with batch.  The former
+                  content of batch is reused for a later batch.
+                - #batch.samples and #batch.labels are the ones made by the batch maker
+                  for batch number #batch.index, and #batch.data is the tensor made from
+                  #batch.samples by the input layer of the network.
+                - if (is_deterministic()) then the k-th call returns batch number k-1.
+                - else each batch is returned once, in the order they became ready.
+            throws
+                - Rethrows the first exception thrown by the batch maker or by the input
+                  layer.  The workers are stopped when this happens.
+        !*/
+    };
+
+// ----------------------------------------------------------------------------------------
+
+}
+
+#endif // DLIB_DNN_DATA_LOADER_ABSTRACT_H_
+
@@ -467,6 +467,124 @@ namespace dlib
         avg_blue(item.get_avg_blue())
     {}
 
+// ----------------------------------------------------------------------------------------
+
+    class token_window
+    {
+    public:
+        token_window() = default;
+
+        token_window(
+            const int* tokens_,
+            long num_tokens_,
+            long start_,
+            long length_,
+            int padding_token_
+        ) : tokens(tokens_), num_tokens(num_tokens_), start(start_), length(length_), padding_token(padding_token_)
+        {
+            DLIB_ASSERT(num_tokens >= 0 && length >= 0);
+            DLIB_ASSERT(tokens != nullptr || num_tokens == 0);
+        }
+
+        long size() const { return length; }
+        long nr() const { return length; }
+        long nc() const { return 1; }
+
+        int operator()(long i) const
+        {
+            DLIB_ASSERT(0 <= i && i < length);
+            const long idx = start + i;
+            return (idx >= 0 && idx < num_tokens) ? tokens[idx] : padding_token;
+        }
+
+        template <typename T>
+        void copy_to(T* dest) const
+        {
+            // Only the ends of the window can fall outside of the token array
+            const long first = std::min(length, std::max(0L, -start));
+            const long last = std::max(first, std::min(length, num_tokens - start));
+            for (long i = 0; i < first; ++i) dest[i] = static_cast<T>(padding_token);
+            const int* src = tokens + (start + first);
+            for (long i = first; i < last; ++i) dest[i] = static_cast<T>(*src++);
+            for (long i = last; i < length; ++i) dest[i] = static_cast<T>(padding_token);
+        }
+
+        matrix<int,0,1> to_matrix() const
+        {
+            matrix<int,0,1> m(length);
+            copy_to(&m(0));
+            return m;
+        }
+
+    private:
+        const int* tokens = nullptr;
+        long num_tokens = 0;
+        long start = 0;
+        long length = 0;
+        int padding_token = 0;
+    };
+
+    template <>
+    class input<token_window>
+    {
+    public:
+        typedef token_window input_type;
+
+        input() {}
+
+        template <typename forward_iterator>
+        void to_tensor (
+            forward_iterator ibegin,
+            forward_iterator iend,
+            resizable_tensor& data
+        ) const
+        {
+            DLIB_CASSERT(std::distance(ibegin,iend) > 0);
+            const long nr = ibegin->size();
+            for (auto i = ibegin; i != iend; ++i)
+            {
+                DLIB_CASSERT(i->size() == nr,
+                    "\t input<token_window>::to_tensor()"
+                    << "\n\t All windows given to to_tensor() must have the same size."
+                    << "\n\t nr: " << nr
+                    << "\n\t i->size(): " << i->size()
+                );
+            }
+
+            data.set_size(std::distance(ibegin,iend), 1, nr, 1);
+            float* ptr = data.host_write_only();
+            for (auto i = ibegin; i != iend; ++i, ptr += nr)
+                i->copy_to(ptr);
+        }
+
+        // The tensors are the ones made by input<matrix<int,0,1>> so the networks are
+        // saved the same way, and a network trained on windows can be loaded by one
+        // taking matrices.
+        friend void serialize(const input& /*item*/, std::ostream& out)
+        {
+            serialize("input<matrix>", out);
+        }
+
+        friend void deserialize(input& /*item*/, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "input<matrix>")
+                throw serialization_error("Unexpected version found while deserializing dlib::input<token_window>.");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const input& /*item*/)
+        {
+            out << "input<token_window>";
+            return out;
+        }
+
+        friend void to_xml(const input& /*item*/, std::ostream& out)
+        {
+            out << "<input/>\n";
+        }
+    };
+
 // ----------------------------------------------------------------------------------------
 
     template <typename T, long NR, long NC, typename MM, typename L>
@@ -480,6 +598,8 @@ namespace dlib
         template <typename mm>
         input(const input<array2d<T,mm>>&) {}
 
+        input(const input<token_window>&) {}
+
         bool image_contained_point ( const tensor& data, const point& p) const { return get_rect(data).contains(p); }
         drectangle tensor_space_to_image_space ( const tensor& /*data*/, drectangle r) const { return r; }
         drectangle image_space_to_tensor_space ( const tensor& /*data*/, double /*scale*/, drectangle r ) const { return r; }
@@ -167,6 +167,136 @@ namespace dlib
         drectangle image_space_to_tensor_space ( const tensor& /*data*/, double /*scale*/, drectangle r ) const { return r; }
     };
 
+// ----------------------------------------------------------------------------------------
+
+    class token_window
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object is a read-only view of length consecutive tokens of a token
+                array, starting at index start.  The positions falling outside of the
+                array read as a padding token.  It does not copy the tokens, so a dataset
+                of sliding windows over a corpus of N tokens takes O(N) memory instead of
+                O(N*window length), and the array can be memory mapped.
+
+                The token array must outlive the windows referring to it.
+
+                It is the input type of input<token_window>, which writes the windows
+                directly into the input tensor of a network.
+        !*/
+
+    public:
+
+        token_window(
+        );
+        /*!
+            ensures
+                - #size() == 0
+        !*/
+
+        token_window(
+            const int* tokens,
+            long num_tokens,
+            long start,
+            long length,
+            int padding_token
+        );
+        /*!
+            requires
+                - num_tokens >= 0
+                - length >= 0
+                - tokens points to num_tokens ints (or num_tokens == 0)
+            ensures
+                - #size() == length
+                - for all 0 <= i < length:
+                    - if 0 <= start+i < num_tokens then #(*this)(i) == tokens[start+i]
+                    - else #(*this)(i) == padding_token
+        !*/
+
+        long size(
+        ) const;
+        long nr(
+        ) const;
+        /*!
+            ensures
+                - returns the number of tokens in this window.
+        !*/
+
+        long nc(
+        ) const;
+        /*!
+            ensures
+                - returns 1.  Like nr(), this is provided so that a window can be used
+                  where a matrix<int,0,1> of tokens is expected.
+        !*/
+
+        int operator()(
+            long i
+        ) const;
+        /*!
+            requires
+                - 0 <= i < size()
+            ensures
+                - returns the i-th token of the window.
+        !*/
+
+        template <typename T>
+        void copy_to(
+            T* dest
+        ) const;
+        /*!
+            requires
+                - dest points to size() elements
+            ensures
+                - for all 0 <= i < size(): #dest[i] == static_cast<T>((*this)(i))
+        !*/
+
+        matrix<int,0,1> to_matrix(
+        ) const;
+        /*!
+            ensures
+                - returns a copy of the tokens of this window.
+        !*/
+    };
+
+    template <>
+    class input<token_window>
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This input layer takes token_window objects and makes the same tensors as
+                input<matrix<int,0,1>> does from matrices holding the same tokens: a window
+                of R tokens becomes a sample with k()==1, nr()==R and nc()==1.  The tokens
+                are copied straight from the token array into the tensor.
+
+                It is serialized like input<matrix<int,0,1>> and that layer can be
+                constructed from it, so a network trained on windows can be saved and
+                then loaded, or copied, into a network taking matrices for inference.
+        !*/
+
+    public:
+        typedef token_window input_type;
+
+        template <typename forward_iterator>
+        void to_tensor (
+            forward_iterator ibegin,
+            forward_iterator iend,
+            resizable_tensor& data
+        ) const;
+        /*!
+            requires
+                - [ibegin, iend) is an iterator range over token_window objects.
+                - std::distance(ibegin,iend) > 0
+                - All the windows have the same size().
+            ensures
+                - #data.num_samples() == std::distance(ibegin,iend)
+                - #data.k() == 1
+                - #data.nr() == ibegin->size()
+                - #data.nc() == 1
+                - The n-th sample of #data holds the tokens of the n-th window.
+        !*/
+    };
+
 // ----------------------------------------------------------------------------------------
 
     class input_rgb_image
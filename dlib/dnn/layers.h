@@ -1583,6 +1583,14 @@ namespace dlib
 
         double get_eps() const { return eps; }
 
+        void disable()
+        {
+            params.clear();
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         double get_learning_rate_multiplier () const  { return learning_rate_multiplier; }
         double get_weight_decay_multiplier () const   { return weight_decay_multiplier; }
         void set_learning_rate_multiplier(double val) { learning_rate_multiplier = val; }
@@ -1611,6 +1619,12 @@ namespace dlib
         template <typename SUBNET>
         void forward(const SUBNET& sub, resizable_tensor& output)
         {
+            if (disabled)
+            {
+                // The linear_ layer above normalizes its own input
+                output.clear();
+                return;
+            }
             auto g = gamma(params,0);
             auto b = beta(params,gamma.size());
             tt::layer_normalize(eps, output, means, invstds, sub.get_output(), g, b);
@@ -1619,6 +1633,7 @@ namespace dlib
         template <typename SUBNET>
         void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad)
         {
+            DLIB_CASSERT(!disabled, "A layer_norm_ fused by fuse_layers() can only be used for inference.");
             auto g = gamma(params, 0);
             auto g_grad = gamma(params_grad, 0);
             auto b_grad = beta(params_grad, gamma.size());
@@ -1630,7 +1645,7 @@ namespace dlib
 
         friend void serialize(const layer_norm_& item, std::ostream& out)
         {
-            serialize("layer_norm_", out);
+            serialize("layer_norm_2", out);
             serialize(item.params, out);
             serialize(item.gamma, out);
             serialize(item.beta, out);
@@ -1641,13 +1656,14 @@ namespace dlib
             serialize(item.bias_learning_rate_multiplier, out);
             serialize(item.bias_weight_decay_multiplier, out);
             serialize(item.eps, out);
+            serialize(item.disabled, out);
         }
 
         friend void deserialize(layer_norm_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "layer_norm_")
+            if (version != "layer_norm_" && version != "layer_norm_2")
                 throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::layer_norm_.");
             deserialize(item.params, in);
             deserialize(item.gamma, in);
@@ -1659,6 +1675,9 @@ namespace dlib
             deserialize(item.bias_learning_rate_multiplier, in);
             deserialize(item.bias_weight_decay_multiplier, in);
             deserialize(item.eps, in);
+            item.disabled = false;
+            if (version == "layer_norm_2")
+                deserialize(item.disabled, in);
         }
 
         friend std::ostream& operator<<(std::ostream& out, const layer_norm_& item)
@@ -1669,6 +1688,8 @@ namespace dlib
             out << " weight_decay_mult="<<item.weight_decay_multiplier;
             out << " bias_learning_rate_mult="<<item.bias_learning_rate_multiplier;
             out << " bias_weight_decay_mult="<<item.bias_weight_decay_multiplier;
+            if (item.disabled)
+                out << " (disabled)";
             return out;
         }
 
@@ -1680,6 +1701,8 @@ namespace dlib
             out << " weight_decay_mult='"<<item.weight_decay_multiplier<<"'";
             out << " bias_learning_rate_mult='"<<item.bias_learning_rate_multiplier<<"'";
             out << " bias_weight_decay_mult='"<<item.bias_weight_decay_multiplier<<"'";
+            if (item.disabled)
+                out << " disabled='true'";
             out << ">\n";
             out << mat(item.params);
             out << "</layer_norm>\n";
@@ -1695,6 +1718,7 @@ namespace dlib
         double bias_learning_rate_multiplier;
         double bias_weight_decay_multiplier;
         double eps;
+        bool disabled = false;
     };
 
     template <typename SUBNET>
@@ -1720,6 +1744,14 @@ namespace dlib
 
         double get_eps() const { return eps; }
 
+        void disable()
+        {
+            params.clear();
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         double get_learning_rate_multiplier() const { return learning_rate_multiplier; }
         double get_weight_decay_multiplier() const { return weight_decay_multiplier; }
         void set_learning_rate_multiplier(double val) { learning_rate_multiplier = val; }
@@ -1744,6 +1776,12 @@ namespace dlib
         template <typename SUBNET>
         void forward(const SUBNET& sub, resizable_tensor& output)
         {
+            if (disabled)
+            {
+                // The linear_ layer above normalizes its own input
+                output.clear();
+                return;
+            }
             auto g = gamma(params, 0);
             tt::rms_normalize(eps, output, scale, sub.get_output(), g);
         }
@@ -1751,6 +1789,7 @@ namespace dlib
         template <typename SUBNET>
         void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad)
         {
+            DLIB_CASSERT(!disabled, "A rms_norm_ fused by fuse_layers() can only be used for inference.");
             auto g = gamma(params, 0);
             auto g_grad = gamma(params_grad, 0);
             tt::rms_normalize_gradient(gradient_input, scale, sub.get_output(), g, sub.get_gradient_input(), g_grad, dscale);
@@ -1761,7 +1800,7 @@ namespace dlib
 
         friend void serialize(const rms_norm_& item, std::ostream& out)
         {
-            serialize("rms_norm_", out);
+            serialize("rms_norm_2", out);
             serialize(item.params, out);
             serialize(item.gamma, out);
             serialize(item.learning_rate_multiplier, out);
@@ -1769,13 +1808,14 @@ namespace dlib
             serialize(item.bias_learning_rate_multiplier, out);
             serialize(item.bias_weight_decay_multiplier, out);
             serialize(item.eps, out);
+            serialize(item.disabled, out);
         }
 
         friend void deserialize(rms_norm_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "rms_norm_")
+            if (version != "rms_norm_" && version != "rms_norm_2")
                 throw serialization_error("Unexpected version '" + version + "' found while deserializing dlib::rms_norm_.");
             deserialize(item.params, in);
             deserialize(item.gamma, in);
@@ -1784,6 +1824,9 @@ namespace dlib
             deserialize(item.bias_learning_rate_multiplier, in);
             deserialize(item.bias_weight_decay_multiplier, in);
             deserialize(item.eps, in);
+            item.disabled = false;
+            if (version == "rms_norm_2")
+                deserialize(item.disabled, in);
         }
 
         friend std::ostream& operator<<(std::ostream& out, const rms_norm_& item)
@@ -1794,6 +1837,8 @@ namespace dlib
             out << " weight_decay_mult=" << item.weight_decay_multiplier;
             out << " bias_learning_rate_mult=" << item.bias_learning_rate_multiplier;
             out << " bias_weight_decay_mult=" << item.bias_weight_decay_multiplier;
+            if (item.disabled)
+                out << " (disabled)";
             return out;
         }
 
@@ -1805,6 +1850,8 @@ namespace dlib
             out << " weight_decay_mult='" << item.weight_decay_multiplier << "'";
             out << " bias_learning_rate_mult='" << item.bias_learning_rate_multiplier << "'";
             out << " bias_weight_decay_mult='" << item.bias_weight_decay_multiplier << "'";
+            if (item.disabled)
+                out << " disabled='true'";
             out << ">\n";
             out << mat(item.params);
             out << "</rms_norm>\n";
@@ -1820,11 +1867,151 @@ namespace dlib
         double bias_learning_rate_multiplier;
         double bias_weight_decay_multiplier;
         double eps;
+        bool disabled = false;
     };
 
     template <typename SUBNET>
     using rms_norm = add_layer<rms_norm_, SUBNET>;
 
+// ----------------------------------------------------------------------------------------
+
+    class token_rms_norm_
+    {
+    public:
+        explicit token_rms_norm_(
+            double eps_ = DEFAULT_RMS_NORM_EPS
+        ) :
+            learning_rate_multiplier(1),
+            weight_decay_multiplier(0),
+            eps(eps_)
+        {
+        }
+
+        double get_eps() const { return eps; }
+
+        void disable()
+        {
+            params.clear();
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
+        double get_learning_rate_multiplier() const { return learning_rate_multiplier; }
+        double get_weight_decay_multiplier() const { return weight_decay_multiplier; }
+        void set_learning_rate_multiplier(double val) { learning_rate_multiplier = val; }
+        void set_weight_decay_multiplier(double val) { weight_decay_multiplier = val; }
+
+        inline dpoint map_input_to_output(const dpoint& p) const { return p; }
+        inline dpoint map_output_to_input(const dpoint& p) const { return p; }
+
+        template <typename SUBNET>
+        void setup(const SUBNET& sub)
+        {
+            gamma = alias_tensor(1, sub.get_output().nc());
+            params.set_size(gamma.size());
+            gamma(params, 0) = 1;
+        }
+
+        template <typename SUBNET>
+        void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            if (disabled)
+            {
+                // The linear_ layer above normalizes its own input
+                output.clear();
+                return;
+            }
+            // Every row of the input is viewed as a sample of its own so that the RMS
+            // statistics never mix different sequence positions.
+            const tensor& input = sub.get_output();
+            auto rows = alias_tensor(input.num_samples() * input.k() * input.nr(), input.nc());
+            auto g = gamma(params, 0);
+            tt::rms_normalize(eps, output, scale, rows(input, 0), g);
+            output.set_size(input.num_samples(), input.k(), input.nr(), input.nc());
+        }
+
+        template <typename SUBNET>
+        void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad)
+        {
+            DLIB_CASSERT(!disabled, "A token_rms_norm_ fused by fuse_layers() can only be used for inference.");
+            const tensor& input = sub.get_output();
+            auto rows = alias_tensor(input.num_samples() * input.k() * input.nr(), input.nc());
+            auto g = gamma(params, 0);
+            auto g_grad = gamma(params_grad, 0);
+            auto prev_grad = rows(sub.get_gradient_input(), 0);
+            tt::rms_normalize_gradient(rows(gradient_input, 0), scale, rows(input, 0), g,
+                prev_grad, g_grad, dscale);
+        }
+
+        const tensor& get_layer_params() const { return params; };
+        tensor& get_layer_params() { return params; };
+
+        friend void serialize(const token_rms_norm_& item, std::ostream& out)
+        {
+            serialize("token_rms_norm_2", out);
+            serialize(item.params, out);
+            serialize(item.gamma, out);
+            serialize(item.learning_rate_multiplier, out);
+            serialize(item.weight_decay_multiplier, out);
+            serialize(item.eps, out);
+            serialize(item.disabled, out);
+        }
+
+        friend void deserialize(token_rms_norm_& item, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "token_rms_norm_" && version != "token_rms_norm_2")
+                throw serialization_error("Unexpected version '" + version + "' found while deserializing dlib::token_rms_norm_.");
+            deserialize(item.params, in);
+            deserialize(item.gamma, in);
+            deserialize(item.learning_rate_multiplier, in);
+            deserialize(item.weight_decay_multiplier, in);
+            deserialize(item.eps, in);
+            item.disabled = false;
+            if (version == "token_rms_norm_2")
+                deserialize(item.disabled, in);
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const token_rms_norm_& item)
+        {
+            out << "token_rms_norm";
+            out << " (eps=" << item.eps << ")";
+            out << " learning_rate_mult=" << item.learning_rate_multiplier;
+            out << " weight_decay_mult=" << item.weight_decay_multiplier;
+            if (item.disabled)
+                out << " (disabled)";
+            return out;
+        }
+
+        friend void to_xml(const token_rms_norm_& item, std::ostream& out)
+        {
+            out << "<token_rms_norm";
+            out << " eps='" << item.eps << "'";
+            out << " learning_rate_mult='" << item.learning_rate_multiplier << "'";
+            out << " weight_decay_mult='" << item.weight_decay_multiplier << "'";
+            if (item.disabled)
+                out << " disabled='true'";
+            out << ">\n";
+            out << mat(item.params);
+            out << "</token_rms_norm>\n";
+        }
+
+    private:
+        resizable_tensor params;
+        alias_tensor gamma;
+        resizable_tensor scale;
+        resizable_tensor dscale;
+        double learning_rate_multiplier;
+        double weight_decay_multiplier;
+        double eps;
+        bool disabled = false;
+    };
+
+    template <typename SUBNET>
+    using token_rms_norm = add_layer<token_rms_norm_, SUBNET>;
+
 // ----------------------------------------------------------------------------------------
     enum layer_mode
     {
@@ -2153,8 +2340,15 @@ namespace dlib
                 "The size of the input tensor to this fc layer doesn't match the size the fc layer was trained with.");
             output.set_size(sub.get_output().num_samples(), num_outputs);
 
-            auto w = weights(params, 0);
-            tt::gemm(0,output, 1,sub.get_output(),false, w,false);
+            if (is_quantized())
+            {
+                tt::quantized_gemm(output, sub.get_output(), qweights);
+            }
+            else
+            {
+                auto w = weights(params, 0);
+                tt::gemm(0,output, 1,sub.get_output(),false, w,false);
+            }
             if (bias_mode == FC_HAS_BIAS && use_bias)
             {
                 auto b = biases(params, weights.size());
@@ -2165,6 +2359,8 @@ namespace dlib
         template <typename SUBNET>
         void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad)
         {
+            DLIB_CASSERT(!is_quantized(), "A quantized fc_ layer can only be used for inference.");
+
             // no point computing the parameter gradients if they won't be used.
             if (learning_rate_multiplier != 0)
             {
@@ -2187,14 +2383,37 @@ namespace dlib
 
         alias_tensor_instance get_weights()
         {
+            DLIB_CASSERT(!is_quantized(), "The float weights of a quantized fc_ layer are gone, use get_quantized_weights().");
             return weights(params, 0);
         }
 
         alias_tensor_const_instance get_weights() const
         {
+            DLIB_CASSERT(!is_quantized(), "The float weights of a quantized fc_ layer are gone, use get_quantized_weights().");
             return weights(params, 0);
         }
 
+        void quantize(int bits = 8)
+        {
+            DLIB_CASSERT(bits == 8 || bits == 4 || bits == 16, "bits: " << bits);
+            if (is_quantized())
+                return;
+            DLIB_CASSERT(params.size() != 0, "The fc_ layer must be allocated before it can be quantized.");
+
+            // Each output gets its own scale, so the weights are stored transposed
+            qweights.quantize(get_weights(), true, bits);
+
+            // Only the biases, if any, are left in params
+            resizable_tensor b;
+            if (bias_mode == FC_HAS_BIAS && use_bias)
+                b = biases(params, weights.size());
+            weights = alias_tensor();
+            params = b;
+        }
+
+        bool is_quantized() const { return !qweights.empty(); }
+        const quantized_matrix& get_quantized_weights() const { return qweights; }
+
         alias_tensor_instance get_biases()
         {
             static_assert(bias_mode == FC_HAS_BIAS, "This fc_ layer doesn't have a bias vector "
@@ -2214,7 +2433,7 @@ namespace dlib
 
         friend void serialize(const fc_& item, std::ostream& out)
         {
-            serialize("fc_3", out);
+            serialize("fc_4", out);
             serialize(item.num_outputs, out);
             serialize(item.num_inputs, out);
             serialize(item.params, out);
@@ -2226,13 +2445,14 @@ namespace dlib
             serialize(item.bias_learning_rate_multiplier, out);
             serialize(item.bias_weight_decay_multiplier, out);
             serialize(item.use_bias, out);
+            serialize(item.qweights, out);
         }
 
         friend void deserialize(fc_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version == "fc_2" || version == "fc_3")
+            if (version == "fc_2" || version == "fc_3" || version == "fc_4")
             {
                 deserialize(item.num_outputs, in);
                 deserialize(item.num_inputs, in);
@@ -2246,10 +2466,14 @@ namespace dlib
                 deserialize(item.weight_decay_multiplier, in);
                 deserialize(item.bias_learning_rate_multiplier, in);
                 deserialize(item.bias_weight_decay_multiplier, in);
-                if (version == "fc_3")
+                if (version == "fc_3" || version == "fc_4")
                 {
                     deserialize(item.use_bias, in);
                 }
+                if (version == "fc_4")
+                    deserialize(item.qweights, in);
+                else
+                    item.qweights.clear();
             }
             else
             {
@@ -2284,6 +2508,8 @@ namespace dlib
                 out << " learning_rate_mult="<<item.learning_rate_multiplier;
                 out << " weight_decay_mult="<<item.weight_decay_multiplier;
             }
+            if (item.is_quantized())
+                out << " quantized=" << (item.qweights.bits() == 16 ? "bf" : "int") << item.qweights.bits();
             return out;
         }
 
@@ -2297,7 +2523,10 @@ namespace dlib
                     << " weight_decay_mult='"<<item.weight_decay_multiplier<<"'"
                     << " bias_learning_rate_mult='"<<item.bias_learning_rate_multiplier<<"'"
                     << " bias_weight_decay_mult='"<<item.bias_weight_decay_multiplier<<"'"
-                    << " use_bias='"<<(item.use_bias?"true":"false")<<"'>\n";
+                    << " use_bias='"<<(item.use_bias?"true":"false")<<"'";
+                if (item.is_quantized())
+                    out << " quantized_bits='"<<item.qweights.bits()<<"'";
+                out << ">\n";
                 out << mat(item.params);
                 out << "</fc>\n";
             }
@@ -2307,6 +2536,8 @@ namespace dlib
                     << " num_outputs='"<<item.num_outputs<<"'"
                     << " learning_rate_mult='"<<item.learning_rate_multiplier<<"'"
                     << " weight_decay_mult='"<<item.weight_decay_multiplier<<"'";
+                if (item.is_quantized())
+                    out << " quantized_bits='"<<item.qweights.bits()<<"'";
                 out << ">\n";
                 out << mat(item.params);
                 out << "</fc_no_bias>\n";
@@ -2324,6 +2555,7 @@ namespace dlib
         double bias_learning_rate_multiplier;
         double bias_weight_decay_multiplier;
         bool use_bias;
+        quantized_matrix qweights;
     };
 
     template <
@@ -2342,6 +2574,36 @@ namespace dlib
     
     enum linear_bias_mode { LINEAR_HAS_BIAS = 0, LINEAR_NO_BIAS = 1 };
 
+    enum linear_fused_input
+    {
+        LINEAR_INPUT = 0,
+        LINEAR_RMS_NORM_INPUT = 1,
+        LINEAR_TOKEN_RMS_NORM_INPUT = 2,
+        LINEAR_LAYER_NORM_INPUT = 3,
+        LINEAR_GELU_INPUT = 4,
+        LINEAR_SILU_INPUT = 5
+    };
+
+    class gelu_;
+    class silu_;
+
+    namespace impl
+    {
+        // The input of a layer whose own input layer has been fused into it
+        template <typename SUBNET>
+        auto fused_layer_input(const SUBNET& sub, int) -> decltype(sub.subnet().get_output())
+        {
+            return sub.subnet().get_output();
+        }
+
+        template <typename SUBNET>
+        const tensor& fused_layer_input(const SUBNET& sub, long)
+        {
+            DLIB_CASSERT(false, "Only a layer with a computational layer beneath it can be fused.");
+            return sub.get_output();
+        }
+    }
+
     template <
         unsigned long num_outputs_,
         linear_bias_mode bias_mode_ = LINEAR_HAS_BIAS
@@ -2355,7 +2617,10 @@ namespace dlib
             num_outputs(num_outputs_),
             num_inputs(0),                        
             learning_rate_multiplier(1),
-            bias_mode(bias_mode_) {
+            bias_mode(bias_mode_),
+            fused_input(LINEAR_INPUT),
+            fused_eps(0),
+            disabled(false) {
         }
 
         linear_(const linear_& other) :
@@ -2365,7 +2630,14 @@ namespace dlib
             bias_mode(other.bias_mode),
             params(other.params),
             weights(other.weights),
-            biases(other.biases) {
+            biases(other.biases),
+            qweights(other.qweights),
+            fused_input(other.fused_input),
+            fused_eps(other.fused_eps),
+            fused_gamma(other.fused_gamma),
+            fused_beta(other.fused_beta),
+            weight_sums(other.weight_sums),
+            disabled(other.disabled) {
         }
 
         linear_& operator=(const linear_& other) {
@@ -2377,6 +2649,13 @@ namespace dlib
                 params = other.params;
                 weights = other.weights;
                 biases = other.biases;
+                qweights = other.qweights;
+                fused_input = other.fused_input;
+                fused_eps = other.fused_eps;
+                fused_gamma = other.fused_gamma;
+                fused_beta = other.fused_beta;
+                weight_sums = other.weight_sums;
+                disabled = other.disabled;
             }
             return *this;
         }
@@ -2420,27 +2699,39 @@ namespace dlib
         template <typename SUBNET>
         void forward(const SUBNET& sub, resizable_tensor& output)
         {
-            const auto& prev_output = sub.get_output();
+            if (disabled)
+            {
+                // The add_prev_ layer above adds this output to its own, see add_output_to()
+                output.clear();
+                return;
+            }
+
+            const tensor& prev_output = fused_input == LINEAR_INPUT ? sub.get_output() : impl::fused_layer_input(sub, 0);
             DLIB_CASSERT((long)num_inputs == prev_output.nc(),
                 "The size of the input tensor to this linear layer doesn't match the size the linear layer was trained with.");
             output.set_size(prev_output.num_samples(), prev_output.k(), prev_output.nr(), num_outputs);
+            compute_output(prev_output, output, false, work);
+        }
 
-            auto o = alias_tensor(output.num_samples() * output.k() * output.nr(), num_outputs)(output, 0);
-            auto so = alias_tensor(prev_output.num_samples() * prev_output.k() * prev_output.nr(), num_inputs)(prev_output, 0);
-
-            auto w = weights(params, 0);
-            tt::gemm(0, (tensor&)o, 1, so, false, w, false);
-
-            if (bias_mode == LINEAR_HAS_BIAS)
-            {
-                auto b = biases(params, weights.size());
-                tt::add(1, (tensor&)o, 1, b);
-            }
+        template <typename SUBNET>
+        void add_output_to(const SUBNET& sub, tensor& output, resizable_tensor& scratch) const
+        {
+            const tensor& prev_output = fused_input == LINEAR_INPUT ? sub.get_output() : impl::fused_layer_input(sub, 0);
+            DLIB_CASSERT((long)num_inputs == prev_output.nc() &&
+                output.num_samples() == prev_output.num_samples() &&
+                output.k() == prev_output.k() &&
+                output.nr() == prev_output.nr() &&
+                output.nc() == (long)num_outputs,
+                "The output of a linear_ layer fused into an add_prev_ layer must have the dimensions of the tensor it is added to.");
+            compute_output(prev_output, output, true, scratch);
         }
 
         template <typename SUBNET>
         void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad)
         {
+            DLIB_CASSERT(!is_quantized(), "A quantized linear_ layer can only be used for inference.");
+            DLIB_CASSERT(fused_input == LINEAR_INPUT && !disabled, "A linear_ layer fused by fuse_layers() can only be used for inference.");
+
             auto gi = alias_tensor(gradient_input.num_samples() * gradient_input.k() * gradient_input.nr(), num_outputs)(gradient_input, 0);
             if (learning_rate_multiplier != 0)
             {
@@ -2462,8 +2753,16 @@ namespace dlib
             tt::gemm(1, sgi, 1, gi, false, w, true);
         }
 
-        alias_tensor_instance get_weights() { return weights(params, 0); }
-        alias_tensor_const_instance get_weights() const { return weights(params, 0); }
+        alias_tensor_instance get_weights()
+        {
+            DLIB_CASSERT(!is_quantized(), "The float weights of a quantized linear_ layer are gone, use get_quantized_weights().");
+            return weights(params, 0);
+        }
+        alias_tensor_const_instance get_weights() const
+        {
+            DLIB_CASSERT(!is_quantized(), "The float weights of a quantized linear_ layer are gone, use get_quantized_weights().");
+            return weights(params, 0);
+        }
         alias_tensor_instance get_biases()
         {
             static_assert(bias_mode == LINEAR_HAS_BIAS, "This linear_ layer doesn't have a bias vector "
@@ -2477,6 +2776,90 @@ namespace dlib
             return biases(params, weights.size());
         }
 
+        void quantize(int bits = 8)
+        {
+            DLIB_CASSERT(bits == 8 || bits == 4 || bits == 16, "bits: " << bits);
+            if (is_quantized())
+                return;
+            DLIB_CASSERT(params.size() != 0, "The linear_ layer must be allocated before it can be quantized.");
+
+            // Each output gets its own scale, so the weights are stored transposed
+            qweights.quantize(get_weights(), true, bits);
+
+            // Only the biases, if any, are left in params
+            resizable_tensor b;
+            if (bias_mode == LINEAR_HAS_BIAS)
+                b = biases(params, weights.size());
+            weights = alias_tensor();
+            params = b;
+        }
+
+        bool is_quantized() const { return !qweights.empty(); }
+        const quantized_matrix& get_quantized_weights() const { return qweights; }
+
+        linear_fused_input get_fused_input() const { return fused_input; }
+        bool can_fuse_input() const { return fused_input == LINEAR_INPUT && !is_quantized() && params.size() != 0; }
+
+        void fuse_input(const rms_norm_& norm)
+        {
+            DLIB_CASSERT(can_fuse_input());
+            fused_gamma = norm.get_layer_params();
+            fused_beta.clear();
+            fuse_normalization(LINEAR_RMS_NORM_INPUT, norm.get_eps());
+        }
+
+        void fuse_input(const token_rms_norm_& norm)
+        {
+            DLIB_CASSERT(can_fuse_input());
+            // Each row has its own statistics and gamma scales the input columns, which
+            // is the same as scaling the rows of the weights.
+            const float* g = norm.get_layer_params().host();
+            alias_tensor row(1, num_outputs);
+            for (unsigned long i = 0; i < num_inputs; ++i)
+                row(params, i*num_outputs) *= g[i];
+            fused_gamma.set_size(1);
+            fused_gamma = 1;
+            fused_beta.clear();
+            fuse_normalization(LINEAR_TOKEN_RMS_NORM_INPUT, norm.get_eps());
+        }
+
+        void fuse_input(const layer_norm_& norm)
+        {
+            DLIB_CASSERT(can_fuse_input());
+            const tensor& p = norm.get_layer_params();
+            alias_tensor half(p.size()/2);
+            fused_gamma = half(p, 0);
+            fused_beta = half(p, half.size());
+            fuse_normalization(LINEAR_LAYER_NORM_INPUT, norm.get_eps());
+        }
+
+        void fuse_input(const gelu_&)
+        {
+            DLIB_CASSERT(can_fuse_input());
+            fused_input = LINEAR_GELU_INPUT;
+        }
+
+        void fuse_input(const silu_&)
+        {
+            DLIB_CASSERT(can_fuse_input());
+            fused_input = LINEAR_SILU_INPUT;
+        }
+
+        void scale_outputs(float val)
+        {
+            DLIB_CASSERT(!is_quantized() && params.size() != 0);
+            params *= val;
+            if (weight_sums.size() != 0)
+                weight_sums *= val;
+        }
+
+        void disable()
+        {
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         inline dpoint map_input_to_output(const dpoint& p) const { return p; }
         inline dpoint map_output_to_input(const dpoint& p) const { return p; }
 
@@ -2485,7 +2868,7 @@ namespace dlib
 
         friend void serialize(const linear_& item, std::ostream& out)
         {
-            serialize("linear_", out);
+            serialize("linear_3", out);
             serialize(item.num_outputs, out);
             serialize(item.num_inputs, out);
             serialize(item.params, out);
@@ -2493,13 +2876,20 @@ namespace dlib
             serialize(item.biases, out);
             serialize((int)item.bias_mode, out);
             serialize(item.learning_rate_multiplier, out);
+            serialize(item.qweights, out);
+            serialize((int)item.fused_input, out);
+            serialize(item.fused_eps, out);
+            serialize(item.fused_gamma, out);
+            serialize(item.fused_beta, out);
+            serialize(item.weight_sums, out);
+            serialize(item.disabled, out);
         }
 
         friend void deserialize(linear_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version == "linear_")
+            if (version == "linear_" || version == "linear_2" || version == "linear_3")
             {
                 deserialize(item.num_outputs, in);
                 deserialize(item.num_inputs, in);
@@ -2511,6 +2901,32 @@ namespace dlib
                 item.bias_mode = static_cast<linear_bias_mode>(bmode);
                 if (bias_mode_ != item.bias_mode) throw serialization_error("Wrong bias_mode found while deserializing dlib::linear_");
                 deserialize(item.learning_rate_multiplier, in);
+                if (version != "linear_")
+                    deserialize(item.qweights, in);
+                else
+                    item.qweights.clear();
+                if (version == "linear_3")
+                {
+                    int fused;
+                    deserialize(fused, in);
+                    if (fused < LINEAR_INPUT || fused > LINEAR_SILU_INPUT)
+                        throw serialization_error("Invalid fused input found while deserializing dlib::linear_");
+                    item.fused_input = static_cast<linear_fused_input>(fused);
+                    deserialize(item.fused_eps, in);
+                    deserialize(item.fused_gamma, in);
+                    deserialize(item.fused_beta, in);
+                    deserialize(item.weight_sums, in);
+                    deserialize(item.disabled, in);
+                }
+                else
+                {
+                    item.fused_input = LINEAR_INPUT;
+                    item.fused_eps = 0;
+                    item.fused_gamma.clear();
+                    item.fused_beta.clear();
+                    item.weight_sums.clear();
+                    item.disabled = false;
+                }
             }
             else
             {
@@ -2527,6 +2943,12 @@ namespace dlib
                 out << ", bias=false";
             out << ")";
             out << " learning_rate_mult=" << item.learning_rate_multiplier;
+            if (item.is_quantized())
+                out << " quantized=" << (item.qweights.bits() == 16 ? "bf" : "int") << item.qweights.bits();
+            if (item.fused_input != LINEAR_INPUT)
+                out << " fused_input=" << fused_input_name(item.fused_input);
+            if (item.disabled)
+                out << " (fused into add_prev)";
             return out;
         }
 
@@ -2535,18 +2957,138 @@ namespace dlib
             out << "<linear"
                 << " num_outputs='" << item.num_outputs << "'"
                 << " bias='" << ((item.bias_mode == LINEAR_HAS_BIAS) ? "true" : "false") << "'"
-                << " learning_rate_mult='" << item.learning_rate_multiplier << "'>\n";
+                << " learning_rate_mult='" << item.learning_rate_multiplier << "'";
+            if (item.is_quantized())
+                out << " quantized_bits='" << item.qweights.bits() << "'";
+            if (item.fused_input != LINEAR_INPUT)
+                out << " fused_input='" << fused_input_name(item.fused_input) << "'";
+            if (item.disabled)
+                out << " disabled='true'";
+            out << ">\n";
             out << mat(item.params);
             out << "</linear>\n";
         }
 
     private:
+
+        static const char* fused_input_name(linear_fused_input f)
+        {
+            switch (f)
+            {
+                case LINEAR_RMS_NORM_INPUT: return "rms_norm";
+                case LINEAR_TOKEN_RMS_NORM_INPUT: return "token_rms_norm";
+                case LINEAR_LAYER_NORM_INPUT: return "layer_norm";
+                case LINEAR_GELU_INPUT: return "gelu";
+                case LINEAR_SILU_INPUT: return "silu";
+                default: return "none";
+            }
+        }
+
+        void fuse_normalization(linear_fused_input f, double eps)
+        {
+            // Normalizing a row subtracts a multiple of the row of ones from it, which
+            // adds a multiple of the column sums of the weights to its product.
+            weight_sums = sum_rows(mat(get_weights()));
+            fused_input = f;
+            fused_eps = eps;
+        }
+
+        void multiply_weights(tensor& dest, const tensor& src, bool add_to, tensor& temp) const
+        {
+            if (is_quantized())
+            {
+                if (!add_to)
+                {
+                    tt::quantized_gemm(dest, src, qweights);
+                    return;
+                }
+                tt::quantized_gemm(temp, src, qweights);
+                tt::add(1, dest, 1, temp);
+            }
+            else
+            {
+                auto w = weights(params, 0);
+                tt::gemm(add_to ? 1 : 0, dest, 1, src, false, w, false);
+            }
+        }
+
+        void compute_output(const tensor& input, tensor& output, bool add_to, resizable_tensor& scratch) const
+        {
+            const long rows = input.num_samples() * input.k() * input.nr();
+            auto o = alias_tensor(rows, num_outputs)(output, 0);
+            auto so = alias_tensor(rows, num_inputs)(input, 0);
+            const bool has_bias = bias_mode == LINEAR_HAS_BIAS;
+
+            if (fused_input == LINEAR_RMS_NORM_INPUT || fused_input == LINEAR_TOKEN_RMS_NORM_INPUT ||
+                fused_input == LINEAR_LAYER_NORM_INPUT)
+            {
+                // The raw rows are multiplied by the weights and the normalization is
+                // applied to the products, together with the biases.
+                resizable_tensor no_bias;
+                auto b = biases(params, weights.size());
+                if (add_to)
+                    scratch.set_size(rows, num_outputs);
+                tensor& xw = add_to ? static_cast<tensor&>(scratch) : static_cast<tensor&>(o);
+                multiply_weights(xw, so, false, xw);
+                // token_rms_norm_ normalizes each row on its own
+                auto token_rows = alias_tensor(rows, 1, 1, num_inputs)(input, 0);
+                const tensor& src = fused_input == LINEAR_TOKEN_RMS_NORM_INPUT ? token_rows.get() : input;
+                tt::normalize_linear_output(o, add_to, xw, src, fused_eps,
+                    fused_input == LINEAR_LAYER_NORM_INPUT, fused_gamma, fused_beta, weight_sums,
+                    has_bias ? b.get() : no_bias);
+                return;
+            }
+
+            if (fused_input == LINEAR_GELU_INPUT || fused_input == LINEAR_SILU_INPUT)
+            {
+                // The activation is applied to a block of rows at a time, small enough to
+                // still be in the cache when it is multiplied by the weights.
+                const long block_rows = std::max<long>(1, std::min<long>(rows, fused_block_size/num_inputs));
+                scratch.set_size(block_rows*(num_inputs + num_outputs));
+                for (long r = 0; r < rows; r += block_rows)
+                {
+                    const long n = std::min(block_rows, rows - r);
+                    auto x = alias_tensor(n, num_inputs)(input, r*num_inputs);
+                    auto a = alias_tensor(n, num_inputs)(scratch, 0);
+                    auto t = alias_tensor(n, num_outputs)(scratch, block_rows*num_inputs);
+                    auto d = alias_tensor(n, num_outputs)(output, r*num_outputs);
+                    if (fused_input == LINEAR_GELU_INPUT)
+                        tt::gelu(a, x);
+                    else
+                        tt::silu(a, x);
+                    multiply_weights(d, a, add_to, t);
+                }
+            }
+            else
+            {
+                if (add_to && is_quantized())
+                    scratch.set_size(rows, num_outputs);
+                multiply_weights(o, so, add_to, scratch);
+            }
+
+            if (has_bias)
+            {
+                auto b = biases(params, weights.size());
+                tt::add(1, (tensor&)o, 1, b);
+            }
+        }
+
+        // Number of activations computed at once by a linear_ with a fused activation
+        static const long fused_block_size = 64*1024;
+
         unsigned long num_outputs;
         unsigned long num_inputs;        
         double learning_rate_multiplier;
         linear_bias_mode bias_mode;
         resizable_tensor params;
         alias_tensor weights, biases;
+        quantized_matrix qweights;
+        linear_fused_input fused_input;
+        double fused_eps;
+        resizable_tensor fused_gamma, fused_beta;
+        resizable_tensor weight_sums;
+        bool disabled;
+        resizable_tensor work;
     };
 
     template <
@@ -2570,6 +3112,7 @@ namespace dlib
             float drop_rate_ = 0.5
         ) :
             drop_rate(drop_rate_),
+            replay(false),
             rnd(std::rand())
         {
             DLIB_CASSERT(0 <= drop_rate && drop_rate <= 1);
@@ -2579,7 +3122,7 @@ namespace dlib
         // is non-copyable.
         dropout_(
             const dropout_& item
-        ) : drop_rate(item.drop_rate), mask(item.mask), rnd(std::rand())
+        ) : drop_rate(item.drop_rate), replay(false), mask(item.mask), rnd(std::rand())
         {}
 
         dropout_& operator= (
@@ -2597,6 +3140,10 @@ namespace dlib
         float get_drop_rate (
         ) const { return drop_rate; }
 
+        void set_replay_mode (
+            bool replay_
+        ) { replay = replay_; }
+
         template <typename SUBNET>
         void setup (const SUBNET& /*sub*/)
         {
@@ -2604,10 +3151,14 @@ namespace dlib
 
         void forward_inplace(const tensor& input, tensor& output)
         {
-            // create a random mask and use it to filter the data
-            mask.copy_size(input);
-            rnd.fill_uniform(mask);
-            tt::threshold(mask, drop_rate);
+            // create a random mask, unless we are replaying the previous one, and use it
+            // to filter the data
+            if (!replay || !have_same_dimensions(mask, input))
+            {
+                mask.copy_size(input);
+                rnd.fill_uniform(mask);
+                tt::threshold(mask, drop_rate);
+            }
             tt::multiply(false, output, input, mask);
         } 
 
@@ -2669,6 +3220,7 @@ namespace dlib
 
     private:
         float drop_rate;
+        bool replay;
         resizable_tensor mask;
 
         tt::tensor_rand rnd;
@@ -2716,6 +3268,13 @@ namespace dlib
         float get_multiply_value (
         ) const { return val; }
 
+        void disable()
+        {
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         template <typename SUBNET>
         void setup (const SUBNET& /*sub*/)
         {
@@ -2723,6 +3282,9 @@ namespace dlib
 
         void forward_inplace(const tensor& input, tensor& output)
         {
+            if (disabled)
+                return;
+
             tt::affine_transform(output, input, val);
         } 
 
@@ -2735,6 +3297,9 @@ namespace dlib
             tensor& /*params_grad*/
         )
         {
+            if (disabled)
+                return;
+
             if (is_same_object(gradient_input, data_grad))
                 tt::affine_transform(data_grad, gradient_input, val);
             else
@@ -2746,8 +3311,9 @@ namespace dlib
 
         friend void serialize(const multiply_& item, std::ostream& out)
         {
-            serialize("multiply_", out);
+            serialize("multiply_2", out);
             serialize(item.val, out);
+            serialize(item.disabled, out);
         }
 
         friend void deserialize(multiply_& item, std::istream& in)
@@ -2765,9 +3331,12 @@ namespace dlib
                 return;
             }
 
-            if (version != "multiply_")
+            if (version != "multiply_" && version != "multiply_2")
                 throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::multiply_.");
             deserialize(item.val, in);
+            item.disabled = false;
+            if (version == "multiply_2")
+                deserialize(item.disabled, in);
         }
 
         friend std::ostream& operator<<(std::ostream& out, const multiply_& item)
@@ -2775,6 +3344,8 @@ namespace dlib
             out << "multiply ("
                 << "val="<<item.val
                 << ")";
+            if (item.disabled)
+                out << "\t (disabled)";
             return out;
         }
 
@@ -2782,10 +3353,13 @@ namespace dlib
         {
             out << "<multiply"
                 << " val='"<<item.val<<"'";
+            if (item.disabled)
+                out << " disabled='true'";
             out << "/>\n";
         }
     private:
         float val;
+        bool disabled = false;
         resizable_tensor params; // unused
     };
 
@@ -3005,6 +3579,30 @@ namespace dlib
 
 // ----------------------------------------------------------------------------------------
 
+    namespace impl
+    {
+        template <typename SUBNET>
+        void add_fused_output(const SUBNET&, tensor&, resizable_tensor&, long)
+        {
+            DLIB_CASSERT(false, "Only a linear_ layer, possibly followed by a multiply_ layer, can be fused into an add_prev_ layer.");
+        }
+
+        template <typename SUBNET>
+        auto add_fused_output(const SUBNET& sub, tensor& output, resizable_tensor& scratch, int)
+            -> decltype(sub.layer_details().add_output_to(sub.subnet(), output, scratch))
+        {
+            sub.layer_details().add_output_to(sub.subnet(), output, scratch);
+        }
+
+        // The value of a multiply_ sitting in between has been folded into the weights
+        template <typename SUBNET>
+        auto add_fused_output(const SUBNET& sub, tensor& output, resizable_tensor& scratch, int)
+            -> typename std::enable_if<std::is_same<typename SUBNET::layer_details_type, multiply_>::value>::type
+        {
+            add_fused_output(sub.subnet(), output, scratch, 0);
+        }
+    }
+
     template <
         template<typename> class tag
         >
@@ -3017,6 +3615,13 @@ namespace dlib
         {
         }
 
+        void fuse_input()
+        {
+            fused = true;
+        }
+
+        bool has_fused_input() const { return fused; }
+
         template <typename SUBNET>
         void setup (const SUBNET& /*sub*/)
         {
@@ -3025,6 +3630,15 @@ namespace dlib
         template <typename SUBNET>
         void forward(const SUBNET& sub, resizable_tensor& output)
         {
+            if (fused)
+            {
+                // Start from the other input and let the linear_ layer below add its
+                // output to it, without ever storing that output.
+                output = layer<tag>(sub).get_output();
+                impl::add_fused_output(sub, output, work, 0);
+                return;
+            }
+
             auto&& t1 = sub.get_output();
             auto&& t2 = layer<tag>(sub).get_output();
             output.set_size(std::max(t1.num_samples(),t2.num_samples()),
@@ -3037,6 +3651,7 @@ namespace dlib
         template <typename SUBNET>
         void backward(const tensor& gradient_input, SUBNET& sub, tensor& /*params_grad*/)
         {
+            DLIB_CASSERT(!fused, "An add_prev_ layer fused by fuse_layers() can only be used for inference.");
             // The gradient just flows backwards to the two layers that forward() added
             // together.
             tt::add(sub.get_gradient_input(), sub.get_gradient_input(), gradient_input);
@@ -3049,31 +3664,42 @@ namespace dlib
         inline dpoint map_input_to_output (const dpoint& p) const { return p; }
         inline dpoint map_output_to_input (const dpoint& p) const { return p; }
 
-        friend void serialize(const add_prev_& /*item*/, std::ostream& out)
+        friend void serialize(const add_prev_& item, std::ostream& out)
         {
-            serialize("add_prev_", out);
+            serialize("add_prev_2", out);
+            serialize(item.fused, out);
         }
 
-        friend void deserialize(add_prev_& /*item*/, std::istream& in)
+        friend void deserialize(add_prev_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "add_prev_")
+            if (version != "add_prev_" && version != "add_prev_2")
                 throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::add_prev_.");
+            item.fused = false;
+            if (version == "add_prev_2")
+                deserialize(item.fused, in);
         }
-        friend std::ostream& operator<<(std::ostream& out, const add_prev_& /*item*/)
+        friend std::ostream& operator<<(std::ostream& out, const add_prev_& item)
         {
             out << "add_prev"<<id;
+            if (item.fused)
+                out << "\t (fused input)";
             return out;
         }
 
-        friend void to_xml(const add_prev_& /*item*/, std::ostream& out)
+        friend void to_xml(const add_prev_& item, std::ostream& out)
         {
-            out << "<add_prev tag='"<<id<<"'/>\n";
+            out << "<add_prev tag='"<<id<<"'";
+            if (item.fused)
+                out << " fused_input='true'";
+            out << "/>\n";
         }
 
     private:
         resizable_tensor params;
+        bool fused = false;
+        resizable_tensor work;
     };
 
     template <
@@ -4284,6 +4910,13 @@ namespace dlib
         {
         }
 
+        void disable()
+        {
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         template <typename SUBNET>
         void setup (const SUBNET& /*sub*/)
         {
@@ -4295,6 +4928,12 @@ namespace dlib
             resizable_tensor& data_output
         )
         {
+            if (disabled)
+            {
+                // The linear_ layer above applies the activation to its own input
+                data_output.clear();
+                return;
+            }
             data_output.copy_size(sub.get_output());
             tt::gelu(data_output, sub.get_output());
         }
@@ -4306,6 +4945,7 @@ namespace dlib
             tensor&
         )
         {
+            DLIB_CASSERT(!disabled, "A gelu_ fused by fuse_layers() can only be used for inference.");
             tt::gelu_gradient(sub.get_gradient_input(), sub.get_output(), gradient_input);
         }
 
@@ -4315,33 +4955,43 @@ namespace dlib
         const tensor& get_layer_params() const { return params; }
         tensor& get_layer_params() { return params; }
 
-        friend void serialize(const gelu_& /*item*/, std::ostream& out)
+        friend void serialize(const gelu_& item, std::ostream& out)
         {
-            serialize("gelu_", out);
+            serialize("gelu_2", out);
+            serialize(item.disabled, out);
         }
 
-        friend void deserialize(gelu_& /*item*/, std::istream& in)
+        friend void deserialize(gelu_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "gelu_")
+            if (version != "gelu_" && version != "gelu_2")
                 throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::gelu_.");
+            item.disabled = false;
+            if (version == "gelu_2")
+                deserialize(item.disabled, in);
         }
 
-        friend std::ostream& operator<<(std::ostream& out, const gelu_& /*item*/)
+        friend std::ostream& operator<<(std::ostream& out, const gelu_& item)
         {
             out << "gelu";
+            if (item.disabled)
+                out << "\t (disabled)";
             return out;
         }
 
-        friend void to_xml(const gelu_& /*item*/, std::ostream& out)
+        friend void to_xml(const gelu_& item, std::ostream& out)
         {
-            out << "<gelu/>\n";
+            out << "<gelu";
+            if (item.disabled)
+                out << " disabled='true'";
+            out << "/>\n";
         }
 
 
     private:
         resizable_tensor params;
+        bool disabled = false;
     };
 
     template <typename SUBNET>
@@ -4435,6 +5085,13 @@ namespace dlib
         {
         }
 
+        void disable()
+        {
+            disabled = true;
+        }
+
+        bool is_disabled() const { return disabled; }
+
         template <typename SUBNET>
         void setup(const SUBNET& /*sub*/)
         {
@@ -4445,6 +5102,12 @@ namespace dlib
             const SUBNET& sub,
             resizable_tensor& data_ouput)
         {
+            if (disabled)
+            {
+                // The linear_ layer above applies the activation to its own input
+                data_ouput.clear();
+                return;
+            }
             data_ouput.copy_size(sub.get_output());
             tt::silu(data_ouput, sub.get_output());
         }
@@ -4456,6 +5119,7 @@ namespace dlib
             tensor&
         )
         {
+            DLIB_CASSERT(!disabled, "A silu_ fused by fuse_layers() can only be used for inference.");
             tt::silu_gradient(sub.get_gradient_input(), sub.get_output(), gradient_input);
         }
 
@@ -4465,32 +5129,42 @@ namespace dlib
         const tensor& get_layer_params() const { return params; }
         tensor& get_layer_params() { return params; }
 
-        friend void serialize(const silu_& /*item*/, std::ostream& out)
+        friend void serialize(const silu_& item, std::ostream& out)
         {
-            serialize("silu_", out);
+            serialize("silu_2", out);
+            serialize(item.disabled, out);
         }
 
-        friend void deserialize(silu_& /*item*/, std::istream& in)
+        friend void deserialize(silu_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "silu_")
+            if (version != "silu_" && version != "silu_2")
                 throw serialization_error("Unexpected version '"+version+"' found while deserializing dlib::silu_.");
+            item.disabled = false;
+            if (version == "silu_2")
+                deserialize(item.disabled, in);
         }
 
-        friend std::ostream& operator<<(std::ostream& out, const silu_& /*item*/)
+        friend std::ostream& operator<<(std::ostream& out, const silu_& item)
         {
             out << "silu";
+            if (item.disabled)
+                out << "\t (disabled)";
             return out;
         }
 
-        friend void to_xml(const silu_& /*item*/, std::ostream& out)
+        friend void to_xml(const silu_& item, std::ostream& out)
         {
-            out << "<silu/>\n";
+            out << "<silu";
+            if (item.disabled)
+                out << " disabled='true'";
+            out << "/>\n";
         }
 
     private:
         resizable_tensor params;
+        bool disabled = false;
     };
 
     template <typename SUBNET>
@@ -5506,8 +6180,15 @@ namespace dlib
             const auto& prev = sub.get_output();
             output.set_size(prev.num_samples(), prev.k(), prev.nr(), embedding_dim);
 
-            tt::embeddings(output, prev, embs);
-            tt::affine_transform(output, output, output_scale);
+            if (is_quantized())
+            {
+                tt::quantized_embeddings(output, prev, qembs, output_scale);
+            }
+            else
+            {
+                tt::embeddings(output, prev, embs);
+                tt::affine_transform(output, output, output_scale);
+            }
         }
 
         template <typename SUBNET>
@@ -5519,6 +6200,7 @@ namespace dlib
             // so it technically doesn't contribute to the gradient computation.
             if (learning_rate_multiplier != 0)
             {
+                DLIB_CASSERT(!is_quantized(), "A quantized embeddings_ layer can only be used for inference.");
                 auto& prev_src = sub.get_output();
                 
                 calc_token_freqs(prev_src, gradient_input);
@@ -5533,21 +6215,37 @@ namespace dlib
         const tensor& get_embeddings() const { return embs; }
         tensor& get_embeddings() { return embs; }
 
+        void quantize(int bits = 8)
+        {
+            DLIB_CASSERT(bits == 8 || bits == 4 || bits == 16, "bits: " << bits);
+            if (is_quantized())
+                return;
+            DLIB_CASSERT(embs.size() != 0, "The embeddings_ layer must be allocated before it can be quantized.");
+
+            // One scale per embedding vector
+            qembs.quantize(embs, false, bits);
+            embs.clear();
+        }
+
+        bool is_quantized() const { return !qembs.empty(); }
+        const quantized_matrix& get_quantized_embeddings() const { return qembs; }
+
         friend void serialize(const embeddings_& item, std::ostream& out)
         {
-            serialize("embeddings_", out);
+            serialize("embeddings_2", out);
             serialize(item.embs, out);
             serialize(item.num_embeddings, out);
             serialize(item.embedding_dim, out);
             serialize(item.learning_rate_multiplier, out);
             serialize(item.scale_by_freq, out);
             serialize(item.output_scale, out);
+            serialize(item.qembs, out);
         }
         friend void deserialize(embeddings_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "embeddings_")
+            if (version != "embeddings_" && version != "embeddings_2")
                 throw serialization_error("Unexpected version found while deserializing dlib::embeddings_.");
             deserialize(item.embs, in);
             deserialize(item.num_embeddings, in);
@@ -5555,6 +6253,10 @@ namespace dlib
             deserialize(item.learning_rate_multiplier, in);
             deserialize(item.scale_by_freq, in);
             deserialize(item.output_scale, in);
+            if (version == "embeddings_2")
+                deserialize(item.qembs, in);
+            else
+                item.qembs.clear();
         }
 
         friend std::ostream& operator<<(std::ostream& out, const embeddings_& item)
@@ -5563,6 +6265,8 @@ namespace dlib
                 << ", embedding_dim=" << item.embedding_dim
                 << ", scale=" << item.output_scale
                 << ") learning_rate_mult=" << item.learning_rate_multiplier;
+            if (item.is_quantized())
+                out << " quantized=" << (item.qembs.bits() == 16 ? "bf" : "int") << item.qembs.bits();
             return out;
         }
         friend void to_xml(const embeddings_& item, std::ostream& out)
@@ -5571,7 +6275,10 @@ namespace dlib
                 << "' embedding_dim='" << item.embedding_dim
                 << "' output_scale='" << item.output_scale
                 << "' learning_rate_mult='"
-                << item.learning_rate_multiplier << "'>\n";
+                << item.learning_rate_multiplier << "'";
+            if (item.is_quantized())
+                out << " quantized_bits='" << item.qembs.bits() << "'";
+            out << ">\n";
             out << mat(item.embs);
             out << "</embeddings>\n";
         }
@@ -5598,6 +6305,7 @@ namespace dlib
 
         resizable_tensor params; // unused
         resizable_tensor embs, freqs;
+        quantized_matrix qembs;
         unsigned long num_embeddings, embedding_dim;
         double learning_rate_multiplier;
         bool scale_by_freq;
@@ -5734,7 +6442,7 @@ namespace dlib
     class tril_
     {
     public:
-        tril_(): diag(diag_), prefix_size(0), diag_value(compute_diag_value()) {}
+        tril_(): diag(diag_), prefix_size(0), bottom_right_aligned(false), diag_value(compute_diag_value()) {}
         
         template <typename SUBNET>
         void setup(const SUBNET& /*sub*/)
@@ -5790,6 +6498,15 @@ namespace dlib
             }
         }
         long get_prefix_size() const { return prefix_size; }
+
+        void set_bottom_right_aligned(bool aligned)
+        {
+            if (bottom_right_aligned != aligned) {
+                bottom_right_aligned = aligned;
+                invalidate_mask();
+            }
+        }
+        bool is_bottom_right_aligned() const { return bottom_right_aligned; }
         
         friend void serialize(const tril_& item, std::ostream& out)
         {
@@ -5848,6 +6565,10 @@ namespace dlib
 
                 const bool has_padding = !cached_padding_lengths_.empty();
 
+                // When the rows only hold the last queries of a longer sequence (e.g. the
+                // keys come from a KV cache), row r is at absolute position r + row_offset.
+                const long row_offset = bottom_right_aligned ? std::max<long>(0, t.nc() - t.nr()) : 0;
+
                 for (long s = 0; s < t.num_samples(); ++s)
                 {
                     const long pad_len = has_padding &&
@@ -5868,7 +6589,7 @@ namespace dlib
                             }
 
                             // Mask future positions (causal)
-                            const long causal_start = std::max({ r + diag + 1, prefix_size, pad_len });
+                            const long causal_start = std::max({ r + row_offset + diag + 1, prefix_size, pad_len });
                             for (long c = causal_start; c < t.nc(); ++c)
                             {
                                 const long idx = tensor_index(t, s, k, r, c);
@@ -5878,7 +6599,7 @@ namespace dlib
                             }
 
                             // Mask padding rows
-                            if (r < pad_len)
+                            if (r + row_offset < pad_len)
                             {
                                 for (long c = 0; c < t.nc(); ++c)
                                 {
@@ -5901,6 +6622,7 @@ namespace dlib
         resizable_tensor binary_mask, output_mask;
         long diag;
         long prefix_size;
+        bool bottom_right_aligned;
         float diag_value;
         std::vector<long> cached_padding_lengths_;
     };
@@ -6335,7 +7057,9 @@ namespace dlib
         explicit rotary_positional_embedding_() :
             seq_len(0),
             d_head(0),
-			theta_base(10000.0f)
+			theta_base(10000.0f),
+            incremental(false),
+            position_offset(0)
         {
 		}
 
@@ -6345,7 +7069,9 @@ namespace dlib
             theta_base(other.theta_base),
             cos_cache(other.cos_cache),
             sin_cache(other.sin_cache),
-            yarn(other.yarn)
+            yarn(other.yarn),
+            incremental(other.incremental),
+            position_offset(other.position_offset)
         {
         }
 
@@ -6358,6 +7084,8 @@ namespace dlib
                 cos_cache = other.cos_cache;
                 sin_cache = other.sin_cache;
                 yarn = other.yarn;
+                incremental = other.incremental;
+                position_offset = other.position_offset;
             }
             return *this;
         }
@@ -6385,6 +7113,18 @@ namespace dlib
         }
         const yarn_config& get_yarn_config() const { return yarn; }
 
+        // Incremental mode is used for KV cache decoding: successive forward() calls
+        // are consecutive chunks of the same sequence, so each chunk is rotated using
+        // its absolute positions instead of restarting at position 0.
+        void set_incremental_mode(bool enabled)
+        {
+            incremental = enabled;
+            position_offset = 0;
+        }
+        bool is_incremental_mode() const { return incremental; }
+        long get_position_offset() const { return position_offset; }
+        void reset_position_offset() { position_offset = 0; }
+
         template <typename SUBNET>
         void setup(const SUBNET& sub)
         {
@@ -6416,6 +7156,12 @@ namespace dlib
             DLIB_CASSERT(in_d_head >= 2, "d_head must be at least 2 for rotation");
             DLIB_CASSERT(in_seq_len > 0, "seq_len must be positive");
 
+            if (incremental)
+            {
+                forward_incremental(input, output);
+                return;
+            }
+
             // If setup() was not called or the incoming sequence length changed from
             // the cached seq_len (e.g. inference with a different context window),
             // recompute trig caches for the current seq_len.
@@ -6458,8 +7204,8 @@ namespace dlib
             tt::apply_rotary_positional_embedding(
                 true,   // backward pass (inverse rotation)
                 grad_output,
-                cos_cache,
-                sin_cache
+                incremental ? chunk_cos : cos_cache,
+                incremental ? chunk_sin : sin_cache
             );
 
             // Accumulate gradients
@@ -6528,6 +7274,36 @@ namespace dlib
         inline dpoint map_output_to_input(const dpoint& p) const { return p; }
 
     private:
+        void forward_incremental(const tensor& input, resizable_tensor& output)
+        {
+            const long chunk_len = input.nr();
+            const long half_dim = input.nc() / 2;
+            if (yarn.original_len == 0) yarn.original_len = chunk_len;
+
+            // The table always covers at least the training length, so positions inside
+            // it get exactly the angles a full window forward pass would use.
+            const long needed_len = std::max(position_offset + chunk_len, yarn.original_len);
+            if (d_head != input.nc() || seq_len < needed_len || cos_cache.size() == 0)
+            {
+                seq_len = needed_len;
+                d_head = input.nc();
+                compute_and_cache_trig_values(seq_len);
+            }
+
+            // Rows [position_offset, position_offset + chunk_len) of the tables
+            chunk_cos.set_size(1, 1, chunk_len, half_dim);
+            chunk_sin.set_size(1, 1, chunk_len, half_dim);
+            std::memcpy(chunk_cos.host_write_only(), cos_cache.host() + position_offset * half_dim,
+                sizeof(float) * chunk_cos.size());
+            std::memcpy(chunk_sin.host_write_only(), sin_cache.host() + position_offset * half_dim,
+                sizeof(float) * chunk_sin.size());
+
+            output.copy_size(input);
+            tt::copy_tensor(false, output, 0, input, 0, input.k());
+            tt::apply_rotary_positional_embedding(false, output, chunk_cos, chunk_sin);
+            position_offset += chunk_len;
+        }
+
         // Compute and cache cosine/sine tables for target_seq_len
         // This function uses YaRN scaling when yarn.enabled is true
         void compute_and_cache_trig_values(long target_seq_len)
@@ -6602,6 +7378,12 @@ namespace dlib
         // YaRN configuration
         yarn_config yarn;
 
+        // Incremental (KV cache) decoding state
+        bool incremental;
+        long position_offset;
+        resizable_tensor chunk_cos;
+        resizable_tensor chunk_sin;
+
         // No trainable parameters
         resizable_tensor params;
     };
@@ -613,6 +613,8 @@ namespace dlib
         alias_tensor_const_instance get_weights(
         ) const;
         /*!
+            requires
+                - is_quantized() == false
             ensures
                 - returns an alias of get_layer_params(), containing the weights matrix of
                   the fully connected layer.
@@ -628,6 +630,8 @@ namespace dlib
         alias_tensor_instance get_weights(
         );
         /*!
+            requires
+                - is_quantized() == false
             ensures
                 - returns an alias of get_layer_params(), containing the weights matrix of
                   the fully connected layer.
@@ -666,6 +670,43 @@ namespace dlib
                 - #get_layer_params().size() == (#get_weights().size() + #get_biases().size())
         !*/
 
+        void quantize(
+            int bits = 8
+        );
+        /*!
+            requires
+                - bits == 8 || bits == 4 || bits == 16
+                - setup() has been called (or the layer was deserialized)
+            ensures
+                - #is_quantized() == true
+                - Replaces the weights with #get_quantized_weights(), a quantized_matrix with
+                  one row, and therefore one scale, per output.  The weights use about 2 (16
+                  bits, stored as bfloat16), 4 (8 bits) or 8 (4 bits) times less memory and
+                  serialize() saves them in this form.
+                - #get_layer_params() only holds the biases, if any.
+                - forward() then computes the outputs with tt::quantized_gemm() on the CPU.
+                  The layer can only be used for inference: backward() and get_weights()
+                  must not be called anymore.
+                - If is_quantized() was already true this function does nothing.
+        !*/
+
+        bool is_quantized(
+        ) const;
+        /*!
+            ensures
+                - returns true if quantize() has been called on this layer.
+        !*/
+
+        const quantized_matrix& get_quantized_weights(
+        ) const;
+        /*!
+            ensures
+                - returns the quantized weights, a get_num_outputs() x (number of inputs)
+                  matrix, i.e. the transpose of the weights returned by get_weights() before
+                  quantization.
+                - returns an empty matrix if !is_quantized().
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output);
         template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad);
@@ -699,6 +740,16 @@ namespace dlib
         LINEAR_NO_BIAS
     };
 
+    enum linear_fused_input
+    {
+        LINEAR_INPUT,                // the input is used as it is
+        LINEAR_RMS_NORM_INPUT,       // rms_norm_ is applied to the input
+        LINEAR_TOKEN_RMS_NORM_INPUT, // token_rms_norm_ is applied to the input
+        LINEAR_LAYER_NORM_INPUT,     // layer_norm_ is applied to the input
+        LINEAR_GELU_INPUT,           // gelu_ is applied to the input
+        LINEAR_SILU_INPUT            // silu_ is applied to the input
+    };
+
     template <
         unsigned long num_outputs,
         linear_bias_mode bias_mode = LINEAR_HAS_BIAS
@@ -851,6 +902,7 @@ namespace dlib
         /*!
             requires
                 - setup() has been called
+                - is_quantized() == false
             ensures
                 - Returns a reference to the weights matrix of this layer.
         !*/
@@ -860,6 +912,7 @@ namespace dlib
         /*!
             requires
                 - setup() has been called
+                - is_quantized() == false
             ensures
                 - Returns a const reference to the weights matrix of this layer.
         !*/
@@ -888,6 +941,128 @@ namespace dlib
                 - static_assert failure if bias_mode != LINEAR_HAS_BIAS
         !*/
 
+        void quantize(
+            int bits = 8
+        );
+        /*!
+            requires
+                - bits == 8 || bits == 4 || bits == 16
+                - setup() has been called (or the layer was deserialized)
+            ensures
+                - #is_quantized() == true
+                - Replaces the weights with #get_quantized_weights(), a quantized_matrix with
+                  one row, and therefore one scale, per output.  The weights use about 2 (16
+                  bits, stored as bfloat16), 4 (8 bits) or 8 (4 bits) times less memory and
+                  serialize() saves them in this form.
+                - #get_layer_params() only holds the biases, if any.
+                - forward() then computes the outputs with tt::quantized_gemm() on the CPU.
+                  The layer can only be used for inference: backward() and get_weights()
+                  must not be called anymore.
+                - If is_quantized() was already true this function does nothing.
+        !*/
+
+        bool is_quantized(
+        ) const;
+        /*!
+            ensures
+                - returns true if quantize() has been called on this layer.
+        !*/
+
+        const quantized_matrix& get_quantized_weights(
+        ) const;
+        /*!
+            ensures
+                - returns the quantized weights, a get_num_outputs() x (number of inputs)
+                  matrix, i.e. the transpose of the weights returned by get_weights() before
+                  quantization.
+                - returns an empty matrix if !is_quantized().
+        !*/
+
+        linear_fused_input get_fused_input(
+        ) const;
+        /*!
+            ensures
+                - returns the normalization or activation this layer applies to its input
+                  before the linear transformation.  It is LINEAR_INPUT unless fuse_input()
+                  has been called, which fuse_layers() does at inference time.
+        !*/
+
+        bool can_fuse_input(
+        ) const;
+        /*!
+            ensures
+                - returns true if get_fused_input() == LINEAR_INPUT, the parameters are
+                  allocated and the layer is not quantized.
+        !*/
+
+        void fuse_input(const rms_norm_& norm);
+        void fuse_input(const token_rms_norm_& norm);
+        void fuse_input(const layer_norm_& norm);
+        void fuse_input(const gelu_& act);
+        void fuse_input(const silu_& act);
+        /*!
+            requires
+                - can_fuse_input() == true
+                - The given layer is the layer directly below this one.
+            ensures
+                - Makes this layer apply the given layer to its input itself, reading the
+                  input of the given layer instead of its output.  The given layer can then
+                  be disabled, so that its output is never computed nor stored:
+                    - A normalization is applied to the products of the raw rows with the
+                      weights, together with the biases, by tt::normalize_linear_output().
+                      The gamma of token_rms_norm_ is folded into the weights.
+                    - An activation is applied to a small block of rows at a time, right
+                      before the block is multiplied by the weights.
+                - #get_fused_input() reflects the fused layer.
+                - The layer can then only be used for inference: backward() must not be
+                  called anymore.  It can still be quantized.
+        !*/
+
+        void scale_outputs(
+            float val
+        );
+        /*!
+            requires
+                - setup() has been called
+                - is_quantized() == false
+            ensures
+                - Multiplies the weights and the biases by val, so that the outputs are
+                  multiplied by val.  This is how fuse_layers() folds a multiply_ layer into
+                  the linear_ layer below it.
+        !*/
+
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - forward() then leaves its output empty.  This is used by fuse_layers()
+                  when the add_prev_ layer above computes the output of this layer and adds
+                  it to its own with add_output_to().
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
+        template <typename SUBNET>
+        void add_output_to(
+            const SUBNET& sub,
+            tensor& output,
+            resizable_tensor& scratch
+        ) const;
+        /*!
+            requires
+                - sub is the input of this layer, as given to forward().
+                - output has the dimensions forward() would give to its output.
+            ensures
+                - Adds the output forward() would compute to output.  scratch is used as
+                  temporary storage.
+        !*/
+
         dpoint map_input_to_output(
             const dpoint& p
         ) const;
@@ -1849,6 +2024,18 @@ namespace dlib
                   be replaced with 0.
         !*/
 
+        void set_replay_mode (
+            bool replay
+        );
+        /*!
+            ensures
+                - While replay == true, forward_inplace() reuses the mask drawn by the
+                  previous call instead of drawing a new one, as long as the input has the
+                  same dimensions.  This is how repeat objects with checkpointing enabled
+                  recompute the same outputs during back_propagate_error().
+                - Replay mode is off by default and is not serialized.
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         void forward_inplace(const tensor& input, tensor& output);
         void backward_inplace(const tensor& gradient_input, tensor& data_grad, tensor& params_grad);
@@ -1939,6 +2126,23 @@ namespace dlib
                   produces the result as output.
         !*/
 
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - forward_inplace() and backward_inplace() then return immediately,
+                  making this layer an identity transform.  fuse_layers() does this when
+                  the value has been folded into the linear_ layer below.
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         void forward_inplace(const tensor& input, tensor& output);
         void backward_inplace(const tensor& gradient_input, tensor& data_grad, tensor& params_grad);
@@ -2009,6 +2213,24 @@ namespace dlib
                   variance to prevent the division from dividing by zero.
         !*/
 
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - #get_layer_params().size() == 0
+                - forward() then leaves its output empty and backward() must not be called
+                  anymore.  fuse_layers() does this when the linear_ layer above applies
+                  the normalization to its own input (see linear_::fuse_input()).
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
         double get_learning_rate_multiplier(
         ) const;
         /*!
@@ -2167,6 +2389,24 @@ namespace dlib
                 mean square to prevent division by zero.
         !*/
 
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - #get_layer_params().size() == 0
+                - forward() then leaves its output empty and backward() must not be called
+                  anymore.  fuse_layers() does this when the linear_ layer above applies
+                  the normalization to its own input (see linear_::fuse_input()).
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
         void set_eps(
             float val
         );
@@ -2268,6 +2508,90 @@ namespace dlib
     template <typename SUBNET>
     using rms_norm = add_layer<rms_norm_, SUBNET>;
 
+// ----------------------------------------------------------------------------------------
+
+    class token_rms_norm_
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object implements the EXAMPLE_COMPUTATIONAL_LAYER_ interface
+                defined above, specifically defining an RMS normalization layer that works
+                on each row of its input independently.
+
+                For an input tensor with shape [num_samples, k, nr, nc], every one of the
+                num_samples*k*nr rows of nc values is divided by its own root mean square
+                and then multiplied by a learnable gamma of size [nc].  Hence, when the rows
+                hold the tokens of a sequence, the output for a token doesn't depend on any
+                other token.  This is what allows a transformer to process only the new
+                tokens of a sequence while decoding with a kv_cache (see transformer_abstract.h),
+                which is not possible with rms_norm_ since it normalizes the whole sample.
+        !*/
+
+    public:
+        token_rms_norm_(
+        );
+        /*!
+            ensures
+                - #get_learning_rate_multiplier() == 1
+                - #get_weight_decay_multiplier()  == 0
+                - #get_eps() == DEFAULT_RMS_NORM_EPS
+        !*/
+
+        explicit token_rms_norm_(
+            float eps_
+        );
+        /*!
+            requires
+                - eps_ > 0
+            ensures
+                - #get_learning_rate_multiplier() == 1
+                - #get_weight_decay_multiplier()  == 0
+                - #get_eps() == eps_
+        !*/
+
+        float get_eps() const;
+
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - #get_layer_params().size() == 0
+                - forward() then leaves its output empty and backward() must not be called
+                  anymore.  fuse_layers() does this when the linear_ layer above applies
+                  the normalization of each row to its own input (see linear_::fuse_input()).
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+        void set_eps(float val);
+        double get_learning_rate_multiplier() const;
+        double get_weight_decay_multiplier() const;
+        void set_learning_rate_multiplier(double val);
+        void set_weight_decay_multiplier(double val);
+        /*!
+            These functions have the same meaning as the corresponding rms_norm_ functions.
+        !*/
+
+        template <typename SUBNET> void setup (const SUBNET& sub);
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output);
+        template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad);
+        dpoint map_input_to_output(dpoint p) const;
+        dpoint map_output_to_input(dpoint p) const;
+        const tensor& get_layer_params() const;
+        tensor& get_layer_params();
+        /*!
+            These functions are implemented as described in the EXAMPLE_COMPUTATIONAL_LAYER_ interface.
+        !*/
+    };
+
+    template <typename SUBNET>
+    using token_rms_norm = add_layer<token_rms_norm_, SUBNET>;
+
 // ----------------------------------------------------------------------------------------
 
     enum layer_mode
@@ -3274,6 +3598,23 @@ namespace dlib
         gelu_(
         );
 
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - forward() then leaves its output empty and backward() must not be called
+                  anymore.  fuse_layers() does this when the linear_ layer above applies
+                  the activation to its own input (see linear_::fuse_input()).
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& data_output);
         template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor&);
@@ -3365,6 +3706,23 @@ namespace dlib
         silu_(
         );
 
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_disabled() == true
+                - forward() then leaves its output empty and backward() must not be called
+                  anymore.  fuse_layers() does this when the linear_ layer above applies
+                  the activation to its own input (see linear_::fuse_input()).
+        !*/
+
+        bool is_disabled(
+        ) const;
+        /*!
+            ensures
+                - returns true if disable() has been called on this layer.
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& data_output);
         template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor&);
@@ -3514,6 +3872,32 @@ namespace dlib
         add_prev_(
         ); 
 
+        void fuse_input(
+        );
+        /*!
+            requires
+                - The layer below this one is a linear_ layer, possibly followed by a
+                  multiply_ layer whose value has been folded into it, and this linear_
+                  layer is disabled.
+                - The output of the linear_ layer has the dimensions of
+                  layer<tag>(sub).get_output().
+            ensures
+                - #has_fused_input() == true
+                - forward() then copies layer<tag>(sub).get_output() to its output and
+                  lets the linear_ layer add its own output to it with
+                  linear_::add_output_to().  The output of the linear_ layer is thus
+                  never stored.
+                - backward() must not be called anymore.
+                - fuse_layers() uses this for the residual connections of transformers.
+        !*/
+
+        bool has_fused_input(
+        ) const;
+        /*!
+            ensures
+                - returns true if fuse_input() has been called on this layer.
+        !*/
+
         template <typename SUBNET> void setup (const SUBNET& sub);
         template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output);
         template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad);
@@ -4526,6 +4910,31 @@ namespace dlib
         const tensor& get_embeddings() const;
         tensor& get_embeddings();
 
+        void quantize(int bits = 8);
+        /*!
+            requires
+                - bits == 8 || bits == 4 || bits == 16
+                - setup() has been called (or the layer was deserialized)
+            ensures
+                - #is_quantized() == true
+                - Replaces the embedding vectors with #get_quantized_embeddings(), which
+                  stores each of them with its own scale, and empties get_embeddings().
+                - forward() then produces the same output as before, up to the quantization
+                  error, using tt::quantized_embeddings().  The layer can only be used for
+                  inference.
+                - If is_quantized() was already true this function does nothing.
+        !*/
+
+        bool is_quantized() const;
+        const quantized_matrix& get_quantized_embeddings() const;
+        /*!
+            ensures
+                - is_quantized() returns true if quantize() has been called on this layer.
+                - get_quantized_embeddings() returns the get_num_embeddings() x
+                  get_embedding_dim() quantized embedding vectors, or an empty matrix if
+                  !is_quantized().
+        !*/
+
         friend void serialize(const embeddings_& item, std::ostream& out);
         friend void deserialize(embeddings_& item, std::istream& in);
         friend std::ostream& operator<<(std::ostream& out, const embeddings_& item);
@@ -4759,6 +5168,25 @@ namespace dlib
 
         bool uses_padding_context() const;
 
+        void set_bottom_right_aligned(bool flag);
+        /*!
+            ensures
+                - #is_bottom_right_aligned() == flag
+                - Invalidates cached mask if value changed
+        !*/
+
+        bool is_bottom_right_aligned() const;
+        /*!
+            ensures
+                - By default the diagonal starts at the top-left corner of the input.  If
+                  this function returns true and the input has more columns than rows
+                  (nc > nr), the diagonal is instead shifted right by nc - nr so that the
+                  last row sees every column.  This is the mask needed when the rows are the
+                  most recent queries of a sequence whose keys are all present in the
+                  columns, as happens when decoding with a kv_cache.
+                - This flag is not serialized.
+        !*/
+
         friend void serialize(const tril_& item, std::ostream& out);
         /*!
             ensures
@@ -5051,6 +5479,43 @@ namespace dlib
                 - Returns the current YaRN configuration
         !*/
 
+        void set_incremental_mode(
+            bool flag
+        );
+        /*!
+            ensures
+                - #is_incremental_mode() == flag
+                - #get_position_offset() == 0
+        !*/
+
+        bool is_incremental_mode(
+        ) const;
+        /*!
+            ensures
+                - Returns true if this layer is in incremental mode.  In this mode the rows
+                  given to forward() are taken to be the positions get_position_offset(),
+                  get_position_offset()+1, ... of a sequence rather than starting at 0, and
+                  each forward() call advances get_position_offset() by the number of rows
+                  it received.  This is used when decoding with a kv_cache, where only the
+                  new tokens of a sequence go through the network.
+                - Incremental mode is not serialized.
+        !*/
+
+        long get_position_offset(
+        ) const;
+        /*!
+            ensures
+                - Returns the position of the first row of the next forward() call when
+                  is_incremental_mode() == true.
+        !*/
+
+        void reset_position_offset(
+        );
+        /*!
+            ensures
+                - #get_position_offset() == 0
+        !*/
+
         template <typename SUBNET>
         void setup(
             const SUBNET& sub
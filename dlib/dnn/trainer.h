@@ -12,6 +12,7 @@
 #include <sstream>
 #include "../serialize.h"
 #include "lr_scheduler.h"
+#include "data_loader.h"
 
 #include "../pipe.h"
 #include "../threads.h"
@@ -163,6 +164,18 @@ namespace dlib
             mini_batch_size = batch_size;
         }
 
+        unsigned long get_gradient_accumulation_steps (
+        ) const { return gradient_accumulation_steps; }
+
+        void set_gradient_accumulation_steps (
+            unsigned long steps
+        )
+        {
+            DLIB_CASSERT(steps > 0);
+            wait_for_thread_to_pause();
+            gradient_accumulation_steps = steps;
+        }
+
         unsigned long get_max_num_epochs (
         ) const { return max_num_epochs; }
 
@@ -297,6 +310,26 @@ namespace dlib
             ++test_one_step_calls;
         }
 
+        void train_one_step (
+            prefetched_batch<input_type,training_label_type>& batch
+        )
+        {
+            print_periodic_verbose_status();
+            sync_to_disk();
+            send_batch_job(false, batch);
+            ++train_one_step_calls;
+        }
+
+        void test_one_step (
+            prefetched_batch<input_type,training_label_type>& batch
+        )
+        {
+            print_periodic_verbose_status();
+            sync_to_disk();
+            send_batch_job(true, batch);
+            ++test_one_step_calls;
+        }
+
         void train (
             const std::vector<input_type>& data,
             const std::vector<training_label_type>& labels 
@@ -654,6 +687,43 @@ namespace dlib
             dev.net.update_parameters(make_sstack(dev.solvers), learning_rate);
         }
 
+        void accumulate_parameter_gradients(size_t device)
+        {
+            auto&& dev = *devices[device];
+            dlib::cuda::set_device(dev.device_id);
+            dev.gradient_sums.resize(num_computational_layers);
+            visit_layer_parameter_gradients(dev.net, [&](size_t j, tensor& t)
+            {
+                if (t.size() == 0)
+                    return;
+                if (dev.accumulated_batches == 0)
+                {
+                    dev.gradient_sums[j].copy_size(t);
+                    memcpy(dev.gradient_sums[j], t);
+                }
+                else
+                {
+                    tt::add(1, dev.gradient_sums[j], 1, t);
+                }
+            });
+            ++dev.accumulated_batches;
+        }
+
+        void load_accumulated_gradients(size_t device)
+        {
+            // The loss layers average their gradient over the samples of a mini-batch, so
+            // averaging over the micro-batches gives the gradient of the whole step.
+            auto&& dev = *devices[device];
+            dlib::cuda::set_device(dev.device_id);
+            if (dev.accumulated_batches == 0)
+                return;
+            visit_layer_parameter_gradients(dev.net, [&](size_t j, tensor& t)
+            {
+                if (t.size() != 0)
+                    tt::affine_transform(t, dev.gradient_sums[j], 1.0f/dev.accumulated_batches);
+            });
+        }
+
         void thread() try
         {
             training_label_type pick_which_run_update;
@@ -699,7 +769,15 @@ namespace dlib
                     double theloss = 0;
                     for (auto&& loss : losses)
                         theloss += loss.get();
-                    record_test_loss(theloss/losses.size());
+
+                    // When accumulating gradients a test loss is recorded for the same
+                    // number of mini-batches as a training loss.
+                    test_loss_sum += theloss/losses.size();
+                    if (++test_micro_batches < gradient_accumulation_steps)
+                        continue;
+                    record_test_loss(test_loss_sum/test_micro_batches);
+                    test_loss_sum = 0;
+                    test_micro_batches = 0;
 
                     // Check if we should shrink the learning rate based on how the test
                     // error has been doing lately.
@@ -724,8 +802,6 @@ namespace dlib
                     continue;
                 }
 
-                updated_net_since_last_sync = true;
-                ++main_iteration_counter;
                 // Call compute_parameter_gradients() and update_parameters() but pick the
                 // right version for unsupervised or supervised training based on the type
                 // of training_label_type.
@@ -735,7 +811,37 @@ namespace dlib
                 double theloss = 0;
                 for (auto&& loss : losses)
                     theloss += loss.get();
-                record_loss(theloss/losses.size());
+
+                // When accumulating gradients, each job is a micro-batch whose gradients
+                // are summed on every device.  The solvers only run once
+                // gradient_accumulation_steps of them have been seen, on the average
+                // gradient, and the loss of the step is the average of their losses.
+                bool accumulated = false;
+                if (gradient_accumulation_steps > 1 || accumulated_micro_batches != 0)
+                {
+                    for (size_t i = 0; i < devices.size(); ++i)
+                        tp[i]->add_task_by_value([&,i](){ if (next_job.have_data[i]) accumulate_parameter_gradients(i); });
+                    for (size_t i = 0; i < devices.size(); ++i)
+                        tp[i]->wait_for_all_tasks();
+                    accumulated_loss += theloss/losses.size();
+                    if (++accumulated_micro_batches < gradient_accumulation_steps)
+                        continue;
+
+                    for (size_t i = 0; i < devices.size(); ++i)
+                        tp[i]->add_task_by_value([&,i](){ load_accumulated_gradients(i); });
+                    for (size_t i = 0; i < devices.size(); ++i)
+                        tp[i]->wait_for_all_tasks();
+                    record_loss(accumulated_loss/accumulated_micro_batches);
+                    accumulated_loss = 0;
+                    accumulated_micro_batches = 0;
+                    accumulated = true;
+                }
+                else
+                {
+                    record_loss(theloss/losses.size());
+                }
+                updated_net_since_last_sync = true;
+                ++main_iteration_counter;
 
                 // Now, if there is more than one active device we need to synchronize the
                 // gradient updates between devices.  So we do that now.
@@ -788,7 +894,14 @@ namespace dlib
 
                 // Now apply all the updates to each device.
                 for (size_t i = 0; i < devices.size(); ++i)
-                    tp[i]->add_task_by_value([&,i](){ if (next_job.have_data[i]) update_parameters(i); });
+                {
+                    tp[i]->add_task_by_value([&,i](){
+                        auto&& dev = *devices[i];
+                        if (accumulated ? dev.accumulated_batches != 0 : next_job.have_data[i]) 
+                            update_parameters(i);
+                        dev.accumulated_batches = 0;
+                    });
+                }
                 // and wait for the updates to all happen.
                 for (size_t i = 0; i < devices.size(); ++i)
                     tp[i]->wait_for_all_tasks();
@@ -876,6 +989,11 @@ namespace dlib
         {
             max_num_epochs = 10000;
             mini_batch_size = 128;
+            gradient_accumulation_steps = 1;
+            accumulated_micro_batches = 0;
+            accumulated_loss = 0;
+            test_micro_batches = 0;
+            test_loss_sum = 0;
             verbose = false;
             learning_rate = 1e-2;
             min_learning_rate = 1e-5;
@@ -914,7 +1032,7 @@ namespace dlib
         friend void serialize(const dnn_trainer& item, std::ostream& out)
         {
             item.wait_for_thread_to_pause();
-            int version = 13;
+            int version = 14;
             serialize(version, out);
 
             size_t nl = dnn_trainer::num_layers;
@@ -944,13 +1062,14 @@ namespace dlib
             serialize(item.previous_loss_values_dump_amount, out);
             serialize(item.test_previous_loss_values_dump_amount, out);
             serialize(item.previous_loss_values_to_keep_until_disk_sync, out);
+            serialize(item.gradient_accumulation_steps, out);
         }
         friend void deserialize(dnn_trainer& item, std::istream& in)
         {
             item.wait_for_thread_to_pause();
             int version = 0;
             deserialize(version, in);
-            if (version != 13)
+            if (!(13 <= version && version <= 14))
                 throw serialization_error("Unexpected version found while deserializing dlib::dnn_trainer.");
 
             size_t num_layers = 0;
@@ -990,6 +1109,17 @@ namespace dlib
             deserialize(item.previous_loss_values_dump_amount, in);
             deserialize(item.test_previous_loss_values_dump_amount, in);
             deserialize(item.previous_loss_values_to_keep_until_disk_sync, in);
+            item.gradient_accumulation_steps = 1;
+            if (version >= 14)
+                deserialize(item.gradient_accumulation_steps, in);
+
+            // Gradients accumulated for the network that was replaced are thrown away
+            item.accumulated_micro_batches = 0;
+            item.accumulated_loss = 0;
+            item.test_micro_batches = 0;
+            item.test_loss_sum = 0;
+            for (auto&& dev : item.devices)
+                dev->accumulated_batches = 0;
 
             if (item.devices.size() > 1)
             {
@@ -1172,6 +1302,11 @@ namespace dlib
             std::shared_ptr<net_type> net_copy;
             net_type& net;
             std::vector<solver_type> solvers;
+
+            // Sums of the parameter gradients of the micro-batches seen since the last
+            // update when accumulating gradients, and the number of these micro-batches.
+            std::vector<resizable_tensor> gradient_sums;
+            unsigned long accumulated_batches = 0;
         };
 
         template <
@@ -1243,6 +1378,72 @@ namespace dlib
             send_job(test_only, dbegin, dend, nothing);
         }
 
+        void send_batch_job (
+            bool test_only,
+            prefetched_batch<input_type,training_label_type>& batch
+        )
+        {
+            const size_t num = batch.samples.size();
+            DLIB_CASSERT(num > 0 && batch.data.num_samples() > 0 && batch.data.num_samples()%num == 0,
+                "The batch must hold samples and the tensor made from them by the input layer.");
+            propagate_exception();
+            const size_t devs = devices.size();
+            job.t.resize(devs);
+            job.labels.resize(devs);
+            job.have_data.resize(devs);
+            job.test_only = test_only;
+
+            const bool has_unsupervised_loss = std::is_same<no_label_type, training_label_type>::value;
+            DLIB_CASSERT(has_unsupervised_loss || batch.labels.size() == num);
+
+            const long long factor = batch.data.num_samples()/num;
+            const size_t sample_size = batch.data.size()/batch.data.num_samples();
+            const double block_size = num / static_cast<double>(devs);
+            const auto prev_dev = dlib::cuda::get_device();
+
+            double j = 0;
+            for (size_t i = 0; i < devs; ++i)
+            {
+                dlib::cuda::set_device(devices[i]->device_id);
+
+                const size_t start = static_cast<size_t>(std::round(j));
+                const size_t stop  = static_cast<size_t>(std::round(j + block_size));
+
+                if (start < stop)
+                {
+                    // The tensor was made without the network, which learns its sample
+                    // expansion factor by converting one sample the first time.
+                    if (devices[i]->net.sample_expansion_factor() == 0)
+                        devices[i]->net.to_tensor(batch.samples.begin()+start, batch.samples.begin()+start+1, job.t[i]);
+
+                    if (start == 0 && stop == num)
+                    {
+                        // Exchange the buffers, the batch gets back the ones of an older job
+                        job.t[i].swap(batch.data);
+                    }
+                    else
+                    {
+                        alias_tensor slice((stop-start)*factor, batch.data.k(), batch.data.nr(), batch.data.nc());
+                        job.t[i].set_size(slice.num_samples(), slice.k(), slice.nr(), slice.nc());
+                        memcpy(job.t[i], slice(static_cast<const tensor&>(batch.data), start*factor*sample_size).get());
+                    }
+                    job.t[i].async_copy_to_device();
+                    if (!has_unsupervised_loss)
+                        job.labels[i].assign(batch.labels.begin()+start, batch.labels.begin()+stop);
+                    job.have_data[i] = true;
+                }
+                else
+                {
+                    job.have_data[i] = false;
+                }
+
+                j += block_size;
+            }
+
+            dlib::cuda::set_device(prev_dev);
+            job_pipe.enqueue(job);
+        }
+
         void print_progress()
         {
             if (lr_schedule.size() == 0)
@@ -1297,6 +1498,7 @@ namespace dlib
         std::deque<double> previous_loss_values;
         unsigned long max_num_epochs;
         size_t mini_batch_size;
+        unsigned long gradient_accumulation_steps;
         bool verbose;
         net_type& net;
         std::atomic<double> learning_rate;
@@ -1343,6 +1545,12 @@ namespace dlib
         bool sync_file_reloaded;
         unsigned long previous_loss_values_dump_amount;
         unsigned long test_previous_loss_values_dump_amount;
+
+        // State of the current gradient accumulation, not serialized either
+        unsigned long accumulated_micro_batches;
+        double accumulated_loss;
+        unsigned long test_micro_batches;
+        double test_loss_sum;
     };
 
 // ----------------------------------------------------------------------------------------
@@ -1378,6 +1586,8 @@ namespace dlib
         out << "  synchronization file:                       " << trainer.get_synchronization_file() << endl;
         out << "  trainer.get_solvers()[0]:                   " << trainer.get_solvers()[0] << endl;
         out << "  mini batch size:                            " << trainer.get_mini_batch_size() << endl;
+        if (trainer.get_gradient_accumulation_steps() > 1)
+            out << "  gradient accumulation steps:                " << trainer.get_gradient_accumulation_steps() << endl;
         auto sched = trainer.get_learning_rate_schedule();
         if (sched.size() != 0)
         {
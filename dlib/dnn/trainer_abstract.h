@@ -83,6 +83,7 @@ namespace dlib
                   provided solver instance.
                 - #get_max_num_epochs() == 10000
                 - #get_mini_batch_size() == 128
+                - #get_gradient_accumulation_steps() == 1
                 - #get_learning_rate() == 1e-2 
                 - #get_min_learning_rate() == 1e-5
                 - #get_iterations_without_progress_threshold() == 2000
@@ -163,6 +164,39 @@ namespace dlib
                 - #get_mini_batch_size() == batch_size
         !*/
 
+        unsigned long get_gradient_accumulation_steps (
+        ) const; 
+        /*!
+            ensures
+                - Returns the number of mini-batches whose parameter gradients are
+                  averaged before the solvers update the network.  Each mini-batch given
+                  to the network is then a "micro-batch" and the solvers behave as if
+                  they saw a single mini-batch of
+                  get_mini_batch_size()*get_gradient_accumulation_steps() samples.  This
+                  allows training with large batches that do not fit in the memory of
+                  the device.
+                - The loss recorded for a step (see get_average_loss()) is the average of
+                  the losses of its micro-batches.  Likewise, the loss recorded by
+                  test_one_step() is the average over get_gradient_accumulation_steps()
+                  calls, so the test loss history keeps the same granularity as the
+                  training loss history.
+                - The learning rate schedule, the learning rate shrinking and the
+                  synchronization with the other devices all happen once per step, not
+                  once per micro-batch.
+        !*/
+
+        void set_gradient_accumulation_steps (
+            unsigned long steps
+        );
+        /*!
+            requires
+                - steps > 0
+            ensures
+                - #get_gradient_accumulation_steps() == steps
+                - This function blocks until all threads inside the dnn_trainer have
+                  stopped touching the net. 
+        !*/
+
         unsigned long get_max_num_epochs (
         ) const; 
         /*!
@@ -468,6 +502,10 @@ namespace dlib
                   disk into the training process while train() requires you to first load
                   all the training data into RAM.  Otherwise, these training methods are
                   equivalent.
+                - If get_gradient_accumulation_steps() > 1 then data is a micro-batch and
+                  the network is only updated every get_gradient_accumulation_steps()
+                  calls.  Micro-batches left over when training stops do not update
+                  the network.
                 - You can observe the current average loss value by calling get_average_loss().
                 - The network training will happen in another thread.  Therefore, after
                   calling this function you should call get_net() before you touch the net
@@ -558,6 +596,26 @@ namespace dlib
                   accessing the network.
                 - #get_train_one_step_calls() == get_train_one_step_calls() + 1.
         !*/
+
+        void train_one_step (
+            prefetched_batch<input_type,training_label_type>& batch
+        );
+        /*!
+            requires
+                - batch was made by a data_loader<net_type>, i.e. batch.data is the
+                  tensor made by the input layer of the network from batch.samples, and
+                  batch.labels.size() == batch.samples.size() if net_type uses a
+                  supervised loss.
+            ensures
+                - Same as train_one_step(batch.samples, batch.labels), except that the
+                  samples are not converted to a tensor again: batch.data is used
+                  directly.  This is how a data_loader moves the conversion out of the
+                  training thread.
+                - With a single device, the memory of batch.data is exchanged with the
+                  trainer's, so #batch.data is an unspecified tensor whose memory
+                  get_next_batch() will reuse.
+                - #get_train_one_step_calls() == get_train_one_step_calls() + 1.
+        !*/
         
         double get_average_loss (
         ) const;
@@ -712,6 +770,18 @@ namespace dlib
                 - #get_test_one_step_calls() == get_test_one_step_calls() + 1.
         !*/
 
+        void test_one_step (
+            prefetched_batch<input_type,training_label_type>& batch
+        );
+        /*!
+            requires
+                - batch was made by a data_loader<net_type>.
+            ensures
+                - Same as test_one_step(batch.samples, batch.labels), using batch.data
+                  as the input tensor, like train_one_step(batch).
+                - #get_test_one_step_calls() == get_test_one_step_calls() + 1.
+        !*/
+
         void set_test_iterations_without_progress_threshold (
             unsigned long thresh 
         );
@@ -5,6 +5,7 @@
 
 #include "transformer_abstract.h"
 #include "layers.h"
+#include "../threads/parallel_for_extension.h"
 
 namespace dlib
 {
@@ -28,6 +29,339 @@ namespace dlib
 
     // ----------------------------------------------------------------------------------------
 
+    class kv_cache_
+    {
+    public:
+        /*!
+            Key/value cache for incremental (token by token) decoding.
+
+            While disabled this layer is an identity transform.  Once enabled, every
+            forward() call appends the rows of its input (batch, num_heads, new_rows, d_head)
+            to the rows received by the previous calls and outputs the whole history
+            (batch, num_heads, cached_rows + new_rows, d_head).  The history is kept in a
+            buffer with spare capacity so appending only writes the new rows.
+        !*/
+        kv_cache_() : enabled(false), cached_len(0) {}
+
+        kv_cache_(const kv_cache_& other) : enabled(other.enabled), cached_len(0) {}
+
+        kv_cache_& operator=(const kv_cache_& other)
+        {
+            if (this != &other) {
+                enabled = other.enabled;
+                clear();
+            }
+            return *this;
+        }
+
+        void enable() { enabled = true; clear(); }
+        void disable() { enabled = false; clear(); }
+        bool is_enabled() const { return enabled; }
+
+        void clear()
+        {
+            cached_len = 0;
+            storage.clear();
+        }
+
+        long get_cached_length() const { return cached_len; }
+
+        template <typename SUBNET>
+        void setup(const SUBNET& /*sub*/)
+        {
+        }
+
+        template <typename SUBNET>
+        void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            const tensor& input = sub.get_output();
+            if (!enabled)
+            {
+                output.copy_size(input);
+                tt::copy_tensor(false, output, 0, input, 0, input.k());
+                return;
+            }
+
+            const long num_planes = input.num_samples() * input.k();
+            const long new_rows = input.nr();
+            const long nc = input.nc();
+            DLIB_CASSERT(cached_len == 0 || (storage.num_samples() == input.num_samples() &&
+                storage.k() == input.k() && storage.nc() == nc),
+                "\nThe input of an enabled kv_cache_ must keep the same batch size, number of heads and"
+                << " row width between calls. Call clear() before starting a new sequence."
+                << "\ncached: [" << storage.num_samples() << ", " << storage.k() << ", " << cached_len << ", " << storage.nc() << "]"
+                << "\ninput:  [" << input.num_samples() << ", " << input.k() << ", " << new_rows << ", " << nc << "]");
+
+            const long total_len = cached_len + new_rows;
+            if (cached_len == 0 || storage.nr() < total_len)
+                reserve(input.num_samples(), input.k(), std::max(total_len, 2 * cached_len), nc);
+
+            // Append the new rows at the end of every plane
+            const long capacity = storage.nr();
+            float* s = storage.host();
+            const float* in = input.host();
+            for (long p = 0; p < num_planes; ++p)
+                std::memcpy(s + (p * capacity + cached_len) * nc, in + p * new_rows * nc,
+                    sizeof(float) * new_rows * nc);
+            cached_len = total_len;
+
+            output.set_size(input.num_samples(), input.k(), cached_len, nc);
+            float* out = output.host_write_only();
+            for (long p = 0; p < num_planes; ++p)
+                std::memcpy(out + p * cached_len * nc, s + p * capacity * nc,
+                    sizeof(float) * cached_len * nc);
+        }
+
+        template <typename SUBNET>
+        void backward(const tensor& gradient_input, SUBNET& sub, tensor& /*params_grad*/)
+        {
+            DLIB_CASSERT(!enabled, "A kv_cache_ layer can't be trained while its cache is enabled.");
+            tt::copy_tensor(true, sub.get_gradient_input(), 0, gradient_input, 0, gradient_input.k());
+        }
+
+        inline dpoint map_input_to_output(const dpoint& p) const { return p; }
+        inline dpoint map_output_to_input(const dpoint& p) const { return p; }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const kv_cache_& /*item*/, std::ostream& out)
+        {
+            serialize("kv_cache_", out);
+        }
+
+        friend void deserialize(kv_cache_& item, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "kv_cache_")
+                throw serialization_error("Unexpected version '" + version + "' found while deserializing dlib::kv_cache_.");
+            item.disable();
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const kv_cache_& item)
+        {
+            out << "kv_cache (enabled=" << (item.enabled ? "true" : "false")
+                << ", cached_length=" << item.cached_len << ")";
+            return out;
+        }
+
+        friend void to_xml(const kv_cache_& /*item*/, std::ostream& out)
+        {
+            out << "<kv_cache/>\n";
+        }
+
+    private:
+        void reserve(long num_samples, long k, long capacity, long nc)
+        {
+            resizable_tensor temp(num_samples, k, capacity, nc);
+            if (cached_len != 0)
+            {
+                const float* s = storage.host();
+                float* d = temp.host_write_only();
+                for (long p = 0; p < num_samples * k; ++p)
+                    std::memcpy(d + p * capacity * nc, s + p * storage.nr() * nc,
+                        sizeof(float) * cached_len * nc);
+            }
+            storage.swap(temp);
+        }
+
+        bool enabled;
+        long cached_len;
+        resizable_tensor storage;   // (batch, num_heads, capacity, d_head)
+        resizable_tensor params;    // unused
+    };
+
+    template <typename SUBNET>
+    using kv_cache = add_layer<kv_cache_, SUBNET>;
+
+    namespace impl
+    {
+        class visitor_kv_cache
+        {
+        public:
+            enum class action { enable, disable, reset };
+
+            visitor_kv_cache(action a_, long& num_caches_) : a(a_), num_caches(num_caches_) {}
+
+            template <typename T>
+            void apply(T&) const
+            {
+                // ignore other layer types
+            }
+
+            void apply(kv_cache_& l) const
+            {
+                ++num_caches;
+                switch (a)
+                {
+                    case action::enable: l.enable(); break;
+                    case action::disable: l.disable(); break;
+                    case action::reset: l.clear(); break;
+                }
+            }
+
+            void apply(rotary_positional_embedding_& l) const
+            {
+                if (a == action::reset)
+                    l.reset_position_offset();
+                else
+                    l.set_incremental_mode(a == action::enable);
+            }
+
+            template <long diag, typename tag, long num, long den>
+            void apply(tril_<diag, tag, num, den>& l) const
+            {
+                if (a != action::reset)
+                    l.set_bottom_right_aligned(a == action::enable);
+            }
+
+            template <typename input_layer_type>
+            void operator()(size_t, input_layer_type&) const
+            {
+                // ignore other layers
+            }
+
+            template <typename T, typename U, typename E>
+            void operator()(size_t, add_layer<T, U, E>& l) const
+            {
+                apply(l.layer_details());
+            }
+
+        private:
+            action a;
+            long& num_caches;
+        };
+    }
+
+    template <typename net_type>
+    void enable_kv_cache(
+        net_type& net
+    )
+    {
+        long num_caches = 0;
+        visit_layers(net, impl::visitor_kv_cache(impl::visitor_kv_cache::action::enable, num_caches));
+        DLIB_CASSERT(num_caches > 0, "enable_kv_cache() requires a network built with kv_cache layers.");
+    }
+
+    template <typename net_type>
+    void disable_kv_cache(
+        net_type& net
+    )
+    {
+        long num_caches = 0;
+        visit_layers(net, impl::visitor_kv_cache(impl::visitor_kv_cache::action::disable, num_caches));
+    }
+
+    template <typename net_type>
+    void reset_kv_cache(
+        net_type& net
+    )
+    {
+        long num_caches = 0;
+        visit_layers(net, impl::visitor_kv_cache(impl::visitor_kv_cache::action::reset, num_caches));
+    }
+
+    // ----------------------------------------------------------------------------------------
+
+    template <
+        template<typename> class tag_k,
+        template<typename> class tag_v
+        >
+    class scaled_dot_product_attention_
+    {
+    public:
+        /*!
+            Causal attention computed in one pass by tt::scaled_dot_product_attention().
+            The queries are the output of the previous layer and the keys and values the
+            outputs of the layers tagged tag_k and tag_v, all laid out as
+            (batch, num_heads, seq_len, d_head).  Left padding declared through
+            tril_padding_context is masked the same way tril_ does.
+        !*/
+        const static unsigned long id_k = tag_id<tag_k>::id;
+        const static unsigned long id_v = tag_id<tag_v>::id;
+
+        scaled_dot_product_attention_() {}
+
+        template <typename SUBNET>
+        void setup(const SUBNET& /*sub*/)
+        {
+        }
+
+        template <typename SUBNET>
+        void forward(const SUBNET& sub, resizable_tensor& output)
+        {
+            const tensor& q = sub.get_output();
+            if (tril_padding_context::is_set())
+                padding_lengths = tril_padding_context::get_all_lengths();
+            else
+                padding_lengths.clear();
+            tt::scaled_dot_product_attention(output, lse, q, layer<tag_k>(sub).get_output(),
+                layer<tag_v>(sub).get_output(), get_scale(q), true, padding_lengths);
+        }
+
+        template <typename SUBNET>
+        void backward(
+            const tensor& computed_output,
+            const tensor& gradient_input,
+            SUBNET& sub,
+            tensor& /*params_grad*/
+        )
+        {
+            const tensor& q = sub.get_output();
+            tt::scaled_dot_product_attention_gradient(gradient_input, computed_output, lse,
+                q, layer<tag_k>(sub).get_output(), layer<tag_v>(sub).get_output(),
+                get_scale(q), true, padding_lengths, sub.get_gradient_input(),
+                layer<tag_k>(sub).get_gradient_input(), layer<tag_v>(sub).get_gradient_input());
+        }
+
+        inline dpoint map_input_to_output(const dpoint& p) const { return p; }
+        inline dpoint map_output_to_input(const dpoint& p) const { return p; }
+
+        const tensor& get_layer_params() const { return params; }
+        tensor& get_layer_params() { return params; }
+
+        friend void serialize(const scaled_dot_product_attention_& /*item*/, std::ostream& out)
+        {
+            serialize("scaled_dot_product_attention_", out);
+        }
+
+        friend void deserialize(scaled_dot_product_attention_& /*item*/, std::istream& in)
+        {
+            std::string version;
+            deserialize(version, in);
+            if (version != "scaled_dot_product_attention_")
+                throw serialization_error("Unexpected version '" + version + "' found while deserializing dlib::scaled_dot_product_attention_.");
+        }
+
+        friend std::ostream& operator<<(std::ostream& out, const scaled_dot_product_attention_& /*item*/)
+        {
+            out << "scaled_dot_product_attention (k=tag" << id_k << ", v=tag" << id_v << ")";
+            return out;
+        }
+
+        friend void to_xml(const scaled_dot_product_attention_& /*item*/, std::ostream& out)
+        {
+            out << "<scaled_dot_product_attention k_tag='" << id_k << "' v_tag='" << id_v << "'/>\n";
+        }
+
+    private:
+        static float get_scale(const tensor& q) { return 1.0f / std::sqrt(static_cast<float>(q.nc())); }
+
+        resizable_tensor lse;   // log-sum-exp of the scores of each query row
+        std::vector<long> padding_lengths;
+        resizable_tensor params; // unused
+    };
+
+    template <
+        template<typename> class tag_k,
+        template<typename> class tag_v,
+        typename SUBNET
+        >
+    using scaled_dot_product_attention = add_layer<scaled_dot_product_attention_<tag_k, tag_v>, SUBNET>;
+
+    // ----------------------------------------------------------------------------------------
+
     // CANONICAL TRANSFORMER ARCHITECTURE
     namespace canonical_transformer
     {
@@ -92,6 +426,204 @@ namespace dlib
             long d_model, long num_heads, typename SUBNET>
         using transformer_stack = typename transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, SUBNET>::type;
 
+        // Same network held by a repeat layer, which can recompute the blocks in the
+        // backward pass instead of keeping their activations (see set_all_checkpointing())
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads>
+        struct transformer_block_of
+        {
+            template <typename SUBNET>
+            using type = transformer_block<ACT, DO, d_model, num_heads, SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using repeated_transformer_stack = repeat<num_layers,
+            transformer_block_of<ACT, DO, d_model, num_heads>::template type, tag10<SUBNET>>;
+
+        // FUSED ATTENTION VARIANT
+        // Same network as multihead_attention, but the score matrix, mask and softmax are
+        // replaced by a single scaled_dot_product_attention layer that never stores the
+        // seq_len x seq_len scores.
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_multihead_attention =
+            DO<linear_no_bias<d_model, reshape_to<1, -1, d_model,
+            scaled_dot_product_attention<tag4, tag3,
+            rope<query<d_model, num_heads, skip1<
+            tag4<rope<key<d_model, num_heads, skip2<
+            tag3<value<d_model, num_heads,
+            tag2<SUBNET>>>>>>>>>>>>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_transformer_block =
+            add_prev5<std_ffn<ACT, DO, d_model, rms_norm<tag5<
+            add_prev1<sdpa_multihead_attention<ACT, DO, d_model, num_heads, rms_norm<tag1<SUBNET>>>>>>>>;
+
+        template<long remaining_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET, typename enabled = void>
+        struct sdpa_transformer_stack_impl
+        {
+            using type = sdpa_transformer_block<ACT, DO, d_model, num_heads,
+                typename sdpa_transformer_stack_impl<remaining_layers - 1, ACT, DO, d_model, num_heads, SUBNET>::type>;
+        };
+
+        template<template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        struct sdpa_transformer_stack_impl<0, ACT, DO, d_model, num_heads, SUBNET, void>
+        {
+            using type = tag10<SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_transformer_stack = typename sdpa_transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, SUBNET>::type;
+
+        // KV CACHE VARIANT
+        // Every operation outside attention works on each token independently, so the
+        // network can be fed only the new tokens once the kv_cache layers are enabled.
+
+        // (batch, 1, seq_len, d_model) => (batch, num_heads, seq_len, d_model / num_heads),
+        // each row of a head holding a slice of a single token
+        template <long d_model, long num_heads, typename SUBNET>
+        using split_heads = transpose<reshape_to<num_heads, d_model / num_heads, -1,
+            transpose<SUBNET>>>;
+
+        template <long d_model, typename SUBNET>
+        using merge_heads = transpose<reshape_to<1, d_model, -1, transpose<SUBNET>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_multihead_attention =
+            DO<linear_no_bias<d_model, merge_heads<d_model,
+            multm_prev3<softmaxm<tril_mask<
+            scale_weights<d_model / num_heads,
+            multm_prev4<
+            rope<split_heads<d_model, num_heads, linear_no_bias<d_model, skip2<
+            tag4<transpose<kv_cache<
+            rope<split_heads<d_model, num_heads, linear_no_bias<d_model, skip2<
+            tag3<kv_cache<split_heads<d_model, num_heads, linear_no_bias<d_model,
+            tag2<SUBNET>>>>>>>>>>>>>>>>>>>>>>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_transformer_block =
+            add_prev5<std_ffn<ACT, DO, d_model, token_rms_norm<tag5<
+            add_prev1<cached_multihead_attention<ACT, DO, d_model, num_heads, token_rms_norm<tag1<SUBNET>>>>>>>>;
+
+        template<long remaining_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET, typename enabled = void>
+        struct cached_transformer_stack_impl
+        {
+            using type = cached_transformer_block<ACT, DO, d_model, num_heads,
+                typename cached_transformer_stack_impl<remaining_layers - 1, ACT, DO, d_model, num_heads, SUBNET>::type>;
+        };
+
+        template<template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        struct cached_transformer_stack_impl<0, ACT, DO, d_model, num_heads, SUBNET, void>
+        {
+            using type = tag10<SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_transformer_stack = typename cached_transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, SUBNET>::type;
+
+        // GROUPED-QUERY ATTENTION VARIANT
+        // The keys and values are projected to num_kv_heads heads of d_model / num_heads
+        // features, each shared by num_heads / num_kv_heads query heads.  The sharing is done
+        // by the attention products themselves, so the K/V tensors (and the kv_cache of the
+        // cached variant) are num_heads / num_kv_heads times smaller than the queries.
+        // num_kv_heads == 1 gives multi-query attention, num_kv_heads == num_heads the
+        // standard multi-head attention.
+        template <long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_key = reshape_to<num_kv_heads, -1, d_model / num_heads,
+            linear_no_bias<d_model / num_heads * num_kv_heads, SUBNET>>;
+
+        template <long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_value = reshape_to<num_kv_heads, -1, d_model / num_heads,
+            linear_no_bias<d_model / num_heads * num_kv_heads, SUBNET>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_multihead_attention =
+            DO<linear_no_bias<d_model, reshape_to<1, -1, d_model,
+            multm_prev3<softmaxm<tril_mask<
+            scale_weights<d_model / num_heads,
+            multm_prev4<
+            rope<query<d_model, num_heads, skip1<
+            tag4<transpose<
+            rope<gqa_key<d_model, num_heads, num_kv_heads, skip2<
+            tag3<gqa_value<d_model, num_heads, num_kv_heads,
+            tag2<SUBNET>>>>>>>>>>>>>>>>>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_block =
+            add_prev5<std_ffn<ACT, DO, d_model, rms_norm<tag5<
+            add_prev1<gqa_multihead_attention<ACT, DO, d_model, num_heads, num_kv_heads, rms_norm<tag1<SUBNET>>>>>>>>;
+
+        template<long remaining_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET, typename enabled = void>
+        struct gqa_transformer_stack_impl
+        {
+            using type = gqa_transformer_block<ACT, DO, d_model, num_heads, num_kv_heads,
+                typename gqa_transformer_stack_impl<remaining_layers - 1, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type>;
+        };
+
+        template<template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        struct gqa_transformer_stack_impl<0, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET, void>
+        {
+            using type = tag10<SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_stack = typename gqa_transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_multihead_attention =
+            DO<linear_no_bias<d_model, merge_heads<d_model,
+            multm_prev3<softmaxm<tril_mask<
+            scale_weights<d_model / num_heads,
+            multm_prev4<
+            rope<split_heads<d_model, num_heads, linear_no_bias<d_model, skip2<
+            tag4<transpose<kv_cache<
+            rope<split_heads<d_model / num_heads * num_kv_heads, num_kv_heads,
+            linear_no_bias<d_model / num_heads * num_kv_heads, skip2<
+            tag3<kv_cache<split_heads<d_model / num_heads * num_kv_heads, num_kv_heads,
+            linear_no_bias<d_model / num_heads * num_kv_heads,
+            tag2<SUBNET>>>>>>>>>>>>>>>>>>>>>>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_transformer_block =
+            add_prev5<std_ffn<ACT, DO, d_model, token_rms_norm<tag5<
+            add_prev1<cached_gqa_multihead_attention<ACT, DO, d_model, num_heads, num_kv_heads, token_rms_norm<tag1<SUBNET>>>>>>>>;
+
+        template<long remaining_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET, typename enabled = void>
+        struct cached_gqa_transformer_stack_impl
+        {
+            using type = cached_gqa_transformer_block<ACT, DO, d_model, num_heads, num_kv_heads,
+                typename cached_gqa_transformer_stack_impl<remaining_layers - 1, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type>;
+        };
+
+        template<template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        struct cached_gqa_transformer_stack_impl<0, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET, void>
+        {
+            using type = tag10<SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_transformer_stack = typename cached_gqa_transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type;
+
     } // namespace std_transformer
 
     // FUSED TRANSFORMER ARCHITECTURE
@@ -155,6 +687,54 @@ namespace dlib
             long d_model, long num_heads, typename SUBNET>
         using transformer_stack = typename transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, SUBNET>::type;
 
+        // GROUPED-QUERY ATTENTION VARIANT
+        // One fc layer projects the queries and the num_kv_heads key and value heads, each
+        // key/value head being shared by num_heads / num_kv_heads query heads.
+        template <long num_heads, long num_kv_heads, long d_model, typename SUBNET>
+        using gqa_key = extract<d_model, num_kv_heads, 1, d_model / num_heads, SUBNET>;
+
+        template <long num_heads, long num_kv_heads, long d_model, typename SUBNET>
+        using gqa_value = extract<d_model + d_model / num_heads * num_kv_heads, num_kv_heads,
+            d_model / num_heads, 1, SUBNET>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_multihead_attention =
+            DO<extract<0, 1, 1, d_model, fc_no_bias<d_model,
+            multm_prev3<softmaxm<tril_mask<
+            scale_weights<d_model / num_heads,
+            multm_prev4<
+            query<num_heads, d_model, skip1<
+            tag4<gqa_key<num_heads, num_kv_heads, d_model, skip2<
+            tag3<gqa_value<num_heads, num_kv_heads, d_model,
+            tag2<fc_no_bias<d_model + 2 * (d_model / num_heads * num_kv_heads),
+            SUBNET>>>>>>>>>>>>>>>>>;
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_block =
+            add_prev5<std_ffn<ACT, DO, d_model, rms_norm<tag5<
+            add_prev1<gqa_multihead_attention<ACT, DO, d_model, num_heads, num_kv_heads, rms_norm<tag1<SUBNET>>>>>>>>;
+
+        template<long remaining_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET, typename enabled = void>
+        struct gqa_transformer_stack_impl
+        {
+            using type = gqa_transformer_block<ACT, DO, d_model, num_heads, num_kv_heads,
+                typename gqa_transformer_stack_impl<remaining_layers - 1, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type>;
+        };
+
+        template<template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        struct gqa_transformer_stack_impl<0, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET, void>
+        {
+            using type = tag10<SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_stack = typename gqa_transformer_stack_impl<num_layers, ACT, DO, d_model, num_heads, num_kv_heads, SUBNET>::type;
+
     } // namespace fused_transformer
 
     // Default to canonical transformer implementation
@@ -469,6 +1049,10 @@ namespace dlib
     template <long num_experts, template <typename> class DO, typename SUBNET>
     using gate = fc<num_experts, DO<leaky_relu<fc<num_experts * 8, avg_pool_everything<SUBNET>>>>>;
 
+    // Token gate network: produces raw logits for every token of a sequence
+    template <long num_experts, template <typename> class DO, typename SUBNET>
+    using token_gate = linear<num_experts, DO<leaky_relu<linear<num_experts * 8, SUBNET>>>>;
+
     struct training_mode_tag {};
     struct inference_mode_tag {};
 
@@ -483,17 +1067,22 @@ namespace dlib
     {
     public:
         /*!
-            Mixture of Experts layer with sample-wise expert routing.
+            Mixture of Experts layer with sample-wise or token-wise expert routing.
 
             Key features:
-            - Each sample independently selects top-k experts via gating network
+            - Each sample, or each token when the gate outputs one set of logits per
+              token, independently selects top-k experts via gating network
             - Gate produces logits, optional noise added before softmax (training only)
+            - Samples are dispatched by expert: each expert runs once per batch on all
+              the samples routed to it, up to its capacity
             - Forward/backward consistency via cached expert selections
             - Tracks expert usage statistics for monitoring
 
             Hyperparameters:
             - noise_scale: Gaussian noise std applied to gate logits (exploration)
             - usage_update_rate: EMA smoothing for usage statistics
+            - capacity_factor: budget of each expert relative to a perfectly balanced
+              routing, the routing units beyond it are dropped (<= 0: no limit)
         !*/
         explicit moe_() :
             n_experts(0),
@@ -502,6 +1091,8 @@ namespace dlib
             usage_update_rate(0.05f),
             load_balance_weight(0.01f),
             learning_rate_multiplier(1.0),
+            capacity_factor(1.25f),
+            expert_capacity_(0),
             cached_batch_size_(0)
         {
         }
@@ -513,7 +1104,10 @@ namespace dlib
             usage_update_rate(other.usage_update_rate),
             load_balance_weight(other.load_balance_weight),
             learning_rate_multiplier(other.learning_rate_multiplier),
+            capacity_factor(other.capacity_factor),
             expert_usage(other.expert_usage),
+            expert_drop_rate(other.expert_drop_rate),
+            expert_capacity_(0),
             cached_batch_size_(0)
         {
             // Deep copy of expert networks
@@ -531,7 +1125,10 @@ namespace dlib
                 usage_update_rate = other.usage_update_rate;
                 load_balance_weight = other.load_balance_weight;
                 learning_rate_multiplier = other.learning_rate_multiplier;
+                capacity_factor = other.capacity_factor;
                 expert_usage = other.expert_usage;
+                expert_drop_rate = other.expert_drop_rate;
+                expert_capacity_ = 0;
                 cached_batch_size_ = 0;
 
                 // Deep copy of expert networks
@@ -546,18 +1143,22 @@ namespace dlib
         /*!
             SETUP
                 Initializes expert networks based on gate output dimensions.
-                - Number of experts automatically determined from gate output channels
+                - Number of experts automatically determined from the gate output: its
+                  channels for a (batch, n_experts, 1, 1) sample gate, its columns for a
+                  (batch, 1, seq_len, n_experts) token gate
                 - If top_e == 0 (auto mode), activates 20% of experts (minimum 1)
         !*/
         template <typename SUBNET_TYPE>
         void setup(const SUBNET_TYPE& sub) {
             const tensor& gate_output = layer<TAG>(sub).get_output();
-            long new_n_experts = gate_output.k();
+            long new_n_experts = (gate_output.k() == 1 && gate_output.nc() > 1) ?
+                gate_output.nc() : gate_output.k();
 
             // Initialize experts if needed
             if (new_n_experts != n_experts) {
                 n_experts = new_n_experts;
                 expert_usage.resize(n_experts, 0.0f);
+                expert_drop_rate.resize(n_experts, 0.0f);
 
                 // Create expert network instances
                 experts.clear();
@@ -578,16 +1179,23 @@ namespace dlib
 
         /*!
             FORWARD PASS
-                Sample-wise expert routing with optional exploration noise.
+                Sample-wise or token-wise expert routing with optional exploration noise.
+
+                The routing unit is given by the gate output shape:
+                - [batch, n_experts, 1, 1]: every sample is routed as a whole
+                - [batch, 1, seq_len, n_experts]: every row (token) of a
+                  [batch, 1, seq_len, d_model] input is routed on its own
 
-                Process per sample:
-                1. Retrieve gate logits for this sample
+                Process:
+                1. For each routing unit, retrieve its gate logits
                 2. Add Gaussian noise to logits (training only, if noise_scale > 0)
                 3. Apply softmax to obtain expert probabilities
                 4. Select top-k experts with highest probabilities
                 5. Renormalize top-k weights to sum to 1
-                6. Route sample through selected experts with weighted combination
-                7. Cache expert indices and weights for backward pass
+                6. Gather the units routed to each expert into one contiguous batch,
+                   dropping those beyond the expert's capacity
+                7. Run every expert once on its batch (concurrently on the CPU)
+                8. Scatter the expert outputs back, weighted by the gate
 
                 The cache ensures forward/backward consistency: backward uses the
                 exact same experts and weights, even with stochastic noise.
@@ -598,18 +1206,26 @@ namespace dlib
             const tensor& expert_input = sub.get_output();
             const tensor& gate_logits = layer<TAG>(sub).get_output();
 
-            DLIB_CASSERT(gate_logits.k() == n_experts &&
-                gate_logits.nr() == 1 && gate_logits.nc() == 1,
-                "\nExpected gate output shape [batch_size, " << n_experts << ", 1, 1]"
-                << "\nReceived shape [" << gate_logits.num_samples() << ", "
-                << gate_logits.k() << ", " << gate_logits.nr() << ", "
-                << gate_logits.nc() << "]");
-
-            const long num_samples = gate_logits.num_samples();
             const long k = expert_input.k();
             const long nr = expert_input.nr();
             const long nc = expert_input.nc();
-            const long sample_size = k * nr * nc;
+            const bool per_token = !(gate_logits.k() == n_experts &&
+                gate_logits.nr() == 1 && gate_logits.nc() == 1);
+            DLIB_CASSERT(gate_logits.num_samples() == expert_input.num_samples() && (!per_token ||
+                (gate_logits.k() == 1 && gate_logits.nr() == nr && gate_logits.nc() == n_experts && k == 1)),
+                "\nExpected gate output shape [batch_size, " << n_experts << ", 1, 1]"
+                << " or, for an input of shape [batch_size, 1, seq_len, d_model],"
+                << " [batch_size, 1, seq_len, " << n_experts << "]"
+                << "\nReceived shape [" << gate_logits.num_samples() << ", "
+                << gate_logits.k() << ", " << gate_logits.nr() << ", "
+                << gate_logits.nc() << "]"
+                << "\nInput shape [" << expert_input.num_samples() << ", "
+                << k << ", " << nr << ", " << nc << "]");
+
+            // A routing unit is a whole sample or a single token
+            const long num_units = per_token ? expert_input.num_samples() * nr : expert_input.num_samples();
+            unit_alias_ = per_token ? alias_tensor(1, 1, 1, nc) : alias_tensor(1, k, nr, nc);
+            const long unit_size = unit_alias_.size();
             const float* logits_data = gate_logits.host();
 
             // Initialize output tensor
@@ -617,22 +1233,19 @@ namespace dlib
             output = 0;
 
             // Prepare forward pass cache for backward consistency
-            if (std::is_same<MODE, training_mode_tag>::value) {
-                cached_batch_size_ = num_samples;
-                selected_expert_indices_.resize(num_samples);
-                selected_expert_weights_.resize(num_samples);
-                cached_gate_probs_.resize(num_samples);
-            }
+            cached_batch_size_ = num_units;
+            selected_expert_indices_.resize(num_units);
+            selected_expert_weights_.resize(num_units);
+            if (std::is_same<MODE, training_mode_tag>::value)
+                cached_gate_probs_.resize(num_units);
 
             // Track expert usage for monitoring
             std::vector<float> batch_expert_usage(n_experts, 0.0f);
             std::vector<float> routing_fraction(n_experts, 0.0f);
             std::vector<float> gate_prob_sum(n_experts, 0.0f);
 
-            alias_tensor sample_alias(1, k, nr, nc);
-
-            // Process each sample independently with its own expert routing
-            for (long n = 0; n < num_samples; ++n) {
+            // Select the experts of each routing unit independently
+            for (long n = 0; n < num_units; ++n) {
                 const float* sample_logits = logits_data + n * n_experts;
 
                 // Apply optional Gaussian noise to logits before softmax
@@ -691,42 +1304,53 @@ namespace dlib
                 for (long i = 0; i < top_k; ++i)
                     expert_scores[i].first /= sum_weights;
 
-                // Cache selection for backward pass
-                if (std::is_same<MODE, training_mode_tag>::value) {
-                    selected_expert_indices_[n].resize(top_k);
-                    selected_expert_weights_[n].resize(top_k);
-
-                    for (long i = 0; i < top_k; ++i) {
-                        selected_expert_indices_[n][i] = expert_scores[i].second;
-                        selected_expert_weights_[n][i] = expert_scores[i].first;
-                        routing_fraction[expert_scores[i].second] += 1.0f;
-                    }
-                }
-
-                // Zero-copy views into input and output tensors
-                const long sample_offset = n * sample_size;
-                auto sample_input = sample_alias(expert_input, sample_offset);
-                auto sample_output = sample_alias(output, sample_offset);
-
-                // Route through selected experts and accumulate weighted outputs
+                // Cache selection for dispatch and backward pass
+                selected_expert_indices_[n].resize(top_k);
+                selected_expert_weights_[n].resize(top_k);
                 for (long i = 0; i < top_k; ++i) {
-                    const size_t expert_idx = expert_scores[i].second;
-                    const float weight = expert_scores[i].first;
-
-                    experts[expert_idx].forward(sample_input);
-                    const auto& expert_out = experts[expert_idx].get_output();
+                    selected_expert_indices_[n][i] = expert_scores[i].second;
+                    selected_expert_weights_[n][i] = expert_scores[i].first;
+                    routing_fraction[expert_scores[i].second] += 1.0f;
+                    batch_expert_usage[expert_scores[i].second] += expert_scores[i].first;
+                }
+            }
 
-                    tt::add(1, sample_output, weight, expert_out);
+            // Gather the units of each expert into one batch and run it once
+            const std::vector<long> dropped = dispatch();
+            for (long e = 0; e < n_experts; ++e) {
+                expert_inputs_[e].set_size(expert_samples_[e].size(), unit_alias_.k(), unit_alias_.nr(), unit_alias_.nc());
+                for (size_t j = 0; j < expert_samples_[e].size(); ++j) {
+                    auto dest = unit_alias_(expert_inputs_[e], j * unit_size);
+                    memcpy(dest, unit_alias_(expert_input, expert_samples_[e][j] * unit_size));
+                }
+            }
+            run_experts([&](long e) { experts[e].forward(expert_inputs_[e]); });
+
+            // Scatter the weighted expert outputs back to their units
+            for (long e = 0; e < n_experts; ++e) {
+                const tensor& expert_out = experts[e].get_output();
+                for (size_t j = 0; j < expert_samples_[e].size(); ++j) {
+                    auto unit_output = unit_alias_(output, expert_samples_[e][j] * unit_size);
+                    tt::add(1, unit_output, expert_sample_weights_[e][j],
+                        unit_alias_(expert_out, j * unit_size));
+                }
+            }
 
-                    batch_expert_usage[expert_idx] += weight;
+            // Fraction of the units routed to each expert that exceeded its capacity
+            if (usage_update_rate > 0) {
+                for (long e = 0; e < n_experts; ++e) {
+                    const long routed = expert_samples_[e].size() + dropped[e];
+                    if (routed > 0)
+                        expert_drop_rate[e] = (1.0f - usage_update_rate) * expert_drop_rate[e] +
+                            usage_update_rate * dropped[e] / routed;
                 }
             }
 
             // Update exponential moving average of expert usage (for monitoring)
             if (std::is_same<MODE, training_mode_tag>::value) {
                 for (long e = 0; e < n_experts; ++e) {
-                    routing_fraction[e] /= num_samples;
-                    gate_prob_sum[e] /= num_samples;
+                    routing_fraction[e] /= num_units;
+                    gate_prob_sum[e] /= num_units;
                 }
 
                 load_balance_loss_ = 0.0f;
@@ -740,7 +1364,7 @@ namespace dlib
 
                 if (usage_update_rate > 0) {
                     for (long e = 0; e < n_experts; ++e) {
-                        float avg_usage = batch_expert_usage[e] / num_samples;
+                        float avg_usage = batch_expert_usage[e] / num_units;
                         expert_usage[e] = (1.0f - usage_update_rate) * expert_usage[e] +
                             usage_update_rate * avg_usage;
                     }
@@ -752,12 +1376,13 @@ namespace dlib
             BACKWARD PASS
                 Backpropagates gradients through cached expert selections.
 
-                Process per sample:
-                1. Retrieve cached expert indices and weights from forward pass
-                2. For each selected expert:
-                   a. Scale incoming gradient by expert's weight
-                   b. Backpropagate through expert network
-                   c. Accumulate expert's input gradient
+                Process, mirroring the forward dispatch:
+                1. Gather the incoming gradients of each expert's units, scaled by
+                   the gate weights, into one batch
+                2. Backpropagate each batch once through its expert (concurrently on
+                   the CPU), using the batch of inputs cached by forward()
+                3. Scatter the expert input gradients back to their units.  Dropped
+                   units get no gradient from the expert they overflowed.
 
                 Note: Gradients automatically flow back to gate network through
                 Dlib's computational graph without explicit implementation here.
@@ -768,48 +1393,32 @@ namespace dlib
             tensor& expert_input_grad = sub.get_gradient_input();
             expert_input_grad = 0;
 
-            const tensor& expert_input = sub.get_output();
             const long num_samples = cached_batch_size_;
-            const long k = gradient_input.k();
-            const long nr = gradient_input.nr();
-            const long nc = gradient_input.nc();
-            const long sample_size = k * nr * nc;
+            const long unit_size = unit_alias_.size();
 
-            DLIB_CASSERT(num_samples == (long)selected_expert_indices_.size(),
+            DLIB_CASSERT(num_samples == (long)selected_expert_indices_.size() &&
+                static_cast<size_t>(num_samples) * unit_size == gradient_input.size(),
                 "Forward pass cache missing or invalid in backward pass");
 
-            alias_tensor sample_alias(1, k, nr, nc);
-
-            for (long n = 0; n < num_samples; ++n) {
-                const long sample_offset = n * sample_size;
-
-                auto sample_grad = sample_alias(gradient_input, sample_offset);
-                auto sample_input = sample_alias(expert_input, sample_offset);
-                auto sample_input_grad = sample_alias(expert_input_grad, sample_offset);
-
-                // Use cached expert routing from forward pass
-                const auto& expert_indices = selected_expert_indices_[n];
-                const auto& expert_weights = selected_expert_weights_[n];
-
-                for (size_t i = 0; i < expert_indices.size(); ++i) {
-                    const size_t expert_idx = expert_indices[i];
-                    const float weight = expert_weights[i];
-
-                    // Scale gradient by expert weight
-                    resizable_tensor weighted_grad;
-                    weighted_grad.copy_size(sample_grad);
-
-                    const float* src_data = gradient_input.host() + sample_offset;
-                    float* dst_data = weighted_grad.host();
-                    std::transform(src_data, src_data + sample_size, dst_data,
-                        [weight](float v) { return v * weight; });
-
-                    // Backpropagate through expert
-                    experts[expert_idx].back_propagate_error(sample_input, weighted_grad);
-                    const auto& expert_grad = experts[expert_idx].get_gradient_input();
-
-                    // Accumulate gradient
-                    tt::add(1, sample_input_grad, 1, expert_grad);
+            // Gather the gradients of each expert's units, weighted as in forward()
+            for (long e = 0; e < n_experts; ++e) {
+                expert_grads_[e].copy_size(expert_inputs_[e]);
+                for (size_t j = 0; j < expert_samples_[e].size(); ++j) {
+                    auto dest = unit_alias_(expert_grads_[e], j * unit_size);
+                    tt::affine_transform(dest, unit_alias_(gradient_input, expert_samples_[e][j] * unit_size),
+                        expert_sample_weights_[e][j]);
+                }
+            }
+            run_experts([&](long e) { experts[e].back_propagate_error(expert_inputs_[e], expert_grads_[e]); });
+
+            // Scatter the expert input gradients back to their units
+            for (long e = 0; e < n_experts; ++e) {
+                if (expert_samples_[e].empty())
+                    continue;
+                const tensor& expert_grad = experts[e].get_final_data_gradient();
+                for (size_t j = 0; j < expert_samples_[e].size(); ++j) {
+                    auto unit_input_grad = unit_alias_(expert_input_grad, expert_samples_[e][j] * unit_size);
+                    tt::add(1, unit_input_grad, 1, unit_alias_(expert_grad, j * unit_size));
                 }
             }
 
@@ -881,11 +1490,16 @@ namespace dlib
         long num_active_experts() const { return top_k; }
         bool is_training_mode() const { return std::is_same<MODE, training_mode_tag>::value; }
         const std::vector<float>& get_expert_usage() const { return expert_usage; }
+        const std::vector<float>& get_expert_drop_rate() const { return expert_drop_rate; }
+        long get_expert_capacity() const { return expert_capacity_; }
         float get_load_balance_loss() const { return load_balance_loss_; }
 
+        void set_capacity_factor(float val) { capacity_factor = val; }
+        float get_capacity_factor() const { return capacity_factor; }
+
         friend void serialize(const moe_& item, std::ostream& out)
         {
-            serialize("moe_", out);
+            serialize("moe_2", out);
             serialize(item.n_experts, out);
             serialize(item.top_k, out);
             serialize(item.noise_scale, out);
@@ -894,13 +1508,15 @@ namespace dlib
             serialize(item.learning_rate_multiplier, out);
             serialize(item.experts, out);
             serialize(item.expert_usage, out);
+            serialize(item.capacity_factor, out);
+            serialize(item.expert_drop_rate, out);
         }
 
         friend void deserialize(moe_& item, std::istream& in)
         {
             std::string version;
             deserialize(version, in);
-            if (version != "moe_")
+            if (version != "moe_" && version != "moe_2")
                 throw serialization_error("Incorrect version '" + version + "' found while deserializing moe_.");
 
             deserialize(item.n_experts, in);
@@ -911,7 +1527,17 @@ namespace dlib
             deserialize(item.learning_rate_multiplier, in);
             deserialize(item.experts, in);
             deserialize(item.expert_usage, in);
+            if (version == "moe_2") {
+                deserialize(item.capacity_factor, in);
+                deserialize(item.expert_drop_rate, in);
+            }
+            else {
+                // Models saved before capacity limits existed keep routing without limit
+                item.capacity_factor = 0;
+                item.expert_drop_rate.assign(item.n_experts, 0.0f);
+            }
 
+            item.expert_capacity_ = 0;
             item.cached_batch_size_ = 0;
         }
 
@@ -924,6 +1550,7 @@ namespace dlib
                 << ", mode=" << (is_training ? "train" : "infer")
                 << ", noise=" << item.noise_scale
                 << ", lb=" << item.load_balance_weight
+                << ", capacity=" << item.capacity_factor
                 << ")";
             out << " learning_rate_mult=" << item.learning_rate_multiplier;
             return out;
@@ -939,6 +1566,7 @@ namespace dlib
                 << " usage_update_rate='" << item.usage_update_rate << "'"
                 << " load_balance_weight='" << item.load_balance_weight << "'"
                 << " learning_rate_mult='" << item.learning_rate_multiplier << "'"
+                << " capacity_factor='" << item.capacity_factor << "'"
                 << " mode='" << (is_training ? "training" : "inference") << "'"
                 << ">\n";
             for (size_t i = 0; i < item.experts.size(); ++i)
@@ -954,10 +1582,69 @@ namespace dlib
                 out << item.expert_usage[i];
             }
             out << "</expert_usage>\n";
+            out << "<expert_drop_rate>";
+            for (size_t i = 0; i < item.expert_drop_rate.size(); ++i)
+            {
+                if (i > 0) out << " ";
+                out << item.expert_drop_rate[i];
+            }
+            out << "</expert_drop_rate>\n";
             out << "</moe>\n";
         }
 
     private:
+        // Groups the routing units by selected expert, up to the capacity of each expert.
+        // The first choices of all the units are placed before their second choices and so
+        // on, so an overflowing unit loses its least weighted experts first.  Returns the
+        // number of units dropped by each expert.
+        std::vector<long> dispatch()
+        {
+            const long num_units = cached_batch_size_;
+            expert_capacity_ = num_units;
+            if (capacity_factor > 0) {
+                expert_capacity_ = std::min(num_units, std::max(1L, static_cast<long>(
+                    std::ceil(capacity_factor * num_units * top_k / n_experts))));
+            }
+
+            expert_samples_.assign(n_experts, std::vector<long>());
+            expert_sample_weights_.assign(n_experts, std::vector<float>());
+            expert_inputs_.resize(n_experts);
+            expert_grads_.resize(n_experts);
+            std::vector<long> dropped(n_experts, 0);
+            for (long i = 0; i < top_k; ++i) {
+                for (long n = 0; n < num_units; ++n) {
+                    const size_t e = selected_expert_indices_[n][i];
+                    if (static_cast<long>(expert_samples_[e].size()) < expert_capacity_) {
+                        expert_samples_[e].push_back(n);
+                        expert_sample_weights_[e].push_back(selected_expert_weights_[n][i]);
+                    }
+                    else {
+                        ++dropped[e];
+                    }
+                }
+            }
+            return dropped;
+        }
+
+        // Calls f(e) for every expert that received samples.  On the CPU the experts run
+        // concurrently since they share no state.  The parallel_for() calls made by their
+        // layers are safe: a pool thread runs these tasks itself when no thread is free.
+        template <typename F>
+        void run_experts(F&& f)
+        {
+            std::vector<long> active;
+            for (long e = 0; e < n_experts; ++e) {
+                if (!expert_samples_[e].empty())
+                    active.push_back(e);
+            }
+#ifdef DLIB_USE_CUDA
+            for (long e : active)
+                f(e);
+#else
+            parallel_for(0, static_cast<long>(active.size()), [&](long i) { f(active[i]); });
+#endif
+        }
+
         template<typename NET>
         auto clean_subnet(NET& net) -> decltype(net.clean(), void())
         {
@@ -977,15 +1664,23 @@ namespace dlib
         float usage_update_rate;            // EMA smoothing rate for usage tracking
         float load_balance_weight;          // Auxiliary loss coefficient for expert load balancing
         double learning_rate_multiplier;
+        float capacity_factor;              // Expert budget relative to a balanced routing (<= 0: unlimited)
 
         // Expert networks
         std::vector<EXPERT_NET> experts;
         std::vector<float> expert_usage;     // Usage statistics (for monitoring)
-
-        // Forward/backward cache (training mode only)
-        std::vector<std::vector<size_t>> selected_expert_indices_;  // [sample][top_k]
-        std::vector<std::vector<float>> selected_expert_weights_;   // [sample][top_k]
-        std::vector<std::vector<float>> cached_gate_probs_;
+        std::vector<float> expert_drop_rate; // Fraction of routed units dropped by capacity (for monitoring)
+
+        // Forward/backward cache
+        std::vector<std::vector<size_t>> selected_expert_indices_;  // [unit][top_k]
+        std::vector<std::vector<float>> selected_expert_weights_;   // [unit][top_k]
+        std::vector<std::vector<long>> expert_samples_;             // [expert][routed unit]
+        std::vector<std::vector<float>> expert_sample_weights_;     // [expert][routed unit]
+        std::vector<resizable_tensor> expert_inputs_;               // [expert] gathered inputs
+        std::vector<resizable_tensor> expert_grads_;                // [expert] gathered gradients
+        alias_tensor unit_alias_;                                   // Shape of a routing unit
+        long expert_capacity_;                                      // Capacity of the last batch
+        std::vector<std::vector<float>> cached_gate_probs_;         // training mode only
         std::vector<float> cached_routing_fraction_;
         std::vector<float> cached_gate_prob_avg_;
         long cached_batch_size_;
@@ -1014,6 +1709,18 @@ namespace dlib
     >
     using moe_ffn = add_prev8<moe<EXPERT_NET, top_e, MODE, tag9, rms_norm<skip8<
         tag9<gate<num_experts, DO, tag8<SUBNET>>>>>>>;
+
+    // Same as moe_ffn, but every token of the sequence chooses its own experts
+    template<
+        typename EXPERT_NET,
+        long num_experts,
+        long top_e,
+        typename MODE,
+        template <typename> class DO,
+        typename SUBNET
+    >
+    using moe_token_ffn = add_prev8<moe<EXPERT_NET, top_e, MODE, tag9, rms_norm<skip8<
+        tag9<token_gate<num_experts, DO, tag8<SUBNET>>>>>>>;
 }
 
 #endif // DLIB_DNN_TRANSFORMER_H_
\ No newline at end of file
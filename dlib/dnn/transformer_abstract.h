@@ -80,6 +80,192 @@ namespace dlib
             - embedding_length should match d_model for transformer architectures
     !*/
 
+// ----------------------------------------------------------------------------------------
+
+    class kv_cache_
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object implements the EXAMPLE_COMPUTATIONAL_LAYER_ interface defined
+                in layers_abstract.h.  It holds the keys (or values) of the tokens already
+                seen by an attention layer so that autoregressive decoding only has to run
+                the network on the new tokens.
+
+                While disabled this layer is the identity.  Once enabled, each forward()
+                call appends the rows of its input, of shape
+                (batch_size, num_heads, new_tokens, d_head), to the rows received since the
+                last clear() and outputs all of them:
+                (batch_size, num_heads, get_cached_length(), d_head).
+                The rows are kept in a buffer whose capacity grows geometrically, so a
+                decoding step only copies the new rows into the cache.
+        !*/
+
+    public:
+        kv_cache_(
+        );
+        /*!
+            ensures
+                - #is_enabled() == false
+                - #get_cached_length() == 0
+        !*/
+
+        void enable(
+        );
+        /*!
+            ensures
+                - #is_enabled() == true
+                - #get_cached_length() == 0
+        !*/
+
+        void disable(
+        );
+        /*!
+            ensures
+                - #is_enabled() == false
+                - #get_cached_length() == 0
+        !*/
+
+        bool is_enabled(
+        ) const;
+
+        void clear(
+        );
+        /*!
+            ensures
+                - Forgets all the cached rows, i.e. #get_cached_length() == 0.  Call this
+                  before starting a new sequence.
+        !*/
+
+        long get_cached_length(
+        ) const;
+        /*!
+            ensures
+                - Returns the number of rows (tokens) currently in the cache.
+        !*/
+
+        template <typename SUBNET> void setup (const SUBNET& sub);
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output);
+        /*!
+            requires
+                - If is_enabled() and get_cached_length() > 0 then sub.get_output() has
+                  the same num_samples(), k() and nc() as the inputs previously cached.
+        !*/
+        template <typename SUBNET> void backward(const tensor& gradient_input, SUBNET& sub, tensor& params_grad);
+        /*!
+            requires
+                - is_enabled() == false
+        !*/
+        dpoint map_input_to_output(dpoint p) const;
+        dpoint map_output_to_input(dpoint p) const;
+        const tensor& get_layer_params() const;
+        tensor& get_layer_params();
+        /*!
+            These functions are implemented as described in the EXAMPLE_COMPUTATIONAL_LAYER_ interface.
+            The cache content and the enabled state are not serialized.
+        !*/
+    };
+
+    template <typename SUBNET>
+    using kv_cache = add_layer<kv_cache_, SUBNET>;
+
+    template <typename net_type>
+    void enable_kv_cache (
+        net_type& net
+    );
+    /*!
+        requires
+            - net_type is an object of type add_layer, add_loss_layer, add_skip_layer, or
+              add_tag_layer.
+            - net contains at least one kv_cache_ layer.
+        ensures
+            - Switches net into incremental decoding mode:
+                - every kv_cache_ layer is enabled and emptied,
+                - every rotary_positional_embedding_ layer is put in incremental mode,
+                - every tril_ layer is made bottom-right aligned.
+            - After this call, feeding the tokens of a sequence to net in consecutive
+              chunks produces, for each chunk, the same outputs as the corresponding rows
+              of a single forward pass over the whole sequence, provided every other layer
+              processes each token independently (e.g. canonical_transformer::cached_transformer_stack).
+    !*/
+
+    template <typename net_type>
+    void reset_kv_cache (
+        net_type& net
+    );
+    /*!
+        requires
+            - net_type is an object of type add_layer, add_loss_layer, add_skip_layer, or
+              add_tag_layer.
+        ensures
+            - Empties every kv_cache_ layer and rewinds every rotary_positional_embedding_
+              layer to position 0, so that the next forward() starts a new sequence.  The
+              decoding mode itself is left unchanged.
+    !*/
+
+    template <typename net_type>
+    void disable_kv_cache (
+        net_type& net
+    );
+    /*!
+        requires
+            - net_type is an object of type add_layer, add_loss_layer, add_skip_layer, or
+              add_tag_layer.
+        ensures
+            - Undoes enable_kv_cache(), returning net to full sequence processing.
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    template <
+        template<typename> class tag_k,
+        template<typename> class tag_v
+        >
+    class scaled_dot_product_attention_
+    {
+        /*!
+            WHAT THIS OBJECT REPRESENTS
+                This object implements the EXAMPLE_COMPUTATIONAL_LAYER_ interface defined
+                in layers_abstract.h.  It computes causal scaled dot-product attention
+                with tt::scaled_dot_product_attention(), replacing the chain
+                multm_prev (Q*K^T) => scale_weights => tril_mask => softmaxm => multm_prev (*V).
+
+                The queries are the output of the previous layer, the keys the output of
+                layer<tag_k>(sub) and the values the output of layer<tag_v>(sub), all of
+                shape (batch, num_heads, seq_len, d_head).  Unlike the layer chain, the keys
+                are not transposed.  The output has shape (batch, num_heads, seq_len, d_head)
+                and is, for each head:
+                    softmax(Q*trans(K)/sqrt(d_head) + causal_mask)*V
+
+                Since the seq_len x seq_len score matrix is never stored, the memory used
+                by this layer grows linearly with the sequence length.  Left padding
+                registered with tril_padding_context is masked like tril_ does.  When
+                there are more keys than queries (e.g. keys coming from a kv_cache) the
+                queries are taken to be the last positions of the sequence.
+        !*/
+
+    public:
+        scaled_dot_product_attention_(
+        );
+
+        template <typename SUBNET> void setup (const SUBNET& sub);
+        template <typename SUBNET> void forward(const SUBNET& sub, resizable_tensor& output);
+        template <typename SUBNET> void backward(const tensor& computed_output, const tensor& gradient_input, SUBNET& sub, tensor& params_grad);
+        dpoint map_input_to_output(dpoint p) const;
+        dpoint map_output_to_input(dpoint p) const;
+        const tensor& get_layer_params() const;
+        tensor& get_layer_params();
+        /*!
+            These functions are implemented as described in the EXAMPLE_COMPUTATIONAL_LAYER_ interface.
+        !*/
+    };
+
+    template <
+        template<typename> class tag_k,
+        template<typename> class tag_v,
+        typename SUBNET
+        >
+    using scaled_dot_product_attention = add_layer<scaled_dot_product_attention_<tag_k, tag_v>, SUBNET>;
+
     namespace canonical_transformer
     {
         /*!
@@ -264,7 +450,8 @@ namespace dlib
                 - Decoder-only architecture with causal masking
                 - Uses RMS normalization for improved training stability
                 - Cannot be used directly with repeat<> due to multiple template parameters
-                  (use transformer_stack<> instead for stacking multiple blocks)
+                  (use transformer_stack<> instead for stacking multiple blocks, or
+                  transformer_block_of<>::type)
         !*/
 
         template<long num_layers, template <typename> class ACT, template <typename> class DO,
@@ -296,6 +483,234 @@ namespace dlib
                 - Equivalent to manually nesting num_layers transformer_block definitions
         !*/
 
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads>
+        struct transformer_block_of
+        {
+            /*!
+                WHAT THIS REPRESENTS
+                    Binds the parameters of transformer_block so that
+                    transformer_block_of<ACT,DO,d_model,num_heads>::template type is a
+                    template taking only the subnetwork, as expected by repeat<>.
+            !*/
+            template <typename SUBNET>
+            using type = transformer_block<ACT, DO, d_model, num_heads, SUBNET>;
+        };
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using repeated_transformer_stack = repeat<num_layers,
+            transformer_block_of<ACT, DO, d_model, num_heads>::template type, tag10<SUBNET>>;
+        /*!
+            WHAT THIS REPRESENTS
+                The same network as transformer_stack, with the same layer numbering, but
+                the blocks are held by a single repeat layer.  This allows training deep or
+                long context models with activation checkpointing: after calling
+                set_all_checkpointing(net, true), only the output of each block is kept by
+                the forward pass and the inside of a block is recomputed when its gradient
+                is needed.  The activation memory of the stack then drops from num_layers
+                blocks to about one block plus num_layers block outputs, for the cost of
+                about one more forward pass.  The parameter gradients are unchanged.
+
+                A network using it can be converted to or from one using transformer_stack
+                by copying the layer parameters in order, but their serialized forms differ.
+
+            TYPICAL USAGE
+                using net_type = loss_cross_entropy_per_logit<linear<vocab_size, rms_norm<
+                    repeated_transformer_stack<24, silu, dropout_10, 512, 8,
+                    embeddings<vocab_size, 512, input<matrix<int, 0, 1>>>>>>>;
+                net_type net;
+                set_all_checkpointing(net, true);
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_multihead_attention = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                Computes the same function as multihead_attention, with the same
+                parameters, but the attention itself is done by a single
+                scaled_dot_product_attention layer.  Training and inference memory no
+                longer grow with the square of the sequence length, which makes long
+                contexts practical on the CPU.
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_transformer_block = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                transformer_block using sdpa_multihead_attention.
+        !*/
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using sdpa_transformer_stack = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                transformer_stack made of sdpa_transformer_block.  It is a drop-in
+                replacement for transformer_stack: a network using one can be converted to
+                the other by copying the layer parameters in order.
+        !*/
+
+        template <long d_model, long num_heads, typename SUBNET>
+        using split_heads = some_template_expression;
+        /*!
+            requires
+                - d_model % num_heads == 0
+            ensures
+                - Splits each token of a (batch, 1, seq_len, d_model) input into num_heads
+                  slices: the output has shape (batch, num_heads, seq_len, d_model/num_heads)
+                  and row t of every head only holds values of token t.
+        !*/
+
+        template <long d_model, typename SUBNET>
+        using merge_heads = some_template_expression;
+        /*!
+            ensures
+                - Inverse of split_heads: (batch, num_heads, seq_len, d_head) =>
+                  (batch, 1, seq_len, d_model) with d_model == num_heads*d_head.
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_multihead_attention = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                Multi-head causal self-attention that supports incremental decoding.
+
+                Unlike multihead_attention, the heads are formed with split_heads so
+                that a token never mixes with the other tokens outside of the attention
+                product, and kv_cache layers are inserted after the (rotated) keys and the
+                values.  Once enable_kv_cache() has been called on the network, only the
+                new tokens need to be given to forward().
+
+            INPUT/OUTPUT SHAPES
+                Input:  (batch_size, 1, new_tokens, d_model)
+                Output: (batch_size, 1, new_tokens, d_model)
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_transformer_block = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                A pre-normalization transformer block built from
+                cached_multihead_attention and std_ffn, using token_rms_norm so that
+                every operation outside attention works on each token independently:
+                    x = x + Attention(TokenRMSNorm(x))
+                    x = x + FFN(TokenRMSNorm(x))
+        !*/
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, typename SUBNET>
+        using cached_transformer_stack = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                Stacks num_layers cached_transformer_block.
+
+            TYPICAL USAGE
+                using my_model =
+                    loss_multiclass_log<linear<vocab_size, token_rms_norm<
+                    cached_transformer_stack<6, silu, multiply, 256, 8,
+                    embeddings<vocab_size, 256,
+                    input<matrix<int, 0, 1>>>>>>>;
+
+                my_model net;
+                enable_kv_cache(net);
+                // forward the prompt, then one generated token at a time
+        !*/
+
+        template <long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_key = some_template_expression;
+        /*!
+            requires
+                - d_model % num_heads == 0
+                - num_heads % num_kv_heads == 0
+            ensures
+                - Projects the input to num_kv_heads key heads of d_model/num_heads features.
+                - Output shape: (batch, num_kv_heads, seq_len, d_model/num_heads)
+        !*/
+
+        template <long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_value = some_template_expression;
+        /*!
+            Same as gqa_key, for the values.
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_multihead_attention = some_template_expression;
+        /*!
+            requires
+                - d_model % num_heads == 0
+                - num_heads % num_kv_heads == 0
+            WHAT THIS REPRESENTS
+                Grouped-query attention: multihead_attention where the keys and values
+                only have num_kv_heads heads, each one shared by num_heads/num_kv_heads
+                consecutive query heads.  num_kv_heads == 1 is multi-query attention and
+                num_kv_heads == num_heads is equivalent to multihead_attention.
+
+                The key and value projections, their outputs and their gradients are
+                num_heads/num_kv_heads times smaller than with multihead_attention.  The
+                shared heads are read in place by the PLANE_WISE tt::gemm() of the
+                attention products, they are never copied for each query head.
+
+            INPUT/OUTPUT SHAPES
+                Input:  (batch_size, 1, seq_len, d_model)
+                Output: (batch_size, 1, seq_len, d_model)
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_block = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                transformer_block using gqa_multihead_attention.
+        !*/
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_stack = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                Stacks num_layers gqa_transformer_block.
+
+            TYPICAL USAGE
+                // 8 query heads sharing 2 key/value heads
+                using my_model =
+                    loss_multiclass_log<fc<vocab_size, rms_norm<
+                    gqa_transformer_stack<6, silu, dropout_10, 256, 8, 2,
+                    embeddings<vocab_size, 256,
+                    input<matrix<int, 0, 1>>>>>>>;
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_multihead_attention = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                cached_multihead_attention with grouped-query attention.  The kv_cache
+                layers only hold num_kv_heads heads, so the cache is num_heads/num_kv_heads
+                times smaller than with cached_multihead_attention.
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_transformer_block = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                cached_transformer_block using cached_gqa_multihead_attention.
+        !*/
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using cached_gqa_transformer_stack = some_template_expression;
+        /*!
+            WHAT THIS REPRESENTS
+                Stacks num_layers cached_gqa_transformer_block.
+        !*/
+
     } // namespace std_transformer
 
     namespace fused_transformer
@@ -447,6 +862,50 @@ namespace dlib
             optimized implementation using fused operations.
         !*/
 
+        template <long num_heads, long num_kv_heads, long d_model, typename SUBNET>
+        using gqa_key = some_template_expression;
+        /*!
+            requires
+                - d_model % num_heads == 0
+                - num_heads % num_kv_heads == 0
+            ensures
+                - Extracts the num_kv_heads key heads from the output of the fused
+                  d_model => d_model + 2*(d_model/num_heads)*num_kv_heads projection.
+                - Output shape: (batch, num_kv_heads, 1, d_model/num_heads)
+        !*/
+
+        template <long num_heads, long num_kv_heads, long d_model, typename SUBNET>
+        using gqa_value = some_template_expression;
+        /*!
+            Same as gqa_key, for the values.
+            Output shape: (batch, num_kv_heads, d_model/num_heads, 1)
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_multihead_attention = some_template_expression;
+        /*!
+            Same interface as canonical_transformer::gqa_multihead_attention.  The query,
+            key and value projections are done by a single fc_no_bias layer of
+            d_model + 2*(d_model/num_heads)*num_kv_heads outputs.
+        !*/
+
+        template <template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_block = some_template_expression;
+        /*!
+            Same interface as canonical_transformer::gqa_transformer_block but with
+            optimized implementation using fused operations.
+        !*/
+
+        template<long num_layers, template <typename> class ACT, template <typename> class DO,
+            long d_model, long num_heads, long num_kv_heads, typename SUBNET>
+        using gqa_transformer_stack = some_template_expression;
+        /*!
+            Same interface as canonical_transformer::gqa_transformer_stack but with
+            optimized implementation using fused operations.
+        !*/
+
     } // namespace fused_transformer
 
     // ----------------------------------------------------------------------------------------
@@ -610,6 +1069,22 @@ namespace dlib
             to these logits to obtain routing probabilities.
     !*/
 
+    template <long num_experts, template <typename> class DO, typename SUBNET>
+    using token_gate = some_template_expression;
+    /*!
+        WHAT THIS OBJECT REPRESENTS
+            Gating network producing one set of expert logits per token, so that every
+            token of a sequence is routed on its own by the moe_ layer.
+
+        TEMPLATE PARAMETERS
+            - num_experts: number of experts to route between
+            - DO: dropout policy template (e.g., dropout_10 for training, multiply for inference)
+
+        OUTPUT
+            For an input of shape (batch_size, 1, seq_len, d_model), a tensor with shape
+            (batch_size, 1, seq_len, num_experts) containing raw logits.
+    !*/
+
     template<
         typename EXPERT_NET,
         long top_e,
@@ -626,8 +1101,10 @@ namespace dlib
                 - top_e >= 0 (use 0 for automatic selection of 20% of available experts)
                 - MODE must be either training_mode_tag or inference_mode_tag
                 - TAG must be a valid layer tag template (e.g., tag9, tag8, etc.)
-                - The gate network referenced by TAG must output a tensor with shape
-                  (batch_size, num_experts, 1, 1) containing raw logits
+                - The gate network referenced by TAG must output a tensor of raw logits
+                  with shape (batch_size, num_experts, 1, 1) (sample routing) or, for an
+                  input of shape (batch_size, 1, seq_len, d_model), with shape
+                  (batch_size, 1, seq_len, num_experts) (token routing)
 
             WHAT THIS OBJECT REPRESENTS
                 This layer implements a Mixture of Experts (MoE) architecture with per-sample
@@ -659,6 +1136,24 @@ namespace dlib
                 This per-sample routing allows different samples to utilize different experts,
                 providing fine-grained specialization and better model capacity utilization.
 
+                When the gate outputs one set of logits per token (see token_gate), the
+                routing unit is a single row of the input instead of a whole sample: every
+                token of every sequence selects its own experts, and the experts process
+                batches of rows of shape (1, 1, 1, d_model).  Everything below that talks
+                about samples then applies to tokens.
+
+            EXPERT CAPACITY
+                Each expert accepts at most
+                    capacity = ceil(capacity_factor * num_units * top_k / num_experts)
+                routing units per batch, num_units being the number of samples or tokens of
+                the batch.  The units are assigned in priority order: the first choices of
+                all the units come before their second choices and so on, so an overloaded
+                expert drops the units for which it was the least preferred choice.  A
+                dropped unit loses the contribution of that expert (and the matching
+                gradient), its other experts and the residual path are unaffected.  Setting
+                capacity_factor <= 0 disables the limit.  The fraction of routed units
+                dropped by each expert is tracked in get_expert_drop_rate().
+
             FORWARD PASS DETAILS
                 The forward pass processes each sample independently:
 
@@ -669,21 +1164,27 @@ namespace dlib
                    b. Apply numerically stable softmax to obtain probabilities
                    c. Select top-k experts with highest probabilities
                    d. Renormalize selected expert weights to sum to 1
-                   e. Route sample through selected experts
-                   f. Accumulate weighted expert outputs: output = sum(w_i * expert_i(input))
-                3. Track expert usage statistics for monitoring and load balancing
-                4. Compute auxiliary load balancing loss (training mode only)
+                3. Dispatch: the samples routed to each expert are gathered into one
+                   contiguous batch and every expert runs forward() once on its batch.
+                   Without CUDA the experts run concurrently on the default thread pool.
+                4. Scatter the expert outputs back to their samples:
+                   output = sum(w_i * expert_i(input))
+                5. Track expert usage statistics for monitoring and load balancing
+                6. Compute auxiliary load balancing loss (training mode only)
+
+                The cost of an expert therefore depends on the number of samples routed
+                to it, not on a per-sample overhead.
 
             BACKWARD PASS DETAILS
                 The backward pass uses cached expert selections for consistency:
 
-                1. For each sample:
-                   a. Retrieve cached expert indices and weights from forward pass
-                   b. For each activated expert:
-                      - Scale incoming gradient by expert's weight
-                      - Backpropagate through expert network
-                      - Accumulate weighted expert gradient to input gradient
-                2. If load_balance_weight > 0 (training mode):
+                1. For each expert, gather the incoming gradients of its samples, scaled
+                   by their gate weights, into one batch
+                2. Backpropagate each batch once through its expert, against the batch of
+                   inputs gathered by forward() (concurrently without CUDA)
+                3. Scatter the expert input gradients back and accumulate them into the
+                   input gradient of each sample
+                4. If load_balance_weight > 0 (training mode):
                    a. Compute auxiliary load balancing loss gradient
                    b. Add gradient to gate network via layer<TAG>(sub).get_gradient_input()
                    c. Uses complete softmax gradient formula with normalization term
@@ -741,6 +1242,7 @@ namespace dlib
                     * noise_scale = 0.1 (Gaussian noise std for exploration)
                     * usage_update_rate = 0.05 (EMA smoothing for usage tracking)
                     * load_balance_weight = 0.01 (auxiliary loss coefficient)
+                    * capacity_factor = 1.25 (expert capacity relative to balanced routing)
                 - cached_batch_size_ = 0 (no forward pass cache yet)
         !*/
 
@@ -749,7 +1251,7 @@ namespace dlib
             ensures
                 - Performs deep copy of all expert networks and configuration
                 - Copies: n_experts, noise_scale, top_k, usage_update_rate,
-                  load_balance_weight, expert_usage
+                  load_balance_weight, capacity_factor, expert_usage, expert_drop_rate
                 - Does NOT copy forward/backward cache (cached_batch_size_ = 0)
         !*/
 
@@ -766,14 +1268,14 @@ namespace dlib
             requires
                 - SUBNET_TYPE implements the SUBNET interface
                 - layer<TAG>(sub).get_output() returns a tensor with shape (N, E, 1, 1)
-                  where N is batch size and E is the number of experts
+                  or (N, 1, seq_len, E) where N is batch size and E is the number of experts
             ensures
                 - Initializes the MoE layer based on gate network output:
-                    * Creates E expert network instances (E = gate output dimension k)
+                    * Creates E expert network instances
                     * #num_experts() == E
                     * If top_e == 0: #num_active_experts() == max(1, floor(E * 0.2))
                     * If top_e > 0: #num_active_experts() == min(top_e, E)
-                - Initializes expert_usage vector with zeros
+                - Initializes expert_usage and expert_drop_rate vectors with zeros
                 - Called automatically by Dlib during first forward pass
         !*/
 
@@ -784,19 +1286,23 @@ namespace dlib
                 - setup(sub) has been called at least once
                 - sub.get_output() is a valid tensor that experts can process
                 - layer<TAG>(sub).get_output() has shape (batch_size, num_experts(), 1, 1)
-                  containing raw logits (unnormalized scores)
+                  or, if sub.get_output() has shape (batch_size, 1, seq_len, d_model),
+                  (batch_size, 1, seq_len, num_experts()), containing raw logits
             ensures
-                - Performs per-sample expert routing and computation:
-                    * For each sample in the batch:
+                - Performs per-sample (or per-token) expert routing and computation:
+                    * For each routing unit in the batch:
                       - Extracts that sample's gate logits
                       - Adds Gaussian exploration noise if MODE == training_mode_tag
                         with noise ~ N(0, noise_scale^2)
                       - Applies numerically stable softmax to obtain probabilities
                       - Selects top-k experts with highest probabilities
                       - Renormalizes selected expert weights to sum to 1
-                      - Routes sample through selected experts
+                      - Routes the unit through the selected experts that still have
+                        capacity left (see EXPERT CAPACITY)
                       - Combines expert outputs: output = sum(w_i * expert_i(input))
                 - #output has same dimensions as sub.get_output()
+                - #get_expert_capacity() == the capacity used for this batch
+                - Updates get_expert_drop_rate() using EMA when usage_update_rate > 0
                 - If MODE == training_mode_tag:
                     * Caches expert indices and weights for backward consistency
                     * Updates expert usage statistics using EMA
@@ -820,7 +1326,8 @@ namespace dlib
                     * For each sample:
                       - Uses cached expert indices and weights from forward pass
                       - Scales incoming gradient by expert weight
-                      - Backpropagates through activated experts only
+                      - Backpropagates through activated experts only (a unit dropped by
+                        an expert gets no gradient from it)
                       - Accumulates weighted expert gradients to sub.get_gradient_input()
                 - If MODE == training_mode_tag and load_balance_weight > 0:
                     * Computes auxiliary load balancing loss gradient
@@ -893,13 +1400,46 @@ namespace dlib
                 - Returns 0.0 if not in training mode or load_balance_weight == 0
         !*/
 
+        void set_capacity_factor(float val);
+        /*!
+            ensures
+                - #get_capacity_factor() == val
+                - val <= 0 removes the limit on the number of units per expert
+        !*/
+
+        float get_capacity_factor() const;
+        /*!
+            ensures
+                - Returns the capacity of each expert relative to a perfectly balanced
+                  routing (see EXPERT CAPACITY)
+        !*/
+
+        long get_expert_capacity() const;
+        /*!
+            ensures
+                - Returns the maximum number of routing units each expert accepted in the
+                  last forward pass, or 0 if forward() has not been called yet
+        !*/
+
+        const std::vector<float>& get_expert_drop_rate() const;
+        /*!
+            ensures
+                - Returns exponential moving average of the fraction of the units routed
+                  to each expert that were dropped because it was full
+                - Vector size == num_experts()
+                - Updated in both modes when usage_update_rate > 0
+        !*/
+
         friend void serialize(const moe_& item, std::ostream& out);
         friend void deserialize(moe_& item, std::istream& in);
         /*!
             ensures
                 - Provides serialization support for the MoE layer
                 - Saves/loads: n_experts, top_k, noise_scale, usage_update_rate,
-                  load_balance_weight, expert networks, expert_usage
+                  load_balance_weight, expert networks, expert_usage, capacity_factor,
+                  expert_drop_rate
+                - Models saved before capacity limits existed load with
+                  capacity_factor == 0, i.e. unlimited capacity
         !*/
 
         friend std::ostream& operator<<(std::ostream& out, const moe_& item);
@@ -907,7 +1447,7 @@ namespace dlib
         /*!
             ensures
                 - Writes human-readable summary to output stream
-                - Format: "moe (experts=N, top_k=K, mode=train/infer, noise=X, lb=Y)"
+                - Format: "moe (experts=N, top_k=K, mode=train/infer, noise=X, lb=Y, capacity=C)"
         !*/
     };
 
@@ -935,6 +1475,21 @@ namespace dlib
             replacement for standard transformer feed-forward blocks. Combines gate network,
             expert routing, RMS normalization, and skip connection in a single template.
     !*/
+
+    template<
+        typename EXPERT_NET,
+        long num_experts,
+        long top_e,
+        typename MODE,
+        template <typename> class DO,
+        typename SUBNET
+    >
+    using moe_token_ffn = some_template_expression;
+    /*!
+        WHAT THIS OBJECT REPRESENTS
+            Same as moe_ffn but built on token_gate: every token of the
+            (batch_size, 1, seq_len, d_model) input is routed to its own experts.
+    !*/
 }
 
 #endif // DLIB_DNN_TRANSFORMER_H_
\ No newline at end of file
@@ -285,6 +285,125 @@ namespace dlib
         visit_layers(net, impl::visitor_bn_running_stats_window_size(new_window_size));
     }
 
+// ----------------------------------------------------------------------------------------
+
+    namespace impl
+    {
+        // repeat objects are not reachable through layer<i>() so the network is walked
+        // through subnet() instead of being visited.
+        class checkpointing_setter
+        {
+        public:
+
+            checkpointing_setter(bool enabled_, bool bfloat16_storage_) : enabled(enabled_), bfloat16_storage(bfloat16_storage_) {}
+
+            template <typename net_type>
+            void operator()(net_type& net) const
+            {
+                visit(net, 0);
+            }
+
+        private:
+
+            template <size_t num, template<typename> class REPEATED_LAYER, typename SUBNET>
+            void visit(repeat<num,REPEATED_LAYER,SUBNET>& net, int) const
+            {
+                net.set_checkpointing(enabled, bfloat16_storage);
+                for (size_t i = 0; i < net.num_repetitions(); ++i)
+                    visit(net.get_repeated_layer(i), 0);
+                visit(net.subnet(), 0);
+            }
+
+            template <typename net_type>
+            auto visit(net_type& net, int) const -> decltype(net.subnet(), void())
+            {
+                visit(net.subnet(), 0);
+            }
+
+            template <typename input_layer_type>
+            void visit(input_layer_type&, long) const
+            {
+                // reached the input layer
+            }
+
+            bool enabled;
+            bool bfloat16_storage;
+        };
+    }
+
+    template <typename net_type>
+    void set_all_checkpointing (
+        net_type& net,
+        bool enabled,
+        bool bfloat16_storage = false
+    )
+    {
+        impl::checkpointing_setter temp(enabled, bfloat16_storage);
+        temp(net);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    namespace impl
+    {
+        class visitor_quantize_weights
+        {
+        public:
+
+            visitor_quantize_weights(int bits_) : bits(bits_) {}
+
+            template <typename T>
+            void quantize(T&) const
+            {
+                // ignore other layer detail types
+            }
+
+            template <unsigned long num_outputs, fc_bias_mode bias_mode>
+            void quantize(fc_<num_outputs, bias_mode>& l) const
+            {
+                l.quantize(bits);
+            }
+
+            template <unsigned long num_outputs, linear_bias_mode bias_mode>
+            void quantize(linear_<num_outputs, bias_mode>& l) const
+            {
+                l.quantize(bits);
+            }
+
+            template <unsigned long num_embeddings, unsigned long embedding_dim>
+            void quantize(embeddings_<num_embeddings, embedding_dim>& l) const
+            {
+                l.quantize(bits);
+            }
+
+            template<typename input_layer_type>
+            void operator()(size_t , input_layer_type& )  const
+            {
+                // ignore other layers
+            }
+
+            template <typename T, typename U, typename E>
+            void operator()(size_t , add_layer<T,U,E>& l)  const
+            {
+                quantize(l.layer_details());
+            }
+
+        private:
+
+            int bits;
+        };
+    }
+
+    template <typename net_type>
+    void quantize_weights (
+        net_type& net,
+        int bits = 8
+    )
+    {
+        DLIB_CASSERT(bits == 8 || bits == 4 || bits == 16, "bits: " << bits);
+        visit_layers(net, impl::visitor_quantize_weights(bits));
+    }
+
 // ----------------------------------------------------------------------------------------
 
     namespace impl
@@ -509,6 +628,62 @@ namespace dlib
                 l.layer_details().disable();
             }
 
+            template <typename T>
+            void fuse_linear(T&) const
+            {
+                // disable other layer types
+            }
+
+            // handle the case of linear layer on top of a normalization or an activation,
+            // which the linear layer then applies to its own input
+            template <unsigned long no, linear_bias_mode bm, typename L, typename U, typename E, typename R>
+            typename std::enable_if<is_nonloss_layer_type<U>::value && (
+                std::is_same<L, rms_norm_>::value || std::is_same<L, token_rms_norm_>::value ||
+                std::is_same<L, layer_norm_>::value || std::is_same<L, gelu_>::value ||
+                std::is_same<L, silu_>::value)>::type
+            fuse_linear(add_layer<linear_<no, bm>, add_layer<L, U, E>, R>& l)
+            {
+                auto& lin = l.layer_details();
+                auto& input = l.subnet().layer_details();
+                if (input.is_disabled() || !lin.can_fuse_input())
+                    return;
+
+                lin.fuse_input(input);
+
+                // disable the layer below the linear layer
+                input.disable();
+            }
+
+            // handle the case of residual connection added to the output of a linear layer
+            template <template<typename> class tag, unsigned long no, linear_bias_mode bm, typename U, typename E, typename R>
+            void fuse_linear(add_layer<add_prev_<tag>, add_layer<linear_<no, bm>, U, E>, R>& l)
+            {
+                auto& lin = l.subnet().layer_details();
+                if (l.layer_details().has_fused_input() || lin.is_disabled())
+                    return;
+
+                // the add_prev layer computes the output of the linear layer on its own
+                lin.disable();
+                l.layer_details().fuse_input();
+            }
+
+            // handle the case of residual connection added to the scaled output of a linear layer
+            template <template<typename> class tag, unsigned long no, linear_bias_mode bm, typename U, typename E, typename M, typename R>
+            void fuse_linear(add_layer<add_prev_<tag>, add_layer<multiply_, add_layer<linear_<no, bm>, U, E>, M>, R>& l)
+            {
+                auto& mul = l.subnet().layer_details();
+                auto& lin = l.subnet().subnet().layer_details();
+                if (l.layer_details().has_fused_input() || mul.is_disabled() || lin.is_disabled() || lin.is_quantized())
+                    return;
+
+                // fold the multiplication into the weights and biases
+                lin.scale_outputs(mul.get_multiply_value());
+                mul.disable();
+
+                lin.disable();
+                l.layer_details().fuse_input();
+            }
+
             template <typename input_layer_type>
             void operator()(size_t , input_layer_type& ) const
             {
@@ -519,6 +694,7 @@ namespace dlib
             void operator()(size_t , add_layer<T, U, E>& l)
             {
                 fuse_convolution(l);
+                fuse_linear(l);
             }
         };
     }
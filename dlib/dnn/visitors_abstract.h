@@ -27,6 +27,55 @@ namespace dlib
               new_window_size.
     !*/
 
+// ----------------------------------------------------------------------------------------
+
+    template <typename net_type>
+    void quantize_weights (
+        net_type& net,
+        int bits = 8
+    );
+    /*!
+        requires
+            - bits == 8 || bits == 4 || bits == 16
+            - net_type is an object of type add_layer, add_loss_layer, add_skip_layer, or
+              add_tag_layer.
+            - The fc_, linear_ and embeddings_ layers of net have been allocated, e.g. the
+              network was trained or deserialized.
+        ensures
+            - Calls quantize(bits) on all the fc_, linear_ and embeddings_ layers in net:
+              their float weights are replaced by bits wide integers with one scale per
+              output channel (or per embedding vector), making them about 4 (8 bits) or
+              8 (4 bits) times smaller, and serialize() saves them in that form.  With 16
+              bits the weights are stored as bfloat16 instead, halving their size with
+              much less rounding error.
+            - Layers that are already quantized are left as they are.
+            - The quantized layers can only be used for inference.  This is a post
+              training transformation, call it on a trained network before deploying it.
+            - Layers held inside other layers, like the experts of a moe_ layer, are not
+              visited.
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename net_type>
+    void set_all_checkpointing (
+        net_type& net,
+        bool enabled,
+        bool bfloat16_storage = false
+    );
+    /*!
+        requires
+            - net_type is an object of type add_layer, add_loss_layer, add_skip_layer,
+              add_tag_layer or repeat.
+        ensures
+            - Calls set_checkpointing(enabled, bfloat16_storage) on all the repeat objects in net, including
+              the ones nested inside the repeated layers of another repeat.  With
+              checkpointing enabled, a repeat keeps the activations of a single
+              repetition at a time during training, recomputing them in the backward pass
+              (see repeat::is_checkpointing() for details).  The trained parameters are
+              unaffected.
+    !*/
+
 // ----------------------------------------------------------------------------------------
 
     template <typename net_type>
@@ -63,6 +112,20 @@ namespace dlib
               convolution as input.
             - Updates the convolution to apply a relu activation function, to produce the same
               output as with the relu_ layer enabled.
+            - Disables all the rms_norm_, token_rms_norm_, layer_norm_, gelu_ and silu_
+              layers that have a linear_ layer directly on top of them and a layer (not an
+              input layer) beneath them, and makes the linear_ layer apply them to its own
+              input (see linear_::fuse_input()).  The output of these layers is no longer
+              computed or stored.  A tag in between, or a linear_ layer that is already
+              quantized, prevents the fusion.
+            - Disables all the linear_ layers directly beneath an add_prev_ layer, possibly
+              with a multiply_ layer in between, and makes the add_prev_ layer add their
+              output straight to its own (see add_prev_::fuse_input()).  The value of the
+              multiply_ layer is folded into the weights of the linear_ layer and the
+              multiply_ layer is disabled.
+            - The network then computes the same outputs, up to rounding, with fewer
+              passes over the activations.  It can only be used for inference, it can be
+              serialized, and quantize_weights() can still be applied to it.
     !*/
 
 // ----------------------------------------------------------------------------------------
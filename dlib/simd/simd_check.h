@@ -25,6 +25,16 @@
                 #define DLIB_HAVE_AVX
             #endif
         #endif
+        #ifdef __AVX512F__
+            #ifndef DLIB_HAVE_AVX512F
+                #define DLIB_HAVE_AVX512F
+            #endif
+        #endif
+        #if defined(__AVX512F__) && defined(__AVX512BF16__)
+            #ifndef DLIB_HAVE_AVX512BF16
+                #define DLIB_HAVE_AVX512BF16
+            #endif
+        #endif
         #if (defined( _M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 2) && !defined(DLIB_HAVE_SSE2)
             #define DLIB_HAVE_SSE2
         #endif
@@ -54,6 +64,16 @@
                 #define DLIB_HAVE_AVX2
             #endif
         #endif
+        #ifdef __AVX512F__
+            #ifndef DLIB_HAVE_AVX512F
+                #define DLIB_HAVE_AVX512F
+            #endif
+        #endif
+        #if defined(__AVX512F__) && defined(__AVX512BF16__)
+            #ifndef DLIB_HAVE_AVX512BF16
+                #define DLIB_HAVE_AVX512BF16
+            #endif
+        #endif
         #ifdef __ALTIVEC__
             #ifndef DLIB_HAVE_ALTIVEC
                 #define DLIB_HAVE_ALTIVEC
@@ -106,6 +126,9 @@
     #include <immintrin.h> // AVX
 //    #include <avx2intrin.h>
 #endif
+#ifdef DLIB_HAVE_AVX512F
+    #include <immintrin.h> // AVX-512
+#endif
 #ifdef DLIB_HAVE_NEON
     #include <arm_neon.h> // ARM NEON
 #endif
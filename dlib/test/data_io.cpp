@@ -4,6 +4,8 @@
 #include "tester.h"
 #include <dlib/svm_threaded.h>
 #include <dlib/data_io.h>
+#include <dlib/tokenizer.h>
+#include <dlib/misc_api.h>
 #include <dlib/sparse_vector.h>
 #include "create_iris_datafile.h"
 #include <vector>
@@ -205,6 +207,87 @@ namespace
         }
 
 
+        void test_token_corpus()
+        {
+            print_spinner();
+            const std::string dir = "token_corpus_test_dir";
+            create_directory(dir);
+            create_directory(dir + "/sub");
+            const std::vector<std::string> names = { dir + "/a.txt", dir + "/sub/b.txt", dir + "/c.txt" };
+            const std::vector<std::string> texts = {
+                "The tokens of the corpus are written once and mapped in memory.",
+                "Each file of the directory tree is one document of the corpus.",
+                "Files are sorted by name."
+            };
+            for (size_t i = 0; i < names.size(); ++i)
+                std::ofstream(names[i], std::ios::binary) << texts[i];
+            // Binary and empty files are skipped
+            std::ofstream(dir + "/empty.txt");
+            const unsigned char png[] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A, 0, 0, 0, 0x0D };
+            std::ofstream(dir + "/image.png", std::ios::binary).write((const char*)png, sizeof(png));
+
+            bpe_tokenizer tokenizer;
+            tokenizer.train(texts[0] + " " + texts[1], 300);
+            const std::string filename = "token_corpus_test.bin";
+            const std::string filename2 = "token_corpus_test2.bin";
+            const std::string filename3 = "token_corpus_test3.bin";
+            DLIB_TEST(build_token_corpus(tokenizer, dir, filename) == 3);
+
+            // The documents are in the order of the file names
+            token_corpus corpus(filename);
+            DLIB_TEST(corpus.num_documents() == 3);
+            DLIB_TEST(corpus.token_bytes() == 2);
+            DLIB_TEST(corpus.vocab_size() == tokenizer.get_vocab_size());
+            const std::vector<size_t> order = { 0, 2, 1 };
+            std::vector<int> tokens;
+            uint64_t total = 0;
+            for (size_t d = 0; d < 3; ++d)
+            {
+                corpus.get_document(d, tokens);
+                DLIB_TEST(tokens == tokenizer.encode(texts[order[d]]));
+                DLIB_TEST(corpus.document_begin(d) == total);
+                for (size_t i = 0; i < tokens.size(); ++i)
+                    DLIB_TEST(corpus[total + i] == tokens[i]);
+                total += tokens.size();
+            }
+            DLIB_TEST(corpus.num_tokens() == total);
+
+            // Shards split many documents in ranges of about the same number of tokens
+            {
+                token_corpus_writer writer(filename2, 100000);
+                DLIB_TEST(writer.token_bytes() == 4);
+                dlib::rand rnd;
+                for (int d = 0; d < 100; ++d)
+                {
+                    std::vector<int> doc(1 + rnd.get_random_32bit_number() % 50);
+                    for (auto& t : doc) t = rnd.get_random_32bit_number() % 100000;
+                    writer.add_document(doc);
+                }
+            }
+            token_corpus copy = corpus;
+            corpus.open(filename2);
+            DLIB_TEST(copy.num_documents() == 3);
+            DLIB_TEST(corpus.num_documents() == 100 && corpus.token_bytes() == 4);
+            corpus.get_tokens(0, corpus.num_tokens(), tokens);
+            DLIB_TEST(std::equal(tokens.begin(), tokens.end(), corpus.int_tokens()));
+            size_t next = 0;
+            for (size_t s = 0; s < 4; ++s)
+            {
+                const auto shard = corpus.shard(s, 4);
+                DLIB_TEST(shard.first == next && shard.second > shard.first);
+                const uint64_t shard_tokens = corpus.document_begin(shard.second) - corpus.document_begin(shard.first);
+                DLIB_TEST(std::abs((double)shard_tokens - corpus.num_tokens()/4.0) <= 50);
+                next = shard.second;
+            }
+            DLIB_TEST(next == corpus.num_documents());
+
+            std::ofstream(filename3) << "not a token corpus";
+            bool thrown = false;
+            try { corpus.open(filename3); } catch (error&) { thrown = true; }
+            DLIB_TEST(thrown);
+            DLIB_TEST(corpus.num_documents() == 100);
+        }
+
         void perform_test (
         )
         {
@@ -212,6 +295,7 @@ namespace
             create_iris_datafile();
 
             test_sparse_to_dense();
+            test_token_corpus();
 
             run_test<std::map<unsigned int, double> >();
             run_test<std::map<unsigned int, float> >();
@@ -9,7 +9,9 @@
 #include <vector>
 #include <random>
 #include <numeric>
+#include <set>
 #include "../dnn.h"
+#include "../data_io.h"
 
 #include "tester.h"
 
@@ -2442,6 +2444,18 @@ namespace
             auto res = test_layer(l);  
             DLIB_TEST_MSG(res, res);  
         }         
+        {
+            print_spinner();
+            token_rms_norm_ l;
+            auto res = test_layer(l);
+            DLIB_TEST_MSG(res, res);
+        }
+        {
+            print_spinner();
+            kv_cache_ l;
+            auto res = test_layer(l);
+            DLIB_TEST_MSG(res, res);
+        }
         {
             print_spinner();
             cont_<3,3,3,2,2,0,0> l;
@@ -3544,6 +3558,85 @@ void test_multm_prev()
     DLIB_TEST(max(abs(mat(net_output) - mat(expected_output))) < 1e-5);
 }
 
+// ----------------------------------------------------------------------------------------
+
+void test_gemm_plane_wise()
+{
+    print_spinner();
+    tt::tensor_rand rnd(0);
+    // Small planes go through the multithreaded kernel, the last shape is large enough to
+    // be handed to BLAS when it's available.
+    const std::vector<std::array<long, 5>> shapes = { {2, 3, 5, 7, 4}, {1, 4, 33, 18, 65}, {2, 2, 256, 64, 256} };
+    for (const auto& shape : shapes)
+    for (bool trans_lhs : {false, true})
+    for (bool trans_rhs : {false, true})
+    for (bool shared_rhs : {false, true})
+    for (float beta : {0.0f, 0.5f})
+    {
+        const long n = shape[0], k = shape[1], M = shape[2], K = shape[3], N = shape[4];
+        resizable_tensor lhs = trans_lhs ? resizable_tensor(n, k, K, M) : resizable_tensor(n, k, M, K);
+        resizable_tensor rhs;
+        if (shared_rhs)
+            rhs = trans_rhs ? resizable_tensor(1, 1, N, K) : resizable_tensor(1, 1, K, N);
+        else
+            rhs = trans_rhs ? resizable_tensor(n, k, N, K) : resizable_tensor(n, k, K, N);
+        resizable_tensor dest(n, k, M, N);
+        rnd.fill_gaussian(lhs);
+        rnd.fill_gaussian(rhs);
+        rnd.fill_gaussian(dest);
+
+        resizable_tensor expected = dest;
+        for (long p = 0; p < n*k; ++p)
+        {
+            const matrix<float> L = trans_lhs ? matrix<float>(trans(mat(lhs.host() + p*M*K, K, M))) : matrix<float>(mat(lhs.host() + p*M*K, M, K));
+            const float* r = rhs.host() + (shared_rhs ? 0 : p*K*N);
+            const matrix<float> R = trans_rhs ? matrix<float>(trans(mat(r, N, K))) : matrix<float>(mat(r, K, N));
+            float* e = expected.host() + p*M*N;
+            const matrix<float> D = 2*L*R + beta*mat(e, M, N);
+            std::copy(D.begin(), D.end(), e);
+        }
+
+        tt::gemm(beta, dest, 2, lhs, trans_lhs, rhs, trans_rhs, operation_mode::PLANE_WISE);
+        const float err = max(abs(mat(dest) - mat(expected)));
+        DLIB_TEST_MSG(err < 1e-3, "err: " << err << ", shape: " << M << "x" << K << "x" << N
+            << ", trans_lhs: " << trans_lhs << ", trans_rhs: " << trans_rhs << ", shared_rhs: " << shared_rhs);
+    }
+
+    // Grouped channels: 6 channels of lhs share the 2 channels of rhs, as the query heads of
+    // grouped-query attention share key/value heads.  The products of the channels sharing
+    // a dest channel are summed into it, which is what the key/value gradients need.
+    for (bool trans_rhs : {false, true})
+    for (float beta : {0.0f, 1.0f})
+    {
+        const long n = 2, k = 6, kv = 2, M = 5, K = 4, N = 3;
+        resizable_tensor lhs(n, k, M, K), dest(n, k, M, N), grad(n, kv, K, N);
+        resizable_tensor rhs = trans_rhs ? resizable_tensor(n, kv, N, K) : resizable_tensor(n, kv, K, N);
+        rnd.fill_gaussian(lhs);
+        rnd.fill_gaussian(rhs);
+        rnd.fill_gaussian(grad);
+        tt::gemm(0, dest, 1, lhs, false, rhs, trans_rhs, operation_mode::PLANE_WISE);
+
+        resizable_tensor expected_grad = grad;
+        if (beta == 0)
+            expected_grad = 0;
+        for (long s = 0; s < n; ++s)
+        for (long h = 0; h < k; ++h)
+        {
+            const matrix<float> L = mat(lhs.host() + (s*k + h)*M*K, M, K);
+            const float* r = rhs.host() + (s*kv + h/(k/kv))*K*N;
+            const matrix<float> R = trans_rhs ? matrix<float>(trans(mat(r, N, K))) : matrix<float>(mat(r, K, N));
+            const matrix<float> D = mat(dest.host() + (s*k + h)*M*N, M, N);
+            DLIB_TEST(max(abs(D - L*R)) < 1e-4);
+
+            float* e = expected_grad.host() + (s*kv + h/(k/kv))*K*N;
+            const matrix<float> G = trans(L)*D + mat(e, K, N);
+            std::copy(G.begin(), G.end(), e);
+        }
+        tt::gemm(beta, grad, 1, lhs, true, dest, false, operation_mode::PLANE_WISE);
+        DLIB_TEST(max(abs(mat(grad) - mat(expected_grad))) < 1e-3);
+    }
+}
+
 // ----------------------------------------------------------------------------------------
 
     void test_multioutput_linear_regression()
@@ -5288,6 +5381,1319 @@ void test_multm_prev()
         DLIB_TEST(max(abs(mat(net_output) - mat(expected_output))) < 1e-5);
     }
 
+// ----------------------------------------------------------------------------------------
+
+    template <typename SUBNET> using kv_test_block = canonical_transformer::cached_transformer_block<gelu, multiply, 16, 4, SUBNET>;
+
+    void test_kv_cache()
+    {
+        print_spinner();
+        using net_type = linear<11, token_rms_norm<repeat<2, kv_test_block, embeddings<11, 16, input<matrix<int, 0, 1>>>>>>;
+        net_type net;
+
+        const long seq_len = 9, n_samples = 2;
+        dlib::rand rnd(1);
+        std::vector<matrix<int, 0, 1>> x(n_samples);
+        for (auto& m : x)
+        {
+            m.set_size(seq_len);
+            for (long i = 0; i < seq_len; ++i)
+                m(i) = rnd.get_random_32bit_number() % 11;
+        }
+
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        resizable_tensor full_output = net.forward(input_tensor);
+
+        // Prefill with the first 4 tokens, then decode one token at a time.  Every step must
+        // reproduce the rows of the full sequence forward pass.
+        enable_kv_cache(net);
+        float max_err = 0;
+        for (long t = 0; t < seq_len;)
+        {
+            const long n = (t == 0) ? 4 : 1;
+            std::vector<matrix<int, 0, 1>> chunk(n_samples);
+            for (long s = 0; s < n_samples; ++s)
+                chunk[s] = rowm(x[s], range(t, t + n - 1));
+            resizable_tensor chunk_tensor;
+            net.to_tensor(chunk.begin(), chunk.end(), chunk_tensor);
+            const tensor& out = net.forward(chunk_tensor);
+            DLIB_TEST(out.nr() == n);
+            for (long s = 0; s < n_samples; ++s)
+                for (long r = 0; r < n; ++r)
+                    for (long c = 0; c < out.nc(); ++c)
+                        max_err = std::max(max_err, std::abs(out.host()[tensor_index(out, s, 0, r, c)] -
+                            full_output.host()[tensor_index(full_output, s, 0, t + r, c)]));
+            t += n;
+        }
+        DLIB_TEST_MSG(max_err < 1e-4, max_err);
+
+        // Starting over must give the same answer as the first pass
+        reset_kv_cache(net);
+        {
+            std::vector<matrix<int, 0, 1>> chunk(n_samples);
+            for (long s = 0; s < n_samples; ++s)
+                chunk[s] = rowm(x[s], range(0, 4));
+            resizable_tensor chunk_tensor;
+            net.to_tensor(chunk.begin(), chunk.end(), chunk_tensor);
+            const tensor& out = net.forward(chunk_tensor);
+            max_err = 0;
+            for (long s = 0; s < n_samples; ++s)
+                for (long r = 0; r < 5; ++r)
+                    for (long c = 0; c < out.nc(); ++c)
+                        max_err = std::max(max_err, std::abs(out.host()[tensor_index(out, s, 0, r, c)] -
+                            full_output.host()[tensor_index(full_output, s, 0, r, c)]));
+            DLIB_TEST_MSG(max_err < 1e-4, max_err);
+        }
+
+        disable_kv_cache(net);
+        const tensor& again = net.forward(input_tensor);
+        DLIB_TEST(max(abs(mat(again) - mat(full_output))) < 1e-5);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    void test_scaled_dot_product_attention()
+    {
+        print_spinner();
+        tt::tensor_rand rnd(0);
+
+        // Direct evaluation of softmax(scale*q*k^T + mask)*v, one row at a time
+        const auto reference = [](resizable_tensor& out, const tensor& q, const tensor& k, const tensor& v,
+            float scale, bool causal, const std::vector<long>& padding)
+        {
+            out.set_size(q.num_samples(), q.k(), q.nr(), v.nc());
+            out = 0;
+            const long offset = k.nr() - q.nr();
+            const long group = q.k() / k.k();
+            for (long n = 0; n < q.num_samples(); ++n)
+            for (long h = 0; h < q.k(); ++h)
+            for (long r = 0; r < q.nr(); ++r)
+            {
+                const long pad = n < (long)padding.size() ? padding[n] : 0;
+                if (r + offset < pad)
+                    continue;
+                const long end = causal ? r + offset + 1 : k.nr();
+                std::vector<double> p(k.nr(), 0);
+                double max_score = -std::numeric_limits<double>::infinity(), sum = 0;
+                for (long c = pad; c < end; ++c)
+                {
+                    for (long i = 0; i < q.nc(); ++i)
+                        p[c] += q.host()[tensor_index(q, n, h, r, i)] * k.host()[tensor_index(k, n, h / group, c, i)];
+                    p[c] *= scale;
+                    max_score = std::max(max_score, p[c]);
+                }
+                for (long c = pad; c < end; ++c)
+                {
+                    p[c] = std::exp(p[c] - max_score);
+                    sum += p[c];
+                }
+                for (long c = pad; c < end; ++c)
+                    for (long j = 0; j < v.nc(); ++j)
+                        out.host()[tensor_index(out, n, h, r, j)] += p[c] / sum * v.host()[tensor_index(v, n, h / group, c, j)];
+            }
+        };
+
+        // {samples, heads, queries, keys, d_head, d_value, key/value heads}, the sequences
+        // being long enough to span several blocks
+        const std::vector<std::array<long, 7>> shapes = { {2, 3, 5, 5, 4, 4, 3}, {1, 2, 70, 70, 8, 6, 2}, {2, 2, 3, 130, 5, 5, 2},
+            {2, 4, 7, 7, 4, 4, 2}, {2, 3, 66, 66, 4, 3, 1} };
+        for (const auto& shape : shapes)
+        for (bool causal : {false, true})
+        for (const std::vector<long>& padding : {std::vector<long>(), std::vector<long>{2, 0}})
+        {
+            resizable_tensor q(shape[0], shape[1], shape[2], shape[4]);
+            resizable_tensor k(shape[0], shape[6], shape[3], shape[4]);
+            resizable_tensor v(shape[0], shape[6], shape[3], shape[5]);
+            rnd.fill_gaussian(q);
+            rnd.fill_gaussian(k);
+            rnd.fill_gaussian(v);
+            const float scale = 0.4f;
+
+            resizable_tensor out, lse, expected;
+            tt::scaled_dot_product_attention(out, lse, q, k, v, scale, causal, padding);
+            reference(expected, q, k, v, scale, causal, padding);
+            DLIB_TEST_MSG(max(abs(mat(out) - mat(expected))) < 1e-5, max(abs(mat(out) - mat(expected))));
+
+            resizable_tensor gradient_input, q_grad, k_grad, v_grad;
+            gradient_input.copy_size(out);
+            rnd.fill_gaussian(gradient_input);
+            q_grad.copy_size(q); q_grad = 0;
+            k_grad.copy_size(k); k_grad = 0;
+            v_grad.copy_size(v); v_grad = 0;
+            tt::scaled_dot_product_attention_gradient(gradient_input, out, lse, q, k, v, scale, causal,
+                padding, q_grad, k_grad, v_grad);
+
+            // Compare with central differences of dot(gradient_input, output)
+            const auto f = [&]()
+            {
+                resizable_tensor o;
+                reference(o, q, k, v, scale, causal, padding);
+                return sum(pointwise_multiply(matrix_cast<double>(mat(o)), matrix_cast<double>(mat(gradient_input))));
+            };
+            dlib::rand rnd_idx;
+            for (auto& x : {std::make_pair(&q, &q_grad), std::make_pair(&k, &k_grad), std::make_pair(&v, &v_grad)})
+            {
+                for (int trial = 0; trial < 10; ++trial)
+                {
+                    const size_t i = rnd_idx.get_random_32bit_number() % x.first->size();
+                    const float old = x.first->host()[i];
+                    x.first->host()[i] = old + 1e-3f;
+                    const double f_plus = f();
+                    x.first->host()[i] = old - 1e-3f;
+                    const double f_minus = f();
+                    x.first->host()[i] = old;
+                    const double numeric = (f_plus - f_minus) / 2e-3;
+                    DLIB_TEST_MSG(std::abs(numeric - x.second->host()[i]) < 1e-2,
+                        "numeric: " << numeric << ", analytic: " << x.second->host()[i]);
+                }
+            }
+        }
+    }
+
+    template <typename SUBNET> using sdpa_test_block = canonical_transformer::sdpa_transformer_block<gelu, multiply, 16, 4, SUBNET>;
+    template <typename SUBNET> using mha_test_block = canonical_transformer::transformer_block<gelu, multiply, 16, 4, SUBNET>;
+
+    void test_sdpa_transformer()
+    {
+        print_spinner();
+        // The fused attention must compute the same function as the score matrix based one
+        using fused_net_type = sdpa_test_block<input<matrix<float>>>;
+        using net_type = mha_test_block<input<matrix<float>>>;
+        fused_net_type fused_net;
+        net_type net;
+
+        std::vector<matrix<float>> x(2, matrix<float>(12, 16));
+        dlib::rand rnd(2);
+        for (auto& m : x)
+            for (auto& val : m)
+                val = rnd.get_random_gaussian();
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        net.forward(input_tensor);
+        fused_net.forward(input_tensor);
+
+        std::vector<resizable_tensor> params;
+        visit_computational_layers(net, [&](auto& l) {
+            if (l.get_layer_params().size() != 0)
+                params.push_back(l.get_layer_params());
+        });
+        size_t i = 0;
+        visit_computational_layers(fused_net, [&](auto& l) {
+            if (l.get_layer_params().size() != 0 && i < params.size())
+                l.get_layer_params() = mat(params[i++]);
+        });
+        DLIB_TEST(i == params.size());
+
+        const tensor& expected = net.forward(input_tensor);
+        const tensor& out = fused_net.forward(input_tensor);
+        DLIB_TEST_MSG(max(abs(mat(out) - mat(expected))) < 1e-4, max(abs(mat(out) - mat(expected))));
+
+        resizable_tensor gradient;
+        gradient.copy_size(expected);
+        tt::tensor_rand(1).fill_gaussian(gradient);
+        net.back_propagate_error(input_tensor, gradient);
+        fused_net.back_propagate_error(input_tensor, gradient);
+        const auto err = max(abs(mat(fused_net.get_final_data_gradient()) - mat(net.get_final_data_gradient())));
+        DLIB_TEST_MSG(err < 1e-3, err);
+    }
+
+    void test_fuse_transformer_layers()
+    {
+        print_spinner();
+        // Every linear_ of the blocks absorbs the layer below it and both residual additions
+        // absorb the linear_ (and multiply_) below them.
+        using net_type = linear<11, token_rms_norm<repeat<2, mha_test_block, tag10<input<matrix<float>>>>>>;
+        net_type net;
+        std::vector<matrix<float>> x(2, matrix<float>(7, 16));
+        dlib::rand rnd(3);
+        for (auto& m : x)
+            for (auto& val : m)
+                val = rnd.get_random_gaussian();
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        const resizable_tensor expected = net.forward(input_tensor);
+
+        net_type fused(net);
+        fuse_layers(fused);
+        DLIB_TEST(layer<0>(fused).layer_details().get_fused_input() == LINEAR_TOKEN_RMS_NORM_INPUT);
+        DLIB_TEST(layer<1>(fused).layer_details().is_disabled());
+        const tensor& out = fused.forward(input_tensor);
+        DLIB_TEST_MSG(max(abs(mat(out) - mat(expected))) < 1e-4, max(abs(mat(out) - mat(expected))));
+
+        std::ostringstream sout;
+        serialize(fused, sout);
+        std::istringstream sin(sout.str());
+        net_type fused2;
+        deserialize(fused2, sin);
+        const tensor& out2 = fused2.forward(input_tensor);
+        DLIB_TEST(max(abs(mat(out2) - mat(expected))) < 1e-4);
+
+        // The fused layers can still be quantized
+        quantize_weights(fused2, 16);
+        const tensor& out3 = fused2.forward(input_tensor);
+        DLIB_TEST_MSG(max(abs(mat(out3) - mat(expected))) < 0.1*max(abs(mat(expected))), max(abs(mat(out3) - mat(expected))));
+
+        // layer_norm_ and silu_, without bias
+        using net_type2 = add_prev1<linear_no_bias<8, silu<linear<8, layer_norm<tag1<input<matrix<float>>>>>>>>;
+        net_type2 net2;
+        std::vector<matrix<float>> x2(3, matrix<float>(5, 8));
+        for (auto& m : x2)
+            for (auto& val : m)
+                val = 2 + rnd.get_random_gaussian();
+        net2.to_tensor(x2.begin(), x2.end(), input_tensor);
+        net2.forward(input_tensor);
+        visit_computational_layers(net2, [&](layer_norm_& l) {
+            tt::tensor_rand(4).fill_gaussian(l.get_layer_params(), 1, 0.5);
+        });
+        const resizable_tensor expected2 = net2.forward(input_tensor);
+        fuse_layers(net2);
+        DLIB_TEST(layer<0>(net2).layer_details().has_fused_input());
+        DLIB_TEST(layer<1>(net2).layer_details().get_fused_input() == LINEAR_SILU_INPUT);
+        DLIB_TEST(layer<3>(net2).layer_details().get_fused_input() == LINEAR_LAYER_NORM_INPUT);
+        DLIB_TEST(layer<4>(net2).layer_details().is_disabled());
+        const tensor& out4 = net2.forward(input_tensor);
+        DLIB_TEST_MSG(max(abs(mat(out4) - mat(expected2))) < 1e-4, max(abs(mat(out4) - mat(expected2))));
+    }
+
+    template <typename SUBNET> using cached_gqa_test_block = canonical_transformer::cached_gqa_transformer_block<gelu, multiply, 16, 4, 2, SUBNET>;
+    template <typename SUBNET> using gqa_test_block = canonical_transformer::gqa_transformer_block<gelu, multiply, 16, 4, 2, SUBNET>;
+    template <typename SUBNET> using fused_gqa_test_block = fused_transformer::gqa_transformer_block<gelu, multiply, 16, 4, 1, SUBNET>;
+
+    void test_gqa_transformer()
+    {
+        print_spinner();
+        std::vector<matrix<float>> x(2, matrix<float>(7, 16));
+        dlib::rand rnd(3);
+        for (auto& m : x)
+            for (auto& val : m)
+                val = rnd.get_random_gaussian();
+
+        // With split heads, 4 query heads sharing 2 key/value heads compute the same function
+        // as multi-head attention whose key/value projections duplicate each shared head.
+        {
+            using gqa_net_type = cached_gqa_test_block<input<matrix<float>>>;
+            using net_type = kv_test_block<input<matrix<float>>>;
+            gqa_net_type gqa_net;
+            net_type net;
+            resizable_tensor input_tensor;
+            net.to_tensor(x.begin(), x.end(), input_tensor);
+            gqa_net.forward(input_tensor);
+            net.forward(input_tensor);
+
+            std::vector<resizable_tensor> params;
+            visit_computational_layers(gqa_net, [&](auto& l) {
+                if (l.get_layer_params().size() != 0)
+                    params.push_back(l.get_layer_params());
+            });
+            size_t i = 0;
+            visit_computational_layers(net, [&](auto& l) {
+                tensor& p = l.get_layer_params();
+                if (p.size() == 0 || i >= params.size())
+                    return;
+                const resizable_tensor& src = params[i++];
+                if (src.size() == p.size())
+                {
+                    p = mat(src);
+                    return;
+                }
+                // (16 inputs, 2 heads x 4) => (16 inputs, 4 heads x 4)
+                DLIB_TEST(src.size() * 2 == p.size());
+                for (long r = 0; r < 16; ++r)
+                    for (long c = 0; c < 16; ++c)
+                        p.host()[r * 16 + c] = src.host()[r * 8 + (c / 8) * 4 + c % 4];
+            });
+            DLIB_TEST(i == params.size());
+
+            const tensor& expected = net.forward(input_tensor);
+            const tensor& out = gqa_net.forward(input_tensor);
+            DLIB_TEST_MSG(max(abs(mat(out) - mat(expected))) < 1e-4, max(abs(mat(out) - mat(expected))));
+        }
+
+        // The other variants only have to train: check their gradients numerically
+        const auto check_gradient = [&](auto& net)
+        {
+            resizable_tensor input_tensor;
+            net.to_tensor(x.begin(), x.end(), input_tensor);
+            const tensor& out = net.forward(input_tensor);
+            resizable_tensor gradient;
+            gradient.copy_size(out);
+            tt::tensor_rand(4).fill_gaussian(gradient);
+            net.back_propagate_error(input_tensor, gradient);
+            const resizable_tensor data_grad = net.get_final_data_gradient();
+
+            const auto f = [&]()
+            {
+                const tensor& o = net.forward(input_tensor);
+                return sum(pointwise_multiply(matrix_cast<double>(mat(o)), matrix_cast<double>(mat(gradient))));
+            };
+            for (size_t i = 0; i < input_tensor.size(); i += 13)
+            {
+                const float old = input_tensor.host()[i];
+                input_tensor.host()[i] = old + 1e-2f;
+                const double f_plus = f();
+                input_tensor.host()[i] = old - 1e-2f;
+                const double f_minus = f();
+                input_tensor.host()[i] = old;
+                const double numeric = (f_plus - f_minus) / 2e-2;
+                DLIB_TEST_MSG(std::abs(numeric - data_grad.host()[i]) < 2e-2 * std::max(1.0, std::abs(numeric)),
+                    "numeric: " << numeric << ", analytic: " << data_grad.host()[i]);
+            }
+        };
+        gqa_test_block<input<matrix<float>>> gqa_net;
+        check_gradient(gqa_net);
+        fused_gqa_test_block<input<matrix<float>>> fused_gqa_net;
+        check_gradient(fused_gqa_net);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    using moe_test_expert = canonical_transformer::swiglu<multiply, 8, input_tensor>;
+    using moe_test_net = moe<moe_test_expert, 2, inference_mode_tag, tag9,
+        skip8<tag9<gate<4, multiply, tag8<input<matrix<float>>>>>>>;
+
+    void test_moe_dispatch()
+    {
+        print_spinner();
+        moe_test_net net;
+        net.layer_details().set_capacity_factor(0);
+        std::vector<matrix<float>> x(11, matrix<float>(3, 8));
+        dlib::rand rnd(5);
+        for (auto& m : x)
+            for (auto& val : m)
+                val = rnd.get_random_gaussian();
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        const tensor& out = net.forward(input_tensor);
+        resizable_tensor gradient;
+        gradient.copy_size(out);
+        tt::tensor_rand(6).fill_gaussian(gradient);
+        net.back_propagate_error(input_tensor, gradient);
+
+        // The experts run once on all their samples, which must match routing every sample
+        // on its own through copies of the experts.
+        auto& moe_layer = net.layer_details();
+        std::vector<moe_test_expert> experts;
+        for (long e = 0; e < moe_layer.num_experts(); ++e)
+            experts.push_back(moe_layer.get_expert(e));
+        const tensor& logits = layer<tag9>(net).get_output();
+        const long sample_size = 3 * 8;
+        alias_tensor sample_alias(1, 1, 3, 8);
+        float max_out_err = 0, max_grad_err = 0;
+        for (long n = 0; n < input_tensor.num_samples(); ++n)
+        {
+            matrix<float> p = exp(mat(logits.host() + n * 4, 1, 4) - max(mat(logits.host() + n * 4, 1, 4)));
+            p /= sum(p);
+            long first = index_of_max(p), second = first == 0 ? 1 : 0;
+            for (long e = 0; e < 4; ++e)
+                if (e != first && p(e) > p(second))
+                    second = e;
+            const float w_first = p(first) / (p(first) + p(second)), w_second = p(second) / (p(first) + p(second));
+
+            resizable_tensor xs(1, 1, 3, 8), gs(1, 1, 3, 8);
+            memcpy(xs, sample_alias(input_tensor, n * sample_size));
+            memcpy(gs, sample_alias(gradient, n * sample_size));
+            const matrix<float> expected = w_first * mat(experts[first].forward(xs)) + w_second * mat(experts[second].forward(xs));
+            max_out_err = std::max(max_out_err, max(abs(mat(out.host() + n * sample_size, 1, sample_size) - expected)));
+
+            matrix<float> expected_grad = zeros_matrix<float>(1, sample_size);
+            for (const auto& ew : { std::make_pair(first, w_first), std::make_pair(second, w_second) })
+            {
+                resizable_tensor wg = gs;
+                tt::affine_transform(wg, gs, ew.second);
+                experts[ew.first].forward(xs);
+                experts[ew.first].back_propagate_error(xs, wg);
+                expected_grad += mat(experts[ew.first].get_final_data_gradient());
+            }
+            const tensor& data_grad = net.get_final_data_gradient();
+            max_grad_err = std::max(max_grad_err, max(abs(mat(data_grad.host() + n * sample_size, 1, sample_size) - expected_grad)));
+        }
+        DLIB_TEST_MSG(max_out_err < 1e-5, max_out_err);
+        DLIB_TEST_MSG(max_grad_err < 1e-5, max_grad_err);
+    }
+
+    using moe_token_test_net = moe<moe_test_expert, 2, inference_mode_tag, tag9,
+        skip8<tag9<token_gate<4, multiply, tag8<input<matrix<float>>>>>>>;
+
+    void test_moe_token_routing()
+    {
+        print_spinner();
+        moe_token_test_net net;
+        net.layer_details().set_capacity_factor(0.75f);
+        std::vector<matrix<float>> x(11, matrix<float>(3, 8));
+        dlib::rand rnd(7);
+        for (auto& m : x)
+            for (auto& val : m)
+                val = rnd.get_random_gaussian();
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        const tensor& out = net.forward(input_tensor);
+        resizable_tensor gradient;
+        gradient.copy_size(out);
+        tt::tensor_rand(8).fill_gaussian(gradient);
+        net.back_propagate_error(input_tensor, gradient);
+
+        // Every token picks its own two experts, and each expert keeps at most
+        // ceil(0.75*33*2/4) tokens, first choices taking precedence over second choices.
+        auto& moe_layer = net.layer_details();
+        const long num_tokens = 11 * 3, capacity = 13;
+        DLIB_TEST(moe_layer.get_expert_capacity() == capacity);
+        const tensor& logits = layer<tag9>(net).get_output();
+        DLIB_TEST(logits.k() == 1 && logits.nr() == 3 && logits.nc() == 4);
+
+        std::vector<std::array<long, 2>> choice(num_tokens);
+        std::vector<std::array<float, 2>> weight(num_tokens);
+        for (long n = 0; n < num_tokens; ++n)
+        {
+            matrix<float> p = exp(mat(logits.host() + n * 4, 1, 4) - max(mat(logits.host() + n * 4, 1, 4)));
+            p /= sum(p);
+            long first = index_of_max(p), second = first == 0 ? 1 : 0;
+            for (long e = 0; e < 4; ++e)
+                if (e != first && p(e) > p(second))
+                    second = e;
+            choice[n] = {{ first, second }};
+            weight[n] = {{ p(first) / (p(first) + p(second)), p(second) / (p(first) + p(second)) }};
+        }
+        std::vector<std::array<bool, 2>> kept(num_tokens);
+        std::vector<long> load(4, 0);
+        long num_dropped = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            for (long n = 0; n < num_tokens; ++n)
+            {
+                kept[n][i] = load[choice[n][i]] < capacity;
+                if (kept[n][i])
+                    ++load[choice[n][i]];
+                else
+                    ++num_dropped;
+            }
+        }
+        DLIB_TEST_MSG(num_dropped > 0, "the capacity limit was never reached");
+
+        std::vector<moe_test_expert> experts;
+        for (long e = 0; e < moe_layer.num_experts(); ++e)
+            experts.push_back(moe_layer.get_expert(e));
+        alias_tensor token_alias(1, 1, 1, 8);
+        float max_out_err = 0, max_grad_err = 0;
+        for (long n = 0; n < num_tokens; ++n)
+        {
+            resizable_tensor xs(1, 1, 1, 8), gs(1, 1, 1, 8);
+            memcpy(xs, token_alias(input_tensor, n * 8));
+            memcpy(gs, token_alias(gradient, n * 8));
+            matrix<float> expected = zeros_matrix<float>(1, 8), expected_grad = zeros_matrix<float>(1, 8);
+            for (int i = 0; i < 2; ++i)
+            {
+                if (!kept[n][i])
+                    continue;
+                auto& expert = experts[choice[n][i]];
+                expected += weight[n][i] * mat(expert.forward(xs));
+                resizable_tensor wg = gs;
+                tt::affine_transform(wg, gs, weight[n][i]);
+                expert.back_propagate_error(xs, wg);
+                expected_grad += mat(expert.get_final_data_gradient());
+            }
+            max_out_err = std::max(max_out_err, max(abs(mat(out.host() + n * 8, 1, 8) - expected)));
+            const tensor& data_grad = net.get_final_data_gradient();
+            max_grad_err = std::max(max_grad_err, max(abs(mat(data_grad.host() + n * 8, 1, 8) - expected_grad)));
+        }
+        DLIB_TEST_MSG(max_out_err < 1e-5, max_out_err);
+        DLIB_TEST_MSG(max_grad_err < 1e-5, max_grad_err);
+
+        // The capacity settings and statistics survive serialization
+        std::ostringstream sout;
+        serialize(moe_layer, sout);
+        std::istringstream sin(sout.str());
+        moe_token_test_net::layer_details_type copy;
+        deserialize(copy, sin);
+        DLIB_TEST(copy.get_capacity_factor() == 0.75f);
+        DLIB_TEST(copy.get_expert_drop_rate() == moe_layer.get_expert_drop_rate());
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    using quantized_test_net = fc<7, linear<40, embeddings<50, 48, input<matrix<unsigned long, 0, 1>>>>>;
+
+    void test_quantized_weights()
+    {
+        print_spinner();
+        dlib::rand rnd(3);
+        auto fill_gaussian = [&](tensor& t)
+        {
+            for (auto& val : t)
+                val = rnd.get_random_gaussian();
+        };
+
+        for (int bits : { 8, 4 })
+        {
+            // Every value is rounded to the closest step of its row's scale, also in the
+            // padding of the last 4 bit block (45 columns).
+            resizable_tensor w(37, 45);
+            fill_gaussian(w);
+            quantized_matrix qw;
+            qw.quantize(w, false, bits);
+            DLIB_TEST(qw.nr() == 37 && qw.nc() == 45 && qw.bits() == bits);
+            DLIB_TEST(qw.size_in_bytes() < w.size()*sizeof(float)/(bits == 8 ? 3 : 4));
+            resizable_tensor dw;
+            qw.dequantize(dw);
+            for (long r = 0; r < qw.nr(); ++r)
+            {
+                const float err = max(abs(rowm(mat(dw), r) - rowm(mat(w), r)));
+                DLIB_TEST_MSG(err <= qw.scale(r)/2*1.0001f, "bits: " << bits << ", err: " << err);
+            }
+
+            // quantized_gemm() computes exactly the product with the dequantized matrix,
+            // for a few rows (decoding) as well as many rows (prefill).
+            for (long K : { 45, 96, 200 })
+            {
+                resizable_tensor weights(K, 33);
+                fill_gaussian(weights);
+                qw.quantize(weights, true, bits);
+                qw.dequantize(dw);
+                for (long M : { 1, 3, 20 })
+                {
+                    resizable_tensor lhs(M, 1, 1, K), dest(M, 33);
+                    fill_gaussian(lhs);
+                    tt::quantized_gemm(dest, lhs, qw);
+                    const matrix<float> expected = mat(lhs)*trans(mat(dw));
+                    DLIB_TEST_MSG(max(abs(mat(dest) - expected)) < 1e-4*(1 + max(abs(expected))),
+                        "bits: " << bits << ", M: " << M << ", K: " << K);
+                }
+            }
+        }
+
+        // Quantized networks stay close to the float ones and survive serialization
+        // in their compact form.
+        std::vector<matrix<unsigned long, 0, 1>> x(3, matrix<unsigned long, 0, 1>(5));
+        dlib::rand rnd_tokens(4);
+        for (auto& seq : x)
+            for (auto& t : seq)
+                t = rnd_tokens.get_random_32bit_number() % 50;
+        quantized_test_net net;
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        const matrix<float> expected = mat(net.forward(input_tensor));
+        // The serialized sizes are compared without the cached layer outputs
+        quantized_test_net clean_net = net;
+        clean_net.clean();
+        std::ostringstream float_model;
+        serialize(clean_net, float_model);
+
+        for (int bits : { 8, 4 })
+        {
+            quantized_test_net qnet = net;
+            quantize_weights(qnet, bits);
+            DLIB_TEST(layer<1>(qnet).layer_details().is_quantized());
+            DLIB_TEST(layer<2>(qnet).layer_details().get_quantized_embeddings().bits() == bits);
+            const matrix<float> out = mat(qnet.forward(input_tensor));
+            const float err = max(abs(out - expected))/max(abs(expected));
+            DLIB_TEST_MSG(err < (bits == 8 ? 0.02 : 0.3), "bits: " << bits << ", err: " << err);
+
+            quantized_test_net clean_qnet = qnet;
+            clean_qnet.clean();
+            std::ostringstream sout;
+            serialize(clean_qnet, sout);
+            DLIB_TEST_MSG(sout.str().size()*(bits == 8 ? 3 : 4) < float_model.str().size(),
+                sout.str().size() << " " << float_model.str().size());
+            std::istringstream sin(sout.str());
+            quantized_test_net qnet2;
+            deserialize(qnet2, sin);
+            DLIB_TEST(layer<0>(qnet2).layer_details().is_quantized());
+            DLIB_TEST(max(abs(mat(qnet2.forward(input_tensor)) - out)) == 0);
+        }
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    void test_cpu_conv()
+    {
+        print_spinner();
+        // cpu::tensor_conv against a plain loop implementation, covering the blocked
+        // im2col path, the 3x3 stride 1 kernel and the large sample (BLAS) path.
+        dlib::rand rnd(9);
+        auto fill = [&](tensor& t)
+        {
+            for (auto& v : t)
+                v = rnd.get_random_gaussian();
+        };
+
+        struct conv_case { long n, k, nr, nc, nf, fnr, fnc, sy, sx, py, px; };
+        std::vector<conv_case> cases = {
+            { 2, 3, 9, 7, 5, 3, 3, 1, 1, 1, 1 },
+            { 1, 2, 5, 6, 3, 3, 3, 1, 1, 0, 2 },
+            { 3, 4, 8, 8, 17, 3, 3, 1, 1, 1, 0 },
+            { 2, 16, 32, 32, 32, 3, 3, 1, 1, 1, 1 },
+            { 1, 3, 1, 1, 2, 1, 1, 1, 1, 0, 0 }
+        };
+        for (int i = 0; i < 30; ++i)
+        {
+            conv_case c;
+            c.n = rnd.get_integer_in_range(1, 4);
+            c.k = rnd.get_integer_in_range(1, 6);
+            c.nf = rnd.get_integer_in_range(1, 20);
+            c.fnr = rnd.get_integer_in_range(1, 6);
+            c.fnc = rnd.get_integer_in_range(1, 6);
+            c.py = rnd.get_integer_in_range(0, c.fnr);
+            c.px = rnd.get_integer_in_range(0, c.fnc);
+            c.nr = rnd.get_integer_in_range(std::max<long>(1, c.fnr - 2*c.py), 14);
+            c.nc = rnd.get_integer_in_range(std::max<long>(1, c.fnc - 2*c.px), 14);
+            c.sy = rnd.get_integer_in_range(1, 4);
+            c.sx = rnd.get_integer_in_range(1, 4);
+            cases.push_back(c);
+        }
+
+        for (const auto& c : cases)
+        {
+            resizable_tensor data(c.n, c.k, c.nr, c.nc), filters(c.nf, c.k, c.fnr, c.fnc);
+            fill(data);
+            fill(filters);
+            cpu::tensor_conv conv;
+            conv.setup(data, filters, c.sy, c.sx, c.py, c.px);
+            resizable_tensor out;
+            conv(false, out, data, filters);
+
+            resizable_tensor expected, gi, data_grad, filters_grad;
+            expected.copy_size(out);
+            expected = 0;
+            gi.copy_size(out);
+            fill(gi);
+            data_grad.copy_size(data);
+            data_grad = 0;
+            filters_grad.copy_size(filters);
+            filters_grad = 0;
+            for (long n = 0; n < c.n; ++n)
+            for (long f = 0; f < c.nf; ++f)
+            for (long r = 0; r < out.nr(); ++r)
+            for (long col = 0; col < out.nc(); ++col)
+            {
+                const long oidx = tensor_index(out, n, f, r, col);
+                for (long k = 0; k < c.k; ++k)
+                for (long y = 0; y < c.fnr; ++y)
+                for (long x = 0; x < c.fnc; ++x)
+                {
+                    const long yy = r*c.sy - c.py + y;
+                    const long xx = col*c.sx - c.px + x;
+                    if (yy < 0 || yy >= c.nr || xx < 0 || xx >= c.nc)
+                        continue;
+                    const long didx = tensor_index(data, n, k, yy, xx);
+                    const long fidx = tensor_index(filters, f, k, y, x);
+                    expected.host()[oidx] += filters.host()[fidx]*data.host()[didx];
+                    data_grad.host()[didx] += filters.host()[fidx]*gi.host()[oidx];
+                    filters_grad.host()[fidx] += data.host()[didx]*gi.host()[oidx];
+                }
+            }
+            DLIB_TEST_MSG(max(abs(mat(out) - mat(expected))) < 1e-4, max(abs(mat(out) - mat(expected))));
+
+            // add_to_output adds to what is already there
+            resizable_tensor out2(out);
+            conv(true, out2, data, filters);
+            DLIB_TEST(max(abs(mat(out2) - 2*mat(expected))) < 1e-4);
+
+            resizable_tensor dg(data), fg(filters);
+            dg = 1;
+            fg = 1;
+            conv.get_gradient_for_data(false, gi, filters, dg);
+            conv.get_gradient_for_filters(false, gi, data, fg);
+            DLIB_TEST_MSG(max(abs(mat(dg) - mat(data_grad))) < 1e-4, max(abs(mat(dg) - mat(data_grad))));
+            DLIB_TEST_MSG(max(abs(mat(fg) - mat(filters_grad))) < 1e-3, max(abs(mat(fg) - mat(filters_grad))));
+            conv.get_gradient_for_data(true, gi, filters, dg);
+            conv.get_gradient_for_filters(true, gi, data, fg);
+            DLIB_TEST(max(abs(mat(dg) - 2*mat(data_grad))) < 1e-4);
+            DLIB_TEST(max(abs(mat(fg) - 2*mat(filters_grad))) < 2e-3);
+        }
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    void test_repeat_checkpointing()
+    {
+        print_spinner();
+        using net_type = linear<11, rms_norm<repeated_transformer_stack<3, gelu, multiply, 16, 4,
+            embeddings<11, 16, input<matrix<int,0,1>>>>>>;
+        using stack_type = net_type::subnet_type::subnet_type;
+
+        dlib::rand rnd(5);
+        std::vector<matrix<int,0,1>> samples(2, matrix<int,0,1>(8));
+        for (auto& s : samples)
+            for (auto& v : s)
+                v = rnd.get_random_32bit_number()%11;
+
+        net_type net;
+        resizable_tensor x;
+        net.to_tensor(samples.begin(), samples.end(), x);
+        net.forward(x);
+        net_type ckpt_net = net;
+        set_all_checkpointing(ckpt_net, true);
+        DLIB_TEST(ckpt_net.subnet().subnet().is_checkpointing());
+        DLIB_TEST(!net.subnet().subnet().is_checkpointing());
+
+        resizable_tensor gradient;
+        gradient.copy_size(net.get_output());
+        tt::tensor_rand(1).fill_gaussian(gradient);
+
+        const auto parameter_gradients = [&](net_type& n)
+        {
+            n.forward(x);
+            n.back_propagate_error(x, gradient);
+            std::vector<float> grads;
+            visit_layer_parameter_gradients(n, [&](tensor& t) { grads.insert(grads.end(), t.begin(), t.end()); });
+            return grads;
+        };
+
+        // Run twice to also go through the freeing and recomputation of a previous step
+        for (int iter = 0; iter < 2; ++iter)
+        {
+            const std::vector<float> expected = parameter_gradients(net);
+            const std::vector<float> grads = parameter_gradients(ckpt_net);
+            DLIB_TEST(max(abs(mat(net.get_output()) - mat(ckpt_net.get_output()))) < 1e-6);
+            DLIB_TEST(grads.size() == expected.size() && grads.size() > 0);
+            DLIB_TEST(max(abs(mat(grads) - mat(expected))) < 1e-5);
+
+            // Only the top block of the stack keeps its activations
+            ckpt_net.forward(x);
+            const size_t block_layers = stack_type::layers_in_each_group;
+            DLIB_TEST(layer<3>(ckpt_net).get_output().size() != 0);
+            DLIB_TEST(layer<3 + block_layers>(ckpt_net).get_output().size() == 0);
+            DLIB_TEST(layer<3 + 2*block_layers>(ckpt_net).get_output().size() == 0);
+            DLIB_TEST(layer<3 + block_layers>(net).get_output().size() != 0);
+        }
+
+        // Storing the checkpoints as bfloat16 leaves the outputs as they are and only
+        // perturbs the gradients by the rounding of the saved inputs.  embeddings_
+        // updates itself in backward, so both networks are compared from the same state,
+        // after a first step that leaves saved checkpoints behind.
+        net_type bf16_net = net;
+        set_all_checkpointing(bf16_net, true, true);
+        DLIB_TEST(bf16_net.subnet().subnet().uses_bfloat16_checkpoints());
+        parameter_gradients(bf16_net);
+        net_type ref_net = bf16_net;
+        set_all_checkpointing(ref_net, false);
+        const std::vector<float> expected = parameter_gradients(ref_net);
+        const std::vector<float> grads = parameter_gradients(bf16_net);
+        DLIB_TEST(max(abs(mat(ref_net.get_output()) - mat(bf16_net.get_output()))) < 1e-6);
+        const float err = max(abs(mat(grads) - mat(expected)))/max(abs(mat(expected)));
+        DLIB_TEST_MSG(err < 0.02, "err: " << err);
+        DLIB_TEST(err > 0);
+
+        std::ostringstream sout;
+        serialize(ckpt_net, sout);
+        std::istringstream sin(sout.str());
+        net_type net2;
+        deserialize(net2, sin);
+        DLIB_TEST(net2.subnet().subnet().is_checkpointing());
+        DLIB_TEST(!net2.subnet().subnet().uses_bfloat16_checkpoints());
+        set_all_checkpointing(net2, false);
+        DLIB_TEST(!net2.subnet().subnet().is_checkpointing());
+
+        // dropout_ draws the same mask again in replay mode
+        dropout_ drop(0.5);
+        resizable_tensor in(2, 3, 4, 5), out1, out2;
+        tt::tensor_rand(2).fill_gaussian(in);
+        out1.copy_size(in);
+        out2.copy_size(in);
+        drop.forward_inplace(in, out1);
+        drop.set_replay_mode(true);
+        drop.forward_inplace(in, out2);
+        DLIB_TEST(max(abs(mat(out1) - mat(out2))) == 0);
+        drop.set_replay_mode(false);
+        drop.forward_inplace(in, out2);
+        DLIB_TEST(max(abs(mat(out1) - mat(out2))) > 0);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    using generator_test_net = linear<11, canonical_transformer::transformer_block<gelu, multiply, 16, 4,
+        embeddings<11, 16, input<matrix<int,0,1>>>>>;
+
+    void test_text_generator()
+    {
+        print_spinner();
+        // The sampler filters: top-k 1 and a tight nucleus reduce to greedy decoding,
+        // min-p keeps the tokens close to the best one only.
+        {
+            const std::vector<float> logits = { 0.5f, 3.0f, 2.9f, -1.0f, 0.0f };
+            token_sampler greedy;
+            greedy.set_temperature(0);
+            DLIB_TEST(greedy(logits.data(), logits.size()) == 1);
+
+            token_sampler sampler(7);
+            sampler.set_top_k(1);
+            for (int i = 0; i < 20; ++i)
+                DLIB_TEST(sampler(logits.data(), logits.size()) == 1);
+            sampler.set_top_k(0);
+            sampler.set_top_p(0.4f);
+            for (int i = 0; i < 20; ++i)
+                DLIB_TEST(sampler(logits.data(), logits.size()) == 1);
+            sampler.set_top_p(1);
+            sampler.set_min_p(0.5f);
+            std::vector<int> counts(logits.size(), 0);
+            for (int i = 0; i < 2000; ++i)
+                counts[sampler(logits.data(), logits.size())]++;
+            DLIB_TEST(counts[1] > 800 && counts[2] > 800 && counts[1] + counts[2] == 2000);
+
+            // A strong repetition penalty moves the choice away from the recent tokens
+            sampler.set_min_p(0);
+            sampler.set_top_k(1);
+            sampler.set_repetition_penalty(100, 2);
+            DLIB_TEST(sampler(logits.data(), logits.size(), { 1, 2 }) == 0);
+            DLIB_TEST(sampler(logits.data(), logits.size(), { 1, 0, 0 }) == 1);
+
+            // Same seed, same tokens, also after a serialization round trip
+            token_sampler a(3), b(3);
+            std::ostringstream sout;
+            serialize(a, sout);
+            std::istringstream sin(sout.str());
+            token_sampler c;
+            deserialize(c, sin);
+            for (int i = 0; i < 50; ++i)
+            {
+                const long t = a(logits.data(), logits.size());
+                DLIB_TEST(t == b(logits.data(), logits.size()));
+                DLIB_TEST(t == c(logits.data(), logits.size()));
+            }
+        }
+
+        generator_test_net net;
+        const long window_size = 8, pad = 0;
+        text_generator<generator_test_net> gen(net, window_size, pad);
+        gen.sampler().set_temperature(0);
+        gen.set_max_new_tokens(10);
+        const std::vector<std::vector<int>> prompts = {
+            { 3 }, { 4, 5, 6 }, { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }, { 7, 7 }
+        };
+
+        // Batched decoding with per sample padding gives the same tokens as decoding
+        // each prompt alone.
+        std::vector<std::vector<int>> single;
+        for (const auto& p : prompts)
+            single.push_back(gen.generate(p));
+        DLIB_TEST(!tril_padding_context::is_set());
+        for (const auto& s : single)
+            DLIB_TEST(s.size() == 10);
+
+        std::vector<std::vector<int>> streamed(prompts.size());
+        auto batched = gen.generate(prompts, [&](size_t i, int token) {
+            streamed[i].push_back(token);
+            return true;
+        });
+        DLIB_TEST(batched == single);
+        DLIB_TEST(streamed == single);
+
+        // Limiting the batch admits the waiting prompts as the others finish
+        gen.set_max_batch_size(3);
+        DLIB_TEST(gen.generate(prompts) == single);
+        gen.set_max_batch_size(0);
+
+        // A stop token ends its sequence and is kept as its last token
+        gen.add_stop_token(single[1][2]);
+        auto stopped = gen.generate(prompts);
+        for (size_t i = 0; i < prompts.size(); ++i)
+        {
+            auto pos = std::find(single[i].begin(), single[i].end(), single[1][2]);
+            const size_t expected = pos == single[i].end() ? single[i].size() : pos - single[i].begin() + 1;
+            DLIB_TEST(stopped[i] == std::vector<int>(single[i].begin(), single[i].begin() + expected));
+        }
+        gen.set_stop_tokens({});
+
+        // The callback can stop a sequence
+        auto early = gen.generate(prompts, [](size_t i, int) { return i != 2; });
+        DLIB_TEST(early[2].size() == 1 && early[2][0] == single[2][0]);
+        DLIB_TEST(early[0] == single[0]);
+    }
+
+    using draft_test_net = linear<11, embeddings<11, 8, input<matrix<int,0,1>>>>;
+
+    void test_speculative_generator()
+    {
+        print_spinner();
+        generator_test_net target;
+        draft_test_net draft;
+        const long window_size = 16, pad = 0;
+
+        // With greedy decoding the draft network only changes the speed: the tokens are
+        // those the target network generates alone.
+        text_generator<generator_test_net> plain(target, window_size, pad);
+        plain.sampler().set_temperature(0);
+        plain.set_max_new_tokens(10);
+        speculative_generator<generator_test_net, draft_test_net> gen(target, draft, window_size, pad);
+        gen.sampler().set_temperature(0);
+        gen.set_max_new_tokens(10);
+        gen.set_num_draft_tokens(3);
+        for (const auto& prompt : std::vector<std::vector<int>>{ { 3 }, { 4, 5, 6 }, { 9, 1 } })
+        {
+            std::vector<int> streamed;
+            auto tokens = gen.generate(prompt, [&](int t) { streamed.push_back(t); return true; });
+            DLIB_TEST(tokens == plain.generate(prompt));
+            DLIB_TEST(streamed == tokens);
+            DLIB_TEST(gen.get_num_accepted() <= gen.get_num_drafted());
+            DLIB_TEST(!tril_padding_context::is_set());
+        }
+
+        // A draft identical to the target is always right
+        speculative_generator<generator_test_net, generator_test_net> self(target, target, window_size, pad);
+        self.sampler().set_temperature(0);
+        self.set_max_new_tokens(10);
+        DLIB_TEST(self.generate({ 4, 5, 6 }) == plain.generate({ 4, 5, 6 }));
+        DLIB_TEST(self.get_num_drafted() > 0 && self.get_acceptance_rate() == 1);
+
+        // When sampling, the first token follows the target distribution
+        std::vector<float> p;
+        {
+            matrix<int,0,1> window(window_size);
+            window = pad;
+            window(window_size - 1) = 3;
+            resizable_tensor x;
+            target.to_tensor(&window, &window + 1, x);
+            tril_padding_context::set_from_lengths({ window_size - 1 });
+            const tensor& out = target.forward(x);
+            tril_padding_context::clear();
+            token_sampler sampler;
+            sampler.set_temperature(0.5f);
+            sampler.get_distribution(out.host() + tensor_index(out, 0, 0, window_size - 1, 0), out.nc(), { 3 }, p);
+        }
+        speculative_generator<generator_test_net, draft_test_net> sampled(target, draft, window_size, pad, 5);
+        sampled.sampler().set_temperature(0.5f);
+        sampled.set_max_new_tokens(2);
+        std::vector<double> freq(p.size(), 0);
+        const int num_runs = 3000;
+        for (int i = 0; i < num_runs; ++i)
+            freq[sampled.generate({ 3 })[0]] += 1.0 / num_runs;
+        for (size_t i = 0; i < p.size(); ++i)
+            DLIB_TEST_MSG(std::abs(freq[i] - p[i]) < 0.035, i << ": " << freq[i] << " " << p[i]);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    using window_test_net = loss_cross_entropy_per_logit<linear<11, embeddings<11, 8, input<token_window>>>>;
+    using window_matrix_test_net = loss_cross_entropy_per_logit<draft_test_net>;
+
+    void test_token_windows()
+    {
+        print_spinner();
+        dlib::rand rnd(5);
+        std::vector<std::vector<int>> sequences;
+        for (long len : { 1, 3, 8, 9, 20 })
+        {
+            std::vector<int> seq(len);
+            for (auto& t : seq) t = 1 + rnd.get_random_32bit_number() % 10;
+            sequences.push_back(seq);
+        }
+
+        // The windows hold the same tokens as the copied samples
+        for (bool left_padding : { false, true })
+        {
+            std::vector<matrix<int,0,1>> X;
+            std::vector<unsigned long> Y, Yw;
+            std::vector<token_window> windows;
+            build_single_token_prediction_dataset(sequences, 8, 0, left_padding, X, Y);
+            build_single_token_prediction_dataset(sequences, 8, 0, left_padding, windows, Yw);
+            DLIB_TEST(X.size() > 0 && windows.size() == X.size() && Yw == Y);
+            for (size_t i = 0; i < X.size(); ++i)
+                DLIB_TEST(X[i] == windows[i].to_matrix());
+        }
+        {
+            std::vector<matrix<int,0,1>> X;
+            std::vector<matrix<unsigned long,0,1>> Y, Yw;
+            std::vector<token_window> windows;
+            build_multi_token_prediction_dataset(sequences, sequences, 6, 4, 0, X, Y);
+            build_multi_token_prediction_dataset(sequences, sequences, 6, 4, 0, windows, Yw);
+            DLIB_TEST(X.size() > 0 && windows.size() == X.size() && Yw.size() == Y.size());
+            for (size_t i = 0; i < X.size(); ++i)
+                DLIB_TEST(X[i] == windows[i].to_matrix() && Y[i] == Yw[i]);
+        }
+
+        // A contiguous array gives the windows of a single sequence, with the same
+        // tensors as the matrices, also after shuffling
+        const std::vector<int>& corpus = sequences.back();
+        std::vector<matrix<int,0,1>> X;
+        std::vector<unsigned long> Y, Yw;
+        std::vector<token_window> windows;
+        build_single_token_prediction_dataset({ corpus }, 8, 0, true, X, Y);
+        build_single_token_prediction_dataset(corpus.data(), corpus.size(), 8, 0, true, windows, Yw);
+        DLIB_TEST(Yw == Y);
+        shuffle_training_dataset(X, Y, 3);
+        shuffle_training_dataset(windows, Yw, 3);
+        DLIB_TEST(Yw == Y);
+        resizable_tensor tm, tw;
+        input<matrix<int,0,1>>().to_tensor(X.begin(), X.end(), tm);
+        input<token_window>().to_tensor(windows.begin(), windows.end(), tw);
+        DLIB_TEST(tm.num_samples() == tw.num_samples() && tm.k() == tw.k() && tm.nr() == tw.nr() && tm.nc() == tw.nc());
+        DLIB_TEST(max(abs(mat(tm) - mat(tw))) == 0);
+
+        // A network trained on windows is loaded by the same network taking matrices
+        window_test_net net;
+        dnn_trainer<window_test_net> trainer(net);
+        trainer.set_mini_batch_size(8);
+        for (int i = 0; i < 3; ++i)
+            trainer.train_one_step(windows, Yw);
+        trainer.get_net();
+
+        window_matrix_test_net loaded;
+        std::ostringstream sout;
+        serialize(net, sout);
+        std::istringstream sin(sout.str());
+        deserialize(loaded, sin);
+        window_matrix_test_net copied(net);
+
+        resizable_tensor x;
+        net.to_tensor(windows.begin(), windows.begin() + 4, x);
+        const matrix<float> expected = mat(net.subnet().forward(x));
+        loaded.to_tensor(X.begin(), X.begin() + 4, x);
+        DLIB_TEST(max(abs(mat(loaded.subnet().forward(x)) - expected)) < 1e-6);
+        DLIB_TEST(max(abs(mat(copied.subnet().forward(x)) - expected)) < 1e-6);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    using loader_test_net = loss_multiclass_log<fc<3, relu<fc<8, input<matrix<float>>>>>>;
+
+    void make_loader_test_batch(
+        unsigned long long index,
+        std::vector<matrix<float>>& samples,
+        std::vector<unsigned long>& labels
+    )
+    {
+        dlib::rand rnd(index);
+        for (int i = 0; i < 6; ++i)
+        {
+            const unsigned long label = rnd.get_random_32bit_number()%3;
+            samples.push_back(matrix_cast<float>(randm(4, 1, rnd)) + label);
+            labels.push_back(label);
+        }
+    }
+
+    void test_data_loader()
+    {
+        print_spinner();
+        loader_test_net net;
+        std::vector<matrix<float>> samples;
+        std::vector<unsigned long> labels;
+        resizable_tensor x;
+
+        // In deterministic mode the batches come in order and hold what the batch maker
+        // made, already converted to a tensor
+        {
+            data_loader<loader_test_net> loader(net, make_loader_test_batch, 3, 4);
+            DLIB_TEST(loader.get_num_workers() == 3 && loader.get_max_prefetched_batches() == 4);
+            data_loader<loader_test_net>::batch_type batch;
+            for (unsigned long long i = 0; i < 20; ++i)
+            {
+                loader.get_next_batch(batch);
+                samples.clear();
+                labels.clear();
+                make_loader_test_batch(i, samples, labels);
+                net.to_tensor(samples.begin(), samples.end(), x);
+                DLIB_TEST(batch.index == i && batch.labels == labels && batch.samples.size() == samples.size());
+                DLIB_TEST(max(abs(mat(batch.data) - mat(x))) == 0);
+            }
+        }
+        {
+            data_loader<loader_test_net> loader(net, make_loader_test_batch, 4, 0, false);
+            DLIB_TEST(!loader.is_deterministic() && loader.get_max_prefetched_batches() == 8);
+            data_loader<loader_test_net>::batch_type batch;
+            std::set<unsigned long long> indices;
+            for (int i = 0; i < 20; ++i)
+            {
+                loader.get_next_batch(batch);
+                indices.insert(batch.index);
+            }
+            DLIB_TEST(indices.size() == 20 && *indices.rbegin() < 28);
+        }
+
+        // Training on prefetched batches is the same as training on the samples
+        samples.clear();
+        labels.clear();
+        make_loader_test_batch(0, samples, labels);
+        net(samples);
+        loader_test_net net2 = net;
+        {
+            dnn_trainer<loader_test_net> trainer(net), trainer2(net2);
+            data_loader<loader_test_net> loader(net2, make_loader_test_batch, 2);
+            data_loader<loader_test_net>::batch_type batch;
+            for (unsigned long long i = 0; i < 10; ++i)
+            {
+                samples.clear();
+                labels.clear();
+                make_loader_test_batch(i, samples, labels);
+                trainer.train_one_step(samples, labels);
+                loader.get_next_batch(batch);
+                trainer2.train_one_step(batch);
+            }
+            trainer.get_net();
+            trainer2.get_net();
+            DLIB_TEST(trainer2.get_train_one_step_calls() == 10);
+        }
+        net.subnet().forward(x);
+        const matrix<float> out = mat(net.subnet().get_output());
+        net2.subnet().forward(x);
+        DLIB_TEST(max(abs(out - mat(net2.subnet().get_output()))) < 1e-5);
+
+        // A network that never converted any input learns its sample expansion factor
+        // from the batch
+        {
+            loader_test_net net3;
+            dnn_trainer<loader_test_net> trainer(net3);
+            data_loader<loader_test_net> loader(net3, make_loader_test_batch, 1);
+            data_loader<loader_test_net>::batch_type batch;
+            loader.get_next_batch(batch);
+            trainer.train_one_step(batch);
+            trainer.get_net();
+            DLIB_TEST(net3.sample_expansion_factor() == 1);
+        }
+
+        // Errors of the batch maker are given to the caller
+        {
+            data_loader<loader_test_net> loader(net, [](unsigned long long index, std::vector<matrix<float>>& s, std::vector<unsigned long>& l) {
+                if (index == 3) throw dlib::error("bad batch");
+                make_loader_test_batch(index, s, l);
+            }, 2);
+            data_loader<loader_test_net>::batch_type batch;
+            bool thrown = false;
+            try
+            {
+                for (int i = 0; i < 10; ++i)
+                    loader.get_next_batch(batch);
+            }
+            catch (dlib::error& e)
+            {
+                thrown = e.info == "bad batch";
+            }
+            DLIB_TEST(thrown);
+        }
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    void test_bfloat16()
+    {
+        print_spinner();
+
+        // Rounding to nearest even, and the special values
+        DLIB_TEST(float(bfloat16(1.0f)) == 1.0f);
+        DLIB_TEST(float(bfloat16(1.0f + 1/256.0f)) == 1.0f);
+        DLIB_TEST(float(bfloat16(1.0f + 3/256.0f)) == 1.0f + 4/256.0f);
+        DLIB_TEST(float(bfloat16(-1.0f - 1/255.0f)) == -1.0f - 2/256.0f);
+        DLIB_TEST(float(bfloat16(std::numeric_limits<float>::infinity())) == std::numeric_limits<float>::infinity());
+        DLIB_TEST(std::isnan(float(bfloat16(std::numeric_limits<float>::quiet_NaN()))));
+
+        // The tensor conversions, vectorized and threaded for large tensors, agree with
+        // the scalar ones.
+        dlib::rand rnd(6);
+        for (long n : { 1L, 35L, 1000L, 600*1024L })
+        {
+            resizable_tensor src(n, 1, 1, 1), back;
+            for (auto& v : src)
+                v = rnd.get_random_gaussian()*std::pow(10.0f, rnd.get_integer_in_range(-8, 8));
+            src.host()[0] = 100.0f;
+            bfloat16_tensor compact;
+            tt::float_to_bfloat16(compact, src);
+            DLIB_TEST(compact.num_samples() == n && compact.size() == src.size());
+            DLIB_TEST(compact.size_in_bytes()*2 == src.size()*sizeof(float));
+            long mismatches = 0;
+            for (long i = 0; i < n; ++i)
+                mismatches += compact.data()[i].bits != bfloat16(src.host()[i]).bits;
+            DLIB_TEST_MSG(mismatches == 0, "n: " << n << ", mismatches: " << mismatches);
+
+            tt::bfloat16_to_float(back, compact);
+            DLIB_TEST(have_same_dimensions(back, src));
+            DLIB_TEST_MSG(max(pointwise_divide(abs(mat(back) - mat(src)), abs(mat(src)))) <= 1/256.0f, "n: " << n);
+        }
+
+        // 16 bit weights are stored as bfloat16 and multiplied in float
+        resizable_tensor weights(70, 33), dw;
+        for (auto& v : weights)
+            v = rnd.get_random_gaussian();
+        quantized_matrix qw;
+        qw.quantize(weights, true, 16);
+        DLIB_TEST(qw.bits() == 16 && qw.nr() == 33 && qw.nc() == 70);
+        DLIB_TEST(qw.value(3, 5) == float(bfloat16(weights.host()[5*33 + 3])));
+        qw.dequantize(dw);
+        DLIB_TEST(max(abs(mat(dw) - trans(mat(weights)))) <= max(abs(mat(weights)))/256);
+        for (long M : { 1, 3, 20 })
+        {
+            resizable_tensor lhs(M, 70), dest(M, 33);
+            for (auto& v : lhs)
+                v = rnd.get_random_gaussian();
+            tt::quantized_gemm(dest, lhs, qw);
+            const matrix<float> expected = mat(lhs)*trans(mat(dw));
+            DLIB_TEST_MSG(max(abs(mat(dest) - expected)) < 1e-4*(1 + max(abs(expected))), "M: " << M);
+        }
+
+        std::vector<matrix<unsigned long, 0, 1>> x(3, matrix<unsigned long, 0, 1>(5));
+        for (auto& seq : x)
+            for (auto& t : seq)
+                t = rnd.get_random_32bit_number() % 50;
+        quantized_test_net net;
+        resizable_tensor input_tensor;
+        net.to_tensor(x.begin(), x.end(), input_tensor);
+        const matrix<float> expected = mat(net.forward(input_tensor));
+        quantized_test_net qnet = net;
+        quantize_weights(qnet, 16);
+        DLIB_TEST(layer<1>(qnet).layer_details().get_quantized_weights().bits() == 16);
+        const float err = max(abs(mat(qnet.forward(input_tensor)) - expected))/max(abs(expected));
+        DLIB_TEST_MSG(err < 0.01, "err: " << err);
+        std::ostringstream sout;
+        serialize(qnet, sout);
+        std::istringstream sin(sout.str());
+        quantized_test_net qnet2;
+        deserialize(qnet2, sin);
+        DLIB_TEST(max(abs(mat(qnet2.forward(input_tensor)) - mat(qnet.forward(input_tensor)))) == 0);
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    void test_gradient_accumulation()
+    {
+        print_spinner();
+
+        using net_type = loss_mean_squared<fc<1,input<matrix<float>>>>;
+
+        std::vector<matrix<float>> x;
+        std::vector<float> y;
+        dlib::rand rnd(7);
+        for (int i = 0; i < 8; ++i)
+        {
+            x.push_back(matrix_cast<float>(gaussian_randm(5,1,i)));
+            y.push_back(rnd.get_random_gaussian());
+        }
+
+        // Both trainers start from the same parameters
+        net_type net;
+        net(x[0]);
+        net_type net2 = net;
+        const resizable_tensor initial = layer<1>(net).layer_details().get_layer_params();
+
+        // One step on the whole batch...
+        dnn_trainer<net_type> trainer(net, sgd(0,0));
+        trainer.set_learning_rate(0.1);
+        trainer.be_quiet();
+        trainer.train_one_step(x, y);
+
+        // ...gives the same parameters as the same step done over two micro-batches.
+        dnn_trainer<net_type> trainer2(net2, sgd(0,0));
+        trainer2.set_learning_rate(0.1);
+        trainer2.set_gradient_accumulation_steps(2);
+        DLIB_TEST(trainer2.get_gradient_accumulation_steps() == 2);
+        trainer2.be_quiet();
+        trainer2.train_one_step(x.begin(), x.begin()+4, y.begin());
+        DLIB_TEST(max(abs(mat(layer<1>(trainer2.get_net()).layer_details().get_layer_params()) - mat(initial))) == 0);
+        trainer2.train_one_step(x.begin()+4, x.end(), y.begin()+4);
+        DLIB_TEST(trainer2.get_train_one_step_calls() == 2);
+
+        const tensor& p1 = layer<1>(trainer.get_net()).layer_details().get_layer_params();
+        const tensor& p2 = layer<1>(trainer2.get_net()).layer_details().get_layer_params();
+        DLIB_TEST(max(abs(mat(p1) - mat(initial))) > 1e-3);
+        DLIB_TEST_MSG(max(abs(mat(p1) - mat(p2))) < 1e-5, max(abs(mat(p1) - mat(p2))));
+
+        // The setting is kept when serializing the trainer
+        std::ostringstream sout;
+        serialize(trainer2, sout);
+        net_type net3;
+        dnn_trainer<net_type> trainer3(net3, sgd(0,0));
+        std::istringstream sin(sout.str());
+        deserialize(trainer3, sin);
+        DLIB_TEST(trainer3.get_gradient_accumulation_steps() == 2);
+    }
+
 // ----------------------------------------------------------------------------------------
 
     class dnn_tester : public tester
@@ -5374,6 +6780,13 @@ void test_multm_prev()
             test_positional_encodings();
             test_embeddings();
             test_tril();
+            test_kv_cache();
+            test_scaled_dot_product_attention();
+            test_sdpa_transformer();
+            test_fuse_transformer_layers();
+            test_gqa_transformer();
+            test_moe_dispatch();
+            test_moe_token_routing();
             test_adaptive_computation_time_network();
             test_rope_layer();
             test_basic_tensor_ops();
@@ -5386,6 +6799,7 @@ void test_multm_prev()
             test_copy_tensor_slice_add_to_cpu();
             test_concat();
             test_multm_prev();
+            test_gemm_plane_wise();
             test_simple_linear_regression();
             test_simple_linear_regression_eil();
             test_simple_linear_regression_with_mult_prev();
@@ -5412,8 +6826,17 @@ void test_multm_prev()
             test_set_learning_rate_multipliers();
             test_input_ouput_mappers();
             test_fuse_layers();
+            test_quantized_weights();
             test_reorg();
             test_input_tensor();
+            test_text_generator();
+            test_speculative_generator();
+            test_token_windows();
+            test_data_loader();
+            test_cpu_conv();
+            test_repeat_checkpointing();
+            test_gradient_accumulation();
+            test_bfloat16();
         }
 
         void perform_test()
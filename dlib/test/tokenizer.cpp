@@ -5,8 +5,10 @@
 #include <string>
 #include <sstream>
 #include <regex>
+#include <algorithm>
 
 #include <dlib/tokenizer.h>
+#include <dlib/rand.h>
 #include "tester.h"
 
 namespace  
@@ -406,6 +408,36 @@ namespace
 
             DLIB_TEST_MSG(text == decoded, "decoded: " << decoded);
         }
+
+        // Large inputs are encoded in parallel chunks, the result must be the same as
+        // encoding each line on its own
+        std::string large_text;
+        std::vector<int> expected;
+        for (int i = 0; large_text.size() < 300000; ++i) {
+            const std::string line = test_strings[i % test_strings.size()] + " " + std::to_string(i) + "\n";
+            large_text += line;
+            const std::vector<int> line_tokens = loaded_test.encode(line);
+            expected.insert(expected.end(), line_tokens.begin(), line_tokens.end());
+        }
+        const std::vector<int> encoded = loaded_test.encode(large_text);
+        DLIB_TEST(encoded == expected);
+        DLIB_TEST(loaded_test.decode(encoded) == large_text);
+        DLIB_TEST(encoded.size() < large_text.size());
+
+        // Token ids are not limited to 16 bits
+        dlib::rand rnd;
+        std::string random_text;
+        for (int i = 0; i < 20000; ++i) {
+            for (int j = 0; j < 12; ++j)
+                random_text += static_cast<char>('a' + rnd.get_random_32bit_number() % 26);
+            random_text += ' ';
+        }
+        bpe_tok large_vocab;
+        large_vocab.train(random_text, 70000);
+        DLIB_TEST(large_vocab.get_vocab_size() == 70000);
+        const std::vector<int> random_encoded = large_vocab.encode(random_text);
+        DLIB_TEST(*std::max_element(random_encoded.begin(), random_encoded.end()) > 65535);
+        DLIB_TEST(large_vocab.decode(random_encoded) == random_text);
     }
 
     class tokenizer_tester : public tester
@@ -9,16 +9,18 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
-#include <unordered_set>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <algorithm>
 #include <sstream>
-#include <list>
+#include <array>
+#include <queue>
+#include <functional>
 
 #include "../base64.h"
 #include "../serialize.h"
+#include "../threads/parallel_for_extension.h"
 #include "bpe_tokenizer_abstract.h"
 
 namespace dlib
@@ -43,6 +45,7 @@ namespace dlib
 
             // Initialize special tokens
             initialize_special_tokens();
+            initialize_merge_ranks();
         }
 
         // Train the tokenizer on input data
@@ -50,14 +53,10 @@ namespace dlib
         {
             if (text.empty()) return;
 
-            // Convert text to bytes
-            std::vector<uint8_t> data(text.begin(), text.end());
-            if (max_bytes > 0 && data.size() > max_bytes) data.resize(max_bytes);
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+            const size_t size = (max_bytes > 0 && text.size() > max_bytes) ? max_bytes : text.size();
 
-            // Calculate available merges (reserving space for special tokens)
-            size_t num_merges = max_vocab_size - BPE_BASE_VOCAB_SIZE - special_token_list.size();
-
-            if (num_merges <= 0) {
+            if (max_vocab_size <= BPE_BASE_VOCAB_SIZE + special_token_list.size()) {
                 if (verbose) {
                     std::cout << "Warning: max_vocab_size too small for any merges. Need at least "
                         << (BPE_BASE_VOCAB_SIZE + special_token_list.size() + 1) << " tokens." << std::endl;
@@ -65,8 +64,11 @@ namespace dlib
                 return;
             }
 
+            // Calculate available merges (reserving space for special tokens)
+            const size_t num_merges = max_vocab_size - BPE_BASE_VOCAB_SIZE - special_token_list.size();
+
             if (verbose) {
-                std::cout << "Training BPE tokenizer on " << data.size() << " bytes..." << std::endl;
+                std::cout << "Training BPE tokenizer on " << size << " bytes..." << std::endl;
                 std::cout << "Target vocabulary size: " << max_vocab_size << std::endl;
                 std::cout << "Base vocabulary: " << BPE_BASE_VOCAB_SIZE << " tokens" << std::endl;
                 std::cout << "Special tokens: " << special_token_list.size() << " tokens" << std::endl;
@@ -84,77 +86,97 @@ namespace dlib
                 merges.push_back(m);
             }
 
-            // Tokenize input into segments (split on whitespace and newlines)
-            std::vector<std::list<uint16_t>> segments;
-            std::vector<uint32_t> segment_counts;
-            tokenize(data, segments, segment_counts);
+            // Count the distinct words of the text, the delimiters are never merged
+            training_words words;
+            count_words(data, size, words);
 
             if (verbose) {
-                std::cout << "Created " << segments.size() << " segments for training" << std::endl;
+                std::cout << "Found " << words.counts.size() << " distinct words for training" << std::endl;
             }
 
             // Initialize pair counting
-            std::unordered_map<uint32_t, std::pair<int32_t, std::pair<uint16_t, uint16_t>>> pair_counts;
-            std::unordered_map<uint32_t, std::unordered_set<uint32_t>> where_to_update;
+            std::unordered_map<uint64_t, int64_t> pair_counts;
+            std::unordered_map<uint64_t, std::vector<uint32_t>> where_to_update;
+            count_pairs(words, pair_counts, where_to_update);
 
-            // Count initial pairs
-            for (uint32_t i = 0; i < segments.size(); i++) {
-                countInSegment(segments[i], i, segment_counts[i], pair_counts, where_to_update);
-            }
+            // Max-heap of the pair counts.  A merge only increases the counts of the pairs
+            // holding the new token, which are pushed again, so the entries whose count
+            // decreased are lazily fixed when they reach the top.
+            std::priority_queue<pair_count> heap;
+            for (const auto& p : pair_counts) heap.push({ p.second, p.first });
 
             // Main training loop
             size_t merges_performed = 0;
+            std::vector<uint64_t> new_pairs;
 
             for (size_t merge_idx = 0; merge_idx < num_merges; merge_idx++) {
                 // Find most frequent pair
-                int32_t max_count = 0;
-                std::pair<uint16_t, uint16_t> max_pair = findMaxPair(pair_counts, max_count);
+                pair_count max_pair = { 0, 0 };
+                while (!heap.empty()) {
+                    const pair_count top = heap.top();
+                    heap.pop();
+                    auto it = pair_counts.find(top.pair);
+                    const int64_t count = it != pair_counts.end() ? it->second : 0;
+                    if (count == top.count) {
+                        max_pair = top;
+                        break;
+                    }
+                    if (count > 0 && count < top.count) heap.push({ count, top.pair });
+                }
 
-                if (max_count <= 0) {
+                if (max_pair.count <= 0) {
                     if (verbose) {
                         std::cout << "\nNo more pairs to merge at iteration " << merge_idx << std::endl;
                     }
                     break;
                 }
 
-                uint16_t new_token = BPE_BASE_VOCAB_SIZE + merge_idx;
+                const int left = static_cast<int>(max_pair.pair >> 32);
+                const int right = static_cast<int>(max_pair.pair & 0xFFFFFFFF);
+                const int new_token = static_cast<int>(merges.size());
 
                 // Create merge entry
                 Merge m;
                 m.token_id = new_token;
-                m.left = max_pair.first;
-                m.right = max_pair.second;
+                m.left = left;
+                m.right = right;
 
                 // Build pattern for new token
-                m.pattern = merges[max_pair.first].pattern;
-                const auto& right_pattern = merges[max_pair.second].pattern;
+                m.pattern = merges[left].pattern;
+                const auto& right_pattern = merges[right].pattern;
                 m.pattern.insert(m.pattern.end(), right_pattern.begin(), right_pattern.end());
 
                 merges.push_back(m);
 
-                // Store mapping for fast encoding
-                uint32_t pair_key = (static_cast<uint32_t>(max_pair.first) << 16) | max_pair.second;
-
                 if (verbose && (merge_idx % 1000 == 0 || merge_idx < 10)) {
-                    std::cout << "Merge " << merge_idx << ": (" << max_pair.first << ", " << max_pair.second
-                        << ") -> " << new_token << " (occurrences: " << max_count
+                    std::cout << "Merge " << merge_idx << ": (" << left << ", " << right
+                        << ") -> " << new_token << " (occurrences: " << max_pair.count
                         << ", pattern length: " << m.pattern.size() << ")" << std::endl;
                 }
 
-                // Apply merge to all affected segments
-                auto affected_segments = where_to_update[pair_key];
-                applyMerge(max_pair, new_token, segments, segment_counts, affected_segments,
-                    pair_counts, where_to_update);
-
-                // Clear this pair's count
-                pair_counts[pair_key].first = 0;
+                // Apply merge to all affected words
+                std::vector<uint32_t> affected_words;
+                affected_words.swap(where_to_update[max_pair.pair]);
+                new_pairs.clear();
+                for (uint32_t w : affected_words) {
+                    apply_merge(words, w, left, right, new_token, pair_counts, where_to_update, new_pairs);
+                }
+                pair_counts.erase(max_pair.pair);
+                where_to_update.erase(max_pair.pair);
+
+                std::sort(new_pairs.begin(), new_pairs.end());
+                new_pairs.erase(std::unique(new_pairs.begin(), new_pairs.end()), new_pairs.end());
+                for (uint64_t p : new_pairs) {
+                    const int64_t count = pair_counts[p];
+                    if (count > 0) heap.push({ count, p });
+                }
 
                 merges_performed++;
             }
-
             // Update vocabulary size: base + special tokens + actual merges performed
             vocab_size = merges.size() + special_token_list.size();
             initialize_special_tokens();
+            initialize_merge_ranks();
 
             if (verbose) {
                 std::cout << "\nTraining complete!" << std::endl;
@@ -170,34 +192,31 @@ namespace dlib
         {
             if (text.empty()) return {};
 
-            // Convert to initial tokens
-            std::vector<int> tokens;
-            tokens.reserve(text.size());
-            for (unsigned char byte : text) {
-                tokens.push_back(static_cast<int>(byte));
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+            if (text.size() < 2 * ENCODE_CHUNK_SIZE)
+                return encode_bytes(data, text.size());
+
+            // Large inputs are cut at separator bytes no merge can cross, so the chunks
+            // are encoded independently and in parallel
+            std::vector<std::pair<size_t, size_t>> chunks;
+            size_t begin = 0;
+            while (begin < text.size()) {
+                size_t end = std::min(begin + ENCODE_CHUNK_SIZE, text.size());
+                while (end < text.size() && !is_separator[data[end - 1]]) ++end;
+                chunks.push_back({ begin, end });
+                begin = end;
             }
 
-            // Apply all merges in order
-            for (size_t merge_idx = BPE_BASE_VOCAB_SIZE; merge_idx < merges.size(); merge_idx++) {
-                const Merge& m = merges[merge_idx];
-
-                std::vector<int> new_tokens;
-                new_tokens.reserve(tokens.size());
-
-                for (size_t i = 0; i < tokens.size(); ) {
-                    if (i < tokens.size() - 1 && tokens[i] == m.left && tokens[i + 1] == m.right) {
-                        new_tokens.push_back(m.token_id);
-                        i += 2;
-                    }
-                    else {
-                        new_tokens.push_back(tokens[i]);
-                        i++;
-                    }
-                }
-
-                tokens = std::move(new_tokens);
-            }
+            std::vector<std::vector<int>> encoded(chunks.size());
+            parallel_for(0, static_cast<long>(chunks.size()), [&](long i) {
+                encoded[i] = encode_bytes(data + chunks[i].first, chunks[i].second - chunks[i].first);
+            });
 
+            size_t total = 0;
+            for (const auto& e : encoded) total += e.size();
+            std::vector<int> tokens;
+            tokens.reserve(total);
+            for (const auto& e : encoded) tokens.insert(tokens.end(), e.begin(), e.end());
             return tokens;
         }
 
@@ -308,6 +327,7 @@ namespace dlib
 
             // Initialize special tokens
             item.initialize_special_tokens();
+            item.initialize_merge_ranks();
         }
 
     private:
@@ -322,6 +342,9 @@ namespace dlib
             "<answer>", "<search>", "<unk>", "<pad>"
         };
         static const int BPE_BASE_VOCAB_SIZE = 256;
+        static const size_t ENCODE_CHUNK_SIZE = 64 * 1024;
+        static const size_t MAX_CACHED_WORD_SIZE = 64;
+        static const size_t TRAIN_CHUNK_SIZE = 1024 * 1024;
 
         // Merge structure
         struct Merge {
@@ -339,6 +362,111 @@ namespace dlib
         std::map<std::string, int> special_tokens;
         std::unordered_map<int, std::string> special_token_map;
 
+        // Encoding tables: rank (index in merges) of each mergeable pair, and the bytes
+        // appearing in no merge, at which large inputs can be split
+        std::unordered_map<uint64_t, int> merge_ranks;
+        std::array<bool, BPE_BASE_VOCAB_SIZE> is_separator;
+
+        static uint64_t pair_key(int left, int right)
+        {
+            return (static_cast<uint64_t>(static_cast<uint32_t>(left)) << 32) | static_cast<uint32_t>(right);
+        }
+
+        void initialize_merge_ranks()
+        {
+            merge_ranks.clear();
+            is_separator.fill(false);
+            is_separator[' '] = is_separator['\n'] = is_separator['\t'] = is_separator['\r'] = true;
+            for (size_t i = BPE_BASE_VOCAB_SIZE; i < merges.size(); ++i) {
+                // The first merge of a pair is the one that applies
+                merge_ranks.emplace(pair_key(merges[i].left, merges[i].right), static_cast<int>(i));
+                for (uint8_t byte : merges[i].pattern) is_separator[byte] = false;
+            }
+        }
+
+        // Separators are never merged, so the words between them are encoded on their
+        // own and the encoding of each distinct word is computed once
+        std::vector<int> encode_bytes(const uint8_t* data, size_t size) const
+        {
+            std::vector<int> tokens;
+            tokens.reserve(size);
+            std::unordered_map<std::string, std::vector<int>> cache;
+            size_t i = 0;
+            while (i < size) {
+                if (is_separator[data[i]]) {
+                    tokens.push_back(data[i++]);
+                    continue;
+                }
+                size_t j = i + 1;
+                while (j < size && !is_separator[data[j]]) ++j;
+
+                if (j - i <= MAX_CACHED_WORD_SIZE) {
+                    auto it = cache.emplace(std::string(data + i, data + j), std::vector<int>());
+                    if (it.second) it.first->second = merge_bytes(data + i, j - i);
+                    tokens.insert(tokens.end(), it.first->second.begin(), it.first->second.end());
+                }
+                else {
+                    const std::vector<int> merged = merge_bytes(data + i, j - i);
+                    tokens.insert(tokens.end(), merged.begin(), merged.end());
+                }
+                i = j;
+            }
+            return tokens;
+        }
+
+        // Applies the merges by increasing rank, each one from left to right, which is
+        // what a full pass over the text per merge does.  The tokens form a linked list
+        // and a heap holds the mergeable pairs, ordered by rank then position, so the
+        // cost is O(n log n) instead of O(n * number of merges).
+        std::vector<int> merge_bytes(const uint8_t* data, size_t size) const
+        {
+            std::vector<int> tokens(data, data + size);
+            if (size < 2 || merge_ranks.empty()) return tokens;
+
+            const long n = static_cast<long>(size);
+            std::vector<long> prev(n), next(n);
+            for (long i = 0; i < n; ++i) {
+                prev[i] = i - 1;
+                next[i] = i + 1 < n ? i + 1 : -1;
+            }
+
+            typedef std::pair<int, long> entry;
+            std::priority_queue<entry, std::vector<entry>, std::greater<entry>> heap;
+            int current_rank = 0;
+            auto push_pair = [&](long pos) {
+                if (pos < 0 || next[pos] < 0) return;
+                auto it = merge_ranks.find(pair_key(tokens[pos], tokens[next[pos]]));
+                // A pair created by a merge can't be merged by an earlier rank
+                if (it != merge_ranks.end() && it->second > current_rank)
+                    heap.push({ it->second, pos });
+            };
+            for (long i = 0; i + 1 < n; ++i) push_pair(i);
+
+            while (!heap.empty()) {
+                const entry e = heap.top();
+                heap.pop();
+
+                // Skip pairs changed by an earlier merge
+                const long pos = e.second;
+                const long right = next[pos];
+                const Merge& m = merges[e.first];
+                if (tokens[pos] != m.left || right < 0 || tokens[right] != m.right) continue;
+
+                current_rank = e.first;
+                tokens[pos] = m.token_id;
+                tokens[right] = -1;
+                next[pos] = next[right];
+                if (next[right] >= 0) prev[next[right]] = pos;
+                push_pair(prev[pos]);
+                push_pair(pos);
+            }
+
+            std::vector<int> result;
+            result.reserve(n);
+            for (long i = 0; i >= 0; i = next[i]) result.push_back(tokens[i]);
+            return result;
+        }
+
         void initialize_special_tokens()
         {
             special_tokens.clear();
@@ -354,128 +482,160 @@ namespace dlib
             }
         }
 
-        // Segment-based training functions from BPETokenizer
-        void tokenize(const std::vector<uint8_t>& data,
-            std::vector<std::list<uint16_t>>& segments,
-            std::vector<uint32_t>& segment_counts)
-        {
-            segments.clear();
-            segment_counts.clear();
-
-            // Split on whitespace and newlines to create meaningful segments
-            std::list<uint16_t> current_segment;
+        // Training data: the distinct words of the text, stored one after the other in
+        // a flat array of tokens, with the number of times each word occurs
+        struct training_words {
+            std::vector<int> symbols;
+            std::vector<size_t> begin;
+            std::vector<size_t> length;
+            std::vector<int64_t> counts;
+        };
 
-            for (size_t i = 0; i < data.size(); i++) {
-                uint8_t byte = data[i];
+        // Heap entry, the most frequent pair comes first and ties go to the smallest pair
+        struct pair_count {
+            int64_t count;
+            uint64_t pair;
 
-                // Split on whitespace and newlines
-                if (byte == ' ' || byte == '\n' || byte == '\t' || byte == '\r') {
-                    if (!current_segment.empty()) {
-                        segments.push_back(current_segment);
-                        segment_counts.push_back(1);
-                        current_segment.clear();
-                    }
-                    // Add the delimiter as its own segment
-                    segments.push_back({ static_cast<uint16_t>(byte) });
-                    segment_counts.push_back(1);
-                }
-                else {
-                    current_segment.push_back(static_cast<uint16_t>(byte));
-                }
+            bool operator<(const pair_count& item) const
+            {
+                return count < item.count || (count == item.count && pair > item.pair);
             }
+        };
 
-            // Add the last segment if not empty
-            if (!current_segment.empty()) {
-                segments.push_back(current_segment);
-                segment_counts.push_back(1);
-            }
+        static bool is_training_delimiter(uint8_t byte)
+        {
+            return byte == ' ' || byte == '\n' || byte == '\t' || byte == '\r';
         }
 
-        // Count pairs in a segment and update global pair counts
-        void countInSegment(const std::list<uint16_t>& segment, uint32_t segment_idx,
-            int32_t count_delta,
-            std::unordered_map<uint32_t, std::pair<int32_t, std::pair<uint16_t, uint16_t>>>& pair_counts,
-            std::unordered_map<uint32_t, std::unordered_set<uint32_t>>& where_to_update)
+        // Splits the text on whitespace and newlines and counts the distinct words.  The
+        // text is cut in chunks ending at a delimiter, which are counted in parallel.
+        static void count_words(const uint8_t* data, size_t size, training_words& words)
         {
-            if (segment.size() < 2) return;
-
-            auto it = segment.begin();
-            uint16_t prev_token = *it;
-            ++it;
-
-            while (it != segment.end()) {
-                uint16_t curr_token = *it;
-                uint32_t pair_key = (static_cast<uint32_t>(prev_token) << 16) | curr_token;
-
-                auto& entry = pair_counts[pair_key];
-                entry.first += count_delta;
-                entry.second = { prev_token, curr_token };
+            std::vector<std::pair<size_t, size_t>> chunks;
+            const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+            const size_t chunk_size = std::max(size_t(TRAIN_CHUNK_SIZE), size / num_threads + 1);
+            size_t chunk_begin = 0;
+            while (chunk_begin < size) {
+                size_t end = std::min(chunk_begin + chunk_size, size);
+                while (end < size && !is_training_delimiter(data[end - 1])) ++end;
+                chunks.push_back({ chunk_begin, end });
+                chunk_begin = end;
+            }
 
-                if (count_delta > 0) {
-                    where_to_update[pair_key].insert(segment_idx);
-                }
-                else {
-                    where_to_update[pair_key].erase(segment_idx);
+            std::vector<std::unordered_map<std::string, int64_t>> chunk_counts(chunks.size());
+            parallel_for(0, static_cast<long>(chunks.size()), [&](long c) {
+                auto& counts = chunk_counts[c];
+                size_t i = chunks[c].first;
+                while (i < chunks[c].second) {
+                    if (is_training_delimiter(data[i])) {
+                        ++i;
+                        continue;
+                    }
+                    size_t j = i + 1;
+                    while (j < chunks[c].second && !is_training_delimiter(data[j])) ++j;
+                    // A single byte has no pair to merge
+                    if (j - i > 1) counts[std::string(data + i, data + j)]++;
+                    i = j;
                 }
+            }, 1);
+
+            for (size_t c = 1; c < chunk_counts.size(); ++c) {
+                for (const auto& w : chunk_counts[c]) chunk_counts[0][w.first] += w.second;
+                chunk_counts[c].clear();
+            }
 
-                prev_token = curr_token;
-                ++it;
+            words = training_words();
+            if (chunk_counts.empty()) return;
+            for (const auto& w : chunk_counts[0]) {
+                words.begin.push_back(words.symbols.size());
+                words.length.push_back(w.first.size());
+                words.counts.push_back(w.second);
+                for (char byte : w.first) words.symbols.push_back(static_cast<uint8_t>(byte));
             }
         }
 
-        // Find the most frequent pair
-        std::pair<uint16_t, uint16_t> findMaxPair(
-            const std::unordered_map<uint32_t, std::pair<int32_t, std::pair<uint16_t, uint16_t>>>& pair_counts,
-            int32_t& max_count)
+        // Counts the pairs of adjacent tokens of all the words, in parallel over blocks
+        // of words, and records the words in which each pair appears
+        static void count_pairs(const training_words& words,
+            std::unordered_map<uint64_t, int64_t>& pair_counts,
+            std::unordered_map<uint64_t, std::vector<uint32_t>>& where_to_update)
         {
-            max_count = 0;
-            std::pair<uint16_t, uint16_t> max_pair = { 0, 0 };
-
-            for (const auto& entry : pair_counts) {
-                int32_t count = entry.second.first;
-                const auto& pair = entry.second.second;
-
-                if (count > max_count || (count == max_count && pair < max_pair)) {
-                    max_count = count;
-                    max_pair = pair;
+            const size_t num_words = words.counts.size();
+            const size_t num_blocks = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), num_words);
+            std::vector<std::unordered_map<uint64_t, int64_t>> block_counts(num_blocks);
+            std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> block_words(num_blocks);
+            parallel_for(0, static_cast<long>(num_blocks), [&](long b) {
+                for (size_t w = num_words * b / num_blocks; w < num_words * (b + 1) / num_blocks; ++w) {
+                    const int* s = words.symbols.data() + words.begin[w];
+                    for (size_t i = 0; i + 1 < words.length[w]; ++i) {
+                        const uint64_t p = pair_key(s[i], s[i + 1]);
+                        block_counts[b][p] += words.counts[w];
+                        auto& where = block_words[b][p];
+                        if (where.empty() || where.back() != w) where.push_back(static_cast<uint32_t>(w));
+                    }
+                }
+            }, 1);
+
+            pair_counts.clear();
+            where_to_update.clear();
+            for (size_t b = 0; b < num_blocks; ++b) {
+                for (const auto& p : block_counts[b]) pair_counts[p.first] += p.second;
+                for (auto& p : block_words[b]) {
+                    auto& where = where_to_update[p.first];
+                    where.insert(where.end(), p.second.begin(), p.second.end());
                 }
+                block_counts[b].clear();
+                block_words[b].clear();
             }
-
-            return max_pair;
         }
 
-        // Apply a merge to all affected segments
-        void applyMerge(const std::pair<uint16_t, uint16_t>& merge_pair, uint16_t new_token_id,
-            std::vector<std::list<uint16_t>>& segments,
-            const std::vector<uint32_t>& segment_counts,
-            const std::unordered_set<uint32_t>& affected_segments,
-            std::unordered_map<uint32_t, std::pair<int32_t, std::pair<uint16_t, uint16_t>>>& pair_counts,
-            std::unordered_map<uint32_t, std::unordered_set<uint32_t>>& where_to_update)
+        // Replaces the pairs (left, right) of a word by new_token, from left to right,
+        // and updates the counts of the pairs around each replacement.  The pairs holding
+        // new_token are appended to new_pairs.
+        static void apply_merge(training_words& words, uint32_t w, int left, int right, int new_token,
+            std::unordered_map<uint64_t, int64_t>& pair_counts,
+            std::unordered_map<uint64_t, std::vector<uint32_t>>& where_to_update,
+            std::vector<uint64_t>& new_pairs)
         {
-            for (uint32_t segment_idx : affected_segments) {
-                auto& segment = segments[segment_idx];
-                int32_t count = segment_counts[segment_idx];
-
-                // Remove old pair counts for this segment
-                countInSegment(segment, segment_idx, -count, pair_counts, where_to_update);
-
-                // Apply merge in this segment
-                auto it = segment.begin();
-                while (it != segment.end()) {
-                    auto next_it = std::next(it);
-                    if (next_it != segment.end() && *it == merge_pair.first && *next_it == merge_pair.second) {
-                        *it = new_token_id;
-                        segment.erase(next_it);
-                        // Don't increment it, check the same position again
+            int* s = words.symbols.data() + words.begin[w];
+            const size_t n = words.length[w];
+            const int64_t count = words.counts[w];
+
+            auto remove_pair = [&](int a, int b) {
+                pair_counts[pair_key(a, b)] -= count;
+            };
+            auto add_pair = [&](int a, int b) {
+                const uint64_t p = pair_key(a, b);
+                pair_counts[p] += count;
+                // All the pairs of a word are updated at once, so a word already listed
+                // for this pair is at the back of the list
+                auto& where = where_to_update[p];
+                if (where.empty() || where.back() != w) where.push_back(w);
+                new_pairs.push_back(p);
+            };
+
+            // The merged word is written in place, s[out-1] being the token before the
+            // current position once merged
+            size_t out = 0;
+            for (size_t in = 0; in < n;) {
+                if (in + 1 < n && s[in] == left && s[in + 1] == right) {
+                    if (out > 0) {
+                        remove_pair(s[out - 1], left);
+                        add_pair(s[out - 1], new_token);
                     }
-                    else {
-                        ++it;
+                    if (in + 2 < n) {
+                        remove_pair(right, s[in + 2]);
+                        add_pair(new_token, s[in + 2]);
                     }
+                    remove_pair(left, right);
+                    s[out++] = new_token;
+                    in += 2;
+                }
+                else {
+                    s[out++] = s[in++];
                 }
-
-                // Add new pair counts for this segment
-                countInSegment(segment, segment_idx, count, pair_counts, where_to_update);
             }
+            words.length[w] = out;
         }
     };
 
@@ -65,6 +65,15 @@ namespace dlib
                   of size `vocab_size`.
                 - If max_bytes==0, uses entire text.
                 - If `verbose` is true, progress information is printed to the standard output.
+                - The text is split at whitespace and newlines, which are never merged.  At
+                  each step the most frequent pair is merged, ties going to the pair with the
+                  smallest token ids, so the result doesn't depend on the number of threads.
+                - The distinct words and their pairs are counted in parallel, and the pairs
+                  are kept in a max-heap, so each merge costs O(log n) plus the work on the
+                  words holding the merged pair.  Token ids are ints and vocab_size can be
+                  larger than 65536.
+                - If vocab_size <= 256 + get_specials_size(), no merge is learned and the
+                  tokenizer is left unchanged.
         !*/
 
         std::vector<int> encode(
@@ -75,6 +84,10 @@ namespace dlib
                 - Encodes the input text into a sequence of subword tokens.
                 - Special tokens are automatically added to mark the beginning and end of paragraphs.
                 - Returns a vector of token IDs representing the encoded text.
+                - The result is the same as applying each merge, in the order they were
+                  learned, from left to right over the whole text.  It is computed in
+                  O(n log n) time by merging pairs by rank, and inputs larger than a few
+                  hundred KB are split at whitespace and encoded in parallel.
         !*/
 
         std::string decode(
@@ -512,24 +512,19 @@ int main(int argc, char** argv)
             float min_p = get_option(parser, "min-p", 0.05f);
             bool deterministic_mode = parser.option("deterministic");
             float temperature = deterministic_mode ? 1.0f : get_option(parser, "temperature", 0.8f);
-            dlib::rand rng(std::time(0));
 
             // Load fine-tuned model
             bpe_tokenizer tokenizer;
-            softmaxm<multiply<infer_net::subnet_type>> generator(multiply_(1.0 / temperature));
-            {
-                infer_net net;
-                std::string finetuned_model = model_file.substr(0, model_file.find_last_of('.'))
-                    + "_finetuned.dat";
-                if (!file_exists(finetuned_model)) {
-                    cerr << "Error: fine-tuned model not found: " << finetuned_model << "\n";
-                    cerr << "Please run --fine-tune first.\n";
-                    return 1;
-                }
-                deserialize(finetuned_model) >> net >> tokenizer;
-                cout << "Fine-tuned model loaded from " << finetuned_model << "\n\n";
-                generator.subnet().subnet() = net.subnet();
-            }            
+            infer_net net;
+            std::string finetuned_model = model_file.substr(0, model_file.find_last_of('.'))
+                + "_finetuned.dat";
+            if (!file_exists(finetuned_model)) {
+                cerr << "Error: fine-tuned model not found: " << finetuned_model << "\n";
+                cerr << "Please run --fine-tune first.\n";
+                return 1;
+            }
+            deserialize(finetuned_model) >> net >> tokenizer;
+            cout << "Fine-tuned model loaded from " << finetuned_model << "\n\n";
 
             // Get special token IDs
             long text_start_id = tokenizer.get_special_token_id("<text>");
@@ -541,6 +536,20 @@ int main(int argc, char** argv)
             const long pad_token = tokenizer.get_special_token_id("<pad>");
             inference_context ctx(max_seq_len, 3, pad_token);
 
+            // The generator runs the network without its loss layer, on the logits of
+            // the next token.  The sampler applies the repetition penalty, min-p, top-k
+            // and top-p filters, or picks the most probable token in deterministic mode.
+            text_generator<infer_net::subnet_type> generator(net.subnet(), max_seq_len,
+                pad_token, static_cast<unsigned long>(std::time(0)));
+            generator.set_max_new_tokens(3 * max_seq_len);
+            generator.add_stop_token(static_cast<int>(text_end_id));
+            token_sampler& sampler = generator.sampler();
+            sampler.set_temperature(deterministic_mode ? 0.0f : temperature);
+            sampler.set_top_k(static_cast<long>(top_k));
+            sampler.set_top_p(top_p);
+            sampler.set_min_p(min_p);
+            sampler.set_repetition_penalty(repeat_penalty, max_seq_len / 5);
+
             // Interactive loop
             while (!signal_handler::is_triggered())
             {
@@ -579,145 +588,17 @@ int main(int argc, char** argv)
                 ctx.add_token(answer_id);
                 ctx.add_token(text_start_id);
 
-                // Generate response token by token
+                // Generate the response, displaying each token as soon as it is sampled
                 cout << "CHATBOT: ";
                 cout.flush();
-
-                // Top-k/top-p (nucleus) sampling for non-deterministic text generation.
-                // This function applies temperature scaling, repetition penalty, min-p filtering, 
-                // top-k filtering, and nucleus sampling to select the next token.
-                auto top_k_p_sample = [&rng, &ctx, &text_end_id](
-                    const float* probs, size_t N, size_t k,
-                    float p, float repeat_penalty, float min_p) -> size_t
-                    {
-                        // Copy probabilities
-                        std::vector<float> p_copy(probs, probs + N);
-
-                        // Step 1: Apply repetition penalty ONCE
-                        if (repeat_penalty > 1.0f) {
-                            const auto& context_tokens = ctx.get_full_context();
-
-                            // Penalize only recent tokens (last 20%)
-                            size_t recent_size = std::max(size_t(1),
-                                static_cast<size_t>(context_tokens.size() * 0.2));
-                            size_t start_idx = (context_tokens.size() > recent_size)
-                                ? context_tokens.size() - recent_size : 0;
-
-                            for (size_t i = start_idx; i < context_tokens.size(); ++i) {
-                                int token_id = context_tokens[i];
-                                if (token_id >= 0 && static_cast<size_t>(token_id) < N) {
-                                    p_copy[token_id] /= repeat_penalty;
-                                }
-                            }
-                        }
-
-                        // Step 2: Renormalize after penalty
-                        float sum_after_penalty = 0.0f;
-                        for (size_t i = 0; i < N; ++i) {
-                            sum_after_penalty += p_copy[i];
-                        }
-                        if (sum_after_penalty > 1e-8f) {
-                            for (size_t i = 0; i < N; ++i) {
-                                p_copy[i] /= sum_after_penalty;
-                            }
-                        }
-
-                        // Step 3: Find max probability for min-p filtering
-                        float max_prob = *std::max_element(p_copy.begin(), p_copy.end());
-                        float min_p_threshold = max_prob * min_p;
-
-                        // Step 4: Build candidate list with min-p filter
-                        std::vector<std::pair<size_t, float>> candidates;
-                        candidates.reserve(N);
-
-                        for (size_t i = 0; i < N; ++i) {
-                            if (p_copy[i] >= min_p_threshold) {
-                                candidates.push_back({ i, p_copy[i] });
-                            }
-                        }
-
-                        if (candidates.empty()) {
-                            return text_end_id;  // Fallback
-                        }
-
-                        // Step 5: Sort and apply top-k
-                        k = std::min(k, candidates.size());
-                        std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(),
-                            [](const auto& a, const auto& b) { return a.second > b.second; });
-
-                        // Step 6: Apply top-p (nucleus sampling)
-                        float cumsum = 0.0f;
-                        size_t cutoff = 0;
-                        for (size_t i = 0; i < k; ++i) {
-                            cumsum += candidates[i].second;
-                            cutoff = i;
-                            if (cumsum >= p) break;
-                        }
-
-                        // Step 7: Renormalize filtered distribution
-                        float final_sum = 0.0f;
-                        for (size_t i = 0; i <= cutoff; ++i) {
-                            final_sum += candidates[i].second;
-                        }
-
-                        if (final_sum < 1e-8f) {
-                            return candidates[0].first;  // Return most probable
-                        }
-
-                        // Step 8: Sample from normalized distribution
-                        float r = rng.get_random_float() * final_sum;
-                        float cs = 0.0f;
-                        for (size_t i = 0; i <= cutoff; ++i) {
-                            cs += candidates[i].second;
-                            if (r <= cs) {
-                                return candidates[i].first;
-                            }
-                        }
-
-                        return candidates[0].first;  // Fallback
-                    };
-
-                int next_token, max_response_tokens = 3 * max_seq_len;
-                for (int i = 0; i < max_response_tokens && !signal_handler::is_triggered(); ++i)
-                {
-                    // Get current context window and predict next token
-                    auto input_window = ctx.get_input_window();
-                    long pad_len = count_leading_padding(input_window, static_cast<int>(pad_token));
-                    tril_padding_context::set_uniform(pad_len, 1);
-                    auto& probs_tensor = generator(input_window);
-
-                    // Extract dimensions
-                    const long seq_len = probs_tensor.nr();
-                    const long vocab_size = probs_tensor.nc();
-                    const long last_pos = seq_len - 1;
-
-                    // Get pointer to probabilities at last position
-                    const long offset = tensor_index(probs_tensor, 0, 0, last_pos, 0);
-                    const float* probs = probs_tensor.host() + offset;
-
-                    if (deterministic_mode) {
-                        // Argmax: select most probable token
-                        const float* max_ptr = std::max_element(probs, probs + vocab_size);
-                        next_token = static_cast<int>(std::distance(probs, max_ptr));
-                    }
-                    else {
-                        // Stochastic sampling
-                        next_token = top_k_p_sample(probs, vocab_size, top_k, top_p, repeat_penalty, min_p);
-                    }
-
-                    ctx.add_token(next_token);
-
-                    // Decode and display token
-                    std::string token_text = tokenizer.decode(next_token, false);
-                    cout << token_text;
+                auto response = generator.generate(ctx.get_full_context(), [&](int token) {
+                    cout << tokenizer.decode(token, false);
                     cout.flush();
-
-                    // Stop if end token is found
-                    if (next_token == text_end_id) break;
-                }
+                    return !signal_handler::is_triggered();
+                });
+                ctx.add_tokens(response);
                 cout << "\n\n";
             }
-            tril_padding_context::clear();
         }
 
         return 0;